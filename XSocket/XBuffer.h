@@ -3,6 +3,9 @@
 
 #include "XSocketDef.h"
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <new>
 
 namespace XSocket {
 
@@ -469,6 +472,357 @@ protected:
 	std::string innerBuffer_;
 };
 
+
+/*
+* 类名：IOBufPool
+* 说明：IOBuf内存块池，按大小分级，每个线程有自己的空闲块缓存，
+*       缓存满了/空了才和全局空闲链表批量交换；内存块从slab切分，
+*       slab可选大页(MAP_HUGETLB，失败退化为THP建议)，slab不归还系统
+*/
+class IOBufPool
+{
+public:
+	enum {
+		CLASS_COUNT = 5,		//512/2K/8K/32K/128K
+		CLASS_LARGE = CLASS_COUNT,	//超过最大分级直接malloc
+		SLAB_SIZE = 2 * 1024 * 1024,
+		CACHE_COUNT = 64,	//每个线程每个分级最多缓存的空闲块
+	};
+
+	//内存块头，后面紧跟数据
+	struct Block
+	{
+		std::atomic<uint32_t> ref;
+		uint32_t cls;
+		size_t cap; //数据容量
+		size_t used; //已写入的末尾位置
+		Block* next; //空闲链表
+		inline char* data() { return (char*)(this + 1); }
+	};
+
+	static inline size_t ClassSize(uint32_t cls) { return (size_t)512 << (cls * 2); }
+
+	static inline void EnableHugePage(bool enable) { global().huge_page = enable; }
+	static inline bool IsHugePageEnable() { return global().huge_page; }
+
+	static Block* Alloc(size_t cap)
+	{
+		uint32_t cls = 0;
+		while (cls < CLASS_COUNT && ClassSize(cls) - sizeof(Block) < cap) {
+			cls++;
+		}
+		Block* block = nullptr;
+		if (cls == CLASS_LARGE) {
+			block = (Block*)malloc(sizeof(Block) + cap);
+			if (!block) {
+				return nullptr;
+			}
+			block->cap = cap;
+		} else {
+			Cache& c = cache();
+			if (!c.free[cls]) {
+				global().Take(cls, c);
+			}
+			block = c.free[cls];
+			if (!block) {
+				return nullptr;
+			}
+			c.free[cls] = block->next;
+			c.count[cls]--;
+			block->cap = ClassSize(cls) - sizeof(Block);
+		}
+		new (&block->ref) std::atomic<uint32_t>(1);
+		block->cls = cls;
+		block->used = 0;
+		block->next = nullptr;
+		return block;
+	}
+
+	static void Free(Block* block)
+	{
+		if (block->cls == CLASS_LARGE) {
+			free(block);
+			return;
+		}
+		Cache& c = cache();
+		uint32_t cls = block->cls;
+		block->next = c.free[cls];
+		c.free[cls] = block;
+		if (++c.count[cls] > CACHE_COUNT) {
+			global().Give(cls, c, CACHE_COUNT / 2);
+		}
+	}
+
+protected:
+	struct Cache
+	{
+		Block* free[CLASS_COUNT] = { 0 };
+		int count[CLASS_COUNT] = { 0 };
+		~Cache()
+		{
+			//线程退出，空闲块还给全局
+			for (uint32_t cls = 0; cls < CLASS_COUNT; cls++)
+			{
+				global().Give(cls, *this, count[cls]);
+			}
+		}
+	};
+
+	struct Global
+	{
+		std::mutex mutex;
+		Block* free[CLASS_COUNT] = { 0 };
+		bool huge_page = false;
+
+		//取一批空闲块给线程缓存，没有就新分配一个slab
+		void Take(uint32_t cls, Cache& c)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!free[cls]) {
+				NewSlab(cls);
+			}
+			for (int i = 0; i < CACHE_COUNT / 2 && free[cls]; i++)
+			{
+				Block* block = free[cls];
+				free[cls] = block->next;
+				block->next = c.free[cls];
+				c.free[cls] = block;
+				c.count[cls]++;
+			}
+		}
+
+		//线程缓存还回n个空闲块
+		void Give(uint32_t cls, Cache& c, int n)
+		{
+			if (n <= 0) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			for (int i = 0; i < n && c.free[cls]; i++)
+			{
+				Block* block = c.free[cls];
+				c.free[cls] = block->next;
+				c.count[cls]--;
+				block->next = free[cls];
+				free[cls] = block;
+			}
+		}
+
+		void NewSlab(uint32_t cls)
+		{
+			size_t block_size = ClassSize(cls);
+			char* slab = nullptr;
+#ifdef WIN32
+			slab = (char*)VirtualAlloc(NULL, SLAB_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+			if (huge_page) {
+				slab = (char*)mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+				if (slab == MAP_FAILED) {
+					slab = nullptr;
+				}
+			}
+			if (!slab) {
+				slab = (char*)mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (slab == MAP_FAILED) {
+					slab = nullptr;
+				}
+#ifdef MADV_HUGEPAGE
+				else if (huge_page) {
+					madvise(slab, SLAB_SIZE, MADV_HUGEPAGE);
+				}
+#endif//MADV_HUGEPAGE
+			}
+#endif//
+			if (!slab) {
+				PRINTF("IOBufPool::NewSlab failed, size=%u", (unsigned)SLAB_SIZE);
+				return;
+			}
+			for (size_t off = SLAB_SIZE; off >= block_size; off -= block_size)
+			{
+				Block* block = (Block*)(slab + off - block_size);
+				block->next = free[cls];
+				free[cls] = block;
+			}
+		}
+	};
+
+	static inline Global& global()
+	{
+		static Global g;
+		return g;
+	}
+
+	static inline Cache& cache()
+	{
+		static thread_local Cache c;
+		return c;
+	}
+};
+
+/*
+* 类名：IOBuf
+* 说明：引用计数的内存块切片，复制和切片只增加引用计数不拷贝数据，
+*       接收的数据可以保留下来或者直接放到其他连接的发送队列
+*
+* @code
+* +---------------+------------------+------------------+
+* |   其他切片    |  data_ ~ size_   |   tailroom       |
+* +---------------+------------------+------------------+
+* block->data()                block->used         block->cap
+*/
+class IOBuf
+{
+public:
+	typedef IOBufPool::Block Block;
+protected:
+	Block* block_ = nullptr;
+	char* data_ = nullptr;
+	size_t size_ = 0;
+	bool writable_ = false; //只有分配内存块的对象可以写入，复制和切片都是只读的
+public:
+	IOBuf() {}
+	//分配至少cap字节的空内存块
+	explicit IOBuf(size_t cap) : block_(IOBufPool::Alloc(cap)) {
+		if (block_) {
+			data_ = block_->data();
+			writable_ = true;
+		}
+	}
+	IOBuf(const IOBuf& rhs) : block_(rhs.block_), data_(rhs.data_), size_(rhs.size_) {
+		if (block_) {
+			block_->ref.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	IOBuf(IOBuf&& rhs) : block_(rhs.block_), data_(rhs.data_), size_(rhs.size_), writable_(rhs.writable_) {
+		rhs.block_ = nullptr;
+		rhs.data_ = nullptr;
+		rhs.size_ = 0;
+		rhs.writable_ = false;
+	}
+	~IOBuf() { release(); }
+
+	inline IOBuf& operator=(const IOBuf& rhs) {
+		if (this != &rhs) {
+			IOBuf tmp(rhs);
+			swap(tmp);
+		}
+		return *this;
+	}
+	inline IOBuf& operator=(IOBuf&& rhs) {
+		if (this != &rhs) {
+			release();
+			swap(rhs);
+		}
+		return *this;
+	}
+
+	//拷贝数据到新内存块
+	static inline IOBuf copy(const char* buf, size_t len) {
+		IOBuf iobuf(len);
+		if (iobuf.block_ && len) {
+			memcpy(iobuf.tail(), buf, len);
+			iobuf.append(len);
+		}
+		return iobuf;
+	}
+
+	inline void swap(IOBuf& rhs) {
+		std::swap(block_, rhs.block_);
+		std::swap(data_, rhs.data_);
+		std::swap(size_, rhs.size_);
+		std::swap(writable_, rhs.writable_);
+	}
+
+	inline explicit operator bool() const { return block_ != nullptr; }
+	inline const char* data() const { return data_; }
+	inline size_t size() const { return size_; }
+	inline bool empty() const { return !size_; }
+	inline size_t capacity() const { return block_ ? block_->cap : 0; }
+	inline bool unique() const { return block_ && block_->ref.load(std::memory_order_acquire) == 1; }
+
+	//是否包含[buf,buf+len)
+	inline bool contains(const char* buf, size_t len) const {
+		return block_ && buf >= data_ && buf + len <= data_ + size_;
+	}
+
+	//切片，共享内存块
+	inline IOBuf slice(size_t offset, size_t len) const {
+		ASSERT(offset + len <= size_);
+		IOBuf iobuf(*this);
+		iobuf.data_ += offset;
+		iobuf.size_ = len;
+		return iobuf;
+	}
+	inline IOBuf slice(const char* buf, size_t len) const {
+		ASSERT(contains(buf, len));
+		return slice(buf - data_, len);
+	}
+
+	inline void trim_front(size_t len) {
+		ASSERT(len <= size_);
+		data_ += len;
+		size_ -= len;
+	}
+	inline void trim_back(size_t len) {
+		ASSERT(len <= size_);
+		size_ -= len;
+	}
+
+	//只有分配者且末尾是内存块的写入末尾时才能继续写入，不会覆盖其他切片
+	inline size_t tailroom() const {
+		if (!writable_ || data_ + size_ != block_->data() + block_->used) {
+			return 0;
+		}
+		return block_->cap - block_->used;
+	}
+	inline char* tail() { return data_ + size_; }
+	inline void append(size_t len) {
+		ASSERT(len <= tailroom());
+		size_ += len;
+		block_->used += len;
+	}
+
+	//保证至少len字节tailroom，独占时原地搬移，共享时换新内存块只拷贝本切片数据
+	inline bool reserve(size_t len) {
+		if (tailroom() >= len) {
+			return true;
+		}
+		if (writable_ && unique() && block_->cap >= size_ + len) {
+			memmove(block_->data(), data_, size_);
+			data_ = block_->data();
+			block_->used = size_;
+			return true;
+		}
+		IOBuf iobuf(size_ + len);
+		if (!iobuf.block_) {
+			return false;
+		}
+		if (size_) {
+			memcpy(iobuf.tail(), data_, size_);
+			iobuf.append(size_);
+		}
+		swap(iobuf);
+		return true;
+	}
+
+	inline void clear() {
+		release();
+	}
+
+protected:
+	inline void release() {
+		if (block_) {
+			if (block_->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				IOBufPool::Free(block_);
+			}
+			block_ = nullptr;
+		}
+		data_ = nullptr;
+		size_ = 0;
+		writable_ = false;
+	}
+};
+
 }
 
 #endif //__H_XBUFFER_H__
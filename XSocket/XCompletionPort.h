@@ -355,6 +355,13 @@ public:
 		return nSend;
 	}
 
+	//重叠发送只投递第一个缓存，完成后再继续
+	int SendV(const struct iovec* lpIov, int nIovCnt, int nFlags = 0)
+	{
+		ASSERT(nIovCnt > 0);
+		return Send((const char*)lpIov[0].iov_base, (int)lpIov[0].iov_len, nFlags);
+	}
+
 	int Receive(char* lpBuf, int nBufLen, int nFlags = 0)
 	{
 		PER_IO_OPERATION_DATA* pOverlapped = &receive_overlapped_;
@@ -453,6 +460,8 @@ public:
 			Trigger(FD_ACCEPT, 0);
 		}
 	}
+	//完成端口靠触发FD_WRITE投递重叠发送，不会有EAGAIN，同Select
+	inline void SelectWait(int lEvent) { Select(lEvent); }
 };
 
 /*!
@@ -556,7 +565,7 @@ typedef ThreadServiceT<CompletionPortServiceT<Service>> CompletionPortService;
 /*!
  *	@brief CompletionPortSocketSet 模板定义.
  *
- *	封装CompletionPortSocketSet，实现对CompletionPort模型封装，最多管理uFD_SETSize数Socket
+ *	封装CompletionPortSocketSet，实现对CompletionPort模型封装，最多管理nMaxSocketCount数Socket
  */
 template<class TService = CompletionPortService, class TSocket = SocketEx>
 class CompletionPortSocketSetT : public SocketSetT<TService,TSocket>
@@ -578,62 +587,52 @@ public:
 
 	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
 	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		int i, j = sock_ptrs_.size();
-		for (i = 0; i < j; i++)
-		{
-			if(sock_ptrs_[i]==NULL) {
-				if (sock_ptr) {
-					sock_count_++;
-					sock_ptrs_[i] = sock_ptr;
-					sock_ptr->AttachService(this);
-					//SetHandleInformation((HANDLE) (SOCKET)*sock_ptr, HANDLE_FLAG_INHERIT, 0);
-					HANDLE hIocp = CreateIoCompletionPort((HANDLE)(SOCKET)*sock_ptr, hIocp_, (ULONG_PTR)(i + 1), 0);
-					ASSERT(hIocp);
-					if (hIocp != INVALID_HANDLE_VALUE) {
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		if (!sock_ptr || Base::sock_free_ < 0) {
+			//测试可不可以增加Socket，返回>=0表示可以增加
+			return Base::sock_free_;
+		}
+		sock_ptr->AttachService(this);
+		int i = Base::AllocSlot(sock_ptr);
+		//SetHandleInformation((HANDLE) (SOCKET)*sock_ptr, HANDLE_FLAG_INHERIT, 0);
+		HANDLE hIocp = CreateIoCompletionPort((HANDLE)(SOCKET)*sock_ptr, hIocp_, (ULONG_PTR)(i + 1), 0);
+		ASSERT(hIocp);
+		if (hIocp != INVALID_HANDLE_VALUE) {
 #ifdef _DEBUG
-						PRINTF("CreateIoCompletionPort: %ld by %ld", hIocp, hIocp_);
+			PRINTF("CreateIoCompletionPort: %ld by %ld", hIocp, hIocp_);
 #endif
-					} else {
-						PRINTF("CreateIoCompletionPort Error:%d", ::GetLastError());
-					}
-					// if (family == AF_INET6) {
-					// 	//uv_tcp_non_ifs_lsp_ipv6 = 1表示IPPROTO_IP协议使用真正地操作系统句柄，没有lsp封装
-					// 	non_ifs_lsp = uv_tcp_non_ifs_lsp_ipv6;
-					// } else {
-					// 	//同理
-					// 	non_ifs_lsp = uv_tcp_non_ifs_lsp_ipv4;
-					// }
-
-					// if (pSetFileCompletionNotificationModes &&
-					// 	!(handle->flags & UV_HANDLE_EMULATE_IOCP) && !non_ifs_lsp) {
-					// 	if (pSetFileCompletionNotificationModes((HANDLE) socket,
-					// 		FILE_SKIP_SET_EVENT_ON_HANDLE |
-					// 		FILE_SKIP_COMPLETION_PORT_ON_SUCCESS))//如果操作立刻完成，不再向iocp发送通知 
-					// 	{
-					// 	handle->flags |= UV_HANDLE_SYNC_BYPASS_IOCP;
-					// 	} else if (GetLastError() != ERROR_INVALID_FUNCTION) {
-					// 	return GetLastError();
-					// 	}
-					// }
-					if(evt & FD_READ) {
-						PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYRECEIVE, (ULONG_PTR)(i + 1), NULL);
-					}
-					if(evt & FD_WRITE) {
-						PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYSEND, (ULONG_PTR)(i + 1), NULL);
-					}
-					if(evt & FD_ACCEPT) {
-						PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYACCEPT, (ULONG_PTR)(i + 1), NULL);
-					}
-					return i;
-				} else {
-					//测试可不可以增加Socket，返回true表示可以增加
-					return i;
-				}
-				break;
-			}
+		} else {
+			PRINTF("CreateIoCompletionPort Error:%d", ::GetLastError());
+		}
+		// if (family == AF_INET6) {
+		// 	//uv_tcp_non_ifs_lsp_ipv6 = 1表示IPPROTO_IP协议使用真正地操作系统句柄，没有lsp封装
+		// 	non_ifs_lsp = uv_tcp_non_ifs_lsp_ipv6;
+		// } else {
+		// 	//同理
+		// 	non_ifs_lsp = uv_tcp_non_ifs_lsp_ipv4;
+		// }
+
+		// if (pSetFileCompletionNotificationModes &&
+		// 	!(handle->flags & UV_HANDLE_EMULATE_IOCP) && !non_ifs_lsp) {
+		// 	if (pSetFileCompletionNotificationModes((HANDLE) socket,
+		// 		FILE_SKIP_SET_EVENT_ON_HANDLE |
+		// 		FILE_SKIP_COMPLETION_PORT_ON_SUCCESS))//如果操作立刻完成，不再向iocp发送通知 
+		// 	{
+		// 	handle->flags |= UV_HANDLE_SYNC_BYPASS_IOCP;
+		// 	} else if (GetLastError() != ERROR_INVALID_FUNCTION) {
+		// 	return GetLastError();
+		// 	}
+		// }
+		if(evt & FD_READ) {
+			PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYRECEIVE, (ULONG_PTR)(i + 1), NULL);
+		}
+		if(evt & FD_WRITE) {
+			PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYSEND, (ULONG_PTR)(i + 1), NULL);
+		}
+		if(evt & FD_ACCEPT) {
+			PostQueuedCompletionStatus(hIocp_, IOCP_OPERATION_TRYACCEPT, (ULONG_PTR)(i + 1), NULL);
 		}
-		return -1;
+		return i;
 	}
 	template<class Ty = Socket>
 	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
@@ -654,12 +653,10 @@ protected:
 	virtual bool OnCompletion(BOOL bStatus, ULONG_PTR Key, DWORD dwTransfer, WSAOVERLAPPED* lpOverlap)
 	{
 		PER_IO_OPERATION_DATA* lpOverlapped = (PER_IO_OPERATION_DATA*)lpOverlap;
-		int uFD_SETSize = sock_ptrs_.size();
+		int uFD_SETSize = Base::sock_ptrs_.size();
 		int Pos = Key;
 		if (Pos > 0 && Pos <= uFD_SETSize) {
-			std::unique_lock<std::mutex> lock(mutex_);
-			std::shared_ptr<Socket> sock_ptr = sock_ptrs_[Pos - 1];
-			lock.unlock();
+			std::shared_ptr<Socket> sock_ptr = std::atomic_load(&Base::sock_ptrs_[Pos - 1]);
 			if(sock_ptr) {
 				bool bContinue = false;
 				switch (dwTransfer)
@@ -0,0 +1,560 @@
+/*
+ * Copyright: 7thTool Open Source <i7thTool@qq.com>
+ * All rights reserved.
+ *
+ * Author	: Scott
+ * Email	：i7thTool@qq.com
+ * Blog		: http://blog.csdn.net/zhangzq86
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _H_XCOROUTINE_H_
+#define _H_XCOROUTINE_H_
+
+#include "XSocketEx.h"
+
+//C++20协程支持，需要编译器开启C++20
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+#include <coroutine>
+#include <optional>
+
+namespace XSocket {
+
+template<class T = void> class CoTask;
+
+/*!
+ *	@brief CoPromiseBase 定义.
+ *
+ *	CoTask的promise公共部分，惰性启动，结束时对称转移到等待者
+ */
+class CoPromiseBase
+{
+public:
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept { return false; }
+		template<class TPromise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<TPromise> h) noexcept
+		{
+			std::coroutine_handle<> cont = h.promise().continuation_;
+			return cont ? cont : std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() { error_ = std::current_exception(); }
+
+	std::coroutine_handle<> continuation_; //co_await这个任务的协程
+	std::exception_ptr error_;
+};
+
+template<class T>
+class CoPromise : public CoPromiseBase
+{
+public:
+	CoTask<T> get_return_object();
+	template<class U>
+	void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+
+	inline T Result()
+	{
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+		return std::move(*value_);
+	}
+
+private:
+	std::optional<T> value_;
+};
+
+template<>
+class CoPromise<void> : public CoPromiseBase
+{
+public:
+	CoTask<void> get_return_object();
+	void return_void() {}
+
+	inline void Result()
+	{
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+	}
+};
+
+/*!
+ *	@brief CoTask 模板定义.
+ *
+ *	封装CoTask，协程返回类型，co_await时才开始执行，执行完恢复等待者
+ *	只能移动，协程帧由CoTask持有
+ */
+template<class T>
+class CoTask
+{
+public:
+	typedef CoPromise<T> promise_type;
+	typedef std::coroutine_handle<promise_type> handle_type;
+
+	struct Awaiter
+	{
+		handle_type h;
+		bool await_ready() noexcept { return !h || h.done(); }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept
+		{
+			h.promise().continuation_ = cont;
+			return h;
+		}
+		T await_resume() { return h.promise().Result(); }
+	};
+
+	CoTask():h_(nullptr) {}
+	explicit CoTask(handle_type h):h_(h) {}
+	CoTask(CoTask&& o):h_(o.h_) { o.h_ = nullptr; }
+	CoTask(const CoTask&) = delete;
+	~CoTask() { if (h_) h_.destroy(); }
+	CoTask& operator=(CoTask&& o) { std::swap(h_, o.h_); return *this; }
+	CoTask& operator=(const CoTask&) = delete;
+
+	inline bool IsDone() const { return !h_ || h_.done(); }
+
+	Awaiter operator co_await() && noexcept { return Awaiter{h_}; }
+	Awaiter operator co_await() & noexcept { return Awaiter{h_}; }
+
+private:
+	handle_type h_;
+};
+
+template<class T>
+inline CoTask<T> CoPromise<T>::get_return_object() { return CoTask<T>(std::coroutine_handle<CoPromise<T>>::from_promise(*this)); }
+inline CoTask<void> CoPromise<void>::get_return_object() { return CoTask<void>(std::coroutine_handle<CoPromise<void>>::from_promise(*this)); }
+
+/*!
+ *	@brief CoDetached 定义.
+ *
+ *	CoSpawn用的分离协程，立即执行，结束自动销毁
+ */
+struct CoDetached
+{
+	struct promise_type
+	{
+		CoDetached get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept
+		{
+			try {
+				std::rethrow_exception(std::current_exception());
+			} catch(std::exception& e) {
+				PRINTF("CoSpawn exception: %s", e.what());
+			} catch(...) {
+				PRINTF("CoSpawn exception");
+			}
+		}
+	};
+};
+
+/*!
+ *	@brief 启动一个分离的协程.
+ *
+ *	在当前线程立即执行到第一次挂起，之后在事件循环线程上恢复，一般在Socket所在服务线程调用
+ */
+template<class T>
+inline CoDetached CoSpawn(CoTask<T> task)
+{
+	co_await std::move(task);
+}
+
+/*!
+ *	@brief CoSleep 定义.
+ *
+ *	co_await SleepFor(ms)，挂在当前服务的时间轮上，到期在服务线程恢复
+ *	当前线程没有服务时退化为阻塞等待
+ *	协程在挂起期间被销毁时，CoSleep随协程帧析构并取消定时器，不会恢复已经释放的协程
+ */
+class CoSleep
+{
+public:
+	explicit CoSleep(size_t millis):millis_(millis) {}
+	CoSleep(CoSleep&& o):millis_(o.millis_),svr_(o.svr_),timer_(o.timer_) { o.svr_ = nullptr; o.timer_ = 0; }
+	CoSleep(const CoSleep&) = delete;
+	~CoSleep()
+	{
+		if (timer_) {
+			//到期回调里恢复协程后再析构时定时器已经执行，取消不到也不会等待自己
+			svr_->RemoveTimer(timer_);
+		}
+	}
+
+	bool await_ready() const noexcept { return !millis_; }
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		Service* svr = Service::service();
+		if (!svr) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(millis_));
+			return false;
+		}
+		svr_ = svr;
+		timer_ = svr->AddTimer(millis_, [h]() { h.resume(); });
+		return true;
+	}
+	void await_resume() noexcept {}
+
+private:
+	size_t millis_;
+	Service* svr_ = nullptr;
+	Service::TimerID timer_ = 0;
+};
+
+inline CoSleep SleepFor(size_t millis) { return CoSleep(millis); }
+template<class Rep, class Period>
+inline CoSleep SleepFor(const std::chrono::duration<Rep,Period>& timeout)
+{
+	return CoSleep(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count());
+}
+
+/*!
+ *	@brief CoPostAwaiter 模板定义.
+ *
+ *	co_await CoPost(service)，切换到service的事件循环线程继续执行
+ *	已经在该服务线程上时不切换
+ */
+template<class TService>
+class CoPostAwaiter
+{
+public:
+	explicit CoPostAwaiter(TService& svr):svr_(svr) {}
+
+	bool await_ready() const noexcept { return Service::service() == static_cast<Service*>(&svr_); }
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		svr_.Post([h]() { h.resume(); });
+	}
+	void await_resume() noexcept {}
+
+private:
+	TService& svr_;
+};
+
+template<class TService>
+inline CoPostAwaiter<TService> CoPost(TService& svr) { return CoPostAwaiter<TService>(svr); }
+
+/*!
+ *	@brief CoSocketT 模板定义.
+ *
+ *	封装CoSocketT，在SocketEx事件回调之上提供协程接口：
+ *	co_await Connect(addr,len)、Read(buf,len)、ReadAll(buf,len)、Write(buf,len)、WriteAll(buf,len)
+ *	先直接读写，EWOULDBLOCK时挂起等待FD_READ/FD_WRITE，在事件循环线程的回调里完成读写并恢复协程
+ *	每个方向同时只能有一个等待者，需要在Socket所在服务线程上使用
+ */
+template<class TBase>
+class CoSocketT : public TBase
+{
+	typedef CoSocketT<TBase> This;
+	typedef TBase Base;
+protected:
+	struct CoWait
+	{
+		std::coroutine_handle<> handle;
+		char* buf = nullptr;
+		int len = 0;
+		int flags = 0;
+		int done_len = 0; //已经完成的字节数
+		bool all = false; //是否要完成全部len字节
+		bool suspended = false; //协程已经挂起，完成时需要恢复
+		bool done = false;
+		int result = 0;
+		int error = 0;
+	};
+	CoWait* connect_wait_ = nullptr;
+	CoWait* read_wait_ = nullptr;
+	CoWait* write_wait_ = nullptr;
+
+	//挂起等待者，如果注册时已经完成就不挂起
+	template<class TAwaiter>
+	struct CoAwaiterT
+	{
+		This* sock;
+		CoWait wait;
+		bool await_ready() { return static_cast<TAwaiter*>(this)->OnReady(); }
+		bool await_suspend(std::coroutine_handle<> h)
+		{
+			wait.handle = h;
+			static_cast<TAwaiter*>(this)->OnSuspend();
+			if (wait.done) {
+				return false;
+			}
+			wait.suspended = true;
+			return true;
+		}
+		int await_resume()
+		{
+			if (wait.error) {
+				Socket::SetLastError(wait.error);
+			}
+			return wait.result;
+		}
+	};
+
+public:
+	struct ConnectAwaiter : public CoAwaiterT<ConnectAwaiter>
+	{
+		const SOCKADDR* addr;
+		int addr_len;
+		bool OnReady()
+		{
+			int ret = this->sock->SocketEx::Connect(addr, addr_len);
+			if (ret == SOCKET_ERROR) {
+				int nErrorCode = Socket::GetLastError();
+				if (nErrorCode != EWOULDBLOCK && nErrorCode != EINPROGRESS) {
+					this->wait.result = nErrorCode;
+					this->wait.error = nErrorCode;
+					return true;
+				}
+			}
+			return false;
+		}
+		void OnSuspend() { this->sock->WaitConnect(&this->wait); }
+	};
+	struct ReadAwaiter : public CoAwaiterT<ReadAwaiter>
+	{
+		bool OnReady() { return this->sock->DoRead(this->wait); }
+		void OnSuspend() { this->sock->WaitRead(&this->wait); }
+	};
+	struct WriteAwaiter : public CoAwaiterT<WriteAwaiter>
+	{
+		bool OnReady() { return this->sock->DoWrite(this->wait); }
+		void OnSuspend() { this->sock->WaitWrite(&this->wait); }
+	};
+
+	using Base::Connect;
+
+	//连接，返回0表示成功，否则是错误码
+	inline ConnectAwaiter Connect(const SOCKADDR* lpSockAddr, int nSockAddrLen)
+	{
+		ConnectAwaiter awaiter;
+		awaiter.sock = this;
+		awaiter.addr = lpSockAddr;
+		awaiter.addr_len = nSockAddrLen;
+		return awaiter;
+	}
+
+	//读取最多nBufLen字节，返回读到的字节数，0表示对端关闭，SOCKET_ERROR表示出错
+	inline ReadAwaiter Read(char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL)
+	{
+		return MakeAwaiter<ReadAwaiter>(lpBuf, nBufLen, nFlags, false);
+	}
+	//读满nBufLen字节，对端关闭时返回已读字节数
+	inline ReadAwaiter ReadAll(char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL)
+	{
+		return MakeAwaiter<ReadAwaiter>(lpBuf, nBufLen, nFlags, true);
+	}
+	inline WriteAwaiter Write(const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL)
+	{
+		return MakeAwaiter<WriteAwaiter>((char*)lpBuf, nBufLen, nFlags, false);
+	}
+	//写完nBufLen字节，返回nBufLen或者SOCKET_ERROR
+	inline WriteAwaiter WriteAll(const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL)
+	{
+		return MakeAwaiter<WriteAwaiter>((char*)lpBuf, nBufLen, nFlags, true);
+	}
+
+	int Close()
+	{
+		CancelWait(ECONNABORTED);
+		return Base::Close();
+	}
+
+protected:
+	template<class TAwaiter>
+	inline TAwaiter MakeAwaiter(char* lpBuf, int nBufLen, int nFlags, bool all)
+	{
+		TAwaiter awaiter;
+		awaiter.sock = this;
+		awaiter.wait.buf = lpBuf;
+		awaiter.wait.len = nBufLen;
+		awaiter.wait.flags = nFlags;
+		awaiter.wait.all = all;
+		return awaiter;
+	}
+
+	//返回true表示操作结束（完成或者出错），false表示需要等待
+	inline bool DoRead(CoWait& w)
+	{
+		while (w.done_len < w.len)
+		{
+			int ret = Base::Receive(w.buf + w.done_len, w.len - w.done_len, w.flags);
+			if (ret > 0) {
+				w.done_len += ret;
+				if (!w.all) {
+					break;
+				}
+			} else if (ret == 0) {
+				break;
+			} else {
+				int nErrorCode = Socket::GetLastError();
+				if (nErrorCode == EWOULDBLOCK || nErrorCode == EAGAIN) {
+					return false;
+				}
+				w.error = nErrorCode;
+				w.result = SOCKET_ERROR;
+				return true;
+			}
+		}
+		w.result = w.done_len;
+		return true;
+	}
+
+	inline bool DoWrite(CoWait& w)
+	{
+		while (w.done_len < w.len)
+		{
+			int ret = Base::Send(w.buf + w.done_len, w.len - w.done_len, w.flags);
+			if (ret >= 0) {
+				w.done_len += ret;
+				if (!w.all) {
+					break;
+				}
+			} else {
+				int nErrorCode = Socket::GetLastError();
+				if (nErrorCode == EWOULDBLOCK || nErrorCode == EAGAIN) {
+					return false;
+				}
+				w.error = nErrorCode;
+				w.result = SOCKET_ERROR;
+				return true;
+			}
+		}
+		w.result = w.done_len;
+		return true;
+	}
+
+	inline void WaitConnect(CoWait* w)
+	{
+		ASSERT(!connect_wait_);
+		connect_wait_ = w;
+		auto svr = Base::service();
+		if (svr) {
+			svr->SelectSocket(this, FD_CONNECT);
+		}
+	}
+
+	inline void WaitRead(CoWait* w)
+	{
+		ASSERT(!read_wait_);
+		read_wait_ = w;
+		if (!Base::IsSelect(FD_READ)) {
+			Base::Select(FD_READ); //可能同步触发OnReceive完成读取
+		}
+	}
+
+	inline void WaitWrite(CoWait* w)
+	{
+		ASSERT(!write_wait_);
+		write_wait_ = w;
+		if (!Base::IsSelect(FD_WRITE)) {
+			Base::Select(FD_WRITE); //可能同步触发OnSend完成写入
+		}
+	}
+
+	//结束等待，协程已挂起时恢复
+	static inline void Resume(CoWait* w)
+	{
+		w->done = true;
+		if (w->suspended) {
+			w->handle.resume();
+		}
+	}
+
+	inline void CancelWait(int nErrorCode)
+	{
+		CoWait* waits[3] = { connect_wait_, read_wait_, write_wait_ };
+		connect_wait_ = read_wait_ = write_wait_ = nullptr;
+		for (CoWait* w : waits)
+		{
+			if (w) {
+				w->result = w == waits[0] ? nErrorCode : SOCKET_ERROR;
+				w->error = nErrorCode;
+				Resume(w);
+			}
+		}
+	}
+
+	virtual void OnConnect(int nErrorCode)
+	{
+		Base::OnConnect(nErrorCode);
+
+		CoWait* w = connect_wait_;
+		if (w) {
+			connect_wait_ = nullptr;
+			w->result = nErrorCode;
+			w->error = nErrorCode;
+			Resume(w);
+		}
+	}
+
+	//读由协程负责，可读事件不交给Base::OnReceive，TcpSocket等Base会先把数据读进自己的缓存，协程就读不到了
+	virtual void OnReceive(int nErrorCode)
+	{
+		if (nErrorCode) {
+			Base::OnReceive(nErrorCode);
+		}
+
+		CoWait* w = read_wait_;
+		if (!w) {
+			//没有等待者时不再关注可读，数据留在内核里，下次Read直接读
+			Base::RemoveSelect(FD_READ);
+			return;
+		}
+		if (DoRead(*w)) {
+			read_wait_ = nullptr;
+			Resume(w);
+		}
+	}
+
+	//协程在写时不交给Base::OnSend，TcpSocket等Base没有待发数据时会取消FD_WRITE，协程就等不到可写了
+	virtual void OnSend(int nErrorCode)
+	{
+		CoWait* w = write_wait_;
+		if (!w) {
+			Base::OnSend(nErrorCode);
+			return;
+		}
+		if (DoWrite(*w)) {
+			write_wait_ = nullptr;
+			Base::RemoveSelect(FD_WRITE);
+			Resume(w);
+		}
+	}
+
+	virtual void OnClose(int nErrorCode)
+	{
+		Base::OnClose(nErrorCode);
+		CancelWait(nErrorCode ? nErrorCode : ECONNRESET);
+	}
+
+	virtual void OnDetachService(Service* pSvr)
+	{
+		CancelWait(ECANCELED);
+		Base::OnDetachService(pSvr);
+	}
+};
+
+}
+
+#endif//__cpp_impl_coroutine
+
+#endif//_H_XCOROUTINE_H_
@@ -23,6 +23,7 @@
 
 #include "XHttpImpl.h"
 #include "XBuffer.h"
+#include <random>
 
 namespace XSocket {
 
@@ -930,6 +931,535 @@ protected:
     }
 };
 
+/*!
+ *	@brief DNSResolverT 模板定义.
+ *
+ *	封装DNSResolver，非阻塞DNS解析，用一个UDP Socket和其他Socket注册在同一个反应器里发送DNS::Message查询；
+ *	查询按ID复用同一个Socket，超时按指数退避重试并轮换服务器，AF_UNSPEC时A和AAAA并发查询，
+ *	结果按TTL写入HostCache（包括否定结果），同名同地址族的查找合并成一次。
+ *	TBase需要是UDP Socket（比如SimpleUdpSocketT），Resolve只能在所在服务线程调用，回调也在服务线程执行
+ */
+template<class TBase>
+class DNSResolverT : public TBase
+{
+	typedef TBase Base;
+public:
+	typedef typename Base::SockAddr SockAddr;
+	typedef std::function<void(struct addrinfo*)> Callback;
+protected:
+	struct Waiter
+	{
+		struct addrinfo hints;
+		u_short port;
+		Callback cb;
+	};
+	//按名字和地址族合并的查找
+	struct Lookup
+	{
+		uint64_t id = 0;
+		std::string name;
+		int pending = 0; //未完成的查询数
+		bool has_v4 = false;
+		bool has_v6 = false;
+		HostCache::Result v4;
+		HostCache::Result v6;
+		Service::TimerID delay_timer = 0; //A先返回时等待AAAA的定时器
+		std::vector<Waiter> waiters;
+	};
+	typedef typename std::unordered_map<std::string, Lookup>::iterator LookupIterator;
+	//在途查询，按查询ID索引
+	struct Query
+	{
+		std::string name;
+		uint16_t type = 0;
+		std::string lookup_key;
+		uint64_t lookup_id = 0;
+		size_t server = 0; //当前服务器序号
+		size_t tries = 0; //已经发送次数
+		Service::TimerID timer = 0; //超时定时器
+	};
+	typedef typename std::unordered_map<uint16_t, Query>::iterator QueryIterator;
+	Service* resolve_svr_ = nullptr; //定时器所在服务
+	std::vector<SockAddr> servers_;
+	size_t timeout_ = 1000; //首次超时（毫秒），每次重试翻倍
+	size_t attempts_ = 3; //每个查询最多发送次数
+	size_t resolution_delay_ = 50; //A先返回时等待AAAA的时间（毫秒），见RFC 8305
+	std::unordered_map<uint16_t, Query> queries_;
+	std::unordered_map<std::string, Lookup> lookups_;
+	uint64_t lookup_next_ = 0;
+	std::mt19937 random_;
+public:
+	DNSResolverT():random_(std::random_device()())
+	{
+		//构造时读取resolv.conf，不在服务线程上阻塞读文件；需要自定义服务器时先ClearNameServer再AddNameServer
+		LoadResolvConf();
+	}
+
+	inline int Close()
+	{
+		CancelAll(EAI_AGAIN);
+		return Base::Close();
+	}
+
+	inline void SetTimeOut(size_t millis, size_t attempts)
+	{
+		timeout_ = millis;
+		attempts_ = attempts ? attempts : 1;
+	}
+	inline void SetResolutionDelay(size_t millis) { resolution_delay_ = millis; }
+	inline size_t GetPendingCount() { return queries_.size(); }
+
+	/*!
+	 *	@brief 添加DNS服务器.
+	 *
+	 *	IPv6 Socket也可以添加IPv4服务器，使用IPv4映射地址
+	 */
+	inline bool AddNameServer(const char* ip, u_short port = DNSPort)
+	{
+		SockAddr addr;
+		memset(&addr, 0, sizeof(addr));
+		if (sizeof(SockAddr) >= sizeof(sockaddr_in6)) {
+			sockaddr_in6* sa6 = (sockaddr_in6*)&addr;
+			if (XSocket::Socket::IpStr2IpAddr(ip, AF_INET6, &sa6->sin6_addr) != 1) {
+				struct in_addr v4 = {};
+				if (XSocket::Socket::IpStr2IpAddr(ip, AF_INET, &v4) != 1) {
+					return false;
+				}
+				uint8_t* p = (uint8_t*)&sa6->sin6_addr;
+				p[10] = 0xFF;
+				p[11] = 0xFF;
+				memcpy(p + 12, &v4, sizeof(v4));
+			}
+			sa6->sin6_family = AF_INET6;
+			sa6->sin6_port = htons(port);
+		} else {
+			sockaddr_in* sa = (sockaddr_in*)&addr;
+			if (XSocket::Socket::IpStr2IpAddr(ip, AF_INET, &sa->sin_addr) != 1) {
+				return false;
+			}
+			sa->sin_family = AF_INET;
+			sa->sin_port = htons(port);
+		}
+		servers_.push_back(addr);
+		return true;
+	}
+	inline void ClearNameServer() { servers_.clear(); }
+
+	//读取resolv.conf的nameserver和timeout/attempts选项，返回添加的服务器数；会阻塞读文件，不要在服务线程调用
+	inline size_t LoadResolvConf(const char* path = "/etc/resolv.conf")
+	{
+		FILE* fp = fopen(path, "r");
+		if (!fp) {
+			return 0;
+		}
+		size_t count = 0;
+		char line[512] = {0};
+		while (fgets(line, sizeof(line), fp))
+		{
+			char key[32] = {0};
+			char val[256] = {0};
+			int pos = 0, len = 0;
+			if (sscanf(line, "%31s%n", key, &pos) != 1 || key[0] == '#' || key[0] == ';') {
+				continue;
+			}
+			if (!strcmp(key, "nameserver")) {
+				if (sscanf(line + pos, "%255s", val) == 1 && AddNameServer(val)) {
+					count++;
+				}
+			} else if (!strcmp(key, "options")) {
+				for (const char* p = line + pos; sscanf(p, "%255s%n", val, &len) == 1; p += len)
+				{
+					if (!strncmp(val, "timeout:", 8)) {
+						timeout_ = std::max(1, atoi(val + 8)) * 1000;
+					} else if (!strncmp(val, "attempts:", 9)) {
+						attempts_ = std::max(1, atoi(val + 9));
+					}
+				}
+			}
+		}
+		fclose(fp);
+		return count;
+	}
+
+	/*!
+	 *	@brief 异步解析主机名.
+	 *
+	 *	参数同PostGetAddrInfo，service只支持端口号；IP地址和命中HostCache时直接回调，
+	 *	否则发出查询；回调里的result只在回调期间有效，失败时为nullptr
+	 */
+	inline void Resolve(const std::string& hostname, const std::string& service, const struct addrinfo& hints, Callback&& cb)
+	{
+		u_short port = (u_short)strtoul(service.c_str(), nullptr, 10);
+		HostCache::Result res;
+		if (HostCache::IsNumericHost(hostname.c_str())) {
+			struct addrinfo numeric_hints = hints;
+			numeric_hints.ai_flags |= AI_NUMERICHOST;
+			struct addrinfo* ai = nullptr;
+			if (!XSocket::Socket::GetAddrInfo(hostname.c_str(), nullptr, &numeric_hints, &ai)) {
+				HostCache::ToResult(ai, res);
+				freeaddrinfo(ai);
+			} else {
+				res.error = EAI_NONAME;
+			}
+			Done(res, hints, port, cb);
+			return;
+		}
+		if (HostCache::Inst().Lookup(hostname, hints.ai_family, res)) {
+			Done(res, hints, port, cb);
+			return;
+		}
+		std::string key = HostCache::MakeKey(hostname, hints.ai_family);
+		auto it = lookups_.find(key);
+		if (it != lookups_.end()) {
+			//同名查找正在进行，合并等待
+			it->second.waiters.push_back({hints, port, std::move(cb)});
+			return;
+		}
+		Lookup& lookup = lookups_[key];
+		lookup.id = ++lookup_next_;
+		lookup.name = hostname;
+		lookup.waiters.push_back({hints, port, std::move(cb)});
+		if (hints.ai_family != AF_INET) {
+			StartQuery(key, lookup, DNS::TYPE_AAAA);
+		}
+		if (hints.ai_family != AF_INET6) {
+			StartQuery(key, lookup, DNS::TYPE_A);
+		}
+		if (!lookup.pending) {
+			CompleteLookup(lookups_.find(key));
+		}
+	}
+
+protected:
+	//
+	static inline void Done(const HostCache::Result& res, const struct addrinfo& hints, u_short port, const Callback& cb)
+	{
+		AddrInfoList ai;
+		if (!res.error) {
+			ai.Assign(res, hints, port);
+		}
+		cb(ai.get());
+	}
+
+	inline bool StartQuery(const std::string& key, Lookup& lookup, uint16_t type)
+	{
+		if (!Base::IsSocket() || servers_.empty() || queries_.size() >= 0xFFFF) {
+			return false;
+		}
+		//随机ID，避免被猜中伪造应答
+		uint16_t id = 0;
+		do {
+			id = (uint16_t)random_();
+		} while (queries_.count(id));
+		Query& query = queries_[id];
+		query.name = lookup.name;
+		query.type = type;
+		query.lookup_key = key;
+		query.lookup_id = lookup.id;
+		query.server = (size_t)random_() % servers_.size(); //ID之外再随机首选服务器，分散负载
+		lookup.pending++;
+		SendQuery(id, query);
+		return true;
+	}
+
+	inline void SendQuery(uint16_t id, Query& query)
+	{
+		DNS::Message msg;
+		msg.Head().id = id;
+		msg.Head().QR = DNS::QR_QUERY;
+		msg.Head().opcode = DNS::OPCODE_QUERY;
+		msg.Head().RD = 1;
+		msg.Head().Questions = 1;
+		DNS::qrinfo_t qr;
+		qr.name_ = query.name;
+		qr.type_ = query.type;
+		qr.class_ = DNS::CLASS_IN;
+		msg.QRs().push_back(qr);
+		XBuffer buff(512, true);
+		msg.Encode(buff);
+		Base::SendBuf(buff.data(), buff.size(), servers_[query.server % servers_.size()], SOCKET_PACKET_FLAG_TEMPBUF);
+		size_t timeout = timeout_ << std::min<size_t>(query.tries, 8);
+		query.tries++;
+		if (resolve_svr_) {
+			query.timer = resolve_svr_->AddTimer(timeout, [this,id]() {
+				OnQueryTimeOut(id);
+			});
+		}
+	}
+
+	//换下一个服务器重发
+	inline void RetryQuery(QueryIterator it)
+	{
+		Query& query = it->second;
+		if (query.timer) {
+			if (resolve_svr_) {
+				resolve_svr_->RemoveTimer(query.timer);
+			}
+			query.timer = 0;
+		}
+		query.server++;
+		SendQuery(it->first, query);
+	}
+
+	inline void OnQueryTimeOut(uint16_t id)
+	{
+		auto it = queries_.find(id);
+		if (it == queries_.end()) {
+			return;
+		}
+		it->second.timer = 0;
+		if (it->second.tries < attempts_) {
+			RetryQuery(it);
+			return;
+		}
+		HostCache::Result res;
+		res.error = EAI_AGAIN;
+		FinishQuery(it, res, 0);
+	}
+
+	inline bool IsServerAddr(const SockAddr& addr)
+	{
+		const SOCKADDR* sa = (const SOCKADDR*)&addr;
+		for (auto& server : servers_)
+		{
+			const SOCKADDR* ss = (const SOCKADDR*)&server;
+			if (sa->sa_family != ss->sa_family) {
+				continue;
+			}
+			if (sa->sa_family == AF_INET) {
+				const sockaddr_in* a = (const sockaddr_in*)sa, *b = (const sockaddr_in*)ss;
+				if (a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr) {
+					return true;
+				}
+			} else if (sa->sa_family == AF_INET6) {
+				const sockaddr_in6* a = (const sockaddr_in6*)sa, *b = (const sockaddr_in6*)ss;
+				if (a->sin6_port == b->sin6_port && !memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr))) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	//否定应答的缓存时间，取SOA的TTL和MINIMUM较小值，没有SOA不缓存（RFC 2308）
+	static inline uint32_t NegativeTTL(DNS::Message& msg)
+	{
+		for (auto& rr : msg.AuthorityRRs())
+		{
+			if (rr.type_ == DNS::TYPE_SOA && rr.data_.size() == sizeof(DNS::soa_t)) {
+				DNS::soa_t soa;
+				memcpy(&soa, rr.data_.data(), sizeof(soa));
+				return std::min<uint32_t>(rr.ttl_, soa.minimum);
+			}
+		}
+		return 0;
+	}
+
+	//解析数据包，UDP一个包就是一个完整应答，解析失败直接丢弃
+	virtual int ParseBuf(const char* lpBuf, int & nBufLen, const SockAddr & stAddr)
+	{
+		DNS::Message msg;
+		int nMsgLen = nBufLen;
+		if (msg.Parse(lpBuf, nMsgLen) == SOCKET_PACKET_FLAG_COMPLETE) {
+			OnDNSResponse(msg, stAddr);
+		}
+		return SOCKET_PACKET_FLAG_COMPLETE;
+	}
+
+	virtual void OnDNSResponse(DNS::Message& msg, const SockAddr& stAddr)
+	{
+		if (msg.Head().QR != DNS::QR_RESPONSE) {
+			return;
+		}
+		auto it = queries_.find(msg.Head().id);
+		if (it == queries_.end()) {
+			return;
+		}
+		Query& query = it->second;
+		//核对来源和问题，丢弃伪造或者串号的应答
+		if (!IsServerAddr(stAddr)) {
+			return;
+		}
+		if (msg.QRs().size() != 1 || msg.QRs()[0].type_ != query.type
+			|| HostCache::MakeKey(msg.QRs()[0].name_, 0) != HostCache::MakeKey(query.name, 0)) {
+			return;
+		}
+		HostCache::Result res;
+		uint32_t ttl = 0;
+		bool failed = false;
+		switch (msg.Head().rcode)
+		{
+		case DNS::RCODE_NOERROR: {
+			//跟随CNAME链，TTL取链上最小值
+			bool first = true;
+			for (auto& rr : msg.AnswerRRs())
+			{
+				if (rr.class_ != DNS::CLASS_IN) {
+					continue;
+				}
+				if (rr.type_ == query.type) {
+					sockaddr_storage addr = {};
+					if (rr.type_ == DNS::TYPE_A && rr.data_.size() == DNS::RR_A_LEN) {
+						sockaddr_in& sa = (sockaddr_in&)addr;
+						sa.sin_family = AF_INET;
+						memcpy(&sa.sin_addr, rr.data_.data(), DNS::RR_A_LEN);
+					} else if (rr.type_ == DNS::TYPE_AAAA && rr.data_.size() == DNS::RR_AAAA_LEN) {
+						sockaddr_in6& sa6 = (sockaddr_in6&)addr;
+						sa6.sin6_family = AF_INET6;
+						memcpy(&sa6.sin6_addr, rr.data_.data(), DNS::RR_AAAA_LEN);
+					} else {
+						continue;
+					}
+					res.addrs.push_back(addr);
+				} else if (rr.type_ != DNS::TYPE_CNAME) {
+					continue;
+				}
+				ttl = first ? rr.ttl_ : std::min(ttl, rr.ttl_);
+				first = false;
+			}
+			if (res.addrs.empty()) {
+				if (msg.Head().TC) {
+					//截断且没有地址，不支持TCP重查，当作服务器失败
+					failed = true;
+				} else {
+					//NODATA
+					res.error = EAI_NONAME;
+					ttl = NegativeTTL(msg);
+				}
+			}
+		} break;
+		case DNS::RCODE_NXDOMAIN: {
+			res.error = EAI_NONAME;
+			ttl = NegativeTTL(msg);
+		} break;
+		default: {
+			//SERVFAIL/REFUSED等
+			failed = true;
+		} break;
+		}
+		if (failed) {
+			if (query.tries < attempts_) {
+				RetryQuery(it);
+				return;
+			}
+			res.error = EAI_AGAIN;
+			ttl = 0;
+		}
+		FinishQuery(it, res, ttl);
+	}
+
+	inline void FinishQuery(QueryIterator it, const HostCache::Result& res, uint32_t ttl)
+	{
+		Query query = std::move(it->second);
+		queries_.erase(it);
+		if (query.timer && resolve_svr_) {
+			resolve_svr_->RemoveTimer(query.timer);
+		}
+		int family = query.type == DNS::TYPE_AAAA ? AF_INET6 : AF_INET;
+		HostCache::Inst().Insert(query.name, family, res, ttl);
+		auto lit = lookups_.find(query.lookup_key);
+		if (lit == lookups_.end() || lit->second.id != query.lookup_id) {
+			//查找已经完成，只更新缓存
+			return;
+		}
+		Lookup& lookup = lit->second;
+		lookup.pending--;
+		if (family == AF_INET6) {
+			lookup.has_v6 = true;
+			lookup.v6 = res;
+		} else {
+			lookup.has_v4 = true;
+			lookup.v4 = res;
+		}
+		if (!lookup.pending) {
+			CompleteLookup(lit);
+			return;
+		}
+		if (res.error) {
+			return;
+		}
+		if (family == AF_INET6) {
+			//AAAA先返回，直接完成
+			CompleteLookup(lit);
+		} else if (resolve_svr_ && !lookup.delay_timer) {
+			//A先返回，再等AAAA一会
+			std::string key = query.lookup_key;
+			uint64_t id = lookup.id;
+			lookup.delay_timer = resolve_svr_->AddTimer(resolution_delay_, [this,key,id]() {
+				auto it = lookups_.find(key);
+				if (it != lookups_.end() && it->second.id == id) {
+					it->second.delay_timer = 0;
+					CompleteLookup(it);
+				}
+			});
+		}
+	}
+
+	inline void CompleteLookup(LookupIterator it)
+	{
+		Lookup lookup = std::move(it->second);
+		lookups_.erase(it);
+		if (lookup.delay_timer && resolve_svr_) {
+			resolve_svr_->RemoveTimer(lookup.delay_timer);
+		}
+		HostCache::Result res;
+		if (lookup.has_v6 && !lookup.v6.error) {
+			res.addrs.insert(res.addrs.end(), lookup.v6.addrs.begin(), lookup.v6.addrs.end());
+		}
+		if (lookup.has_v4 && !lookup.v4.error) {
+			res.addrs.insert(res.addrs.end(), lookup.v4.addrs.begin(), lookup.v4.addrs.end());
+		}
+		if (res.addrs.empty()) {
+			bool negative = (lookup.has_v6 && HostCache::IsNegativeError(lookup.v6.error))
+				|| (lookup.has_v4 && HostCache::IsNegativeError(lookup.v4.error));
+			res.error = negative ? EAI_NONAME : EAI_AGAIN;
+		}
+		for (auto& waiter : lookup.waiters)
+		{
+			Done(res, waiter.hints, waiter.port, waiter.cb);
+		}
+	}
+
+	//取消所有查询，等待者以error回调
+	inline void CancelAll(int error)
+	{
+		for (auto& it : queries_)
+		{
+			if (it.second.timer && resolve_svr_) {
+				resolve_svr_->RemoveTimer(it.second.timer);
+			}
+		}
+		queries_.clear();
+		std::unordered_map<std::string, Lookup> lookups;
+		lookups.swap(lookups_);
+		HostCache::Result res;
+		res.error = error;
+		for (auto& it : lookups)
+		{
+			if (it.second.delay_timer && resolve_svr_) {
+				resolve_svr_->RemoveTimer(it.second.delay_timer);
+			}
+			for (auto& waiter : it.second.waiters)
+			{
+				Done(res, waiter.hints, waiter.port, waiter.cb);
+			}
+		}
+	}
+
+	virtual void OnAttachService(Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+		resolve_svr_ = pSvr;
+	}
+
+	virtual void OnDetachService(Service* pSvr)
+	{
+		CancelAll(EAI_AGAIN);
+		resolve_svr_ = nullptr;
+		Base::OnDetachService(pSvr);
+	}
+};
+
 }
 
 #endif//_H_XDNS_IMPL_H_
\ No newline at end of file
@@ -80,6 +80,59 @@ public:
 			Base::Trigger(FD_ACCEPT, 0);
 		}
 	}
+
+	inline void SelectWait(int lEvent) {
+		//只登记到epoll，EPOLL_CTL_MOD会检查当前就绪状态，登记前已经可写也不会丢通知
+		int lAsyncEvent = 0;
+		if(!Base::IsSelect(FD_READ) && (lEvent & FD_READ)) {
+			lAsyncEvent |= FD_READ;
+		}
+		if(!Base::IsSelect(FD_WRITE) && (lEvent & FD_WRITE)) {
+			lAsyncEvent |= FD_WRITE;
+		}
+		Base::Select(lEvent);
+		SocketSet* svr = service();
+		if(lAsyncEvent && svr) {
+			svr->SelectSocket(this,lAsyncEvent);
+		}
+	}
+
+	inline bool PostFlush() {
+		SocketSet* svr = service();
+		return svr && svr->PostFlush(this);
+	}
+
+	inline bool ReadBudgetExceeded(size_t nReadBytes, size_t nReads) {
+		SocketSet* svr = service();
+		if(!svr) {
+			return false;
+		}
+		size_t nBudgetBytes = 0, nBudgetReads = 0;
+		svr->GetReadBudget(nBudgetBytes, nBudgetReads);
+		return ((nBudgetBytes && nReadBytes >= nBudgetBytes) || (nBudgetReads && nReads >= nBudgetReads))
+			&& svr->PostReadable(this);
+	}
+
+	inline void RearmSelect() {
+		//EPOLL_CTL_MOD会重新检查就绪状态，ET下用来让没处理完的事件在下一轮epoll_wait再次通知
+		SocketSet* svr = service();
+		if(svr && Base::IsSocket()) {
+			svr->SelectSocket(this,0);
+		}
+	}
+
+	inline void RemoveSelect(int lEvent) {
+		//发送完成后取消EPOLLOUT，避免可写事件空转；暂停读时取消EPOLLIN
+		bool bWrite = (lEvent & FD_WRITE) && Base::IsSelect(FD_WRITE);
+		bool bRead = (lEvent & FD_READ) && Base::IsSelect(FD_READ);
+		Base::RemoveSelect(lEvent);
+		if((bWrite || bRead) && Base::IsSocket()) {
+			SocketSet* svr = service();
+			if(svr) {
+				svr->SelectSocket(this,FD_WRITE);
+			}
+		}
+	}
 };
 
 /*!
@@ -94,8 +147,25 @@ class EPollServiceT : public TService
 protected:
 	int epfd_ = 0;
 	int evfd_ = 0;
-	int evfd_pair_[2] = {0};
+	MPSCQueue<void*> notify_datas_; //PostNotify(void*)的数据，和通知共用eventfd唤醒
 	int timerfd_ = -1;
+	size_t busy_poll_us_ = 0; //忙轮询最大预算（微秒），0表示不忙轮询
+	size_t busy_poll_budget_ = 0; //当前自适应忙轮询预算（微秒）
+	int busy_poll_sock_us_ = 0; //Socket的SO_BUSY_POLL（微秒），0表示不设置
+	bool busy_poll_prefer_ = false; //Socket是否设置SO_PREFER_BUSY_POLL
+	std::atomic<uint64_t> busy_spin_us_{0};
+	std::atomic<uint64_t> busy_block_us_{0};
+	std::atomic<uint64_t> busy_spin_hits_{0};
+	std::atomic<uint64_t> busy_block_hits_{0};
+public:
+	//忙轮询统计
+	struct BusyPollStat
+	{
+		uint64_t spin_us; //忙轮询耗时（微秒）
+		uint64_t block_us; //阻塞等待耗时（微秒）
+		uint64_t spin_hits; //忙轮询取到事件次数
+		uint64_t block_hits; //阻塞等待取到事件次数
+	};
 public:
 	EPollServiceT()
 	{
@@ -106,29 +176,16 @@ public:
         		PRINTF("create event fd failed, errno(%d): %s\n", errno, strerror(errno));
 			} else {
 				struct epoll_event event = {0};
-				event.data.ptr = nullptr;
-				event.data.fd = evfd_;
+				event.data.u64 = evfd_; //内部描述符代数为0，不会和Socket槽位标签冲突
 				event.events = EPOLLIN | EPOLLERR;
 				epoll_ctl(epfd_, EPOLL_CTL_ADD, evfd_, &event);
 			}
-			//if(socketpair(AF_UNIX, SOCK_STREAM, 0, evfd_pair_) == -1) { //OK
-			if(pipe(evfd_pair_) == -1) { //OK
-			//if(Socket::CreatePair(AF_UNIX, SOCK_STREAM, 0, evfd_pair_) == -1) { //OK
-        		PRINTF("create fd pair failed, errno(%d): %s\n", errno, strerror(errno));
-    		} else {
-				struct epoll_event event = {0};
-				event.data.ptr = nullptr;
-				event.data.fd = evfd_pair_[0];
-				event.events = EPOLLIN | EPOLLERR;
-				epoll_ctl(epfd_, EPOLL_CTL_ADD, evfd_pair_[0], &event);
-			}
 			timerfd_ = timerfd_create(CLOCK_REALTIME, O_NONBLOCK);
 			if(timerfd_ == -1) {
 				PRINTF("timerfd_create failed, errno(%d): %s\n", errno, strerror(errno));
 			} else {
 				struct epoll_event event = {0};
-				event.data.ptr = nullptr;
-				event.data.fd = timerfd_;
+				event.data.u64 = timerfd_;
 				event.events = EPOLLIN | EPOLLERR | EPOLLET;
 				epoll_ctl(epfd_, EPOLL_CTL_ADD, timerfd_, &event);
 			}
@@ -142,13 +199,6 @@ public:
 				close(timerfd_);
 				timerfd_ = 0;
 			}
-			if(evfd_pair_[0]) {
-				epoll_ctl(epfd_, EPOLL_CTL_DEL, evfd_pair_[0], nullptr);
-				close(evfd_pair_[0]);
-				close(evfd_pair_[1]);
-				evfd_pair_[0] = 0;
-				evfd_pair_[1] = 0;
-			}
 			if(evfd_) {
 				epoll_ctl(epfd_, EPOLL_CTL_DEL, evfd_, nullptr);
 				close(evfd_);
@@ -162,13 +212,17 @@ public:
 	inline void PostNotify()
 	{
 		Base::PostNotify();
-		const size_t data = 1;
-		write(evfd_, &data, sizeof(data));
+		//只有服务线程阻塞在epoll_wait里才写eventfd
+		if(Base::IsNeedWakeUp()) {
+			const size_t data = 1;
+			write(evfd_, &data, sizeof(data));
+		}
 	}
 
 	inline void PostNotify(void* data)
 	{
-		write(evfd_pair_[1], &data, sizeof(data));
+		notify_datas_.Push(std::move(data));
+		PostNotify();
 	}
 
 	inline void PostTimer(size_t millis)
@@ -200,8 +254,82 @@ public:
 		timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &new_value, NULL);
 	}
 
+	/*!
+	 *	@brief 设置忙轮询模式，需要在Start之前设置.
+	 *
+	 *	OnWait先以0超时epoll_wait忙轮询最多spin_us微秒，没有事件再阻塞等待；
+	 *	预算内连续空转时预算自动减半，轮询命中时恢复，spin_us为0表示关闭。
+	 *	@param spin_us 忙轮询最大预算（微秒）
+	 *	@param sock_busy_poll_us 新加入Socket的SO_BUSY_POLL（微秒），0表示不设置
+	 *	@param prefer 新加入Socket是否设置SO_PREFER_BUSY_POLL
+	 */
+	inline void SetBusyPoll(size_t spin_us, int sock_busy_poll_us = 0, bool prefer = false)
+	{
+		busy_poll_us_ = spin_us;
+		busy_poll_budget_ = spin_us;
+		busy_poll_sock_us_ = sock_busy_poll_us;
+		busy_poll_prefer_ = prefer;
+		Base::busy_flag_ = spin_us ? 1 : 0;
+	}
+	inline size_t GetBusyPoll() { return busy_poll_us_; }
+
+	inline BusyPollStat GetBusyPollStat()
+	{
+		BusyPollStat stat;
+		stat.spin_us = busy_spin_us_.load(std::memory_order_relaxed);
+		stat.block_us = busy_block_us_.load(std::memory_order_relaxed);
+		stat.spin_hits = busy_spin_hits_.load(std::memory_order_relaxed);
+		stat.block_hits = busy_block_hits_.load(std::memory_order_relaxed);
+		return stat;
+	}
+
 protected:
 	//
+	inline void SetBusyPollSockOpt(SOCKET fd)
+	{
+		if(busy_poll_sock_us_ > 0) {
+			//超过net.core.busy_poll需要CAP_NET_ADMIN权限，失败不影响使用
+			setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_sock_us_, sizeof(busy_poll_sock_us_));
+		}
+		if(busy_poll_prefer_) {
+			int prefer = 1;
+			setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+		}
+	}
+
+	inline int BusyPollWait(struct epoll_event* events, int maxevents)
+	{
+		std::chrono::steady_clock::time_point tp = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point tp_spin = tp + std::chrono::microseconds(busy_poll_budget_);
+		std::chrono::steady_clock::time_point now = tp;
+		int nfds = 0;
+		do {
+			nfds = epoll_wait(epfd_, events, maxevents, 0);
+			now = std::chrono::steady_clock::now();
+		} while (nfds == 0 && now < tp_spin && !Base::notify_flag_ && !Base::IsStopFlag());
+		busy_spin_us_.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(now - tp).count(), std::memory_order_relaxed);
+		if (nfds != 0) {
+			if (nfds > 0) {
+				busy_spin_hits_.fetch_add(1, std::memory_order_relaxed);
+				//轮询命中，恢复预算
+				busy_poll_budget_ = std::min(busy_poll_budget_ * 2, busy_poll_us_);
+			}
+			return nfds;
+		}
+		//预算内空转，减半预算，最少保留1/16
+		busy_poll_budget_ = std::max(busy_poll_budget_ / 2, std::max<size_t>(busy_poll_us_ / 16, 1));
+		size_t timeout = Base::BeginWaiting();
+		if (timeout) {
+			nfds = epoll_wait(epfd_, events, maxevents, timeout);
+			Base::EndWaiting();
+			busy_block_us_.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count(), std::memory_order_relaxed);
+			if (nfds > 0) {
+				busy_block_hits_.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		return nfds;
+	}
+
 	virtual void OnNotifyData(void* data)
 	{
 		//PRINTF("OnNotifyData %p", data);
@@ -216,25 +344,28 @@ protected:
 	{
 		struct epoll_event events[1024] = {0};
 		//Specifying a timeout of -1 makes epoll_wait wait indefinitely, while specifying a timeout equal to zero makes epoll_wait to return immediately even if no events are available (return code equal to zero).
-		int nfds = epoll_wait(epfd_, events, 1024, Base::GetWaitingTimeOut());
+		int nfds = 0;
+		if (busy_poll_us_ && !Base::notify_flag_) {
+			nfds = BusyPollWait(events, 1024);
+		} else {
+			nfds = epoll_wait(epfd_, events, 1024, Base::BeginWaiting());
+			Base::EndWaiting();
+		}
 		if (nfds > 0) {
 			for (int i = 0; i < nfds; ++i)
 			{
 				const struct epoll_event& event = events[i];
-				if(evfd_ == event.data.fd) {
+				if((uint64_t)evfd_ == event.data.u64) {
 					size_t data = 0;
-					if(sizeof(size_t) == read(event.data.fd, &data, sizeof(data))) {
+					if(sizeof(size_t) == read(evfd_, &data, sizeof(data))) {
 						//PRINTF("OnNotify %u", data);
-						OnNotify();
+						if(Base::notify_flag_.exchange(false)) {
+							this->OnNotify();
+						}
 					}
-				} else if(evfd_pair_[0] == event.data.fd) {
-					void* data = 0;
-					if(sizeof(void*) == read(event.data.fd, &data, sizeof(data))) {
-						OnNotifyData(data);
-					}
-				} else if(timerfd_ == event.data.fd) {
+				} else if((uint64_t)timerfd_ == event.data.u64) {
 					uint64_t data = 0;
-					if(sizeof(uint64_t) == read(event.data.fd, &data, sizeof(data))) {
+					if(sizeof(uint64_t) == read(timerfd_, &data, sizeof(data))) {
 						//PRINTF("OnTimer %u", data);
 						OnTimer();
 					}
@@ -245,6 +376,11 @@ protected:
 		} else {
 			//
 		}
+		void* data = nullptr;
+		while(notify_datas_.Pop(data))
+		{
+			OnNotifyData(data);
+		}
 	}
 };
 
@@ -262,6 +398,25 @@ class EPollSocketSetT : public SocketSetT<TService,TSocket>
 public:
 	typedef TService Service;
 	typedef TSocket Socket;
+protected:
+	bool auto_cork_ = false; //自动合并发送
+	bool auto_cork_tcp_ = false; //合并发送时是否用TCP_CORK包住
+	bool flushing_ = false; //正在合并发送
+	std::vector<uint64_t> flush_tags_; //等待合并发送的Socket槽位标签
+	size_t read_budget_bytes_ = 0; //每个Socket每次读事件最多读取的字节数，0表示不限制
+	size_t read_budget_reads_ = 0; //每个Socket每次读事件最多读取的次数，0表示不限制
+	std::vector<uint64_t> readable_tags_; //读预算用完还可读的Socket槽位标签
+	std::vector<uint64_t> readable_serving_;
+	std::atomic<uint64_t> read_budget_hits_{0};
+	std::atomic<uint64_t> readable_rounds_{0};
+	std::atomic<uint64_t> readable_max_{0};
+public:
+	struct ReadBudgetStat
+	{
+		uint64_t hits; //读预算用完的次数
+		uint64_t rounds; //处理还可读列表的轮数
+		uint64_t max_pending; //单轮还可读列表的最大长度
+	};
 public:
 	EPollSocketSetT(int nMaxSocketCount):Base(nMaxSocketCount)
 	{
@@ -270,11 +425,78 @@ public:
 	{
 	}
 
+	/*!
+	 *	@brief 设置自动合并发送(auto-cork)，需要在Start之前设置.
+	 *
+	 *	服务线程上的SendBuf不再立即发送，只登记Socket，本轮事件分发结束后(阻塞等待前)
+	 *	每个Socket一次聚集发送本轮写入的所有缓存，多个小包合成一个系统调用和尽量少的报文。
+	 *	@param enable 是否开启
+	 *	@param tcp_cork 合并发送时是否用TCP_CORK包住，发送跨多个系统调用(如SSL)时也只出满报文
+	 */
+	inline void SetAutoCork(bool enable, bool tcp_cork = false)
+	{
+		auto_cork_ = enable;
+		auto_cork_tcp_ = tcp_cork;
+	}
+	inline bool IsAutoCork() { return auto_cork_; }
+
+	//登记合并发送，只有服务线程上本SocketSet的Socket才能登记，合并发送过程中不再登记
+	inline bool PostFlush(SocketEx* sock_ptr)
+	{
+		if (!auto_cork_ || flushing_ || !Base::FindSocket(sock_ptr)) {
+			return false;
+		}
+		flush_tags_.push_back(sock_ptr->SlotTag());
+		return true;
+	}
+
+	/*!
+	 *	@brief 设置读预算，需要在Start之前设置.
+	 *
+	 *	每个Socket每次读事件最多读取bytes字节或者reads次，用完后剩余数据留到本轮其他就绪事件之后再读，
+	 *	避免一个大流量连接独占服务线程，拉高同一SocketSet里其他连接的延迟。
+	 *	@param bytes 最多读取的字节数，0表示不限制
+	 *	@param reads 最多读取的次数，0表示不限制
+	 */
+	inline void SetReadBudget(size_t bytes, size_t reads = 0)
+	{
+		read_budget_bytes_ = bytes;
+		read_budget_reads_ = reads;
+	}
+	inline void GetReadBudget(size_t& bytes, size_t& reads)
+	{
+		bytes = read_budget_bytes_;
+		reads = read_budget_reads_;
+	}
+
+	inline ReadBudgetStat GetReadBudgetStat()
+	{
+		ReadBudgetStat stat;
+		stat.hits = read_budget_hits_.load(std::memory_order_relaxed);
+		stat.rounds = readable_rounds_.load(std::memory_order_relaxed);
+		stat.max_pending = readable_max_.load(std::memory_order_relaxed);
+		return stat;
+	}
+
+	//登记还可读，只有服务线程上本SocketSet的Socket才能登记
+	inline bool PostReadable(SocketEx* sock_ptr)
+	{
+		if (!Base::FindSocket(sock_ptr)) {
+			return false;
+		}
+		read_budget_hits_.fetch_add(1, std::memory_order_relaxed);
+#if USE_EPOLLET
+		readable_tags_.push_back(sock_ptr->SlotTag());
+#endif//
+		//LT下剩余数据下一轮epoll_wait会再次通知，不需要登记
+		return true;
+	}
+
 	void SelectSocket(SocketEx* sock_ptr, int evt) {
 		//Base::SelectSocket(sock_ptr, evt);
 		int fd = *sock_ptr;
 		struct epoll_event event = {0};
-		event.data.ptr = (void*)sock_ptr;
+		event.data.u64 = sock_ptr->SlotTag();
 		event.events = 0 
 		| EPOLLRDHUP
 						
@@ -292,61 +514,57 @@ public:
 		if (sock_ptr->IsSelect(FD_WRITE|FD_CONNECT)) {
 			event.events |= EPOLLOUT;
 		}
-		epoll_ctl(Base::epfd_,EPOLL_CTL_MOD,fd,&event);
+		if (SOCKET_ERROR == epoll_ctl(Base::epfd_,EPOLL_CTL_MOD,fd,&event)) {
+			//套接字句柄被替换(如Happy Eyeballs胜出的连接)，新句柄还没有注册
+			if (XSocket::Socket::GetLastError() == ENOENT) {
+				epoll_ctl(Base::epfd_,EPOLL_CTL_ADD,fd,&event);
+			}
+		}
 	}
 	
 	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
 	{
 		std::unique_lock<std::mutex> lock(Base::mutex_);
-		int i, j = sock_ptrs_.size();
-		for (i = 0; i < j; i++)
-		{
-			if(Base::sock_ptrs_[i]==NULL) {
-				if (sock_ptr) {
-					Base::sock_count_++;
-					Base::sock_ptrs_[i] = sock_ptr;
-					sock_ptr->AttachService(this);
-					sock_ptr->SocketEx::Select(evt);
-					int fd = *sock_ptr;
-					struct epoll_event event = {0};
-					event.data.ptr = (void *)sock_ptr.get();
-					//LT(默认)，LT+EPOLLONESHOT最可靠
-					//ET，EPOLLET最高效,ET+EPOLLONESHOT高效可靠
-					event.events = 0 
-					//| EPOLLIN //表示对应的文件描述符可以读（包括对端SOCKET正常关闭）；
-					//| EPOLLPRI //表示对应的文件描述符有紧急的数据可读（这里应该表示有带外数据到来）；
-					//| EPOLLOUT //表示对应的文件描述符可以写；
-					| EPOLLRDHUP //Stream socket peer closed connection, or shut down writing  half of connection.
-					//| EPOLLERR //表示对应的文件描述符发生错误；不用注册，会自动触发
-					//| EPOLLHUP //表示对应的文件描述符被挂断；不用注册，会自动触发
-	#if USE_EPOLLET
-					| EPOLLET //将EPOLL设为边缘触发(Edge Triggered)模式，这是相对于水平触发(LevelTriggered)来说的；
-	#endif
-					//| EPOLLONESHOT //只监听一次事件，当监听完这次事件之后，如果还需要继续监听这个socket的话，需要再次把这个socket加入到EPOLL队列里
-					;
-					if (sock_ptr->IsSelect(FD_READ|FD_ACCEPT)) {
-						event.events |= EPOLLIN;
-					}
-					if (sock_ptr->IsSelect(FD_OOB)) {
-						event.events |= EPOLLPRI;
-					}
-					if (sock_ptr->IsSelect(FD_WRITE|FD_CONNECT)) {
-						event.events |= EPOLLOUT;
-					}
-					if (SOCKET_ERROR != epoll_ctl(Base::epfd_, EPOLL_CTL_ADD, fd, &event)) {
-						//return i;
-					} else {
-						PRINTF("epoll_ctl err:%d", XSocket::Socket::GetLastError());
-					}
-					return i;
-				} else {
-					//测试可不可以增加Socket，返回true表示可以增加
-					return i;
-				}
-				break;
-			}
+		if (!sock_ptr || Base::sock_free_ < 0) {
+			//测试可不可以增加Socket，返回>=0表示可以增加
+			return Base::sock_free_;
 		}
-		return -1;
+		sock_ptr->AttachService(this);
+		sock_ptr->SocketEx::Select(evt);
+		int i = Base::AllocSlot(sock_ptr);
+		int fd = *sock_ptr;
+		struct epoll_event event = {};
+		event.data.u64 = sock_ptr->SlotTag();
+		//LT(默认)，LT+EPOLLONESHOT最可靠
+		//ET，EPOLLET最高效,ET+EPOLLONESHOT高效可靠
+		event.events = 0 
+		//| EPOLLIN //表示对应的文件描述符可以读（包括对端SOCKET正常关闭）；
+		//| EPOLLPRI //表示对应的文件描述符有紧急的数据可读（这里应该表示有带外数据到来）；
+		//| EPOLLOUT //表示对应的文件描述符可以写；
+		| EPOLLRDHUP //Stream socket peer closed connection, or shut down writing  half of connection.
+		//| EPOLLERR //表示对应的文件描述符发生错误；不用注册，会自动触发
+		//| EPOLLHUP //表示对应的文件描述符被挂断；不用注册，会自动触发
+#if USE_EPOLLET
+		| EPOLLET //将EPOLL设为边缘触发(Edge Triggered)模式，这是相对于水平触发(LevelTriggered)来说的；
+#endif
+		//| EPOLLONESHOT //只监听一次事件，当监听完这次事件之后，如果还需要继续监听这个socket的话，需要再次把这个socket加入到EPOLL队列里
+		;
+		if (sock_ptr->IsSelect(FD_READ|FD_ACCEPT)) {
+			event.events |= EPOLLIN;
+		}
+		if (sock_ptr->IsSelect(FD_OOB)) {
+			event.events |= EPOLLPRI;
+		}
+		if (sock_ptr->IsSelect(FD_WRITE|FD_CONNECT)) {
+			event.events |= EPOLLOUT;
+		}
+		Base::SetBusyPollSockOpt(fd);
+		if (SOCKET_ERROR != epoll_ctl(Base::epfd_, EPOLL_CTL_ADD, fd, &event)) {
+			//return i;
+		} else {
+			PRINTF("epoll_ctl err:%d", XSocket::Socket::GetLastError());
+		}
+		return i;
 	}
 	template<class Ty = Socket>
 	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
@@ -363,30 +581,147 @@ public:
 
 	int RemoveSocket(std::shared_ptr<Socket> sock_ptr)
 	{
-		//std::unique_lock<std::mutex> lock(Base::mutex_);
-		int i, j = sock_ptrs_.size();
-		for (i = 0; i < j; i++)
-		{
-			if(Base::sock_ptrs_[i]==sock_ptr) {
-				if (sock_ptr->IsSocket()) {
-					int fd = *sock_ptr;
-					struct epoll_event event = {0};
-					event.data.ptr = (void *)sock_ptr.get();
-					epoll_ctl(Base::epfd_, EPOLL_CTL_DEL, fd, &event);
-				}
-				return Base::RemoveSocketByPos(i);
+		ASSERT(sock_ptr);
+		int i = Base::SockTagPos(sock_ptr->SlotTag());
+		if (Base::FindSocket(sock_ptr->SlotTag()) != sock_ptr) {
+			return -1;
+		}
+		if (sock_ptr->IsSocket()) {
+			int fd = *sock_ptr;
+			struct epoll_event event = {};
+			event.data.u64 = sock_ptr->SlotTag();
+			epoll_ctl(Base::epfd_, EPOLL_CTL_DEL, fd, &event);
+		}
+		return Base::RemoveSocketByPos(i, sock_ptr.get());
+	}
+
+	/*!
+	 *	@brief 迁移Socket到另一个SocketSet，用于运行时把热点连接挪到空闲的服务线程.
+	 *
+	 *	可以在任意线程调用：先通过本服务的任务队列在本服务线程注销(之前投递的任务先执行完)，
+	 *	登记了合并发送的先发出去，再通过目标的任务队列在目标服务线程注册；
+	 *	注册时epoll重新检查就绪状态，迁移期间到达的数据不会丢失；
+	 *	目标满了退回本服务，cb在最终所在服务线程回调，参数是AddSocket的结果(小于0表示失败)和是否退回了本服务.
+	 *	通过Socket投递的任务(BasicSocketT::PostOwned、TaskSocketT::Post/Send)按Socket归属转发到目标服务线程执行，
+	 *	Socket自己的超时/关闭定时器由OnDetachService/OnAttachService重新挂到目标服务；
+	 *	直接投递到本服务的任务不知道属于哪个Socket，不会转发
+	 */
+	void MigrateSocket(std::shared_ptr<Socket> sock_ptr, EPollSocketSetT* target, std::function<void(int,bool)> cb = nullptr)
+	{
+		if (!sock_ptr || !target || target == this) {
+			if (cb) {
+				cb(-1, false);
 			}
+			return;
 		}
-		return -1;
+		Base::Post([this, sock_ptr, target, cb]() {
+			if (Base::FindSocket(sock_ptr.get()) != sock_ptr || !sock_ptr->IsSocket()) {
+				if (cb) {
+					cb(-1, false);
+				}
+				return;
+			}
+			if (std::find(flush_tags_.begin(), flush_tags_.end(), sock_ptr->SlotTag()) != flush_tags_.end()) {
+				bool flushing = flushing_;
+				flushing_ = true;
+				sock_ptr->Trigger(FD_WRITE, 0);
+				flushing_ = flushing;
+			}
+			if (RemoveSocket(sock_ptr) < 0) {
+				if (cb) {
+					cb(-1, false);
+				}
+				return;
+			}
+			target->Post([this, sock_ptr, target, cb]() {
+				int result = target->AddSocket(sock_ptr);
+				if (result >= 0) {
+					if (cb) {
+						cb(result, false);
+					}
+					return;
+				}
+				//目标满了，退回原来的服务
+				Base::Post([this, sock_ptr, cb]() {
+					int result = AddSocket(sock_ptr);
+					if (result < 0) {
+						sock_ptr->Trigger(FD_CLOSE, 0);
+					}
+					if (cb) {
+						cb(result, true);
+					}
+				});
+			});
+		});
 	}
 
 protected:
 	//
+	inline void FlushSockets()
+	{
+		if (flush_tags_.empty()) {
+			return;
+		}
+		flushing_ = true;
+		for (size_t i = 0; i < flush_tags_.size(); i++)
+		{
+			std::shared_ptr<Socket> sock_ptr = Base::FindSocket(flush_tags_[i]);
+			if (!sock_ptr || !sock_ptr->IsSocket()) {
+				continue;
+			}
+			if (auto_cork_tcp_) {
+				sock_ptr->SetSockOpt(IPPROTO_TCP, TCP_CORK, 1);
+			}
+			sock_ptr->Trigger(FD_WRITE, 0);
+			if (auto_cork_tcp_ && sock_ptr->IsSocket()) {
+				sock_ptr->SetSockOpt(IPPROTO_TCP, TCP_CORK, 0);
+			}
+		}
+		flush_tags_.clear();
+		flushing_ = false;
+	}
+
+	//继续读上一轮读预算用完的Socket，这一轮又用完的留到下一轮
+	inline void ServeReadable()
+	{
+		if (readable_tags_.empty()) {
+			return;
+		}
+		readable_serving_.swap(readable_tags_);
+		//同一个Socket可能登记多次
+		std::sort(readable_serving_.begin(), readable_serving_.end());
+		readable_serving_.erase(std::unique(readable_serving_.begin(), readable_serving_.end()), readable_serving_.end());
+		readable_rounds_.fetch_add(1, std::memory_order_relaxed);
+		if (readable_serving_.size() > readable_max_.load(std::memory_order_relaxed)) {
+			readable_max_.store(readable_serving_.size(), std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < readable_serving_.size(); i++)
+		{
+			std::shared_ptr<Socket> sock_ptr = Base::FindSocket(readable_serving_[i]);
+			if (!sock_ptr || !sock_ptr->IsSocket() || !sock_ptr->IsSelect(FD_READ)) {
+				continue;
+			}
+			sock_ptr->Trigger(FD_READ, 0);
+		}
+		readable_serving_.clear();
+	}
+
+	virtual void OnWait()
+	{
+		//任务/定时器里登记的先发送，不要带着未发送数据阻塞等待
+		FlushSockets();
+		Base::OnWait();
+		ServeReadable();
+		FlushSockets();
+		if (!readable_tags_.empty()) {
+			//还有可读的Socket，下一轮不要阻塞等待
+			Base::PostNotify();
+		}
+	}
+
 	virtual void OnEPollEvent(const epoll_event& event)
 	{
-		std::unique_lock<std::mutex> lock(Base::mutex_);
-		std::shared_ptr<Socket> sock_ptr = Base::FindSocket((Socket *)event.data.ptr);
-		lock.unlock();
+		std::shared_ptr<Socket> sock_ptr = Base::FindSocket(event.data.u64);
 		if (!sock_ptr) {
 			return;
 		}
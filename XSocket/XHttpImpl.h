@@ -1002,6 +1002,8 @@ namespace XSocket {
 		typedef typename HttpBuffer::Message Message;
 		HttpBuffer http_buffer_;
 		std::chrono::steady_clock::time_point close_if_time_point_; //等到时间点到达也关闭连接
+		Service* close_svr_ = nullptr; //超时关闭定时器所在服务
+		Service::TimerID close_timer_ = 0; //超时关闭定时器
 	public:
 		HttpSocketT(http_parser_type type = HTTP_BOTH):Base(),http_buffer_(this,type)
 		{
@@ -1031,12 +1033,44 @@ namespace XSocket {
 			Base::SendBufDirect();
 		}
 
+		//包体零拷贝发送，rsp只带头部，Content-Length取body长度
+		template<class TRequest>
+		inline void SendHttpResponse(TRequest&& req, HttpResponse& rsp, const IOBuf& body)
+		{
+			ASSERT(!rsp.size());
+			bool need_body = HttpBuffer::is_response_needs_body(req, rsp);
+			if (need_body && !rsp.is_chunked()) {
+				rsp.set_field("Content-Length", tostr(body.size()));
+			}
+			http_buffer_.BuildRspBuf(Base::SendBuf(), std::forward<TRequest>(req), rsp);
+			if (need_body && !body.empty()) {
+				Base::SendBuf(body);
+			} else {
+				Base::SendBufDirect();
+			}
+		}
+
 		inline void SendHttpChunk(const char* lpBuf, int nBufLen)
 		{
 			http_buffer_.BuildChunkBuf(Base::SendBuf(), lpBuf, nBufLen);
 			Base::SendBufDirect();
 		}
 
+		//分块包体零拷贝发送
+		inline void SendHttpChunk(const IOBuf& body)
+		{
+			if (body.empty()) {
+				SendHttpChunk(nullptr, 0);
+				return;
+			}
+			char head[32];
+			int head_len = sprintf(head, "%x\r\n", (unsigned)body.size());
+			Base::SendBuf().append(head, head_len);
+			Base::SendBuf(body);
+			Base::SendBuf().append("\r\n", 2);
+			Base::SendBufDirect();
+		}
+
 #if USE_WEBSOCKET
 		//升级websocket
 		void SendWSUpgrade(const char* host, const char* path = "/")
@@ -1060,7 +1094,7 @@ namespace XSocket {
 			//base64_key[base64_len] = 0;
 			en64((const byte*)buf, (byte*)base64_key, buflen);
 #endif
-			SendBuffer& send_buf = Base::SendBuf();int send_len = send_buf.size();
+			typename Base::SendBuffer& send_buf = Base::SendBuf();int send_len = send_buf.size();
 			send_buf.resize(send_len + 1024);
 			std::ostrstream ss(&send_buf[send_len], 1024);
 			ss << "GET " << path << " HTTP/1.1\r\n"
@@ -1100,7 +1134,7 @@ namespace XSocket {
 			//buf[buflen] = 0;
 			en64((const byte*)hash_key.bytes, (byte*)buf, SHA1_HASH_SIZE);
 #endif
-			SendBuffer& send_buf = Base::SendBuf();int send_len = send_buf.size();
+			typename Base::SendBuffer& send_buf = Base::SendBuf();int send_len = send_buf.size();
 			send_buf.resize(send_len + 1024);
 			std::ostrstream ss(&send_buf[send_len], 1024);
 			ss << "HTTP/1.1 101 Switching Protocols\r\n"
@@ -1121,12 +1155,35 @@ namespace XSocket {
 		inline void StopCloseIfTimeOut() 
 		{
 			close_if_time_point_ = std::chrono::steady_clock::time_point();
+			if(close_timer_) {
+				if(close_svr_) {
+					close_svr_->RemoveTimer(close_timer_);
+				}
+				close_timer_ = 0;
+			}
 		}
 
 		inline void SetCloseIfTimeOut(size_t millis)
 		{
 			close_if_time_point_ = (std::chrono::steady_clock::now() + std::chrono::milliseconds(millis));
-			Select(FD_IDLE);
+			//还没挂到服务上时，等OnAttachService再设置定时器
+			SetCloseTimer(millis);
+		}
+
+		//超时关闭挂在服务时间轮上，重设超时是O(1)的
+		inline void SetCloseTimer(size_t millis)
+		{
+			if(!close_svr_) {
+				return;
+			}
+			if(!close_timer_ || !close_svr_->ResetTimer(close_timer_, millis)) {
+				close_timer_ = close_svr_->AddTimer(millis, [this]() {
+					close_timer_ = 0;
+					if(IsCloseIfTimeOut()) {
+						DoClose();
+					}
+				});
+			}
 		}
 
 		inline int IsCloseIfTimeOut() {
@@ -1244,8 +1301,31 @@ namespace XSocket {
 			Base::SetLinger(0, 0); //保证数据发完，才关闭套接字
 		}
 
+		virtual void OnAttachService(Service* pSvr)
+		{
+			Base::OnAttachService(pSvr);
+			close_svr_ = pSvr;
+			if(IsCloseIfTimeOut()) {
+				auto span = std::chrono::duration_cast<std::chrono::milliseconds>(close_if_time_point_ - std::chrono::steady_clock::now()).count();
+				SetCloseTimer(span > 0 ? span : 0);
+			}
+		}
+
+		virtual void OnDetachService(Service* pSvr)
+		{
+			if(close_timer_) {
+				close_svr_->RemoveTimer(close_timer_);
+				close_timer_ = 0;
+			}
+			close_svr_ = nullptr;
+			Base::OnDetachService(pSvr);
+		}
+
 		virtual void OnIdle()
 		{
+			if(close_svr_) {
+				return;
+			}
 			auto isval = IsCloseIfTimeOut();
 			if(isval) {
 				if(isval == 1) {
@@ -1293,7 +1373,8 @@ namespace XSocket {
 
 		void PostHttpRequest(std::shared_ptr<RequestInfo> req)
 		{
-			this_service()->Post(std::bind(&This::SendHttpRequest, shared_from_this(), req));
+			auto self = this->shared_from_this();
+			this->PostOwned([self, req]() { self->This::SendHttpRequest(req); });
 		}
 
 		void SendHttpRequest(std::shared_ptr<RequestInfo> req)
@@ -1610,12 +1691,14 @@ namespace XSocket {
 
 		inline void PostHttpResponse(std::shared_ptr<HttpResponse> rsp)
 		{
-			this_service()->Post(std::bind((void (This::*)(std::shared_ptr<HttpResponse>))&This::SendHttpResponse, shared_from_this(), rsp));
+			auto self = this->shared_from_this();
+			this->PostOwned([self, rsp]() { self->This::SendHttpResponse(rsp); });
 		}
 
 		inline void PostHttpChunk(std::shared_ptr<std::string> rsp)
 		{
-			this_service()->Post(std::bind((void (This::*)(std::shared_ptr<std::string>))&This::SendHttpChunk, shared_from_this(), rsp));
+			auto self = this->shared_from_this();
+			this->PostOwned([self, rsp]() { self->This::SendHttpChunk(rsp); });
 		}
 
 		inline void SendHttpResponse(std::shared_ptr<HttpResponse> rsp)
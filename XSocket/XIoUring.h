@@ -0,0 +1,1118 @@
+/*
+ * Copyright: 7thTool Open Source <i7thTool@qq.com>
+ * All rights reserved.
+ *
+ * Author	: Scott
+ * Email	：i7thTool@qq.com
+ * Blog		: http://blog.csdn.net/zhangzq86
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _H_XIOURING_H_
+#define _H_XIOURING_H_
+
+#include "XSocketEx.h"
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+namespace XSocket {
+
+#ifndef IOURING_ENTRIES
+#define IOURING_ENTRIES 1024 //SQ大小，CQ是它的4倍
+#endif//
+#ifndef IOURING_BUF_COUNT
+#define IOURING_BUF_COUNT 1024 //provided buffer ring缓存个数，必须是2的幂
+#endif//
+#ifndef IOURING_BUF_SIZE
+#define IOURING_BUF_SIZE 4096 //provided buffer ring每个缓存大小
+#endif//
+#define IOURING_BUF_GROUP 0
+
+/*!
+ *	@brief io_uring 内部操作定义.
+ *
+ *	内部操作的user_data代数为0，不会和Socket槽位标签冲突
+ */
+enum
+{
+	IOURING_DATA_NONE = 0,
+	IOURING_DATA_NOTIFY,
+	IOURING_DATA_TIMER,
+	IOURING_DATA_WAIT,
+	IOURING_DATA_CANCEL,
+};
+
+/*!
+ *	@brief IoUring 定义.
+ *
+ *	封装io_uring系统调用（不依赖liburing），SQ的生产需要外部加锁，CQ只在服务线程消费
+ */
+class IoUring
+{
+protected:
+	int ring_fd_ = -1;
+	uint32_t features_ = 0;
+	uint32_t sq_entries_ = 0;
+	void* sq_ring_ = MAP_FAILED;
+	size_t sq_ring_len_ = 0;
+	void* cq_ring_ = MAP_FAILED;
+	size_t cq_ring_len_ = 0;
+	struct io_uring_sqe* sqes_ = (struct io_uring_sqe*)MAP_FAILED;
+	size_t sqes_len_ = 0;
+	unsigned* sq_head_ = nullptr;
+	unsigned* sq_tail_ = nullptr;
+	unsigned sq_mask_ = 0;
+	unsigned* cq_head_ = nullptr;
+	unsigned* cq_tail_ = nullptr;
+	unsigned cq_mask_ = 0;
+	struct io_uring_cqe* cqes_ = nullptr;
+public:
+	IoUring(unsigned entries = IOURING_ENTRIES)
+	{
+		struct io_uring_params params = {};
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = entries * 4;
+		ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+		if(ring_fd_ < 0) {
+			PRINTF("io_uring_setup failed, errno(%d): %s\n", errno, strerror(errno));
+			return;
+		}
+		features_ = params.features;
+		sq_entries_ = params.sq_entries;
+		sq_ring_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cq_ring_len_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if(features_ & IORING_FEAT_SINGLE_MMAP) {
+			sq_ring_len_ = cq_ring_len_ = std::max<>(sq_ring_len_, cq_ring_len_);
+		}
+		sq_ring_ = mmap(NULL, sq_ring_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+		if(sq_ring_ == MAP_FAILED) {
+			PRINTF("io_uring mmap sq failed, errno(%d): %s\n", errno, strerror(errno));
+			Close();
+			return;
+		}
+		if(features_ & IORING_FEAT_SINGLE_MMAP) {
+			cq_ring_ = sq_ring_;
+		} else {
+			cq_ring_ = mmap(NULL, cq_ring_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+			if(cq_ring_ == MAP_FAILED) {
+				PRINTF("io_uring mmap cq failed, errno(%d): %s\n", errno, strerror(errno));
+				Close();
+				return;
+			}
+		}
+		sqes_len_ = params.sq_entries * sizeof(struct io_uring_sqe);
+		sqes_ = (struct io_uring_sqe*)mmap(NULL, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+		if(sqes_ == MAP_FAILED) {
+			PRINTF("io_uring mmap sqes failed, errno(%d): %s\n", errno, strerror(errno));
+			Close();
+			return;
+		}
+		char* sq_ptr = (char*)sq_ring_;
+		sq_head_ = (unsigned*)(sq_ptr + params.sq_off.head);
+		sq_tail_ = (unsigned*)(sq_ptr + params.sq_off.tail);
+		sq_mask_ = *(unsigned*)(sq_ptr + params.sq_off.ring_mask);
+		//SQ索引数组固定一一对应，提交时只需移动tail
+		unsigned* sq_array = (unsigned*)(sq_ptr + params.sq_off.array);
+		for (unsigned i = 0; i < params.sq_entries; i++)
+		{
+			sq_array[i] = i;
+		}
+		char* cq_ptr = (char*)cq_ring_;
+		cq_head_ = (unsigned*)(cq_ptr + params.cq_off.head);
+		cq_tail_ = (unsigned*)(cq_ptr + params.cq_off.tail);
+		cq_mask_ = *(unsigned*)(cq_ptr + params.cq_off.ring_mask);
+		cqes_ = (struct io_uring_cqe*)(cq_ptr + params.cq_off.cqes);
+	}
+
+	~IoUring()
+	{
+		Close();
+	}
+
+	inline bool IsOpen() { return ring_fd_ >= 0; }
+	inline int fd() { return ring_fd_; }
+	inline uint32_t Features() { return features_; }
+
+	//取一个清零的SQE，填好后调用Commit，SQ满返回nullptr
+	inline struct io_uring_sqe* GetSqe()
+	{
+		if(!IsOpen()) {
+			return nullptr;
+		}
+		unsigned tail = *sq_tail_;
+		unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+		if(tail - head >= sq_entries_) {
+			return nullptr;
+		}
+		struct io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+	inline void Commit()
+	{
+		__atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+	}
+	//还没提交给内核的SQE数
+	inline unsigned SqPending()
+	{
+		if(!IsOpen()) {
+			return 0;
+		}
+		return __atomic_load_n(sq_tail_, __ATOMIC_ACQUIRE) - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+	}
+
+	inline int Enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg = nullptr, size_t argsz = 0)
+	{
+		return syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, arg, argsz);
+	}
+	inline int Submit()
+	{
+		return Enter(SqPending(), 0, 0);
+	}
+	//提交并等待至少一个CQE，最多等待millis毫秒
+	inline int SubmitAndWait(size_t millis)
+	{
+		struct __kernel_timespec ts = {};
+		ts.tv_sec = millis / 1000;
+		ts.tv_nsec = millis % 1000 * 1000 * 1000;
+		struct io_uring_getevents_arg arg = {};
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (uint64_t)&ts;
+		return Enter(SqPending(), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+
+	//批量取出CQE，返回取出个数
+	inline unsigned PeekCqes(struct io_uring_cqe* cqes, unsigned count)
+	{
+		if(!IsOpen()) {
+			return 0;
+		}
+		unsigned head = *cq_head_;
+		unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		unsigned n = 0;
+		for (; head != tail && n < count; head++, n++)
+		{
+			cqes[n] = cqes_[head & cq_mask_];
+		}
+		__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+		return n;
+	}
+
+	inline int Register(unsigned opcode, void* arg, unsigned nr_args)
+	{
+		return syscall(__NR_io_uring_register, ring_fd_, opcode, arg, nr_args);
+	}
+
+protected:
+	inline void Close()
+	{
+		if(sqes_ != MAP_FAILED) {
+			munmap(sqes_, sqes_len_);
+			sqes_ = (struct io_uring_sqe*)MAP_FAILED;
+		}
+		if(cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+			munmap(cq_ring_, cq_ring_len_);
+		}
+		cq_ring_ = MAP_FAILED;
+		if(sq_ring_ != MAP_FAILED) {
+			munmap(sq_ring_, sq_ring_len_);
+			sq_ring_ = MAP_FAILED;
+		}
+		if(ring_fd_ >= 0) {
+			close(ring_fd_);
+			ring_fd_ = -1;
+		}
+	}
+};
+
+/*!
+ *	@brief IoUringSocket 模板定义.
+ *
+ *	封装IoUringSocket，接收数据优先从SocketSet的provided buffer ring取，关闭时取消未完成的io_uring操作
+ */
+template<class TSocketSet, class TBase = SocketEx>
+class IoUringSocketT : public TBase
+{
+	typedef TBase Base;
+public:
+	typedef TSocketSet SocketSet;
+protected:
+	SocketSet* sockset_ = nullptr;
+public:
+	static SocketSet* service() { return dynamic_cast<SocketSet*>(SocketSet::service()); }
+
+	IoUringSocketT():Base()
+	{
+
+	}
+
+	virtual ~IoUringSocketT()
+	{
+
+	}
+
+	virtual int Close()
+	{
+		if(sockset_ && Base::IsSocket()) {
+			//先取消未完成的操作，否则内核持有文件引用，连接不会真正关闭
+			sockset_->CancelSocket(this);
+		}
+		return Base::Close();
+	}
+
+	inline int Receive(char* lpBuf, int nBufLen, int nFlags = 0)
+	{
+		int nRecvLen = 0;
+		if(!nFlags && sockset_ && sockset_->ReceiveBuf(this, lpBuf, nBufLen, nRecvLen)) {
+			return nRecvLen;
+		}
+		return Base::Receive(lpBuf, nBufLen, nFlags);
+	}
+
+	inline void Select(int lEvent) {
+		int lAsyncEvent = 0;
+		if(!Base::IsSelect(FD_READ) && (lEvent & FD_READ)) {
+			lAsyncEvent |= FD_READ;
+		}
+		if(!Base::IsSelect(FD_WRITE) && (lEvent & FD_WRITE)) {
+			lAsyncEvent |= FD_WRITE;
+		}
+		if(!Base::IsSelect(FD_ACCEPT) && (lEvent & FD_ACCEPT)) {
+			lAsyncEvent |= FD_ACCEPT;
+		}
+		if(!Base::IsSelect(FD_IDLE) && (lEvent & FD_IDLE)) {
+			lAsyncEvent |= FD_IDLE;
+		}
+		Base::Select(lEvent);
+		if(lAsyncEvent) {
+			SocketSet* sockset = sockset_ ? sockset_ : service();
+			if(sockset) {
+				sockset->SelectSocket(this,lAsyncEvent);
+			}
+		}
+		if(lAsyncEvent & FD_READ) {
+			Base::Trigger(FD_READ, 0);
+		}
+		if(lAsyncEvent & FD_WRITE) {
+			Base::Trigger(FD_WRITE, 0);
+		}
+		if(lAsyncEvent & FD_ACCEPT) {
+			Base::Trigger(FD_ACCEPT, 0);
+		}
+	}
+
+	inline void SelectWait(int lEvent) {
+		//只提交poll，就绪后再通知
+		int lAsyncEvent = 0;
+		if(!Base::IsSelect(FD_READ) && (lEvent & FD_READ)) {
+			lAsyncEvent |= FD_READ;
+		}
+		if(!Base::IsSelect(FD_WRITE) && (lEvent & FD_WRITE)) {
+			lAsyncEvent |= FD_WRITE;
+		}
+		Base::Select(lEvent);
+		if(lAsyncEvent) {
+			SocketSet* sockset = sockset_ ? sockset_ : service();
+			if(sockset) {
+				sockset->SelectSocket(this,lAsyncEvent);
+			}
+		}
+	}
+
+protected:
+	//
+	virtual void OnAttachService(Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+		sockset_ = dynamic_cast<SocketSet*>(pSvr);
+	}
+
+	virtual void OnDetachService(Service* pSvr)
+	{
+		if(sockset_ && (Service*)sockset_ == pSvr) {
+			sockset_ = nullptr;
+		}
+		Base::OnDetachService(pSvr);
+	}
+};
+
+/*!
+ *	@brief IoUringServiceT 模板定义.
+ *
+ *	封装IoUringServiceT，实现io_uring模型，通知和定时器都走ring，不再需要eventfd/pipe/timerfd
+ *	服务线程里产生的SQE只入队，等下一次io_uring_enter批量提交；其他线程产生的SQE立即提交
+ */
+template<class TService = Service>
+class IoUringServiceT : public TService
+{
+	typedef TService Base;
+protected:
+	IoUring ring_;
+	std::mutex ring_mutex_; //保护SQ生产和派生类的io_uring状态
+	MPSCQueue<void*> notify_datas_; //PostNotify(void*)的数据，和通知共用NOP唤醒
+	std::chrono::steady_clock::time_point ring_timer_time_; //已提交的最近定时时间
+	struct __kernel_timespec ring_timer_ts_ = {};
+	struct __kernel_timespec ring_wait_ts_ = {};
+public:
+	IoUringServiceT()
+	{
+	}
+	~IoUringServiceT()
+	{
+	}
+
+	inline void PostNotify()
+	{
+		Base::PostNotify();
+		if(!Base::IsNeedWakeUp()) {
+			//服务线程没有阻塞等待，会在下一轮处理notify_flag_
+			return;
+		}
+		std::unique_lock<std::mutex> lock(ring_mutex_);
+		struct io_uring_sqe* sqe = GetSqe();
+		if(sqe) {
+			sqe->opcode = IORING_OP_NOP;
+			sqe->user_data = IOURING_DATA_NOTIFY;
+			CommitSqe();
+		}
+	}
+
+	inline void PostNotify(void* data)
+	{
+		notify_datas_.Push(std::move(data));
+		PostNotify();
+	}
+
+	inline void PostTimer(size_t millis)
+	{
+		std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now() + std::chrono::milliseconds(millis);
+		std::unique_lock<std::mutex> lock(ring_mutex_);
+		if(ring_timer_time_.time_since_epoch().count() && ring_timer_time_ <= time) {
+			//说明有更快的定时器任务需要执行
+			return;
+		}
+		struct io_uring_sqe* sqe = GetSqe();
+		if(sqe) {
+			ring_timer_time_ = time;
+			ring_timer_ts_.tv_sec = millis / 1000;
+			ring_timer_ts_.tv_nsec = millis % 1000 * 1000 * 1000;
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->addr = (uint64_t)&ring_timer_ts_;
+			sqe->len = 1;
+			sqe->user_data = IOURING_DATA_TIMER;
+			ring_.Commit();
+			//timespec在提交时才被内核读取，持锁立即提交
+			ring_.Submit();
+		}
+	}
+
+protected:
+	//取SQE，调用者需持有ring_mutex_，SQ满时先提交再取
+	inline struct io_uring_sqe* GetSqe()
+	{
+		struct io_uring_sqe* sqe = ring_.GetSqe();
+		if(!sqe && ring_.IsOpen()) {
+			ring_.Submit();
+			sqe = ring_.GetSqe();
+		}
+		return sqe;
+	}
+	//提交SQE，调用者需持有ring_mutex_
+	inline void CommitSqe()
+	{
+		ring_.Commit();
+		if(Service::service() != this) {
+			ring_.Submit();
+		}
+	}
+
+	virtual void OnNotifyData(void* /*data*/)
+	{
+		//PRINTF("OnNotifyData %p", data);
+	}
+
+	virtual void OnIoUringEvent(const struct io_uring_cqe& /*cqe*/)
+	{
+		//
+	}
+
+	virtual void OnWait()
+	{
+		size_t timeout = Base::BeginWaiting();
+		if(timeout) {
+			if(ring_.Features() & IORING_FEAT_EXT_ARG) {
+				ring_.SubmitAndWait(timeout);
+			} else {
+				std::unique_lock<std::mutex> lock(ring_mutex_);
+				struct io_uring_sqe* sqe = GetSqe();
+				if(sqe) {
+					ring_wait_ts_.tv_sec = timeout / 1000;
+					ring_wait_ts_.tv_nsec = timeout % 1000 * 1000 * 1000;
+					sqe->opcode = IORING_OP_TIMEOUT;
+					sqe->addr = (uint64_t)&ring_wait_ts_;
+					sqe->len = 1;
+					sqe->user_data = IOURING_DATA_WAIT;
+					ring_.Commit();
+				}
+				lock.unlock();
+				ring_.Enter(ring_.SqPending(), 1, IORING_ENTER_GETEVENTS);
+			}
+			Base::EndWaiting();
+		} else if(ring_.SqPending()) {
+			ring_.Submit();
+		}
+		static const unsigned max_cqes = 256;
+		struct io_uring_cqe cqes[max_cqes];
+		unsigned count = 0;
+		do {
+			count = ring_.PeekCqes(cqes, max_cqes);
+			for (unsigned i = 0; i < count; ++i)
+			{
+				const struct io_uring_cqe& cqe = cqes[i];
+				switch (cqe.user_data)
+				{
+				case IOURING_DATA_NOTIFY:
+					if(Base::notify_flag_.exchange(false)) {
+						this->OnNotify();
+					}
+					break;
+				case IOURING_DATA_TIMER: {
+					std::unique_lock<std::mutex> lock(ring_mutex_);
+					if(ring_timer_time_ <= std::chrono::steady_clock::now()) {
+						ring_timer_time_ = std::chrono::steady_clock::time_point();
+					}
+					lock.unlock();
+					//PRINTF("OnTimer");
+					this->OnTimer();
+				}
+				break;
+				case IOURING_DATA_NONE:
+				case IOURING_DATA_WAIT:
+				case IOURING_DATA_CANCEL:
+					break;
+				default:
+					OnIoUringEvent(cqe);
+					break;
+				}
+			}
+		} while (count == max_cqes);
+		void* data = nullptr;
+		while(notify_datas_.Pop(data))
+		{
+			OnNotifyData(data);
+		}
+	}
+};
+
+typedef ThreadServiceT<IoUringServiceT<Service>> IoUringService;
+
+/*!
+ *	@brief IoUringSocketSet 模板定义.
+ *
+ *	封装IoUringSocketSet，实现io_uring模型
+ *
+ *	监听Socket使用multishot accept，流式Socket使用multishot recv + provided buffer ring，
+ *	其他情况（UDP、内核不支持、缓存用完）退回multishot poll；可写/连接使用oneshot poll。
+ *	user_data是Socket槽位标签，低32位的24~31位存放操作类型，所以最多管理(1<<24)-1个Socket，超出的构造时截断
+ */
+template<class TService = IoUringService, class TSocket = SocketEx>
+class IoUringSocketSetT : public SocketSetT<TService,TSocket>
+{
+	typedef SocketSetT<TService,TSocket> Base;
+public:
+	typedef TService Service;
+	typedef TSocket Socket;
+protected:
+	enum
+	{
+		SOCK_OP_ACCEPT = 1,
+		SOCK_OP_RECV,
+		SOCK_OP_POLLIN,
+		SOCK_OP_POLLOUT,
+		SOCK_OP_POLLPRI,
+	};
+	enum
+	{
+		SOCK_MAX_COUNT = 1 << 24, //user_data低24位是槽位
+	};
+	struct RecvBuf
+	{
+		uint16_t bid; //缓存ID
+		int res; //>0数据长度，0对端关闭，<0错误码
+		int off; //已读取长度
+	};
+	struct SockOps
+	{
+		uint64_t tag = 0; //占用槽位的Socket标签
+		uint8_t armed = 0; //已提交的操作
+		bool stream = false;
+		bool nobufs = false; //缓存用完，临时退回poll
+		std::deque<RecvBuf> bufs;
+	};
+	std::vector<SockOps> sock_ops_;
+	struct io_uring_buf_ring* buf_ring_ = nullptr;
+	char* buf_base_ = nullptr;
+	uint16_t buf_tail_ = 0;
+	int buf_free_ = 0; //ring里可用缓存数
+	std::vector<int> nobufs_; //等待缓存的槽位
+	bool recv_multishot_ = false;
+	bool accept_multishot_ = true;
+public:
+	IoUringSocketSetT(int nMaxSocketCount):Base(CheckSocketCount(nMaxSocketCount))
+	{
+		sock_ops_.resize(Base::GetMaxSocketCount());
+		InitBufRing();
+	}
+	~IoUringSocketSetT()
+	{
+		TermBufRing();
+	}
+
+	void SelectSocket(SocketEx* sock_ptr, int /*evt*/) {
+		int i = Base::SockTagPos(sock_ptr->SlotTag());
+		if (i < 0 || (size_t)i >= sock_ops_.size()) {
+			return;
+		}
+		std::unique_lock<std::mutex> lock(Base::ring_mutex_);
+		SockOps& ops = sock_ops_[i];
+		if (ops.tag == sock_ptr->SlotTag()) {
+			ArmSocket(sock_ptr, ops);
+		}
+	}
+
+	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
+	{
+		std::unique_lock<std::mutex> lock(Base::mutex_);
+		if (!sock_ptr || Base::sock_free_ < 0) {
+			//测试可不可以增加Socket，返回>=0表示可以增加
+			return Base::sock_free_;
+		}
+		sock_ptr->AttachService(this);
+		sock_ptr->SocketEx::Select(evt);
+		int i = Base::AllocSlot(sock_ptr);
+		int type = 0;
+		sock_ptr->GetSockOpt(SOL_SOCKET, SO_TYPE, (void*)&type, sizeof(type));
+		std::unique_lock<std::mutex> ring_lock(Base::ring_mutex_);
+		SockOps& ops = sock_ops_[i];
+		ops.tag = sock_ptr->SlotTag();
+		ops.armed = 0;
+		ops.stream = (type == SOCK_STREAM);
+		ops.nobufs = false;
+		ArmSocket(sock_ptr.get(), ops);
+		return i;
+	}
+	template<class Ty = Socket>
+	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
+	{
+		if(sock_ptr) {
+			sock_ptr->Connect(port);
+		}
+		return AddSocket(std::static_pointer_cast<Socket>(sock_ptr));
+	}
+	inline int AddAccept(std::shared_ptr<Socket> sock_ptr)
+	{
+		return AddSocket(sock_ptr,FD_ACCEPT);
+	}
+
+	//取消Socket所有未完成的操作，Socket关闭前调用
+	void CancelSocket(SocketEx* sock_ptr)
+	{
+		int i = Base::SockTagPos(sock_ptr->SlotTag());
+		if (i < 0 || (size_t)i >= sock_ops_.size()) {
+			return;
+		}
+		std::unique_lock<std::mutex> lock(Base::ring_mutex_);
+		SockOps& ops = sock_ops_[i];
+		if (ops.tag == sock_ptr->SlotTag()) {
+			CancelOps(ops);
+		}
+	}
+
+	//从provided buffer ring已接收的数据里读取，返回false表示没有使用ring接收，需要直接recv
+	bool ReceiveBuf(SocketEx* sock_ptr, char* lpBuf, int nBufLen, int& nRecvLen)
+	{
+		int i = Base::SockTagPos(sock_ptr->SlotTag());
+		if (i < 0 || (size_t)i >= sock_ops_.size()) {
+			return false;
+		}
+		std::unique_lock<std::mutex> lock(Base::ring_mutex_);
+		SockOps& ops = sock_ops_[i];
+		if (ops.tag != sock_ptr->SlotTag()) {
+			return false;
+		}
+		if (ops.bufs.empty()) {
+			if (!(ops.armed & (1 << SOCK_OP_RECV))) {
+				//poll模式或者缓存用完，数据还在内核Socket缓存里
+				return false;
+			}
+			XSocket::Socket::SetLastError(EWOULDBLOCK);
+			nRecvLen = -1;
+			return true;
+		}
+		nRecvLen = 0;
+		while (nBufLen > 0 && !ops.bufs.empty())
+		{
+			RecvBuf& buf = ops.bufs.front();
+			if (buf.res <= 0) {
+				if (nRecvLen > 0) {
+					break;
+				}
+				if (buf.res < 0) {
+					XSocket::Socket::SetLastError(-buf.res);
+					nRecvLen = -1;
+				}
+				ops.bufs.pop_front();
+				break;
+			}
+			int len = std::min<>(nBufLen, buf.res - buf.off);
+			memcpy(lpBuf, buf_base_ + (size_t)buf.bid * IOURING_BUF_SIZE + buf.off, len);
+			lpBuf += len;
+			nBufLen -= len;
+			nRecvLen += len;
+			buf.off += len;
+			if (buf.off >= buf.res) {
+				uint16_t bid = buf.bid;
+				ops.bufs.pop_front();
+				RecycleBuf(bid);
+			}
+		}
+		return true;
+	}
+
+protected:
+	//槽位超过24位会覆盖user_data里的操作类型，超出的截断
+	static inline int CheckSocketCount(int nMaxSocketCount)
+	{
+		if (nMaxSocketCount >= SOCK_MAX_COUNT) {
+			PRINTF("IoUringSocketSetT max socket count %d clamped to %d", nMaxSocketCount, SOCK_MAX_COUNT - 1);
+			return SOCK_MAX_COUNT - 1;
+		}
+		return nMaxSocketCount;
+	}
+	static inline uint64_t MakeOpData(uint64_t tag, int op) { return tag | ((uint64_t)op << 24); }
+	static inline uint64_t OpDataTag(uint64_t data) { return data & ~((uint64_t)0xFF << 24); }
+	static inline int OpDataOp(uint64_t data) { return (int)((data >> 24) & 0xFF); }
+
+	inline void InitBufRing()
+	{
+		if (!Base::ring_.IsOpen()) {
+			return;
+		}
+		char* base = (char*)mmap(NULL, (size_t)IOURING_BUF_COUNT * IOURING_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (base == MAP_FAILED) {
+			return;
+		}
+		buf_base_ = base;
+		size_t ring_len = IOURING_BUF_COUNT * sizeof(struct io_uring_buf);
+		void* ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (ring != MAP_FAILED) {
+			struct io_uring_buf_reg reg = {};
+			reg.ring_addr = (uint64_t)ring;
+			reg.ring_entries = IOURING_BUF_COUNT;
+			reg.bgid = IOURING_BUF_GROUP;
+			if (Base::ring_.Register(IORING_REGISTER_PBUF_RING, &reg, 1) == 0) {
+				buf_ring_ = (struct io_uring_buf_ring*)ring;
+				buf_tail_ = 0;
+				for (int bid = 0; bid < IOURING_BUF_COUNT; bid++)
+				{
+					AddBuf(bid);
+				}
+				__atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+				if (!ProbeBufGroup()) {
+					//有的内核注册成功但取不到缓存，退回IORING_OP_PROVIDE_BUFFERS
+					PRINTF("io_uring buffer ring is not usable, fallback to provide buffers");
+					Base::ring_.Register(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+					buf_ring_ = nullptr;
+				}
+			}
+			if (!buf_ring_) {
+				munmap(ring, ring_len);
+			}
+		}
+		if (!buf_ring_) {
+			ProvideBuf(0, IOURING_BUF_COUNT);
+			Base::ring_.Submit();
+			if (!ProbeBufGroup()) {
+				PRINTF("io_uring provided buffers is not usable, fallback to poll");
+				munmap(buf_base_, (size_t)IOURING_BUF_COUNT * IOURING_BUF_SIZE);
+				buf_base_ = nullptr;
+				return;
+			}
+		}
+		buf_free_ = IOURING_BUF_COUNT;
+		recv_multishot_ = true;
+	}
+
+	//用socketpair收一个字节，验证缓存组可用，只在构造时调用
+	inline bool ProbeBufGroup()
+	{
+		int sv[2] = {0};
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+			return false;
+		}
+		bool ok = false;
+		char data = 0;
+		struct io_uring_sqe* sqe = nullptr;
+		if (write(sv[1], &data, 1) == 1 && (sqe = Base::ring_.GetSqe())) {
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = sv[0];
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = IOURING_BUF_GROUP;
+			sqe->user_data = IOURING_DATA_NONE;
+			Base::ring_.Commit();
+			Base::ring_.Enter(Base::ring_.SqPending(), 1, IORING_ENTER_GETEVENTS);
+			struct io_uring_cqe cqe = {};
+			if (Base::ring_.PeekCqes(&cqe, 1) == 1 && cqe.res == 1 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+				ok = true;
+				uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+				if (buf_ring_) {
+					AddBuf(bid);
+					__atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+				} else {
+					ProvideBuf(bid, 1);
+					Base::ring_.Submit();
+				}
+			}
+		}
+		close(sv[0]);
+		close(sv[1]);
+		return ok;
+	}
+
+	inline void TermBufRing()
+	{
+		if (buf_ring_) {
+			struct io_uring_buf_reg reg = {};
+			reg.bgid = IOURING_BUF_GROUP;
+			Base::ring_.Register(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+			munmap(buf_ring_, IOURING_BUF_COUNT * sizeof(struct io_uring_buf));
+			buf_ring_ = nullptr;
+		}
+		if (buf_base_) {
+			munmap(buf_base_, (size_t)IOURING_BUF_COUNT * IOURING_BUF_SIZE);
+			buf_base_ = nullptr;
+		}
+	}
+
+	//tail和bufs[0].resv共用内存，只能逐个字段写
+	inline void AddBuf(uint16_t bid)
+	{
+		struct io_uring_buf* buf = &buf_ring_->bufs[buf_tail_ & (IOURING_BUF_COUNT - 1)];
+		buf->addr = (uint64_t)(buf_base_ + (size_t)bid * IOURING_BUF_SIZE);
+		buf->len = IOURING_BUF_SIZE;
+		buf->bid = bid;
+		buf_tail_++;
+	}
+
+	//没有buffer ring时用IORING_OP_PROVIDE_BUFFERS归还缓存，成功不产生CQE
+	inline void ProvideBuf(uint16_t bid, int count)
+	{
+		struct io_uring_sqe* sqe = Base::GetSqe();
+		if (!sqe) {
+			return;
+		}
+		sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+		sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+		sqe->fd = count;
+		sqe->addr = (uint64_t)(buf_base_ + (size_t)bid * IOURING_BUF_SIZE);
+		sqe->len = IOURING_BUF_SIZE;
+		sqe->off = bid;
+		sqe->buf_group = IOURING_BUF_GROUP;
+		sqe->user_data = IOURING_DATA_NONE;
+		Base::CommitSqe();
+	}
+
+	//归还缓存，调用者需持有ring_mutex_
+	inline void RecycleBuf(uint16_t bid)
+	{
+		if (buf_ring_) {
+			AddBuf(bid);
+			__atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+		} else {
+			ProvideBuf(bid, 1);
+		}
+		buf_free_++;
+		if (!nobufs_.empty()) {
+			std::vector<int> nobufs;
+			nobufs.swap(nobufs_);
+			for (int i : nobufs)
+			{
+				SockOps& ops = sock_ops_[i];
+				ops.nobufs = false;
+				std::shared_ptr<Socket> sock_ptr = Base::FindSocket(ops.tag);
+				if (sock_ptr) {
+					ArmSocket(sock_ptr.get(), ops);
+				}
+			}
+		}
+	}
+
+	inline void PrepOp(int fd, uint64_t tag, int op, uint8_t opcode, uint32_t events = 0, bool multi = false)
+	{
+		struct io_uring_sqe* sqe = Base::GetSqe();
+		if (!sqe) {
+			PRINTF("io_uring sq is full");
+			return;
+		}
+		sqe->opcode = opcode;
+		sqe->fd = fd;
+		sqe->user_data = MakeOpData(tag, op);
+		switch (opcode)
+		{
+		case IORING_OP_ACCEPT:
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+			break;
+		case IORING_OP_RECV:
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = IOURING_BUF_GROUP;
+			break;
+		case IORING_OP_POLL_ADD:
+			sqe->poll32_events = events;
+			sqe->len = multi ? IORING_POLL_ADD_MULTI : 0;
+			break;
+		default:
+			break;
+		}
+		Base::CommitSqe();
+	}
+
+	inline void CancelOp(uint64_t tag, int op)
+	{
+		struct io_uring_sqe* sqe = Base::GetSqe();
+		if (!sqe) {
+			return;
+		}
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = MakeOpData(tag, op);
+		sqe->user_data = IOURING_DATA_CANCEL;
+		Base::CommitSqe();
+	}
+
+	//取消槽位上所有已提交的操作，调用者需持有ring_mutex_
+	inline void CancelOps(SockOps& ops)
+	{
+		for (int op = SOCK_OP_ACCEPT; op <= SOCK_OP_POLLPRI; op++)
+		{
+			if (ops.armed & (1 << op)) {
+				CancelOp(ops.tag, op);
+			}
+		}
+		ops.armed = 0;
+	}
+
+	//按Socket当前选择的事件提交还没提交的操作，调用者需持有ring_mutex_
+	inline void ArmSocket(SocketEx* sock_ptr, SockOps& ops)
+	{
+		if (!sock_ptr->IsSocket()) {
+			return;
+		}
+		int fd = *sock_ptr;
+		if (sock_ptr->IsSelect(FD_ACCEPT)) {
+			if (accept_multishot_) {
+				if (!(ops.armed & (1 << SOCK_OP_ACCEPT))) {
+					ops.armed |= (1 << SOCK_OP_ACCEPT);
+					PrepOp(fd, ops.tag, SOCK_OP_ACCEPT, IORING_OP_ACCEPT);
+				}
+			} else if (!(ops.armed & (1 << SOCK_OP_POLLIN))) {
+				ops.armed |= (1 << SOCK_OP_POLLIN);
+				PrepOp(fd, ops.tag, SOCK_OP_POLLIN, IORING_OP_POLL_ADD, POLLIN, true);
+			}
+			return;
+		}
+		if (sock_ptr->IsSelect(FD_CONNECT)) {
+			//连接完成前不提交读操作
+			if (!(ops.armed & (1 << SOCK_OP_POLLOUT))) {
+				ops.armed |= (1 << SOCK_OP_POLLOUT);
+				PrepOp(fd, ops.tag, SOCK_OP_POLLOUT, IORING_OP_POLL_ADD, POLLOUT);
+			}
+			return;
+		}
+		if (sock_ptr->IsSelect(FD_READ)) {
+			if (recv_multishot_ && ops.stream) {
+				if (!ops.bufs.empty() && ops.bufs.back().res <= 0) {
+					//已经收到关闭/错误，等Socket读取后关闭
+				} else if (!(ops.armed & (1 << SOCK_OP_RECV))) {
+					if (buf_free_ > 0) {
+						if (ops.armed & (1 << SOCK_OP_POLLIN)) {
+							ops.armed &= ~(1 << SOCK_OP_POLLIN);
+							CancelOp(ops.tag, SOCK_OP_POLLIN);
+						}
+						ops.armed |= (1 << SOCK_OP_RECV);
+						PrepOp(fd, ops.tag, SOCK_OP_RECV, IORING_OP_RECV);
+					} else {
+						if (!ops.nobufs) {
+							ops.nobufs = true;
+							nobufs_.push_back(Base::SockTagPos(ops.tag));
+						}
+						if (!(ops.armed & (1 << SOCK_OP_POLLIN))) {
+							ops.armed |= (1 << SOCK_OP_POLLIN);
+							PrepOp(fd, ops.tag, SOCK_OP_POLLIN, IORING_OP_POLL_ADD, POLLIN | POLLRDHUP, true);
+						}
+					}
+				}
+			} else if (!(ops.armed & (1 << SOCK_OP_POLLIN))) {
+				ops.armed |= (1 << SOCK_OP_POLLIN);
+				PrepOp(fd, ops.tag, SOCK_OP_POLLIN, IORING_OP_POLL_ADD, POLLIN | POLLRDHUP, true);
+			}
+		}
+		if (sock_ptr->IsSelect(FD_OOB) && !(ops.armed & (1 << SOCK_OP_POLLPRI))) {
+			ops.armed |= (1 << SOCK_OP_POLLPRI);
+			PrepOp(fd, ops.tag, SOCK_OP_POLLPRI, IORING_OP_POLL_ADD, POLLPRI, true);
+		}
+		if (sock_ptr->IsSelect(FD_WRITE) && !(ops.armed & (1 << SOCK_OP_POLLOUT))) {
+			ops.armed |= (1 << SOCK_OP_POLLOUT);
+			PrepOp(fd, ops.tag, SOCK_OP_POLLOUT, IORING_OP_POLL_ADD, POLLOUT);
+		}
+	}
+
+	virtual void OnFreeSlot(int i, const std::shared_ptr<Socket>& sock_ptr)
+	{
+		Base::OnFreeSlot(i, sock_ptr);
+		std::unique_lock<std::mutex> lock(Base::ring_mutex_);
+		SockOps& ops = sock_ops_[i];
+		CancelOps(ops);
+		while (!ops.bufs.empty())
+		{
+			RecvBuf buf = ops.bufs.front();
+			ops.bufs.pop_front();
+			if (buf.res > 0) {
+				RecycleBuf(buf.bid);
+			}
+		}
+		if (ops.nobufs) {
+			nobufs_.erase(std::remove(nobufs_.begin(), nobufs_.end(), i), nobufs_.end());
+			ops.nobufs = false;
+		}
+		ops.tag = 0;
+	}
+
+	virtual void OnIoUringEvent(const struct io_uring_cqe& cqe)
+	{
+		uint64_t tag = OpDataTag(cqe.user_data);
+		int op = OpDataOp(cqe.user_data);
+		int i = Base::SockTagPos(tag);
+		int res = cqe.res;
+		bool more = cqe.flags & IORING_CQE_F_MORE;
+		if (res == -ECANCELED) {
+			//主动取消的操作，armed已经清除
+			return;
+		}
+		std::shared_ptr<Socket> sock_ptr = Base::FindSocket(tag);
+		std::unique_lock<std::mutex> lock(Base::ring_mutex_);
+		SockOps* ops = (i >= 0 && (size_t)i < sock_ops_.size() && sock_ops_[i].tag == tag) ? &sock_ops_[i] : nullptr;
+		if (cqe.flags & IORING_CQE_F_BUFFER) {
+			buf_free_--;
+		}
+		if (!sock_ptr || !ops || !(ops->armed & (1 << op))) {
+			//过期的完成事件
+			if (cqe.flags & IORING_CQE_F_BUFFER) {
+				RecycleBuf(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			}
+			if (op == SOCK_OP_ACCEPT && res >= 0) {
+				close(res);
+			}
+			return;
+		}
+		if (!more) {
+			ops->armed &= ~(1 << op);
+		}
+		int nErrorCode = 0;
+		switch (op)
+		{
+		case SOCK_OP_ACCEPT: {
+			if (res == -EINVAL) {
+				//内核不支持multishot accept，退回poll
+				accept_multishot_ = false;
+				break;
+			}
+			lock.unlock();
+			if (res >= 0) {
+				SOCKADDR_STORAGE stAddr = {};
+				socklen_t nAddrLen = sizeof(stAddr);
+				getpeername(res, (SOCKADDR*)&stAddr, &nAddrLen);
+				sock_ptr->Trigger(FD_ACCEPT, (SOCKET)res, (const SOCKADDR*)&stAddr, (int)nAddrLen);
+			} else {
+				sock_ptr->Trigger(FD_ACCEPT, -res);
+			}
+		}
+		break;
+		case SOCK_OP_RECV: {
+			if (res == -EINVAL) {
+				//内核不支持multishot recv，退回poll
+				recv_multishot_ = false;
+				break;
+			}
+			if (res == -ENOBUFS) {
+				//缓存用完，ArmSocket会退回poll直到有缓存归还
+				break;
+			}
+			RecvBuf buf = {};
+			buf.bid = (cqe.flags & IORING_CQE_F_BUFFER) ? (cqe.flags >> IORING_CQE_BUFFER_SHIFT) : 0;
+			buf.res = res;
+			if (res <= 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+				RecycleBuf(buf.bid);
+			}
+			ops->bufs.push_back(buf);
+			lock.unlock();
+			if (sock_ptr->IsSelect(FD_READ)) {
+				sock_ptr->Trigger(FD_READ, 0);
+			}
+		}
+		break;
+		case SOCK_OP_POLLIN: {
+			lock.unlock();
+			if (sock_ptr->IsSelect(FD_ACCEPT)) {
+				sock_ptr->Trigger(FD_ACCEPT, 0);
+			} else if (sock_ptr->IsSelect(FD_READ)) {
+				sock_ptr->Trigger(FD_READ, 0);
+			}
+		}
+		break;
+		case SOCK_OP_POLLPRI: {
+			lock.unlock();
+			if (sock_ptr->IsSelect(FD_OOB)) {
+				sock_ptr->Trigger(FD_OOB, 0);
+			}
+		}
+		break;
+		case SOCK_OP_POLLOUT: {
+			lock.unlock();
+			if (sock_ptr->IsSelect(FD_CONNECT)) {
+				sock_ptr->RemoveSelect(FD_CONNECT);
+				sock_ptr->GetSockOpt(SOL_SOCKET, SO_ERROR, (void *)&nErrorCode, sizeof(nErrorCode));
+				sock_ptr->Trigger(FD_CONNECT, nErrorCode);
+			} else if (sock_ptr->IsSelect(FD_WRITE)) {
+				sock_ptr->Trigger(FD_WRITE, 0);
+			}
+		}
+		break;
+		default:
+			break;
+		}
+		//补交oneshot/结束的multishot操作
+		if (!lock.owns_lock()) {
+			lock.lock();
+		}
+		if (sock_ops_[i].tag == tag) {
+			ArmSocket(sock_ptr.get(), sock_ops_[i]);
+		}
+	}
+};
+
+}
+
+#endif//_H_XIOURING_H_
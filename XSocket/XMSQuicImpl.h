@@ -94,11 +94,12 @@ public:
         api()->ConnectionShutdown(conn_, Flags, ErrorCode);
     }
 
-    void Close() {
+    int Close() {
         if (conn_ != nullptr) {
             api()->ConnectionClose(conn_);
             conn_ = nullptr;
         }
+        return 0;
 	}
 
     inline HQUIC connection() { return conn_; }
@@ -388,6 +388,9 @@ class QuicHandlerBaseT : public ConnectionT<TSocket, TaskSocketT<TBase>>,
   typedef ConnectionT<TSocket, TaskSocketT<TBase>> Base;
 public:
   typedef typename Base::TaskInfo TaskInfo;
+  // MAX_GSO_PKTCNT is the upper bound of max_pktcnt_, keeping a train
+  // below the 64KB UDP datagram limit.
+  enum { MAX_GSO_PKTCNT = 32 };
  protected:
   TManager *manager_;
   std::shared_ptr<TSocket> sock_ptr_;
@@ -398,6 +401,11 @@ public:
   SSL_CTX *ssl_ctx_;
   SSL *ssl_;
   size_t max_pktlen_;
+  // max_pktcnt_ is the maximum number of packets coalesced in sendbuf_
+  // and sent as one UDP GSO train.
+  size_t max_pktcnt_;
+  // pktcnt_ is the number of packets pending in sendbuf_.
+  size_t pktcnt_;
   struct Buffer {
     Buffer(const uint8_t *data, size_t datalen)
         : buf{data, data + datalen}, begin(buf.data()), tail(begin + datalen) {}
@@ -449,10 +457,13 @@ public:
         ssl_ctx_(ssl_ctx),
         ssl_(nullptr),
         max_pktlen_(0),
+        max_pktcnt_(std::max<size_t>(
+            1, std::min<size_t>(manager->max_gso_pktcnt, MAX_GSO_PKTCNT))),
+        pktcnt_(0),
         crypto_{},
         conn_(nullptr),
         nkey_update_(0),
-        sendbuf_{NGTCP2_MAX_PKTLEN_IPV4}
+        sendbuf_{NGTCP2_MAX_PKTLEN_IPV4 * max_pktcnt_}
   // last_error_(QUICErrorType::Transport, 0)
   {
   }
@@ -731,10 +742,38 @@ public:
 
   int on_write() { return 0; }
 
+  // write_packet is called after a packet of nwrite bytes is written at
+  // sendbuf_.wpos() to remote.  Full sized packets are kept in sendbuf_
+  // until max_pktcnt_ of them are pending, a short packet ends the train,
+  // then the train is sent with gso_size max_pktlen_.
+  int write_packet(const ngtcp2_addr *remote, size_t nwrite) {
+    if (pktcnt_ &&
+        (remote->addrlen != this->remote_addr_.len ||
+         memcmp(remote->addr, &this->remote_addr_.su, remote->addrlen) != 0)) {
+      // path changed, send the pending train first, and move the new
+      // packet to the beginning of sendbuf_.
+      auto pos = this->sendbuf_.wpos();
+      send_packet();
+      memmove(this->sendbuf_.wpos(), pos, nwrite);
+    }
+    update_remote_addr(remote);
+    this->sendbuf_.push(nwrite);
+    if (++pktcnt_ >= max_pktcnt_ || nwrite < max_pktlen_ ||
+        this->sendbuf_.left() < max_pktlen_) {
+      return send_packet();
+    }
+    return NETWORK_ERR_OK;
+  }
+
   int send_packet() {
+    if (this->sendbuf_.size() == 0) {
+      return NETWORK_ERR_OK;
+    }
     this->manager_->send_packet(this->sock_ptr_, this->sendbuf_.rpos(), this->sendbuf_.size(),
-                                 &this->remote_addr_.su.sa, this->remote_addr_.len);
+                                 &this->remote_addr_.su.sa, this->remote_addr_.len,
+                                 pktcnt_ > 1 ? max_pktlen_ : 0);
     this->sendbuf_.reset();
+    pktcnt_ = 0;
     return NETWORK_ERR_OK;
   }
 };
@@ -848,6 +887,9 @@ class QuicManagerBaseT : public SocketManagerT<THandlerSet> {
   // static_secret is used to derive keying materials for Stateless
   // Retry token.
   std::array<uint8_t, 32> static_secret;
+  // max_gso_pktcnt is the maximum number of packets a handler coalesces
+  // into one UDP GSO train.  0 or 1 sends packets one by one.
+  size_t max_gso_pktcnt = 0;
 
   inline bool packet_lost(double prob) {
     auto p = std::uniform_real_distribution<>(0, 1)(randgen);
@@ -889,16 +931,40 @@ class QuicManagerBaseT : public SocketManagerT<THandlerSet> {
   int send_packet(std::shared_ptr<TSocket> ep, const uint8_t *data,
                   size_t datalen, const sockaddr *sa, socklen_t salen,
                   size_t gso_size = 0) {
-    if (packet_lost(tx_loss_prob)) {
-      if (IsDebug()) {
-        std::cerr << "** Simulated outgoing packet loss **" << std::endl;
+    if (gso_size == 0 || gso_size >= datalen) {
+      if (packet_lost(tx_loss_prob)) {
+        if (IsDebug()) {
+          std::cerr << "** Simulated outgoing packet loss **" << std::endl;
+        }
+        return NETWORK_ERR_OK;
       }
+      Buffer buf((const char *)data, datalen, sa, salen);
+      ep->Post(
+          [ep, buf]() { ep->SendBuf(buf); });
       return NETWORK_ERR_OK;
     }
 
-    typename TSocket::Buffer buf(data, datalen, sa, salen);
-    ep->Post(
-        [ep, buf]() { ep->SendBuf(buf); });
+    // data is a train of gso_size packets, the last one may be shorter.
+    // The packets are queued by one task, and sent with UDP_SEGMENT in one
+    // sendmsg when the socket enables GSO.
+    std::vector<Buffer> bufs;
+    bufs.reserve((datalen + gso_size - 1) / gso_size);
+    for (size_t pos = 0; pos < datalen; pos += gso_size) {
+      if (packet_lost(tx_loss_prob)) {
+        if (IsDebug()) {
+          std::cerr << "** Simulated outgoing packet loss **" << std::endl;
+        }
+        continue;
+      }
+      bufs.emplace_back((const char *)data + pos,
+                        (int)std::min(gso_size, datalen - pos), sa, salen);
+    }
+    if (bufs.empty()) {
+      return NETWORK_ERR_OK;
+    }
+    ep->Post(std::bind(
+        [ep](std::vector<Buffer> &bufs) { ep->SendBufs(bufs.data(), bufs.size()); },
+        std::move(bufs)));
 
     return NETWORK_ERR_OK;
   }
@@ -597,7 +597,8 @@ int update_key(uint8_t *rx_secret, uint8_t *tx_secret, uint8_t *rx_key,
                 << " seconds)" << std::endl;
     }
 
-    this->sendbuf_.reset();
+    // packets written before closing are still pending as a GSO train.
+    this->send_packet();
     assert(this->sendbuf_.left() >= this->max_pktlen_);
 
     conn_closebuf_ =
@@ -674,6 +675,9 @@ int on_write() {
     return rv;
   }
 
+  // send the last train write_streams left in sendbuf_.
+  this->send_packet();
+
   pT->SetRTTimer();
 
   return 0;
@@ -360,6 +360,25 @@ public:
         return ret;
 	}
 
+	//SSL没有聚集写，逐个缓存SSL_write，遇到部分写入或者错误停止
+	int SendV(const struct iovec* lpIov, int nIovCnt, int nFlags = 0)
+	{
+		int nSendLen = 0;
+		for (int i = 0; i < nIovCnt; i++)
+		{
+			int nBufLen = (int)lpIov[i].iov_len;
+			int ret = Send((const char*)lpIov[i].iov_base, nBufLen, nFlags);
+			if (ret <= 0) {
+				return nSendLen > 0 ? nSendLen : ret;
+			}
+			nSendLen += ret;
+			if (ret < nBufLen) {
+				break;
+			}
+		}
+		return nSendLen;
+	}
+
 	int Receive(char* lpBuf, int nBufLen, int nFlags = 0)
     {
         int ret, ssl_err;
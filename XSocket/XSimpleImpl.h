@@ -25,12 +25,130 @@
 
 #include <string>
 #include <queue>
+#include <deque>
 #include <list>
 #include <map>
+#include <memory>
 using namespace std;
 
 namespace XSocket {
 
+/*!
+ *	@brief SendChain 定义.
+ *
+ *	链式发送队列，每个分片引用一个共享缓存或者IOBuf的一段，入队不拷贝数据，
+ *	发送时一次填充多个iovec聚集发送，支持部分发送。
+ *	分片队列在第一次入队时才分配，Shrink释放空队列
+ */
+class SendChain
+{
+public:
+	typedef std::shared_ptr<const std::string> Buffer;
+protected:
+	struct Slice
+	{
+		Buffer buf;
+		const char* data;
+		size_t size;
+		size_t sent;
+		IOBuf iobuf;
+	};
+	std::unique_ptr<std::deque<Slice>> slices_;
+	size_t size_ = 0; //所有分片的总长度(含头分片已发送部分)
+	inline std::deque<Slice>& Slices()
+	{
+		if (!slices_) {
+			slices_.reset(new std::deque<Slice>());
+		}
+		return *slices_;
+	}
+public:
+	inline bool empty() const { return !slices_ || slices_->empty(); }
+	inline size_t size() const { return size_; }
+	inline void clear() { if (slices_) slices_->clear(); size_ = 0; }
+	//队列为空时释放队列内存
+	inline void Shrink() { if (empty()) slices_.reset(); }
+
+	//引用共享缓存的[offset,offset+len)，sent为其中已发送长度
+	inline void Append(const Buffer& buf, size_t offset, size_t len, size_t sent = 0)
+	{
+		ASSERT(buf && offset + len <= buf->size() && sent <= len);
+		if (len > sent) {
+			Slices().push_back({ buf, buf->data() + offset, len, sent, IOBuf() });
+			size_ += len;
+		}
+	}
+
+	//引用IOBuf切片
+	inline void Append(const IOBuf& iobuf)
+	{
+		if (!iobuf.empty()) {
+			Slices().push_back({ Buffer(), iobuf.data(), iobuf.size(), 0, iobuf });
+			size_ += iobuf.size();
+		}
+	}
+
+	inline void Append(const Buffer& buf)
+	{
+		Append(buf, 0, buf->size());
+	}
+
+	inline void Append(std::string&& buf, size_t sent = 0)
+	{
+		if (buf.size() > sent) {
+			size_t len = buf.size();
+			Append(std::make_shared<const std::string>(std::move(buf)), 0, len, sent);
+		}
+	}
+
+	//填充未发送的分片，返回填充个数
+	inline int Fill(struct iovec* iov, int iovcnt) const
+	{
+		int cnt = 0;
+		size_t total = 0;
+		if (!slices_) {
+			return 0;
+		}
+		for (auto it = slices_->begin(); it != slices_->end() && cnt < iovcnt; ++it)
+		{
+			size_t len = it->size - it->sent;
+			if (total + len > INT_MAX) {
+				if (cnt > 0) {
+					break;
+				}
+				len = INT_MAX;
+			}
+			iov[cnt].iov_base = (void*)(it->data + it->sent);
+			iov[cnt].iov_len = len;
+			total += len;
+			cnt++;
+		}
+		return cnt;
+	}
+
+	//消费len字节，每发送完成一个分片回调f(data,size)，返回超出队列的长度
+	template<class F>
+	inline size_t Consume(size_t len, F&& f)
+	{
+		while (len > 0 && !empty())
+		{
+			Slice& front = slices_->front();
+			size_t left = front.size - front.sent;
+			if (len < left) {
+				front.sent += len;
+				return 0;
+			}
+			len -= left;
+			//先出队再回调，回调里可能继续入队或者关闭清空队列
+			Slice slice = std::move(front);
+			slices_->pop_front();
+			size_ -= slice.size;
+			f(slice.data, (int)slice.size);
+		}
+		return len;
+	}
+};
+
 /*!
  *	@brief CustomSocketT 定义.
  *
@@ -44,8 +162,9 @@ public:
 	typedef std::string RecvBuffer;
 	typedef TSendBuffer SendBuffer;
 protected:
-	RecvBuffer recv_buf_;
-	std::vector<SendBuffer> send_que_;
+	RecvRing recv_ring_;
+	std::deque<SendBuffer> send_que_;
+	size_t send_off_ = 0; //队首缓存已发送长度
 	//std::mutex m_SendSection;
 public:
 	CustomSocketT()
@@ -59,12 +178,21 @@ public:
 	}
 
 	inline void ReserveRecvBufSize(size_t size) {
-		recv_buf_.reserve(size);
-		recv_buf_.resize(size);
+		recv_ring_.Reserve(size);
+	}
+
+	//接收缓存最大长度，超过断开连接，0表示不限制
+	inline void SetMaxRecvBufSize(size_t size) {
+		recv_ring_.SetMaxSize(size);
+	}
+
+	//接收缓存达到size时使用镜像映射，适合少量大流量连接，0表示不使用
+	inline void SetRecvMirrorSize(size_t size) {
+		recv_ring_.SetMirrorSize(size);
 	}
 
 	inline void ReserveSendQueSize(size_t size) {
-		send_que_.reserve(size);
+		//deque不需要预留
 	}
 
 	inline int Close()
@@ -73,6 +201,7 @@ public:
 		//std::unique_lock<std::mutex> lock(m_SendSection);
 
 		send_que_.clear();
+		send_off_ = 0;
 		//lock.unlock();
 		return ret;
 	}
@@ -111,48 +240,53 @@ public:
 	inline void SendBufDirect()
 	{
 		ASSERT(Base::IsSocket());
-		if(!Base::IsSelect(FD_WRITE)) {
-			Base::Select(FD_WRITE);
-		}
+		Base::SendDirect();
 	}
 protected:
 	//TcpSocket 实现接口
-	virtual bool PrepareRecvBuf(char* & lpBuf, int & nBufLen)
-	{
-		lpBuf = &recv_buf_[0];
-		nBufLen = recv_buf_.size();
-
-		return true;
-	}
-	virtual bool PrepareExpandRecvBuf(char* & lpBuf, int & nBufLen)
+	virtual RecvRing* PrepareRecvRing()
 	{
-		recv_buf_.resize(recv_buf_.size() + recv_buf_.size()/2);
-		lpBuf = &recv_buf_[0];
-		nBufLen = recv_buf_.size();
-		return true;
+		return &recv_ring_;
 	}
 
-	virtual bool PrepareSendBuf(const char* & lpBuf, int & nBufLen)
+	virtual int PrepareSendIov(struct iovec* lpIov, int nIovCnt)
 	{
 		//std::unique_lock<std::mutex> lock(m_SendSection);
-		if(!send_que_.empty()) {
-			SendBuffer& send_buf = send_que_[0];
-			lpBuf = send_buf.data();
-			nBufLen = send_buf.size();
-			ASSERT(lpBuf && nBufLen>0);
-			//lock.unlock();
-			return true;
+		int cnt = 0;
+		size_t off = send_off_;
+		for (auto it = send_que_.begin(); it != send_que_.end() && cnt < nIovCnt; ++it)
+		{
+			ASSERT(it->data() && it->size()>off);
+			lpIov[cnt].iov_base = (void*)(it->data() + off);
+			lpIov[cnt].iov_len = it->size() - off;
+			off = 0;
+			cnt++;
 		}
-		return false;
+		return cnt;
 	}
 
 	virtual void OnSendBuf(const char* lpBuf, int nBufLen) 
 	{
 		Base::OnSendBuf(lpBuf, nBufLen);
+	}
 
-		//std::unique_lock<std::mutex> lock(m_SendSection);
-		ASSERT(!send_que_.empty());
-		send_que_.erase(send_que_.begin());
+	virtual void OnSendIov(int nBufLen)
+	{
+		size_t len = nBufLen;
+		while (len > 0 && !send_que_.empty())
+		{
+			size_t left = send_que_.front().size() - send_off_;
+			if (len < left) {
+				send_off_ += len;
+				break;
+			}
+			len -= left;
+			send_off_ = 0;
+			//先出队再回调，回调里可能继续发送或者关闭
+			SendBuffer send_buf = std::move(send_que_.front());
+			send_que_.pop_front();
+			OnSendBuf(send_buf.data(), send_buf.size());
+		}
 	}
 };
 
@@ -169,9 +303,19 @@ public:
 	typedef std::string RecvBuffer;
 	typedef std::string SendBuffer;
 protected:
-	RecvBuffer recv_buf_;
-	SendBuffer send_buf_;
-	SendBuffer ppr_send_buf_;
+	RecvRing recv_ring_;
+	size_t recv_iobuf_size_ = 0; //IOBuf接收内存块大小，0不使用
+	SendBuffer send_buf_; //待发送尾部缓存，追加写入，排在send_chain_之后
+	size_t send_off_ = 0; //尾部缓存已发送长度
+	SendChain send_chain_; //已封存的待发送分片
+	bool lean_buf_ = false; //精简缓存模式
+	bool write_blocked_ = false; //未发送数据超过高水位或者预算
+	bool read_paused_ = false; //被背压暂停读
+	size_t send_high_ = 0; //发送高水位，0表示不限制
+	size_t send_low_ = 0; //发送低水位
+	std::shared_ptr<SendBudget> send_budget_; //共享的发送内存预算
+	size_t send_budget_len_ = 0; //已计入预算的未发送长度
+	std::function<void(bool)> pause_peer_; //写阻塞时暂停对端读，写排空时恢复
 	//std::mutex m_SendSection;
 	//std::mutex m_RecvSection;
 
@@ -181,22 +325,120 @@ public:
 		// recv_buf_.reserve(uMaxBufSize);
 		// recv_buf_.resize(uMaxBufSize);
 		// send_buf_.reserve(uMaxBufSize);
-		// ppr_send_buf_.reserve(uMaxBufSize);
 	}
 
 	virtual ~SimpleSocketT()
 	{
-		
+		if (send_budget_ && send_budget_len_) {
+			send_budget_->Sub(send_budget_len_);
+		}
 	}
 
 	inline void ReserveRecvBufSize(size_t size) {
-		recv_buf_.reserve(size);
-		recv_buf_.resize(size);
+		recv_ring_.Reserve(size);
+	}
+
+	//接收缓存最大长度，超过断开连接，0表示不限制
+	inline void SetMaxRecvBufSize(size_t size) {
+		recv_ring_.SetMaxSize(size);
+	}
+
+	//接收缓存达到size时使用镜像映射，适合少量大流量连接，0表示不使用
+	inline void SetRecvMirrorSize(size_t size) {
+		recv_ring_.SetMirrorSize(size);
+	}
+
+	//使用IOBuf接收，size为内存块大小，OnRecvBuf里可以用RecvIOBuf零拷贝保留数据
+	inline void SetRecvIOBufSize(size_t size) {
+		recv_iobuf_size_ = size;
 	}
 
 	inline void ReserveSendBufSize(size_t size) {
 		send_buf_.reserve(size);
-		ppr_send_buf_.reserve(size);
+	}
+
+	/*!
+	 *	@brief 精简缓存模式.
+	 *
+	 *	适合大量空闲连接：接收缓存只在OnReceive期间借用本线程的临时缓存，
+	 *	剩余半包时才分配私有缓存，解析完就释放；发送缓存按需分配，发送完就释放
+	 */
+	inline void SetLeanBuf(bool lean) {
+		lean_buf_ = lean;
+		recv_ring_.SetLazy(lean);
+		if (lean_buf_ && send_buf_.empty()) {
+			SendBuffer().swap(send_buf_);
+			send_chain_.Shrink();
+		}
+	}
+
+	/*!
+	 *	@brief 发送背压.
+	 *
+	 *	未发送数据达到高水位high时进入写阻塞，回调OnWriteBlocked，
+	 *	降到低水位low时回调OnWriteDrained，low为0时取high的一半
+	 */
+	inline void SetSendWatermark(size_t high, size_t low = 0) {
+		send_high_ = high;
+		send_low_ = low ? low : high / 2;
+	}
+
+	//加入共享的发送内存预算(如SocketManagerT::GetSendBudget)，预算超出时有未发送数据就进入写阻塞
+	inline void SetSendBudget(const std::shared_ptr<SendBudget>& budget) {
+		if (send_budget_ && send_budget_len_) {
+			send_budget_->Sub(send_budget_len_);
+		}
+		send_budget_ = budget;
+		send_budget_len_ = 0;
+		CheckSendWatermark();
+	}
+
+	inline bool IsWriteBlocked() { return write_blocked_; }
+
+	/*!
+	 *	@brief 自动背压.
+	 *
+	 *	peer是给本连接产生发送数据的连接(如代理隧道的另一端)，本连接写阻塞时暂停peer读，
+	 *	写排空时恢复。peer需要有PauseRead/ResumeRead，并且和本连接在同一个服务线程
+	 */
+	template<class Ty>
+	inline void SetPausePeer(const std::shared_ptr<Ty>& peer) {
+		std::weak_ptr<Ty> weak_peer(peer);
+		pause_peer_ = [weak_peer](bool pause) {
+			std::shared_ptr<Ty> peer = weak_peer.lock();
+			if (peer) {
+				if (pause) {
+					peer->PauseRead();
+				} else {
+					peer->ResumeRead();
+				}
+			}
+		};
+	}
+
+	//暂停读，内核接收缓存满后由TCP流控让对方慢下来
+	inline void PauseRead() {
+		if (!read_paused_ && Base::IsSelect(FD_READ)) {
+			read_paused_ = true;
+			Base::RemoveSelect(FD_READ);
+		}
+	}
+
+	//恢复读，并且立即接收暂停期间到达的数据
+	inline void ResumeRead() {
+		if (read_paused_) {
+			read_paused_ = false;
+			if (Base::IsSocket()) {
+				Base::Select(FD_READ);
+			}
+		}
+	}
+
+	inline bool IsReadPaused() { return read_paused_; }
+
+	//连接当前占用的缓存内存，发送分片按未发送长度计
+	inline size_t GetBufMemSize() const {
+		return recv_ring_.capacity() + Base::m_RecvIOBuf.capacity() + send_buf_.capacity() + send_chain_.size();
 	}
 
 	inline int Close()
@@ -204,15 +446,40 @@ public:
 		int ret = Base::Close();
 		//std::unique_lock<std::mutex> lock(m_SendSection);
 
-		ppr_send_buf_.clear();
+		send_chain_.clear();
 		send_buf_.clear();
+		send_off_ = 0;
+		if (lean_buf_) {
+			SendBuffer().swap(send_buf_);
+			send_chain_.Shrink();
+		}
+		if (send_budget_ && send_budget_len_) {
+			send_budget_->Sub(send_budget_len_);
+			send_budget_len_ = 0;
+		}
+		read_paused_ = false;
+		if (write_blocked_) {
+			//关闭了不再回调OnWriteDrained，只恢复对端读；
+			//对端恢复读可能立即往本连接转发数据，挪到Close返回之后（服务线程的下一轮定时器）
+			write_blocked_ = false;
+			if (pause_peer_) {
+				Service* svr = Service::service();
+				if (svr) {
+					svr->AddTimer(0, std::bind([](std::function<void(bool)>& pause_peer) {
+						pause_peer(false);
+					}, pause_peer_));
+				} else {
+					pause_peer_(false);
+				}
+			}
+		}
 		//lock.unlock();
 		return ret;
 	}
 
 	inline size_t NotSendBufSize() 
 	{
-		return send_buf_.size() + ppr_send_buf_.size();
+		return send_buf_.size() + send_chain_.size();
 	}
 
 	inline SendBuffer& SendBuf() 
@@ -238,12 +505,36 @@ public:
 		return SendBufDirect();
 	}
 
+	//移入整个缓存作为独立分片发送，不拷贝
+	inline void SendBuf(SendBuffer&& Buf)
+	{
+		SealSendBuf();
+		send_chain_.Append(std::move(Buf));
+		SendBufDirect();
+	}
+
+	//引用IOBuf发送，可以是其他连接接收的数据(RecvIOBuf)，不拷贝
+	inline void SendBuf(const IOBuf& Buf)
+	{
+		SealSendBuf();
+		send_chain_.Append(Buf);
+		SendBufDirect();
+	}
+
+	//引用共享缓存发送，多个连接可共享同一缓存(如广播同一包体)
+	inline void SendBuf(const SendChain::Buffer& Buf, size_t offset = 0, size_t len = std::string::npos)
+	{
+		ASSERT(Buf && offset <= Buf->size());
+		SealSendBuf();
+		send_chain_.Append(Buf, offset, std::min<size_t>(len, Buf->size() - offset));
+		SendBufDirect();
+	}
+
 	inline void SendBufDirect()
 	{
 		ASSERT(Base::IsSocket());
-		if(!Base::IsSelect(FD_WRITE)) {
-			Base::Select(FD_WRITE);
-		}
+		Base::SendDirect();
+		CheckSendWatermark();
 	}
 
 // 	int RecvBuf(char* lpBuf, int nBufLen, int* nFlags = nullptr)
@@ -309,23 +600,15 @@ public:
 
 protected:
 	//TcpSocket 实现接口
-	virtual bool PrepareRecvBuf(char* & lpBuf, int & nBufLen)
+	virtual RecvRing* PrepareRecvRing()
 	{
 		//std::lock_guard<std::mutex> lock(m_RecvSection);
 
-		lpBuf = &recv_buf_[0];
-		nBufLen = recv_buf_.size();
-
-		return true;
+		return &recv_ring_;
 	}
-	virtual bool PrepareExpandRecvBuf(char* & lpBuf, int & nBufLen)
+	virtual size_t PrepareRecvIOBuf()
 	{
-		//std::lock_guard<std::mutex> lock(m_RecvSection);
-
-		recv_buf_.resize(recv_buf_.size() * 2);
-		lpBuf = &recv_buf_[0];
-		nBufLen = recv_buf_.size();
-		return true;
+		return recv_iobuf_size_;
 	}
 
 	// virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags) 
@@ -337,27 +620,106 @@ protected:
 	// 	// recv_buf_.insert(recv_buf_.end(),lpBuf,lpBuf+nBufLen);
 	// }
 
-	virtual bool PrepareSendBuf(const char* & lpBuf, int & nBufLen)
+	//把尾部缓存封存为一个分片，之后入队的缓存排在它后面
+	inline void SealSendBuf()
 	{
-		//std::unique_lock<std::mutex> lock(m_SendSection);
-
-		int nSendBufLen = send_buf_.size();
-		if (nSendBufLen>0) {
-			ppr_send_buf_.swap(send_buf_);
+		if (!send_buf_.empty()) {
+			send_chain_.Append(std::move(send_buf_), send_off_);
 			send_buf_.clear();
-			lpBuf = ppr_send_buf_.c_str();
-			nBufLen = ppr_send_buf_.size();
-			//lock.unlock();
-			return true;
+			send_off_ = 0;
 		}
+	}
 
-		return false;
+	virtual int PrepareSendIov(struct iovec* lpIov, int nIovCnt)
+	{
+		//std::unique_lock<std::mutex> lock(m_SendSection);
+
+		int cnt = send_chain_.Fill(lpIov, nIovCnt);
+		if (cnt < nIovCnt && send_buf_.size() > send_off_) {
+			//尾部缓存原地发送，不封存，保留其容量
+			lpIov[cnt].iov_base = (void*)(send_buf_.data() + send_off_);
+			lpIov[cnt].iov_len = send_buf_.size() - send_off_;
+			cnt++;
+		}
+		return cnt;
+	}
+
+	virtual void OnSendIov(int nBufLen)
+	{
+		size_t len = send_chain_.Consume(nBufLen, [this](const char* lpBuf, int nBufLen) {
+			OnSendBuf(lpBuf, nBufLen);
+		});
+		if (len > 0 && Base::IsSocket()) {
+			send_off_ += len;
+			ASSERT(send_off_ <= send_buf_.size());
+			if (send_off_ >= send_buf_.size()) {
+				//回调里可能继续写入尾部缓存，先换出
+				SendBuffer send_buf;
+				send_buf.swap(send_buf_);
+				send_off_ = 0;
+				OnSendBuf(send_buf.data(), send_buf.size());
+				if (send_buf_.empty() && !lean_buf_) {
+					send_buf.clear();
+					send_buf_.swap(send_buf);
+				}
+			}
+		}
+		if (lean_buf_ && send_chain_.empty()) {
+			send_chain_.Shrink();
+		}
+		CheckSendWatermark();
 	}
 
 	virtual void OnSendBuf(const char* lpBuf, int nBufLen) 
 	{
 		Base::OnSendBuf(lpBuf, nBufLen);
 	}
+
+	//未发送数据超过高水位或者预算，应该停止产生发送数据
+	virtual void OnWriteBlocked()
+	{
+
+	}
+
+	//未发送数据降到低水位，可以继续产生发送数据
+	virtual void OnWriteDrained()
+	{
+
+	}
+
+	//同步预算并检查水位，未发送数据变化后调用
+	inline void CheckSendWatermark()
+	{
+		if (!Base::IsSocket()) {
+			return;
+		}
+		size_t size = NotSendBufSize();
+		if (send_budget_ && size != send_budget_len_) {
+			if (size > send_budget_len_) {
+				send_budget_->Add(size - send_budget_len_);
+			} else {
+				send_budget_->Sub(send_budget_len_ - size);
+			}
+			send_budget_len_ = size;
+		}
+		bool over_budget = send_budget_ && send_budget_->IsOver();
+		if (!write_blocked_) {
+			if (size && ((send_high_ && size >= send_high_) || over_budget)) {
+				write_blocked_ = true;
+				OnWriteBlocked();
+				if (pause_peer_) {
+					pause_peer_(true);
+				}
+			}
+		} else if (!size || (size <= send_low_ && !over_budget)) {
+			//先回调再恢复对端读，恢复读可能立即产生新的发送数据
+			write_blocked_ = false;
+			OnWriteDrained();
+			if (pause_peer_) {
+				pause_peer_(false);
+			}
+		}
+	}
 };
 
 /*!
@@ -452,9 +814,7 @@ public:
 		buffer.SendAddr = stAddr;
 		buffer.nSendFlags = nFlags;
 		SendBuffers_.push_back(buffer);
-		if(!Base::IsSelect(FD_WRITE)) {
-			Base::Select(FD_WRITE);
-		}
+		Base::SendDirect();
 		return nBufLen;
 	}
 
@@ -519,13 +879,20 @@ public:
 		return ret;
 	}
 
+	/*!
+	 *	@brief 发送数据包.
+	 *
+	 *	写直通，没有等待可写时直接发送，发送缓存满了才等待可写；
+	 *	批量接收回调里的发送先排队，这批处理完后一起发送(SetSendBatch时一次sendmmsg)
+	 */
 	int SendBuf(const Buffer& buf)
 	{
 		ASSERT(Base::IsSocket());
 		sendbufs_.emplace(buf);
-		if(!Base::IsSelect(FD_WRITE)) {
-			Base::Select(FD_WRITE);
+		if(Base::IsSelect(FD_WRITE) || Base::IsRecvBatching()) {
+			return 0;
 		}
+		Base::Trigger(FD_WRITE, 0);
 		return 0;
 	}
 	
@@ -534,6 +901,21 @@ public:
 		return SendBuf(Buffer(lpBuf,nBufLen,lpAddr,nAddrLen,nFlags));
 	}
 
+	//一次排队一组数据包，只触发一次发送，开启GSO时连续的等长数据包合成一个发送
+	int SendBufs(const Buffer* bufs, size_t count)
+	{
+		ASSERT(Base::IsSocket());
+		for (size_t i = 0; i < count; i++)
+		{
+			sendbufs_.emplace(bufs[i]);
+		}
+		if(count == 0 || Base::IsSelect(FD_WRITE) || Base::IsRecvBatching()) {
+			return 0;
+		}
+		Base::Trigger(FD_WRITE, 0);
+		return 0;
+	}
+
 protected:
 	//
 	virtual bool PrepareSendBuf(Buffer& buf)
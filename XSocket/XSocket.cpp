@@ -134,15 +134,19 @@ const char* Socket::N2Ip(u_long ip)
 
 const char* Socket::Url2Ip(const char* Url)
 {
-	struct hostent * lphost = NULL;
-	sockaddr_in addr = {0};
 	if (::inet_addr(Url) == INADDR_NONE) {
-		if ((lphost = ::gethostbyname(Url)) == NULL) {
+		//getaddrinfo可重入，结果放在线程局部缓存，不再用gethostbyname的静态缓存
+		static thread_local char ip[INET_ADDRSTRLEN] = {0};
+		struct addrinfo hints = {}, *ai_res = nullptr;
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if (GetAddrInfo(Url, nullptr, &hints, &ai_res) || !ai_res) {
 			//无效的域名
 			return "";
 		}
-		memcpy((char *)&addr.sin_addr,(char *)lphost->h_addr,lphost->h_length);
-		return (N2Ip(addr.sin_addr.s_addr));
+		IpAddr2IpStr(&((struct sockaddr_in*)ai_res->ai_addr)->sin_addr, AF_INET, ip, INET_ADDRSTRLEN);
+		freeaddrinfo(ai_res);
+		return ip;
 	}
 	//本来就是IP地址
 	return Url;
@@ -274,7 +278,9 @@ const char* Socket::Url2IpStr(const char* url, char* str, int len)
 	if(err) {
 		return "";
 	}
-	return SockAddr2IpStr(ai_res->ai_addr, ai_res->ai_addrlen, str, len);
+	const char* ip = SockAddr2IpStr(ai_res->ai_addr, ai_res->ai_addrlen, str, len);
+	freeaddrinfo(ai_res);
+	return ip;
 }
 
 int Socket::CreatePairs(SOCKET* sv, int svlen)
@@ -385,6 +391,13 @@ SOCKET Socket::Accept(SOCKET Sock, SOCKADDR* lpSockAddr, int* lpSockAddrLen)
 #endif//
 }
 
+#ifndef WIN32
+SOCKET Socket::Accept4(SOCKET Sock, SOCKADDR* lpSockAddr, int* lpSockAddrLen, int nFlags)
+{
+	return accept4(Sock,(struct sockaddr *)lpSockAddr,(socklen_t *)lpSockAddrLen,nFlags);
+}
+#endif//
+
 int Socket::Bind(SOCKET Sock, const SOCKADDR* lpSockAddr, int nSockAddrLen)
 {
 	return bind(Sock, lpSockAddr, nSockAddrLen);
@@ -410,6 +423,53 @@ int Socket::Receive(SOCKET Sock, char* lpBuf, int nBufLen, int nFlags)
 	return recv(Sock, lpBuf, nBufLen, nFlags);
 }
 
+#ifndef WIN32
+int Socket::SendMMsg(SOCKET Sock, struct mmsghdr* lpMsgs, unsigned int nMsgCnt, int nFlags)
+{
+	return sendmmsg(Sock, lpMsgs, nMsgCnt, nFlags);
+}
+
+int Socket::ReceiveMMsg(SOCKET Sock, struct mmsghdr* lpMsgs, unsigned int nMsgCnt, int nFlags)
+{
+	return recvmmsg(Sock, lpMsgs, nMsgCnt, nFlags, NULL);
+}
+
+int Socket::SendMsg(SOCKET Sock, const struct msghdr* lpMsg, int nFlags)
+{
+	return sendmsg(Sock, lpMsg, nFlags);
+}
+
+int Socket::ReceiveMsg(SOCKET Sock, struct msghdr* lpMsg, int nFlags)
+{
+	return recvmsg(Sock, lpMsg, nFlags);
+}
+#endif//
+
+int Socket::SendV(SOCKET Sock, const struct iovec* lpIov, int nIovCnt, int nFlags)
+{
+#ifdef WIN32
+	WSABUF Bufs[IOV_MAX];
+	if (nIovCnt > IOV_MAX) {
+		nIovCnt = IOV_MAX;
+	}
+	for (int i = 0; i < nIovCnt; i++)
+	{
+		Bufs[i].buf = (CHAR*)lpIov[i].iov_base;
+		Bufs[i].len = (ULONG)lpIov[i].iov_len;
+	}
+	DWORD dwSend = 0;
+	if (SOCKET_ERROR == WSASend(Sock, Bufs, nIovCnt, &dwSend, (DWORD)nFlags, NULL, NULL)) {
+		return SOCKET_ERROR;
+	}
+	return (int)dwSend;
+#else
+	struct msghdr msg = {};
+	msg.msg_iov = (struct iovec*)lpIov;
+	msg.msg_iovlen = nIovCnt;
+	return sendmsg(Sock, &msg, nFlags);
+#endif//
+}
+
 //int SyncSend(SOCKET Sock, const char* lpBuf, int nBufLen, int nFlags)
 //{
 //	//if (MSG_PARTIAL)
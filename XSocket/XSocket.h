@@ -95,14 +95,28 @@ public:
 	static int Connect(SOCKET Sock, const SOCKADDR* lpSockAddr, int nSockAddrLen);
 	static int Listen(SOCKET Sock, int nConnectionBacklog);
 	static SOCKET Accept(SOCKET Sock, SOCKADDR* lpSockAddr, int* lpSockAddrLen);
+#ifndef WIN32
+	//accept4，接受连接的同时设置SOCK_NONBLOCK|SOCK_CLOEXEC等标志，省掉后续的fcntl
+	static SOCKET Accept4(SOCKET Sock, SOCKADDR* lpSockAddr, int* lpSockAddrLen, int nFlags);
+#endif//
 	static int Send(SOCKET Sock, const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL);
 	static int Receive(SOCKET Sock, char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL);
+	//聚集发送，一次系统调用发送多个缓存
+	static int SendV(SOCKET Sock, const struct iovec* lpIov, int nIovCnt, int nFlags = MSG_NOSIGNAL);
 	//int SyncSend(SOCKET Sock, const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL);
 	//int SyncReceive(SOCKET Sock, char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL);
 	static int SendTo(SOCKET Sock, const char* lpBuf, int nBufLen,
 		const SOCKADDR* lpSockAddr = 0, int nSockAddrLen = 0, int nFlags = MSG_NOSIGNAL);
 	static int ReceiveFrom(SOCKET Sock, char* lpBuf, int nBufLen, 
 		SOCKADDR* lpSockAddr = 0, int* lpSockAddrLen = 0, int nFlags = MSG_NOSIGNAL);
+#ifndef WIN32
+	//批量收发数据报，一次系统调用收发多个数据报，返回处理的数据报个数
+	static int SendMMsg(SOCKET Sock, struct mmsghdr* lpMsgs, unsigned int nMsgCnt, int nFlags = MSG_NOSIGNAL);
+	static int ReceiveMMsg(SOCKET Sock, struct mmsghdr* lpMsgs, unsigned int nMsgCnt, int nFlags = 0);
+	//带控制消息(cmsg)收发一个数据报，如UDP_SEGMENT/UDP_GRO
+	static int SendMsg(SOCKET Sock, const struct msghdr* lpMsg, int nFlags = MSG_NOSIGNAL);
+	static int ReceiveMsg(SOCKET Sock, struct msghdr* lpMsg, int nFlags = 0);
+#endif//
 
 	static int IOCtl(SOCKET Sock, long lCommand, u_long* lpArgument);
 	static int IOCtl(SOCKET Sock, long lCommand, u_long Argument);
@@ -163,14 +177,24 @@ public:
 	inline int Connect(const SOCKADDR* lpSockAddr, int nSockAddrLen) { return Connect(sock_, lpSockAddr, nSockAddrLen); }
 	inline int Listen(int nConnectionBacklog = 5) { return Listen(sock_, nConnectionBacklog); }
 	inline SOCKET Accept(SOCKADDR* lpSockAddr, int* lpSockAddrLen) { return Accept(sock_, lpSockAddr, lpSockAddrLen); }
+#ifndef WIN32
+	inline SOCKET Accept4(SOCKADDR* lpSockAddr, int* lpSockAddrLen, int nFlags) { return Accept4(sock_, lpSockAddr, lpSockAddrLen, nFlags); }
+#endif//
 	inline int Send(const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL) { return Send(sock_, lpBuf, nBufLen, nFlags); }
 	inline int Receive(char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL) { return Receive(sock_, lpBuf, nBufLen, nFlags); }
+	inline int SendV(const struct iovec* lpIov, int nIovCnt, int nFlags = MSG_NOSIGNAL) { return SendV(sock_, lpIov, nIovCnt, nFlags); }
 	//inline int SyncSend(const char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL) { return SyncSend(sock_, lpBuf, nBufLen, nFlags); }
 	//inline int SyncReceive(char* lpBuf, int nBufLen, int nFlags = MSG_NOSIGNAL) { return SyncReceive(sock_, lpBuf, nBufLen, nFlags); }
 	inline int SendTo(const char* lpBuf, int nBufLen, const SOCKADDR* lpSockAddr, int nSockAddrLen, int nFlags = MSG_NOSIGNAL) 
 	{ return SendTo(sock_, lpBuf, nBufLen, lpSockAddr, nSockAddrLen, nFlags); }
 	inline int ReceiveFrom(char* lpBuf, int nBufLen, SOCKADDR* lpSockAddr, int* lpSockAddrLen, int nFlags = MSG_NOSIGNAL)
 	{ return ReceiveFrom(sock_, lpBuf, nBufLen, lpSockAddr, lpSockAddrLen, nFlags); }
+#ifndef WIN32
+	inline int SendMMsg(struct mmsghdr* lpMsgs, unsigned int nMsgCnt, int nFlags = MSG_NOSIGNAL) { return SendMMsg(sock_, lpMsgs, nMsgCnt, nFlags); }
+	inline int ReceiveMMsg(struct mmsghdr* lpMsgs, unsigned int nMsgCnt, int nFlags = 0) { return ReceiveMMsg(sock_, lpMsgs, nMsgCnt, nFlags); }
+	inline int SendMsg(const struct msghdr* lpMsg, int nFlags = MSG_NOSIGNAL) { return SendMsg(sock_, lpMsg, nFlags); }
+	inline int ReceiveMsg(struct msghdr* lpMsg, int nFlags = 0) { return ReceiveMsg(sock_, lpMsg, nFlags); }
+#endif//
 
 	inline int GetPeerName(SOCKADDR* lpSockAddr, int* lpSockAddrLen) { return GetPeerName(sock_, lpSockAddr, lpSockAddrLen); }
 	inline int GetSockName(SOCKADDR* lpSockAddr, int* lpSockAddrLen) { return GetSockName(sock_, lpSockAddr, lpSockAddrLen); }
@@ -54,6 +54,17 @@
 
 typedef intptr_t ssize_t;
 
+//聚集发送缓存描述，同POSIX iovec
+struct iovec
+{
+	void* iov_base;
+	size_t iov_len;
+};
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif//IOV_MAX
+
 #else //LINUX
 
 #include <sys/types.h> 
@@ -69,10 +80,15 @@ typedef intptr_t ssize_t;
 
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <sys/mman.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <fcntl.h>
 #include <errno.h>
 
@@ -96,6 +112,26 @@ typedef intptr_t ssize_t;
 typedef int SOCKET;
 #endif//SOCKET
 
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT 15
+#endif//SO_REUSEPORT
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif//SO_INCOMING_CPU
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif//SO_BUSY_POLL
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif//SO_PREFER_BUSY_POLL
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif//IOV_MAX
+
 #ifndef FAR
 #define FAR
 #endif//
@@ -324,9 +360,16 @@ typedef unsigned char byte;
 #endif
 #endif
 #else
+#ifndef USE_IOURING
+#define USE_IOURING 0
+#endif
 #ifndef USE_EPOLL
+#if USE_IOURING
+#define USE_EPOLL 0
+#else
 #define USE_EPOLL 1
 #endif
+#endif
 #if USE_EPOLL
 #define USE_EPOLLET 1
 #endif//
@@ -76,6 +76,7 @@ SocketEx::SocketEx()
 ,flags_(SOCKET_FLAG_DEBUG)
 #endif
 ,event_(0)
+,slot_tag_(0)
 {
 #ifdef _DEBUG
 	PRINTF("new Socket %p", this);
@@ -401,7 +402,7 @@ Service* Service::service()
 	return s_thread_service_;
 }
 
-Service::Service():stop_flag_(true),idle_flag_(true),notify_flag_(false),wait_timeout_(0)
+Service::Service():stop_flag_(true),notify_flag_(false),sleep_flag_(false),busy_flag_(false),wait_timeout_(0)
 {
 	
 }
@@ -22,6 +22,7 @@
 #define _H_XSOCKETEX_H_
 
 #include <atomic>
+#include <memory>
 #include <mutex>
 //#include <shared_mutex>
 #ifndef WIN32
@@ -32,7 +33,9 @@
 #include <functional>
 #include <algorithm>
 #include <vector>
+#include <array>
 #include <queue>
+#include <deque>
 #include <map>
 #include <set>
 #include <unordered_map>
@@ -40,12 +43,17 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
-#if USE_BOOST
-#include <boost/lockfree/queue.hpp>
-#endif
+#include <type_traits>
+#include <exception>
+#include <cstddef>
+#include <new>
 #include "XSocket.h"
 #include "XStr.h"
 
+#ifndef XSOCKET_TASK_INLINE_SIZE
+#define XSOCKET_TASK_INLINE_SIZE 48 //InplaceTask内嵌存储字节数，可调用对象超出时才分配内存
+#endif
+
 namespace XSocket {
 
 	class SocketEx;
@@ -100,7 +108,8 @@ public:
 	SOCKET Detach();
 	inline bool IsOpen() { return IsSocket(); }
 	int ShutDown(int nHow = Both);
-	int Close();
+	//Close为虚函数，派生模板（如IoUringSocketT）关闭前需要先取消未完成的异步操作
+	virtual int Close();
 
 	int Bind(const SOCKADDR* lpSockAddr, int nSockAddrLen);
 	int Connect(const SOCKADDR* lpSockAddr, int nSockAddrLen);
@@ -122,11 +131,24 @@ public:
 	inline int Flags() { return flags_; }
 	inline bool IsDebug() { return flags_ & SOCKET_FLAG_DEBUG; }
 
+	//所在SocketSet的槽位标签，高32位是槽位代数，低32位是槽位位置，0表示不在任何SocketSet中
+	inline void SetSlotTag(uint64_t tag) { slot_tag_ = tag; }
+	inline uint64_t SlotTag() { return slot_tag_; }
+
 	inline void AttachService(Service* svr) { OnAttachService(svr); }
 	inline void DetachService(Service* svr) { OnDetachService(svr); }
 	
 	inline void Select(int lEvent) { event_ |= lEvent; }
+	//选择事件但不立即触发，只等就绪通知；发送返回EAGAIN后等待可写用这个，立即触发必然再次EAGAIN
+	inline void SelectWait(int lEvent) { event_ |= lEvent; }
 	inline void RemoveSelect(int lEvent) { event_ &= ~lEvent; }
+	//登记到本轮事件分发结束后合并发送(auto-cork)，返回false表示不支持，需要立即发送
+	inline bool PostFlush() { return false; }
+	//读预算，本次读事件已读nReadBytes字节nReads次，用完时登记还可读，本轮其他就绪事件处理完后再继续读
+	//返回true表示已登记，应停止本次读；返回false表示未用完或者不支持，需要继续读
+	inline bool ReadBudgetExceeded(size_t /*nReadBytes*/, size_t /*nReads*/) { return false; }
+	//重新登记关注的事件，边缘触发下条件仍满足时下一轮会再次通知，水平触发无需处理
+	inline void RearmSelect() { }
 	inline bool IsSelect(int evt, bool all = false) {
 		if(all) {
 			return event_ & evt == evt;
@@ -374,6 +396,7 @@ protected:
 	uint8_t role_:3;
 	uint8_t flags_:5;
 	uint8_t event_;
+	uint64_t slot_tag_;
 
 private:
 	SocketEx(const SocketEx& Sock) {};
@@ -428,134 +451,503 @@ protected:
 /*!
  *	@brief ObjectPoolT 模板定义.
  *
- *	封装ObjectPoolT，对象池
+ *	封装ObjectPoolT，分层对象池
+ *	每个线程在每个池上有两个弹匣（loaded/previous），New和归还只操作线程本地弹匣，只有一个无竞争的原子标志
+ *	弹匣满/空时才和全局仓库整匣交换，仓库是无锁有界MPMC队列（Vyukov），不会有ABA问题
+ *	New返回侵入式引用计数句柄Ptr，最后一个Ptr析构时对象回到当前线程的弹匣，线程局部存储已析构时直接回到仓库
+ *	达到上限时New把其他线程弹匣里的对象收回仓库再取，空闲线程弹匣里的对象也能被用到
+ *	Init/Release/析构要求没有其他线程同时使用池，池要比使用它的线程活得久
  */
 template<class T, class _Ty>
 class ObjectPoolT
 {
 public:
-	ObjectPoolT():count_(0)
+	enum
+	{
+		MAGAZINE_SIZE = 32, //每个弹匣容纳的对象数
+		DEPOT_SIZE = 1024, //全局仓库最多缓存的弹匣数，必须是2的幂
+	};
+	//统计计数，hits+misses是New次数，frees是归还次数
+	struct Stats
+	{
+		size_t hits = 0; //从线程弹匣取到对象
+		size_t misses = 0; //弹匣和仓库都空，新分配对象
+		size_t depot_gets = 0; //从全局仓库取满弹匣
+		size_t depot_puts = 0; //向全局仓库放满弹匣
+		size_t frees = 0; //归还对象
+		size_t count = 0; //当前已分配对象总数
+		size_t used = 0; //正在使用的对象数
+	};
+protected:
+	struct Node
+	{
+		_Ty* obj;
+		std::atomic<uint32_t> ref;
+		ObjectPoolT* pool;
+	};
+	struct Magazine
+	{
+		size_t count = 0;
+		Node* nodes[MAGAZINE_SIZE];
+	};
+	//线程本地缓存，计数只有所属线程写，统计时其他线程读；弹匣由busy保护，平时只有所属线程访问，达到上限时其他线程收回
+	struct Cache
+	{
+		ObjectPoolT* pool = nullptr;
+		std::atomic<bool> busy{false};
+		Magazine* loaded = nullptr;
+		Magazine* previous = nullptr;
+		std::atomic<size_t> hits{0};
+		std::atomic<size_t> misses{0};
+		std::atomic<size_t> depot_gets{0};
+		std::atomic<size_t> depot_puts{0};
+		std::atomic<size_t> frees{0};
+	};
+	//线程退出时把弹匣交还仍然存活的池
+	struct Caches
+	{
+		std::vector<Cache*> caches; //按池id索引
+		~Caches()
+		{
+			//之后（包括释放对象时）再归还的对象直接回到仓库
+			LocalDead() = true;
+			for(Cache* cache : caches) {
+				if(cache) {
+					if(cache->pool) {
+						cache->pool->Detach(cache);
+					}
+					delete cache->loaded;
+					delete cache->previous;
+					delete cache;
+				}
+			}
+		}
+	};
+	static inline Caches& LocalCaches() { static thread_local Caches caches; return caches; }
+	//本线程的Caches已经析构，标志没有析构函数，线程局部存储析构期间仍然可以访问
+	static inline bool& LocalDead() { static thread_local bool dead = false; return dead; }
+	//锁住线程缓存的弹匣，只有收回时才会有竞争
+	struct CacheLock
+	{
+		Cache* cache;
+		explicit CacheLock(Cache* c):cache(c)
+		{
+			while(cache->busy.exchange(true, std::memory_order_acquire)) {
+				std::this_thread::yield();
+			}
+		}
+		~CacheLock() { cache->busy.store(false, std::memory_order_release); }
+	};
+	static inline size_t NextId() { static std::atomic<size_t> id(0); return id++; }
+	static inline void Inc(std::atomic<size_t>& counter) { counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+	//全局仓库，无锁有界MPMC队列
+	class Depot
+	{
+		struct Cell
+		{
+			std::atomic<size_t> seq;
+			Magazine* mag;
+		};
+	public:
+		Depot():enqueue_(0),dequeue_(0)
+		{
+			for(size_t i = 0; i < DEPOT_SIZE; i++)
+			{
+				cells_[i].seq.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		bool Push(Magazine* mag)
+		{
+			Cell* cell;
+			size_t pos = enqueue_.load(std::memory_order_relaxed);
+			for(;;) {
+				cell = &cells_[pos & (DEPOT_SIZE - 1)];
+				intptr_t diff = (intptr_t)cell->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+				if(diff == 0) {
+					if(enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if(diff < 0) {
+					return false; //满了
+				} else {
+					pos = enqueue_.load(std::memory_order_relaxed);
+				}
+			}
+			cell->mag = mag;
+			cell->seq.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		Magazine* Pop()
+		{
+			Cell* cell;
+			size_t pos = dequeue_.load(std::memory_order_relaxed);
+			for(;;) {
+				cell = &cells_[pos & (DEPOT_SIZE - 1)];
+				intptr_t diff = (intptr_t)cell->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+				if(diff == 0) {
+					if(dequeue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if(diff < 0) {
+					return nullptr; //空了
+				} else {
+					pos = dequeue_.load(std::memory_order_relaxed);
+				}
+			}
+			Magazine* mag = cell->mag;
+			cell->seq.store(pos + DEPOT_SIZE, std::memory_order_release);
+			return mag;
+		}
+	private:
+		Cell cells_[DEPOT_SIZE];
+		alignas(64) std::atomic<size_t> enqueue_;
+		alignas(64) std::atomic<size_t> dequeue_;
+	};
+public:
+	/*!
+	 *	@brief Ptr 定义.
+	 *
+	 *	侵入式引用计数句柄，计数和对象放在同一个节点里，拷贝只做一次原子加
+	 */
+	class Ptr
+	{
+		friend class ObjectPoolT;
+		explicit Ptr(Node* node):node_(node) {}
+	public:
+		Ptr() {}
+		Ptr(std::nullptr_t) {}
+		Ptr(const Ptr& rhs):node_(rhs.node_) { if(node_) node_->ref.fetch_add(1, std::memory_order_relaxed); }
+		Ptr(Ptr&& rhs):node_(rhs.node_) { rhs.node_ = nullptr; }
+		~Ptr() { reset(); }
+		Ptr& operator=(const Ptr& rhs) { Ptr(rhs).swap(*this); return *this; }
+		Ptr& operator=(Ptr&& rhs) { Ptr(std::move(rhs)).swap(*this); return *this; }
+
+		inline void swap(Ptr& rhs) { std::swap(node_, rhs.node_); }
+		inline void reset() {
+			if(node_) {
+				if(node_->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					node_->pool->Put(node_);
+				}
+				node_ = nullptr;
+			}
+		}
+		inline _Ty* get() const { return node_ ? node_->obj : nullptr; }
+		inline _Ty& operator*() const { return *node_->obj; }
+		inline _Ty* operator->() const { return node_->obj; }
+		inline explicit operator bool() const { return node_ != nullptr; }
+		inline size_t use_count() const { return node_ ? node_->ref.load(std::memory_order_relaxed) : 0; }
+	private:
+		Node* node_ = nullptr;
+	};
+
+	ObjectPoolT():id_(NextId()),count_(0),waiters_(0)
 	{
 	}
-	ObjectPoolT(size_t count, size_t max_count = 0)
+	ObjectPoolT(size_t count, size_t max_count = 0):ObjectPoolT()
 	{
 		Init(count, max_count);
 	}
 	~ObjectPoolT()
 	{
 		Release();
+		std::lock_guard<std::mutex> lock(mutex_);
+		for(Cache* cache : caches_) {
+			cache->pool = nullptr;
+		}
+		caches_.clear();
+		while(Magazine* mag = empty_.Pop()) {
+			delete mag;
+		}
 	}
 
+	//预分配count个对象放进全局仓库，超出仓库容量的部分按需分配
 	void Init(size_t count, size_t max_count = 0)
 	{
-		T* pT = static_cast<T*>(this);
-		count_ = count;
 		max_count_ = max_count;
-		for(size_t i = 0; i < count_; i++)
-		{
-#if USE_BOOST
-			objptrs_.push(pT->Alloc());
-#else
-			objptrs_.emplace(pT->Alloc());
-#endif
+		while(count > 0) {
+			Magazine* mag = new Magazine();
+			while(count > 0 && mag->count < MAGAZINE_SIZE) {
+				mag->nodes[mag->count++] = NewNode();
+				count--;
+			}
+			if(!full_.Push(mag)) {
+				FreeMagazine(mag);
+				delete mag;
+				break;
+			}
 		}
 	}
 
+	//等待所有对象归还，然后释放线程弹匣和仓库里的对象
 	void Release()
 	{
-		T* pT = static_cast<T*>(this);
-#if USE_BOOST
-		while(count_ != objptrs_.size())) {
-			std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+		while(GetStats().used > 0) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		for(Cache* cache : caches_) {
+			FreeMagazine(cache->loaded);
+			FreeMagazine(cache->previous);
 		}
-		auto objptr = nullptr;
-		while(!objptrs_.pop(objptr)) {
-			pT->Free(objptr);
+		while(Magazine* mag = full_.Pop()) {
+			FreeMagazine(mag);
+			if(!empty_.Push(mag)) {
+				delete mag;
+			}
 		}
-#else
-		std::unique_lock<std::mutex> lock(mutex_);
-		while(count_ != objptrs_.size()) {
-			cv_.wait(lock);
+	}
+
+	Stats GetStats()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		Stats stats = detached_;
+		for(Cache* cache : caches_) {
+			stats.hits += cache->hits.load(std::memory_order_relaxed);
+			stats.misses += cache->misses.load(std::memory_order_relaxed);
+			stats.depot_gets += cache->depot_gets.load(std::memory_order_relaxed);
+			stats.depot_puts += cache->depot_puts.load(std::memory_order_relaxed);
+			stats.frees += cache->frees.load(std::memory_order_relaxed);
 		}
-		while(!objptrs_.empty()) {
-			auto objptr = objptrs_.front();
-			pT->Free(objptr);
-			objptrs_.pop();
+		stats.count = count_.load(std::memory_order_relaxed);
+		//其他线程的计数是分别读的，可能短暂出现frees领先
+		stats.used = stats.hits + stats.misses > stats.frees ? stats.hits + stats.misses - stats.frees : 0;
+		return stats;
+	}
+
+	Ptr New()
+	{
+		if(LocalDead()) {
+			return Ptr(NewDead());
 		}
-#endif
+		Cache* cache = LocalCache();
+		Node* node = Get(cache);
+		if(!node) {
+			if(!max_count_ || count_.load(std::memory_order_relaxed) < max_count_) {
+				node = NewNode();
+				Inc(cache->misses);
+			} else {
+				//达到上限，通知归还的线程把弹匣直接放回仓库，对象可能停在空闲线程的弹匣里，收回到仓库再取
+				waiters_.fetch_add(1, std::memory_order_relaxed);
+				while(!(node = Get(cache))) {
+					Reclaim(cache);
+					if((node = Get(cache))) {
+						break;
+					}
+					std::this_thread::sleep_for(std::chrono::microseconds(1));
+				}
+				waiters_.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+		node->ref.store(1, std::memory_order_relaxed);
+		return Ptr(node);
+	}
+protected:
+	inline _Ty* Alloc() { return new _Ty(); }
+	inline void Free(_Ty* ptr) { return delete ptr; }
+private:
+	inline Cache* LocalCache()
+	{
+		std::vector<Cache*>& caches = LocalCaches().caches;
+		if(id_ < caches.size() && caches[id_]) {
+			return caches[id_];
+		}
+		return Attach();
 	}
 
-	/*template<typename _Rep, typename _Period>
-	std::shared_ptr<_Ty> New(const std::chrono::duration<_Rep, _Period>& timeout)
+	Cache* Attach()
 	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if(!cv_.wait_for(lock,timeout,[this] { return !objptrs_.empty(); })) {
-			return nullptr;
+		std::vector<Cache*>& caches = LocalCaches().caches;
+		if(caches.size() <= id_) {
+			caches.resize(id_ + 1, nullptr);
 		}
-		auto objptr = std::shared_ptr<_Ty>(objptrs_.front(),[this](_Ty* objptr){ 
-			std::lock_guard<std::mutex> lock(mutex_);
-			objptrs_.emplace(objptr);
-			cv_.notify_one();
-		});
-		objptrs_.pop();
-		return objptr;
-	}*/
+		Cache* cache = new Cache();
+		cache->pool = this;
+		cache->loaded = new Magazine();
+		cache->previous = new Magazine();
+		std::lock_guard<std::mutex> lock(mutex_);
+		caches_.push_back(cache);
+		caches[id_] = cache;
+		return cache;
+	}
 
-	std::shared_ptr<_Ty> New()
+	//线程退出，弹匣放回仓库，计数并入detached_
+	void Detach(Cache* cache)
 	{
-		T* pT = static_cast<T*>(this);
-		_Ty* objptr = nullptr;
-#if USE_BOOST
-		if(!objptrs_.pop(objptr)) {
-			if(max_count_ && count_ > max_count_) {
-				do {
-					std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
-				} while(!objptrs_.pop(objptr));
+		std::lock_guard<std::mutex> lock(mutex_);
+		caches_.erase(std::remove(caches_.begin(), caches_.end(), cache), caches_.end());
+		detached_.hits += cache->hits.load(std::memory_order_relaxed);
+		detached_.misses += cache->misses.load(std::memory_order_relaxed);
+		detached_.depot_gets += cache->depot_gets.load(std::memory_order_relaxed);
+		detached_.depot_puts += cache->depot_puts.load(std::memory_order_relaxed);
+		detached_.frees += cache->frees.load(std::memory_order_relaxed);
+		Magazine* mags[2] = { cache->loaded, cache->previous };
+		for(Magazine* mag : mags) {
+			if(!mag->count || !full_.Push(mag)) {
+				FreeMagazine(mag);
+				delete mag;
+			}
+		}
+		cache->loaded = nullptr;
+		cache->previous = nullptr;
+		cache->pool = nullptr;
+	}
+
+	//把其他线程弹匣里的对象放回仓库
+	void Reclaim(Cache* self)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for(Cache* cache : caches_) {
+			if(cache == self) {
+				continue;
+			}
+			CacheLock cache_lock(cache);
+			Magazine** mags[2] = { &cache->loaded, &cache->previous };
+			for(Magazine** mag : mags) {
+				if((*mag)->count && full_.Push(*mag)) {
+					Inc(cache->depot_puts);
+					*mag = NewMagazine();
+				}
+			}
+		}
+	}
+
+	//线程局部存储析构期间没有线程缓存，直接从仓库取一个对象
+	inline Node* NewDead()
+	{
+		Node* node = nullptr;
+		if(Magazine* mag = full_.Pop()) {
+			node = mag->nodes[--mag->count];
+			if(!mag->count || !full_.Push(mag)) {
+				PutDead(mag);
+			}
+		} else {
+			node = NewNode();
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		detached_.misses++;
+		node->ref.store(1, std::memory_order_relaxed);
+		return node;
+	}
+
+	//线程局部存储析构期间归还，单个对象装一个弹匣放回仓库
+	inline void PutDead(Node* node)
+	{
+		Magazine* mag = NewMagazine();
+		mag->nodes[mag->count++] = node;
+		PutDead(mag);
+		std::lock_guard<std::mutex> lock(mutex_);
+		detached_.frees++;
+	}
+	inline void PutDead(Magazine* mag)
+	{
+		if(!mag->count) {
+			if(!empty_.Push(mag)) {
+				delete mag;
+			}
+		} else if(!full_.Push(mag)) {
+			FreeMagazine(mag);
+			delete mag;
+		}
+	}
+
+	inline Node* Get(Cache* cache)
+	{
+		CacheLock cache_lock(cache);
+		Magazine*& loaded = cache->loaded;
+		if(!loaded->count) {
+			if(cache->previous->count) {
+				std::swap(loaded, cache->previous);
+			} else if(Magazine* full = full_.Pop()) {
+				if(!empty_.Push(loaded)) {
+					delete loaded;
+				}
+				loaded = full;
+				Inc(cache->depot_gets);
 			} else {
-				objptr = pT->Alloc();
-				count_++;
+				return nullptr;
 			}
-		} 
-		auto sp_objptr = std::shared_ptr<_Ty>(objptr,[this](_Ty* objptr) { 
-			objptrs_.push(objptr);
-		});
-		return sp_objptr;
-#else
-		std::unique_lock<std::mutex> lock(mutex_);
-		if(objptrs_.empty()) {
-			if(max_count_ && count_ > max_count_) {
-				cv_.wait(lock);
-				objptr = objptrs_.front();
-				objptrs_.pop();
+		}
+		Inc(cache->hits);
+		return loaded->nodes[--loaded->count];
+	}
+
+	inline void Put(Node* node)
+	{
+		if(LocalDead()) {
+			PutDead(node);
+			return;
+		}
+		Cache* cache = LocalCache();
+		CacheLock cache_lock(cache);
+		Magazine*& loaded = cache->loaded;
+		if(loaded->count == MAGAZINE_SIZE) {
+			if(!cache->previous->count) {
+				std::swap(loaded, cache->previous);
 			} else {
-				objptr = pT->Alloc();
-				count_++;
+				PutDepot(cache, cache->previous);
+				cache->previous = loaded;
+				loaded = NewMagazine();
 			}
+		}
+		loaded->nodes[loaded->count++] = node;
+		Inc(cache->frees);
+		if(waiters_.load(std::memory_order_relaxed)) {
+			PutDepot(cache, loaded);
+			loaded = NewMagazine();
+		}
+	}
+
+	inline void PutDepot(Cache* cache, Magazine* mag)
+	{
+		if(full_.Push(mag)) {
+			Inc(cache->depot_puts);
 		} else {
-			objptr = objptrs_.front();
-			objptrs_.pop();
+			//仓库满了，说明对象远多于使用量，整匣释放
+			FreeMagazine(mag);
+			delete mag;
 		}
-		auto sp_objptr = std::shared_ptr<_Ty>(objptr,[this](_Ty* objptr) { 
-			std::lock_guard<std::mutex> lock(mutex_);
-			objptrs_.emplace(objptr);
-			cv_.notify_one();
-		});
-		return sp_objptr;
-#endif
 	}
-protected:
-	inline _Ty* Alloc() { return new _Ty(); }
-	inline void Free(_Ty* ptr) { return delete ptr; }
+
+	inline Magazine* NewMagazine()
+	{
+		Magazine* mag = empty_.Pop();
+		return mag ? mag : new Magazine();
+	}
+
+	inline Node* NewNode()
+	{
+		T* pT = static_cast<T*>(this);
+		Node* node = new Node();
+		node->obj = pT->Alloc();
+		node->ref.store(0, std::memory_order_relaxed);
+		node->pool = this;
+		count_.fetch_add(1, std::memory_order_relaxed);
+		return node;
+	}
+
+	void FreeMagazine(Magazine* mag)
+	{
+		T* pT = static_cast<T*>(this);
+		for(size_t i = 0; i < mag->count; i++)
+		{
+			pT->Free(mag->nodes[i]->obj);
+			delete mag->nodes[i];
+		}
+		count_.fetch_sub(mag->count, std::memory_order_relaxed);
+		mag->count = 0;
+	}
 private:
+	const size_t id_;
 	size_t max_count_ = 0; //0表示不限制
 	std::atomic<size_t> count_;
-#if USE_BOOST
-	boost::lockfree::queue<_Ty > objptrs_;
-#else
-	std::queue<_Ty*> objptrs_;
-	std::mutex mutex_;
-	std::condition_variable cv_;
-#endif
+	std::atomic<size_t> waiters_; //因为达到上限在等待的New数
+	Depot full_; //装有对象的弹匣
+	Depot empty_; //空弹匣
+	std::mutex mutex_; //只保护caches_和detached_
+	std::vector<Cache*> caches_;
+	Stats detached_; //已退出线程的计数
 };
 class BufferPool : public ObjectPoolT<BufferPool,std::string>
 {
@@ -690,468 +1082,2116 @@ private:
 // };
 
 /*!
- *	@brief Service 定义.
+ *	@brief InplaceTaskT 模板定义.
  *
- *	封装Service，实现基本服务框架
+ *	封装InplaceTaskT，只能移动的无参任务，可调用对象不超过Capacity字节时直接内嵌存储，不分配内存
+ *	超出Capacity的可调用对象退化为堆分配
  */
-class Service 
+template<size_t Capacity>
+class InplaceTaskT
 {
-protected:
-    //停止标记，默认停止状态，启动后停止状态为false
-    std::atomic<bool> stop_flag_;
-	uint32_t idle_flag_:1; //空闲处理标志,0表示不执行空闲任务，1表示执行空闲任务
-	uint32_t notify_flag_:1; //通知处理标志,0表示没有通知任务，1表示有通知任务
-	uint32_t wait_timeout_:30; //服务等待时间（毫秒）
-	std::chrono::steady_clock::time_point timer_time_; //最短定时任务时间,0表示没有定时任务，非0表示最短定时任务
+	template<size_t> friend class InplaceTaskT;
+	struct Ops
+	{
+		void (*invoke)(void* data);
+		void (*move)(void* dst, void* src); //移动到dst，并析构src
+		void (*destroy)(void* data);
+	};
+	template<class F>
+	struct InplaceOps
+	{
+		static void Invoke(void* data) { (*static_cast<F*>(data))(); }
+		static void Move(void* dst, void* src) { F* f = static_cast<F*>(src); ::new(dst) F(std::move(*f)); f->~F(); }
+		static void Destroy(void* data) { static_cast<F*>(data)->~F(); }
+		static const Ops* Get() { static const Ops ops = { &Invoke, &Move, &Destroy }; return &ops; }
+	};
+	template<class F>
+	struct HeapOps
+	{
+		static void Invoke(void* data) { (**static_cast<F**>(data))(); }
+		static void Move(void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+		static void Destroy(void* data) { delete *static_cast<F**>(data); }
+		static const Ops* Get() { static const Ops ops = { &Invoke, &Move, &Destroy }; return &ops; }
+	};
+	template<class F>
+	struct IsInplace : std::integral_constant<bool, sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t)> {};
 public:
-	static Service* service();
+	enum { capacity = Capacity };
 
-	Service();
-
-	inline bool StartTest()
+	InplaceTaskT():ops_(nullptr) {}
+	InplaceTaskT(std::nullptr_t):ops_(nullptr) {}
+	template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InplaceTaskT>::value>::type>
+	InplaceTaskT(F&& f):ops_(nullptr)
 	{
-		bool expected = true;
-		if (!stop_flag_.compare_exchange_strong(expected, false)) {
-			return false; //已经Start过了
-		}
-		return true;
+		Assign(std::forward<F>(f));
 	}
-	inline void Start() { ASSERT(!IsStopFlag()); }
-	inline bool StopTest()
+	InplaceTaskT(InplaceTaskT&& o):ops_(o.ops_)
 	{
-		bool expected = false;
-		if (!stop_flag_.compare_exchange_strong(expected, true)) {
-			return false; //已经Stop过了
+		if (ops_) {
+			ops_->move(&data_, &o.data_);
+			o.ops_ = nullptr;
 		}
-		return true;
 	}
-	inline void Stop() { ASSERT(IsStopFlag()); }
-	inline bool IsStopFlag() { return stop_flag_; }
+	InplaceTaskT(const InplaceTaskT&) = delete;
+	~InplaceTaskT() { Reset(); }
 
-	inline void SetWaitTimeOut(size_t millis) { wait_timeout_ = millis; }
-	inline size_t GetWaitTimeOut() { return wait_timeout_; }
-	
-	inline void PostNotify() { notify_flag_ = true; idle_flag_ = false; }
-	inline void PostTimer(size_t millis) { 
-		std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now() + std::chrono::milliseconds(millis);
-		if(!timer_time_.time_since_epoch().count()) {
-			timer_time_ = time;
-		} else if(timer_time_ > time) { 
-			timer_time_ = time; 
-		} 
-	}
-	
-protected:
-	//
-	inline size_t GetWaitingTimeOut()
+	InplaceTaskT& operator=(InplaceTaskT&& o)
 	{
-		if(notify_flag_) {
-			return 0;
-		}
-		if(timer_time_.time_since_epoch().count()) {
-			std::chrono::milliseconds span = std::chrono::duration_cast<std::chrono::milliseconds>(timer_time_ - std::chrono::steady_clock::now());
-			int64_t span_count = span.count();
-			if(span_count <= 0) {
-				return 0;
-			}
-			if(span_count < wait_timeout_) {
-				return span_count;
+		if (this != &o) {
+			Reset();
+			if (o.ops_) {
+				o.ops_->move(&data_, &o.data_);
+				ops_ = o.ops_;
+				o.ops_ = nullptr;
 			}
 		}
-		return wait_timeout_;
+		return *this;
 	}
+	InplaceTaskT& operator=(const InplaceTaskT&) = delete;
+	InplaceTaskT& operator=(std::nullptr_t) { Reset(); return *this; }
 
-	virtual bool OnInit();
+	inline explicit operator bool() const { return ops_ != nullptr; }
+	inline void operator()() const { ops_->invoke(const_cast<void*>(static_cast<const void*>(&data_))); } //同std::function，const调用
 
-	virtual void OnTerm()
+	inline void Reset()
 	{
-
+		if (ops_) {
+			ops_->destroy(&data_);
+			ops_ = nullptr;
+		}
 	}
 
-	virtual void OnNotify()
-	{
+private:
+	template<class F> static inline bool IsNull(const F&) { return false; }
+	template<class F> static inline bool IsNull(F* f) { return !f; }
+	template<class F> static inline bool IsNull(const std::function<F>& f) { return !f; }
+	template<size_t N> static inline bool IsNull(const InplaceTaskT<N>& f) { return !f; }
 
+	template<class F>
+	inline void Assign(F&& f)
+	{
+		typedef typename std::decay<F>::type Fn;
+		if (IsNull(f)) {
+			return; //空的std::function、函数指针等当作空任务
+		}
+		Store<Fn>(std::forward<F>(f), IsInplace<Fn>());
 	}
-
-	virtual void OnWait()
+	template<class Fn, class F>
+	inline void Store(F&& f, std::true_type)
 	{
-
+		::new(&data_) Fn(std::forward<F>(f));
+		ops_ = InplaceOps<Fn>::Get();
 	}
-	
-	virtual void OnTimer()
+	template<class Fn, class F>
+	inline void Store(F&& f, std::false_type)
 	{
+		*reinterpret_cast<Fn**>(&data_) = new Fn(std::forward<F>(f));
+		ops_ = HeapOps<Fn>::Get();
+	}
+
+private:
+	typename std::aligned_storage<Capacity < sizeof(void*) ? sizeof(void*) : Capacity, alignof(std::max_align_t)>::type data_;
+	const Ops* ops_;
+};
+typedef InplaceTaskT<XSOCKET_TASK_INLINE_SIZE> InplaceTask;
 
+template<class T> class TaskPromise;
+
+/*!
+ *	@brief TaskState 模板定义.
+ *
+ *	封装TaskState，TaskPromise/TaskFuture共享状态，一次分配，侵入式引用计数
+ */
+template<class T>
+class TaskState
+{
+	template<class> friend class TaskPromise;
+	template<class> friend class TaskFuture;
+	typedef typename std::conditional<std::is_void<T>::value, char
+		, typename std::conditional<std::is_reference<T>::value
+		, std::reference_wrapper<typename std::remove_reference<T>::type>, T>::type>::type Value;
+public:
+	TaskState():ref_(1),ready_(false) {}
+	~TaskState()
+	{
+		if (ready_ && !error_) {
+			reinterpret_cast<Value*>(&value_)->~Value();
+		}
 	}
 
-	virtual void OnIdle()
+protected:
+	inline void AddRef() { ref_.fetch_add(1, std::memory_order_relaxed); }
+	inline void Release()
 	{
+		if (ref_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			delete this;
+		}
+	}
 
+	template<class F>
+	inline void Call(F& f)
+	{
+		try {
+			CallValue(f, std::is_void<T>());
+		} catch(...) {
+			error_ = std::current_exception();
+		}
+		SetReady();
+	}
+	template<class F>
+	inline void CallValue(F& f, std::false_type) { ::new(&value_) Value(f()); }
+	template<class F>
+	inline void CallValue(F& f, std::true_type) { f(); ::new(&value_) Value(0); }
+	inline T GetValue(std::false_type) { return std::move(*reinterpret_cast<Value*>(&value_)); }
+	inline T GetValue(std::true_type) { }
+	inline void SetError(std::exception_ptr error)
+	{
+		error_ = error;
+		SetReady();
 	}
-	
-	virtual void OnRun()
+	inline void SetReady()
 	{
-		if(OnInit()) {
-			while (!IsStopFlag()) {
-				std::chrono::steady_clock::time_point tp = std::chrono::steady_clock::now();
-				if(notify_flag_) {
-					notify_flag_ = false;
-					idle_flag_ = true;
-					OnNotify();
-				}
-				if(IsStopFlag()) {
-					break;
-				}
-				OnWait();
-				if(IsStopFlag()) {
-					break;
-				}
-				if(timer_time_.time_since_epoch().count()) {
-					if(timer_time_ <= std::chrono::steady_clock::now()) {
-						timer_time_ = std::chrono::steady_clock::time_point();
-						OnTimer();
-					}
-				}
-				if(idle_flag_) {
-					if(IsStopFlag()) {
-						break;
-					}
-					OnIdle(/*std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count()*/);
-					if(IsStopFlag()) {
-						break;
-					}
-					if(!wait_timeout_) {
-						static const std::chrono::microseconds max_span(200);
-						std::chrono::microseconds tp_span = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tp);
-						if(tp_span < max_span) {
-							//std::this_thread::yield();
-							//std::this_thread::sleep_for(std::chrono::nanoseconds(1));
-							std::this_thread::sleep_for(max_span-tp_span);
-						}
-					}
-				}
-			}
+		std::lock_guard<std::mutex> lock(mutex_);
+		ready_ = true;
+		cv_.notify_all();
+	}
+	inline T Get()
+	{
+		Wait();
+		if (error_) {
+			std::rethrow_exception(error_);
 		}
-		OnTerm();
+		return GetValue(std::is_void<T>());
+	}
+	inline void Wait()
+	{
+		if (ready_) {
+			return;
+		}
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait(lock, [this] { return ready_.load(); });
 	}
+	template<class Rep, class Period>
+	inline bool WaitFor(const std::chrono::duration<Rep,Period>& timeout)
+	{
+		if (ready_) {
+			return true;
+		}
+		std::unique_lock<std::mutex> lock(mutex_);
+		return cv_.wait_for(lock, timeout, [this] { return ready_.load(); });
+	}
+
+protected:
+	std::atomic<int> ref_;
+	std::atomic<bool> ready_;
+	std::exception_ptr error_;
+	typename std::aligned_storage<sizeof(Value), alignof(Value)>::type value_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
 };
 
 /*!
- *	@brief TaskID 定义.
+ *	@brief TaskFuture 模板定义.
  *
- *	封装TaskID，实现Task唯一表示，和比较大小
+ *	封装TaskFuture，轻量future，接口兼容std::future常用部分
  */
-struct TaskID
+template<class T>
+class TaskFuture
 {
-	TaskID(size_t _delay = 0) : id(IDGenerator<size_t>::Inst().get()), time(std::chrono::steady_clock::now() + std::chrono::milliseconds(_delay)) {}
+	template<class> friend class TaskPromise;
+	explicit TaskFuture(TaskState<T>* state):state_(state) { state_->AddRef(); }
+public:
+	TaskFuture():state_(nullptr) {}
+	TaskFuture(TaskFuture&& o):state_(o.state_) { o.state_ = nullptr; }
+	TaskFuture(const TaskFuture&) = delete;
+	~TaskFuture() { if (state_) state_->Release(); }
+	TaskFuture& operator=(TaskFuture&& o) { std::swap(state_, o.state_); return *this; }
+	TaskFuture& operator=(const TaskFuture&) = delete;
+
+	inline bool valid() const { return state_ != nullptr; }
+	inline bool is_ready() const { return state_ && state_->ready_; }
+	inline void wait() const { state_->Wait(); }
+	template<class Rep, class Period>
+	inline std::future_status wait_for(const std::chrono::duration<Rep,Period>& timeout) const
+	{
+		return state_->WaitFor(timeout) ? std::future_status::ready : std::future_status::timeout;
+	}
+	//只能get一次，get后future失效
+	inline T get()
+	{
+		TaskState<T>* state = state_;
+		state_ = nullptr;
+		std::unique_ptr<TaskState<T>, void(*)(TaskState<T>*)> guard(state, [](TaskState<T>* s) { s->Release(); });
+		return state->Get();
+	}
 
-	inline bool operator<(const TaskID &o) const
+private:
+	TaskState<T>* state_;
+};
+
+/*!
+ *	@brief TaskPromise 模板定义.
+ *
+ *	封装TaskPromise，只能移动，未设置结果就析构时future得到broken_promise
+ */
+template<class T>
+class TaskPromise
+{
+public:
+	TaskPromise():state_(new TaskState<T>()) {}
+	TaskPromise(TaskPromise&& o):state_(o.state_) { o.state_ = nullptr; }
+	TaskPromise(const TaskPromise&) = delete;
+	~TaskPromise()
 	{
-		if (time < o.time) {
-			return true;
-		} else if (time > o.time) {
-			return false;
+		if (state_) {
+			if (!state_->ready_) {
+				state_->SetError(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+			}
+			state_->Release();
 		}
-		return id < o.id;
 	}
+	TaskPromise& operator=(TaskPromise&& o) { std::swap(state_, o.state_); return *this; }
+	TaskPromise& operator=(const TaskPromise&) = delete;
 
-	const size_t id;
-	const std::chrono::steady_clock::time_point time;
+	inline TaskFuture<T> get_future() { return TaskFuture<T>(state_); }
+
+	//执行f并把结果或者异常交给future
+	template<class F>
+	inline void Call(F& f) { state_->Call(f); }
+
+private:
+	TaskState<T>* state_;
 };
 
 /*!
- *	@brief TaskQue 模板定义.
+ *	@brief PackagedTaskT 模板定义.
  *
- *	封装TaskQue，任务池
+ *	封装PackagedTaskT，可调用对象和promise打包在一起，可以直接放进InplaceTask
  */
-class TaskQue
+template<class R, class F>
+class PackagedTaskT
+{
+public:
+	PackagedTaskT(TaskPromise<R>&& promise, F&& f):promise_(std::move(promise)),f_(std::move(f)) {}
+
+	inline void operator()() { promise_.Call(f_); }
+
+private:
+	TaskPromise<R> promise_;
+	F f_;
+};
+
+//不带参数时直接使用可调用对象，带参数时才bind
+template<class F>
+inline typename std::decay<F>::type TaskBind(F&& f)
+{
+	return std::forward<F>(f);
+}
+template<class F, class Arg, class... Args>
+inline auto TaskBind(F&& f, Arg&& arg, Args&&... args)
+	-> decltype(std::bind(std::forward<F>(f), std::forward<Arg>(arg), std::forward<Args>(args)...))
+{
+	return std::bind(std::forward<F>(f), std::forward<Arg>(arg), std::forward<Args>(args)...);
+}
+
+//打包f(args...)，返回任务，结果通过res获取
+template<class F, class... Args>
+inline auto MakePackagedTask(TaskFuture<typename std::result_of<F(Args...)>::type>& res, F&& f, Args&&... args)
+	-> PackagedTaskT<typename std::result_of<F(Args...)>::type, decltype(TaskBind(std::forward<F>(f), std::forward<Args>(args)...))>
+{
+	typedef typename std::result_of<F(Args...)>::type return_type;
+	TaskPromise<return_type> promise;
+	res = promise.get_future();
+	return PackagedTaskT<return_type, decltype(TaskBind(std::forward<F>(f), std::forward<Args>(args)...))>(
+		std::move(promise), TaskBind(std::forward<F>(f), std::forward<Args>(args)...));
+}
+
+/*!
+ *	@brief TimerWheel 定义.
+ *
+ *	封装TimerWheel，分层时间轮，精度1毫秒，添加、取消、重设定时器都是O(1)
+ *	每层64个槽位，共5层，最长定时2^30毫秒（约12天），更长的定时器会在级联时重新放置
+ *	非线程安全，由调用者加锁
+ */
+class TimerWheel
 {
 public:
-	inline void Push(const TaskID& key, std::function<void()> && task)
+	typedef uint64_t TimerID; //高32位是节点代数，低32位是节点位置，0表示无效定时器
+	typedef InplaceTaskT<2 * XSOCKET_TASK_INLINE_SIZE> Callback; //要能内嵌一个包装了InplaceTask的回调
+
+	enum {
+		WHEEL_BITS = 6,
+		WHEEL_SIZE = 1 << WHEEL_BITS,
+		WHEEL_MASK = WHEEL_SIZE - 1,
+		WHEEL_LEVEL = 5,
+		WHEEL_PENDING = WHEEL_SIZE * WHEEL_LEVEL, //到期待执行链表
+	};
+
+	static inline uint64_t Now() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	TimerWheel():tick_(Now())
 	{
-		//std::lock_guard<std::mutex> lock(mutex_);
-		auto it = tasks_.emplace(key,std::move(task));
-		ASSERT(it.second);
-#ifdef _DEBUG
-		printf("task pool delay queue:");
-		for(auto& pr : tasks_) {
-			ssize_t delay = std::chrono::duration_cast<std::chrono::milliseconds>(pr.first.time-std::chrono::steady_clock::now()).count();
-			printf("%d ", (int)delay);
+		for (int i = 0; i <= WHEEL_PENDING; i++)
+		{
+			heads_[i] = -1;
+		}
+		for (int i = 0; i < WHEEL_LEVEL; i++)
+		{
+			bitmap_[i] = 0;
 		}
-		printf("\n");
-#endif//
 	}
 
-	inline void Push(std::function<void()> && task)
-	{		
-		// TaskID key;
-		// Post(key, std::move(task));
-		//std::lock_guard<std::mutex> lock(mutex_);
-		tasks_que_.emplace(std::move(task));
+	inline size_t Count() { return count_; }
+
+	inline TimerID Add(size_t millis, Callback&& cb)
+	{
+		int i = free_;
+		if (i >= 0) {
+			free_ = nodes_[i].next;
+		} else {
+			i = nodes_.size();
+			nodes_.emplace_back();
+		}
+		Node& node = nodes_[i];
+		node.cb = std::move(cb);
+		uint64_t now = Now();
+		if (!count_) {
+			tick_ = now; //空的时间轮直接对齐到当前时间
+		}
+		Schedule(i, now + millis);
+		count_++;
+		return ((uint64_t)node.gen << 32) | (uint32_t)i;
 	}
 
-	inline void Remove(const TaskID& t)
+	inline bool Reset(TimerID id, size_t millis)
 	{
-		//std::unique_lock<std::mutex> lock(mutex_);
-		tasks_.erase(t);
+		int i = Find(id);
+		if (i < 0) {
+			return false;
+		}
+		Unlink(i);
+		Schedule(i, Now() + millis);
+		return true;
 	}
 
-	inline size_t Count() { return tasks_que_.size() + tasks_.size(); }
-	inline bool IsEmpty() { return tasks_que_.empty() && tasks_.empty(); }
+	inline bool Remove(TimerID id)
+	{
+		int i = Find(id);
+		if (i < 0) {
+			return false;
+		}
+		Unlink(i);
+		Free(i);
+		return true;
+	}
 
-	inline bool Pop(std::function<void()>& task, ssize_t* dealy)
+	inline bool IsActive(TimerID id) { return Find(id) >= 0; }
+
+	//推进时间轮到当前时间，到期的定时器移到待执行链表
+	void Advance()
 	{
-		if (!tasks_que_.empty()) {
-			task = std::move(tasks_que_.front());
-			tasks_que_.pop();
-			return true;
-		} else {
-			auto it = tasks_.begin();
-			if(IsActive(it->first, dealy)) {
-				task = std::move(it->second);
-				tasks_.erase(it);
-				return true;
+		uint64_t now = Now();
+		while (tick_ <= now)
+		{
+			int idx = tick_ & WHEEL_MASK;
+			if (!idx) {
+				//级联上层槽位
+				for (int k = 1; k < WHEEL_LEVEL; k++)
+				{
+					int j = (tick_ >> (WHEEL_BITS * k)) & WHEEL_MASK;
+					Cascade(k, j);
+					if (j) {
+						break;
+					}
+				}
+			}
+			if (!bitmap_[0] && !IsWheelEmpty()) {
+				//第0层为空，直接跳到下一次级联
+				uint64_t next = (tick_ | WHEEL_MASK) + 1;
+				tick_ = next <= now ? next : now + 1;
+				continue;
+			} else if (IsWheelEmpty()) {
+				tick_ = now + 1;
+				break;
 			}
+			int head = heads_[idx];
+			while (head >= 0)
+			{
+				int next = nodes_[head].next;
+				Unlink(head);
+				Link(head, WHEEL_PENDING);
+				head = next;
+			}
+			tick_++;
 		}
-		return false;
+	}
+
+	//取出一个到期的定时器回调
+	inline bool PopExpired(Callback& cb, TimerID* id = nullptr)
+	{
+		int i = heads_[WHEEL_PENDING];
+		if (i < 0) {
+			return false;
+		}
+		Unlink(i);
+		if (id) {
+			*id = ((uint64_t)nodes_[i].gen << 32) | (uint32_t)i;
+		}
+		cb = std::move(nodes_[i].cb);
+		Free(i);
+		return true;
+	}
+
+	//距离下一个需要处理的时刻还有多少毫秒，-1表示没有定时器
+	int64_t NextTimeOut()
+	{
+		if (heads_[WHEEL_PENDING] >= 0) {
+			return 0;
+		}
+		if (IsWheelEmpty()) {
+			return -1;
+		}
+		uint64_t next = (uint64_t)-1;
+		for (int k = 0; k < WHEEL_LEVEL; k++)
+		{
+			if (!bitmap_[k]) {
+				continue;
+			}
+			int shift = WHEEL_BITS * k;
+			int cur = (tick_ >> shift) & WHEEL_MASK;
+			uint64_t rot = Rotr(bitmap_[k], cur);
+			uint64_t diff = 0;
+			if (k && (rot & 1) && (tick_ & (((uint64_t)1 << shift) - 1))) {
+				//当前槽位已经级联过了，要等下一轮
+				rot &= ~(uint64_t)1;
+				diff = rot ? Ctz(rot) : WHEEL_SIZE;
+			} else {
+				diff = Ctz(rot);
+			}
+			uint64_t time = k ? (((tick_ >> shift) + diff) << shift) : (tick_ + diff);
+			if (time < next) {
+				next = time;
+			}
+		}
+		uint64_t now = Now();
+		return next > now ? (int64_t)(next - now) : 0;
 	}
 
 protected:
-	inline bool IsActive(const TaskID& t, ssize_t* delay) {
-		ssize_t diff = std::chrono::duration_cast<std::chrono::milliseconds>(t.time-std::chrono::steady_clock::now()).count();
-		if(delay) {
-			*delay = diff;
+	struct Node
+	{
+		int prev = -1;
+		int next = -1;
+		int list = -1; //所在链表，-1表示空闲
+		uint32_t gen = 1;
+		uint64_t expire = 0;
+		Callback cb;
+	};
+
+	static inline uint64_t Rotr(uint64_t v, int r) { return r ? ((v >> r) | (v << (64 - r))) : v; }
+	static inline int Ctz(uint64_t v) {
+#ifdef _MSC_VER
+		unsigned long i = 0;
+		_BitScanForward64(&i, v);
+		return (int)i;
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+
+	inline bool IsWheelEmpty() { return count_ == pending_count_; }
+
+	inline int Find(TimerID id)
+	{
+		int i = (int)(uint32_t)id;
+		if (i < 0 || i >= (int)nodes_.size()) {
+			return -1;
 		}
-		return diff <= 0;
+		const Node& node = nodes_[i];
+		if (node.list < 0 || node.gen != (uint32_t)(id >> 32)) {
+			return -1;
+		}
+		return i;
 	}
-	
-private:
-	std::map<TaskID,std::function<void()>> tasks_;
-	std::queue<std::function<void()>> tasks_que_;
+
+	inline void Schedule(int i, uint64_t expire)
+	{
+		nodes_[i].expire = expire;
+		uint64_t when = expire < tick_ ? tick_ : expire;
+		uint64_t delta = when - tick_;
+		int k = 0;
+		while (k < WHEEL_LEVEL - 1 && delta >= ((uint64_t)1 << (WHEEL_BITS * (k + 1))))
+		{
+			k++;
+		}
+		if (delta >= ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVEL))) {
+			when = tick_ + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVEL)) - 1;
+		}
+		Link(i, k * WHEEL_SIZE + ((when >> (WHEEL_BITS * k)) & WHEEL_MASK));
+	}
+
+	inline void Cascade(int k, int j)
+	{
+		int list = k * WHEEL_SIZE + j;
+		int head = heads_[list];
+		while (head >= 0)
+		{
+			int next = nodes_[head].next;
+			Unlink(head);
+			Schedule(head, nodes_[head].expire);
+			head = next;
+		}
+	}
+
+	inline void Link(int i, int list)
+	{
+		Node& node = nodes_[i];
+		node.list = list;
+		node.prev = -1;
+		node.next = heads_[list];
+		if (node.next >= 0) {
+			nodes_[node.next].prev = i;
+		}
+		heads_[list] = i;
+		if (list == WHEEL_PENDING) {
+			pending_count_++;
+		} else {
+			bitmap_[list / WHEEL_SIZE] |= (uint64_t)1 << (list & WHEEL_MASK);
+		}
+	}
+
+	inline void Unlink(int i)
+	{
+		Node& node = nodes_[i];
+		int list = node.list;
+		if (node.prev >= 0) {
+			nodes_[node.prev].next = node.next;
+		} else {
+			heads_[list] = node.next;
+		}
+		if (node.next >= 0) {
+			nodes_[node.next].prev = node.prev;
+		}
+		node.prev = node.next = node.list = -1;
+		if (list == WHEEL_PENDING) {
+			pending_count_--;
+		} else if (heads_[list] < 0) {
+			bitmap_[list / WHEEL_SIZE] &= ~((uint64_t)1 << (list & WHEEL_MASK));
+		}
+	}
+
+	inline void Free(int i)
+	{
+		Node& node = nodes_[i];
+		node.cb = nullptr;
+		if (!++node.gen) {
+			node.gen = 1;
+		}
+		node.next = free_;
+		free_ = i;
+		count_--;
+	}
+
+protected:
+	uint64_t tick_; //下一个要处理的时刻（毫秒）
+	std::vector<Node> nodes_;
+	int free_ = -1; //空闲节点链表头
+	size_t count_ = 0; //定时器数
+	size_t pending_count_ = 0; //到期待执行定时器数
+	int heads_[WHEEL_PENDING + 1]; //各槽位链表头
+	uint64_t bitmap_[WHEEL_LEVEL]; //各层非空槽位位图
 };
 
 /*!
- *	@brief ThreadPool 模板定义.
+ *	@brief Service 定义.
  *
- *	封装ThreadPool，线程池
+ *	封装Service，实现基本服务框架
  */
-class ThreadPool : public TaskQue
+class Service 
 {
+protected:
+    //停止标记，默认停止状态，启动后停止状态为false
+    std::atomic<bool> stop_flag_;
+	std::atomic<bool> notify_flag_; //通知处理标志,false表示没有通知任务，true表示有通知任务，其他线程会写
+	std::atomic<bool> sleep_flag_; //休眠标志,true表示服务线程即将阻塞等待，其他线程通知时才需要真正唤醒
+	uint32_t busy_flag_:1; //忙轮询标志,0表示空闲时休眠，1表示OnWait自行忙轮询，空闲时不再休眠
+	uint32_t wait_timeout_:31; //服务等待时间（毫秒）
+	std::chrono::steady_clock::time_point timer_time_; //最短定时任务时间,0表示没有定时任务，非0表示最短定时任务
+	TimerWheel timer_wheel_; //定时器时间轮
+	std::mutex timer_mutex_;
+	TimerWheel::TimerID timer_running_ = 0; //正在锁外执行的定时器
+	std::thread::id timer_thread_; //执行定时器回调的线程
+	std::condition_variable timer_cond_; //定时器回调执行完通知RemoveTimer
+	std::chrono::steady_clock::time_point wait_tp_; //开始阻塞等待的时刻，0表示没有在等待
+	std::chrono::steady_clock::time_point load_tp_; //负载统计窗口开始时刻
+	uint64_t load_wait_us_ = 0; //统计窗口内阻塞等待耗时（微秒）
+	std::atomic<uint32_t> load_{0}; //最近的循环利用率（千分比），其他线程会读
 public:
-	static ThreadPool& Inst() {
-		static ThreadPool _inst(std::thread::hardware_concurrency() + 1);
-		return _inst;
-	}
+	typedef TimerWheel::TimerID TimerID;
+	enum { LOAD_WINDOW_US = 100000 }; //负载统计窗口（微秒）
+
+	static Service* service();
+
+	Service();
 
-	ThreadPool() : stop_flag_(true)
+	inline bool StartTest()
 	{
-		
+		bool expected = true;
+		if (!stop_flag_.compare_exchange_strong(expected, false)) {
+			return false; //已经Start过了
+		}
+		return true;
+	}
+	inline void Start() { ASSERT(!IsStopFlag()); }
+	inline bool StopTest()
+	{
+		bool expected = false;
+		if (!stop_flag_.compare_exchange_strong(expected, true)) {
+			return false; //已经Stop过了
+		}
+		return true;
 	}
-	ThreadPool(size_t threads) : stop_flag_(true)
+	inline void Stop() { ASSERT(IsStopFlag()); }
+	inline bool IsStopFlag() { return stop_flag_; }
+
+	inline void SetWaitTimeOut(size_t millis) { wait_timeout_ = millis; }
+	inline size_t GetWaitTimeOut() { return wait_timeout_; }
+
+	/*!
+	 *	@brief 获取最近的循环利用率（千分比）.
+	 *
+	 *	服务线程没有阻塞等待的时间占比，每LOAD_WINDOW_US统计一次并平滑，忙轮询也算忙；
+	 *	用BeginWaiting/EndWaiting等待的服务才有统计，长时间阻塞时醒来才更新，可以在任意线程读
+	 */
+	inline uint32_t GetLoad() { return load_.load(std::memory_order_relaxed); }
+	
+	/*!
+	 *	@brief 添加定时器.
+	 *
+	 *	回调在服务线程执行，任意线程都可以调用；
+	 *	其他线程调用并且比时间轮上最近的定时器还早到期时唤醒服务线程，按新的到期时间重新等待
+	 */
+	inline TimerID AddTimer(size_t millis, TimerWheel::Callback&& cb) {
+		TimerID id = 0;
+		bool wakeup = false;
+		{
+		std::lock_guard<std::mutex> lock(timer_mutex_);
+		wakeup = IsTimerWakeUp(millis);
+		id = timer_wheel_.Add(millis, std::move(cb));
+		}
+		if(wakeup) {
+			PostNotify();
+		}
+		return id;
+	}
+	//重设定时器到期时间，定时器已经执行或者取消返回false
+	inline bool ResetTimer(TimerID id, size_t millis) {
+		bool ret = false, wakeup = false;
+		{
+		std::lock_guard<std::mutex> lock(timer_mutex_);
+		wakeup = IsTimerWakeUp(millis);
+		ret = timer_wheel_.Reset(id, millis);
+		}
+		if(ret && wakeup) {
+			PostNotify();
+		}
+		return ret;
+	}
+	//回调正在其他线程执行时等它执行完，返回后回调不会再访问调用者，可以放心释放；
+	//回调里取消自己不等待，调用者不能持有回调需要的锁
+	inline bool RemoveTimer(TimerID id) {
+		std::unique_lock<std::mutex> lock(timer_mutex_);
+		if (timer_wheel_.Remove(id)) {
+			return true;
+		}
+		while (id && id == timer_running_ && timer_thread_ != std::this_thread::get_id())
+		{
+			timer_cond_.wait(lock);
+		}
+		return false;
+	}
+	inline bool IsTimerActive(TimerID id) {
+		std::lock_guard<std::mutex> lock(timer_mutex_);
+		return timer_wheel_.IsActive(id);
+	}
+
+	//派生的服务重载来真正唤醒阻塞等待的服务线程（写eventfd等）
+	virtual void PostNotify() { notify_flag_ = true; }
+	//通知之后调用，返回true表示服务线程阻塞在等待中，需要真正唤醒（写eventfd等）
+	inline bool IsNeedWakeUp() { return sleep_flag_.load() && sleep_flag_.exchange(false); }
+	inline void PostTimer(size_t millis) { 
+		std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now() + std::chrono::milliseconds(millis);
+		if(!timer_time_.time_since_epoch().count()) {
+			timer_time_ = time;
+		} else if(timer_time_ > time) { 
+			timer_time_ = time; 
+		} 
+	}
+	
+protected:
+	//
+	inline size_t GetWaitingTimeOut()
+	{
+		if(notify_flag_) {
+			return 0;
+		}
+		size_t timeout = wait_timeout_;
+		if(timer_time_.time_since_epoch().count()) {
+			std::chrono::milliseconds span = std::chrono::duration_cast<std::chrono::milliseconds>(timer_time_ - std::chrono::steady_clock::now());
+			int64_t span_count = span.count();
+			if(span_count <= 0) {
+				return 0;
+			}
+			if((size_t)span_count < timeout) {
+				timeout = span_count;
+			}
+		}
+		int64_t wheel_timeout = GetTimerTimeOut();
+		if(wheel_timeout >= 0 && (size_t)wheel_timeout < timeout) {
+			timeout = wheel_timeout;
+		}
+		return timeout;
+	}
+
+	/*!
+	 *	@brief 开始阻塞等待，返回等待时间.
+	 *
+	 *	先标记休眠再检查通知标志，和PostNotify先置通知标志再检查休眠标志配对，
+	 *	保证不会丢失唤醒；返回0表示有通知或者定时任务，不需要阻塞
+	 */
+	inline size_t BeginWaiting()
+	{
+		sleep_flag_.store(true);
+		size_t timeout = GetWaitingTimeOut();
+		if(!timeout) {
+			sleep_flag_.store(false, std::memory_order_relaxed);
+		} else {
+			wait_tp_ = std::chrono::steady_clock::now();
+		}
+		return timeout;
+	}
+	inline void EndWaiting()
+	{
+		sleep_flag_.store(false, std::memory_order_relaxed);
+		if(wait_tp_.time_since_epoch().count()) {
+			AddWaitTime(std::chrono::steady_clock::now() - wait_tp_);
+			wait_tp_ = std::chrono::steady_clock::time_point();
+		}
+	}
+
+	inline void AddWaitTime(std::chrono::steady_clock::duration span)
+	{
+		load_wait_us_ += std::chrono::duration_cast<std::chrono::microseconds>(span).count();
+	}
+
+	//统计窗口到了就计算这个窗口的利用率，和之前的平均
+	inline void UpdateLoad(std::chrono::steady_clock::time_point now)
+	{
+		if(!load_tp_.time_since_epoch().count()) {
+			load_tp_ = now;
+			return;
+		}
+		uint64_t span = std::chrono::duration_cast<std::chrono::microseconds>(now - load_tp_).count();
+		if(span < LOAD_WINDOW_US) {
+			return;
+		}
+		uint64_t wait = std::min<uint64_t>(load_wait_us_, span);
+		uint32_t util = (uint32_t)((span - wait) * 1000 / span);
+		load_.store((load_.load(std::memory_order_relaxed) + util) / 2, std::memory_order_relaxed);
+		load_tp_ = now;
+		load_wait_us_ = 0;
+	}
+
+	//其他线程添加的定时器比最近的定时器早到期，服务线程可能按原来的时间阻塞，需要唤醒；持timer_mutex_调用
+	inline bool IsTimerWakeUp(size_t millis)
+	{
+		if(service() == this) {
+			return false;
+		}
+		int64_t next = timer_wheel_.NextTimeOut();
+		return next < 0 || (int64_t)millis < next;
+	}
+
+	inline int64_t GetTimerTimeOut()
+	{
+		std::lock_guard<std::mutex> lock(timer_mutex_);
+		return timer_wheel_.NextTimeOut();
+	}
+
+	//执行到期的定时器
+	inline void DoTimerWheel()
+	{
+		std::unique_lock<std::mutex> lock(timer_mutex_);
+		if(!timer_wheel_.Count()) {
+			return;
+		}
+		timer_wheel_.Advance();
+		TimerWheel::Callback cb;
+		TimerID id = 0;
+		while(timer_wheel_.PopExpired(cb, &id))
+		{
+			timer_running_ = id;
+			timer_thread_ = std::this_thread::get_id();
+			lock.unlock();
+			cb();
+			cb = nullptr;
+			lock.lock();
+			timer_running_ = 0;
+			timer_cond_.notify_all();
+		}
+	}
+
+	virtual bool OnInit();
+
+	virtual void OnTerm()
+	{
+
+	}
+
+	virtual void OnNotify()
+	{
+
+	}
+
+	virtual void OnWait()
+	{
+
+	}
+	
+	virtual void OnTimer()
+	{
+
+	}
+
+	virtual void OnIdle()
+	{
+
+	}
+	
+	virtual void OnRun()
+	{
+		if(OnInit()) {
+			while (!IsStopFlag()) {
+				std::chrono::steady_clock::time_point tp = std::chrono::steady_clock::now();
+				UpdateLoad(tp);
+				if(notify_flag_.exchange(false)) {
+					OnNotify();
+				}
+				if(IsStopFlag()) {
+					break;
+				}
+				OnWait();
+				if(IsStopFlag()) {
+					break;
+				}
+				DoTimerWheel();
+				if(IsStopFlag()) {
+					break;
+				}
+				if(timer_time_.time_since_epoch().count()) {
+					if(timer_time_ <= std::chrono::steady_clock::now()) {
+						timer_time_ = std::chrono::steady_clock::time_point();
+						OnTimer();
+					}
+				}
+				if(!notify_flag_) {
+					if(IsStopFlag()) {
+						break;
+					}
+					OnIdle(/*std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count()*/);
+					if(IsStopFlag()) {
+						break;
+					}
+					if(!wait_timeout_ && !busy_flag_) {
+						static const std::chrono::microseconds max_span(200);
+						std::chrono::microseconds tp_span = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tp);
+						if(tp_span < max_span) {
+							//std::this_thread::yield();
+							//std::this_thread::sleep_for(std::chrono::nanoseconds(1));
+							std::this_thread::sleep_for(max_span-tp_span);
+							AddWaitTime(max_span-tp_span);
+						}
+					}
+				}
+			}
+		}
+		OnTerm();
+	}
+};
+
+/*!
+ *	@brief TaskID 定义.
+ *
+ *	封装TaskID，实现Task唯一表示，和比较大小
+ */
+struct TaskID
+{
+	TaskID(size_t _delay = 0) : id(NextID()), time(std::chrono::steady_clock::now() + std::chrono::milliseconds(_delay)) {}
+
+	//每个线程一次领取一段ID，避免每次都竞争全局原子计数
+	static inline size_t NextID()
+	{
+		enum { ID_SEGMENT = 4096 };
+		static std::atomic<size_t> s_next(0);
+		static thread_local size_t t_id = 0, t_end = 0;
+		if (t_id == t_end) {
+			t_id = s_next.fetch_add(ID_SEGMENT, std::memory_order_relaxed);
+			t_end = t_id + ID_SEGMENT;
+		}
+		return ++t_id;
+	}
+
+	inline bool operator<(const TaskID &o) const
+	{
+		if (time < o.time) {
+			return true;
+		} else if (time > o.time) {
+			return false;
+		}
+		return id < o.id;
+	}
+
+	const size_t id;
+	const std::chrono::steady_clock::time_point time;
+};
+
+/*!
+ *	@brief MPSCQueue 模板定义.
+ *
+ *	封装MPSCQueue，无锁多生产者单消费者队列（Vyukov），节点内嵌数据
+ *	任意线程Push，只有消费线程可以Pop/IsEmpty
+ *	消费完的节点挂到空闲链表，生产线程整条取走放进线程本地缓存复用，稳定后Push不分配内存
+ */
+template<class T>
+class MPSCQueue
+{
+	struct Node
+	{
+		Node():next(nullptr) {}
+		std::atomic<Node*> next;
+		T value;
+	};
+	struct NodeCache
+	{
+		enum { MAX_COUNT = 1024 };
+		Node* head = nullptr;
+		size_t count = 0;
+		~NodeCache()
+		{
+			while(head) {
+				Node* node = head;
+				head = node->next.load(std::memory_order_relaxed);
+				delete node;
+			}
+		}
+	};
+	static inline NodeCache& Cache()
+	{
+		static thread_local NodeCache cache;
+		return cache;
+	}
+public:
+	MPSCQueue():head_(new Node()),free_(nullptr)
+	{
+		tail_ = head_.load(std::memory_order_relaxed);
+	}
+	~MPSCQueue()
+	{
+		T value;
+		while(Pop(value));
+		delete tail_;
+		Node* node = free_.load(std::memory_order_acquire);
+		while(node) {
+			Node* next = node->next.load(std::memory_order_relaxed);
+			delete node;
+			node = next;
+		}
+	}
+
+	inline void Push(T&& value)
+	{
+		Node* node = Alloc();
+		node->value = std::move(value);
+		node->next.store(nullptr, std::memory_order_relaxed);
+		Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	inline bool Pop(T& value)
+	{
+		Node* tail = tail_;
+		Node* next = tail->next.load(std::memory_order_acquire);
+		if(!next) {
+			return false;
+		}
+		value = std::move(next->value);
+		next->value = T();
+		tail_ = next;
+		Free(tail);
+		return true;
+	}
+
+	inline bool IsEmpty() { return !tail_->next.load(std::memory_order_acquire); }
+
+protected:
+	inline Node* Alloc()
+	{
+		NodeCache& cache = Cache();
+		if(!cache.head) {
+			//整条取走空闲链表，只用exchange不会有ABA问题
+			Node* node = free_.exchange(nullptr, std::memory_order_acquire);
+			while(node) {
+				Node* next = node->next.load(std::memory_order_relaxed);
+				if(cache.count < NodeCache::MAX_COUNT) {
+					node->next.store(cache.head, std::memory_order_relaxed);
+					cache.head = node;
+					cache.count++;
+				} else {
+					delete node;
+				}
+				node = next;
+			}
+		}
+		if(cache.head) {
+			Node* node = cache.head;
+			cache.head = node->next.load(std::memory_order_relaxed);
+			cache.count--;
+			return node;
+		}
+		return new Node();
+	}
+
+	inline void Free(Node* node)
+	{
+		Node* head = free_.load(std::memory_order_relaxed);
+		do {
+			node->next.store(head, std::memory_order_relaxed);
+		} while(!free_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+private:
+	std::atomic<Node*> head_; //生产者端，最后入队的节点
+	Node* tail_; //消费者端，哨兵节点，数据从tail_->next开始
+	std::atomic<Node*> free_; //消费完的空闲节点
+};
+
+/*!
+ *	@brief TaskQue 模板定义.
+ *
+ *	封装TaskQue，任务池
+ */
+class TaskQue
+{
+public:
+	inline void Push(const TaskID& key, InplaceTask&& task)
+	{
+		//std::lock_guard<std::mutex> lock(mutex_);
+		auto it = tasks_.emplace(key,std::move(task));
+		ASSERT(it.second);
+#ifdef _DEBUG
+		printf("task pool delay queue:");
+		for(auto& pr : tasks_) {
+			ssize_t delay = std::chrono::duration_cast<std::chrono::milliseconds>(pr.first.time-std::chrono::steady_clock::now()).count();
+			printf("%d ", (int)delay);
+		}
+		printf("\n");
+#endif//
+	}
+
+	inline void Push(InplaceTask&& task)
+	{		
+		// TaskID key;
+		// Post(key, std::move(task));
+		//std::lock_guard<std::mutex> lock(mutex_);
+		tasks_que_.emplace(std::move(task));
+	}
+
+	inline void Remove(const TaskID& t)
+	{
+		//std::unique_lock<std::mutex> lock(mutex_);
+		tasks_.erase(t);
+	}
+
+	inline size_t Count() { return tasks_que_.size() + tasks_.size(); }
+	inline bool IsEmpty() { return tasks_que_.empty() && tasks_.empty(); }
+
+	inline bool Pop(InplaceTask& task, ssize_t* dealy)
+	{
+		if (!tasks_que_.empty()) {
+			task = std::move(tasks_que_.front());
+			tasks_que_.pop();
+			return true;
+		} else {
+			auto it = tasks_.begin();
+			if(IsActive(it->first, dealy)) {
+				task = std::move(it->second);
+				tasks_.erase(it);
+				return true;
+			}
+		}
+		return false;
+	}
+
+protected:
+	inline bool IsActive(const TaskID& t, ssize_t* delay) {
+		ssize_t diff = std::chrono::duration_cast<std::chrono::milliseconds>(t.time-std::chrono::steady_clock::now()).count();
+		if(delay) {
+			*delay = diff;
+		}
+		return diff <= 0;
+	}
+	
+private:
+	std::map<TaskID,InplaceTask> tasks_;
+	std::queue<InplaceTask> tasks_que_;
+};
+
+/*!
+ *	@brief ThreadPool 模板定义.
+ *
+ *	封装ThreadPool，工作窃取线程池
+ *	每个工作线程一个本地队列，工作线程内投递的任务进本地队列，外部线程投递的任务进全局注入队列
+ *	本地队列空了先从注入队列批量取，再去其他线程的本地队列窃取，都没有才休眠
+ *	延迟任务由定时器线程的时间轮调度，到期后再投递；定时器线程在第一次投递延迟任务时才启动
+ */
+class ThreadPool
+{
+	struct TaskNode
+	{
+		InplaceTask task;
+		TaskNode* next = nullptr;
+	};
+	//节点缓存，线程本地缓存满了归还到全局空闲链表，缓存空了再整条取走
+	struct TaskNodeCache
+	{
+		enum { MAX_COUNT = 1024 };
+		TaskNode* head = nullptr;
+		size_t count = 0;
+		~TaskNodeCache()
+		{
+			while(head) {
+				TaskNode* node = head;
+				head = node->next;
+				delete node;
+			}
+		}
+	};
+	struct TaskNodeFree
+	{
+		std::atomic<TaskNode*> head;
+		TaskNodeFree():head(nullptr) {}
+		~TaskNodeFree()
+		{
+			TaskNode* node = head.exchange(nullptr);
+			while(node) {
+				TaskNode* next = node->next;
+				delete node;
+				node = next;
+			}
+		}
+	};
+	static inline TaskNodeCache& NodeCache() { static thread_local TaskNodeCache cache; return cache; }
+	static inline TaskNodeFree& NodeFree() { static TaskNodeFree free; return free; }
+	static inline TaskNode* AllocNode(InplaceTask&& task)
+	{
+		TaskNodeCache& cache = NodeCache();
+		if(!cache.head) {
+			//只用exchange整条取走，没有ABA问题
+			TaskNode* node = NodeFree().head.exchange(nullptr, std::memory_order_acquire);
+			while(node) {
+				TaskNode* next = node->next;
+				if(cache.count < TaskNodeCache::MAX_COUNT) {
+					node->next = cache.head;
+					cache.head = node;
+					cache.count++;
+				} else {
+					delete node;
+				}
+				node = next;
+			}
+		}
+		TaskNode* node = cache.head;
+		if(node) {
+			cache.head = node->next;
+			cache.count--;
+		} else {
+			node = new TaskNode();
+		}
+		node->task = std::move(task);
+		return node;
+	}
+	static inline void FreeNode(TaskNode* node)
+	{
+		node->task = nullptr;
+		TaskNodeCache& cache = NodeCache();
+		if(cache.count < TaskNodeCache::MAX_COUNT) {
+			node->next = cache.head;
+			cache.head = node;
+			cache.count++;
+		} else {
+			std::atomic<TaskNode*>& head = NodeFree().head;
+			node->next = head.load(std::memory_order_relaxed);
+			while(!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed));
+		}
+	}
+
+	/*!
+	 *	@brief WorkQueue 定义.
+	 *
+	 *	Chase-Lev风格的有界环形队列，只有所属工作线程Push到尾部，
+	 *	所属线程和窃取线程都从头部CAS取，保持投递顺序（同Go的runq）
+	 */
+	class WorkQueue
+	{
+	public:
+		enum { CAPACITY = 1024, MASK = CAPACITY - 1 };
+
+		WorkQueue():top_(0),bottom_(0)
+		{
+			for (size_t i = 0; i < CAPACITY; i++)
+			{
+				buf_[i].store(nullptr, std::memory_order_relaxed);
+			}
+		}
+
+		//只有所属线程调用，满了返回false
+		inline bool Push(TaskNode* node)
+		{
+			uint64_t b = bottom_.load(std::memory_order_relaxed);
+			uint64_t t = top_.load(std::memory_order_acquire);
+			if (b - t >= CAPACITY) {
+				return false;
+			}
+			buf_[b & MASK].store(node, std::memory_order_relaxed);
+			bottom_.store(b + 1, std::memory_order_release);
+			return true;
+		}
+
+		//任意线程调用
+		inline TaskNode* Pop()
+		{
+			uint64_t t = top_.load(std::memory_order_acquire);
+			for (;;)
+			{
+				uint64_t b = bottom_.load(std::memory_order_acquire);
+				if (t >= b) {
+					return nullptr;
+				}
+				TaskNode* node = buf_[t & MASK].load(std::memory_order_relaxed);
+				if (top_.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+					return node;
+				}
+			}
+		}
+
+		inline bool IsEmpty() const
+		{
+			return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+		}
+
+	private:
+		std::atomic<uint64_t> top_;
+		char pad1_[64 - sizeof(std::atomic<uint64_t>)]; //头尾分开缓存行，避免伪共享
+		std::atomic<uint64_t> bottom_;
+		char pad2_[64 - sizeof(std::atomic<uint64_t>)];
+		std::atomic<TaskNode*> buf_[CAPACITY];
+	};
+
+	struct Worker
+	{
+		WorkQueue que;
+		std::thread thread;
+	};
+
+	//当前线程所属的线程池和工作线程序号
+	struct Current
+	{
+		ThreadPool* pool = nullptr;
+		size_t index = 0;
+	};
+	static inline Current& ThisWorker() { static thread_local Current cur; return cur; }
+
+public:
+	static ThreadPool& Inst() {
+		static ThreadPool _inst(std::thread::hardware_concurrency() + 1);
+		return _inst;
+	}
+
+	ThreadPool() : stop_flag_(true), inject_count_(0), sleepers_(0), signals_(0)
+	{
+		
+	}
+	ThreadPool(size_t threads) : stop_flag_(true), inject_count_(0), sleepers_(0), signals_(0)
+	{
+		Start(threads);
+	}
+
+	~ThreadPool()
+	{
+		Stop();
+	}
+
+	inline bool IsStopFlag() {
+		return stop_flag_;
+	}
+
+	void Start(size_t threads)
+	{
+		bool expected = true;
+		if (!stop_flag_.compare_exchange_strong(expected, false)) {
+			return;
+		}
+		if (!threads) {
+			threads = 1;
+		}
+		for (size_t i = 0; i < threads; ++i) {
+			workers_.emplace_back(new Worker());
+		}
+		for (size_t i = 0; i < threads; ++i) {
+			workers_[i]->thread = std::thread(&ThreadPool::OnRun, this, i);
+		}
+	}
+
+	void Stop()
+	{
+		bool expected = false;
+		if (!stop_flag_.compare_exchange_strong(expected, true)) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(park_mutex_);
+			park_cv_.notify_all();
+		}
+		{
+			std::lock_guard<std::mutex> lock(timer_mutex_);
+			timer_cv_.notify_all();
+		}
+		for (auto &worker : workers_) {
+			worker->thread.join();
+		}
+		//stop_flag_设置后Post不会再启动定时线程，这里不需要加锁
+		if (timer_thread_.joinable()) {
+			timer_thread_.join();
+		}
+		//丢弃没有执行的任务，Send的future得到broken_promise
+		for (auto &worker : workers_) {
+			while (TaskNode* node = worker->que.Pop()) {
+				FreeNode(node);
+			}
+		}
+		workers_.clear();
+		{
+			std::lock_guard<std::mutex> lock(inject_mutex_);
+			for (TaskNode* node : inject_) {
+				FreeNode(node);
+			}
+			inject_.clear();
+			inject_count_ = 0;
+		}
+		{
+			std::lock_guard<std::mutex> lock(timer_mutex_);
+			timers_.clear();
+			timer_wheel_ = TimerWheel();
+		}
+		sleepers_ = 0;
+		signals_ = 0;
+	}
+
+	void Post(const TaskID& key, InplaceTask&& task)
+	{
+		ssize_t delay = std::chrono::duration_cast<std::chrono::milliseconds>(key.time-std::chrono::steady_clock::now()).count();
+		if (delay <= 0) {
+			Post(std::move(task));
+			return;
+		}
+		std::lock_guard<std::mutex> lock(timer_mutex_);
+		if (!timer_thread_.joinable()) {
+			if (stop_flag_) {
+				return;
+			}
+			//定时线程在第一次投递延迟任务时才启动，不用延迟任务的池（如ThreadGroupPool的每个单线程池）不多占线程
+			timer_thread_ = std::thread(&ThreadPool::OnTimerRun, this);
+		}
+		size_t id = key.id;
+		timers_[id] = timer_wheel_.Add(delay, std::bind([this,id](InplaceTask& task) {
+			{
+			std::lock_guard<std::mutex> lock(timer_mutex_);
+			timers_.erase(id);
+			}
+			Post(std::move(task));
+		}, std::move(task)));
+		timer_cv_.notify_one();
+	}
+
+	void Post(InplaceTask&& task)
+	{
+		TaskNode* node = AllocNode(std::move(task));
+		Current& cur = ThisWorker();
+		if (cur.pool != this || !workers_[cur.index]->que.Push(node)) {
+			std::lock_guard<std::mutex> lock(inject_mutex_);
+			inject_.push_back(node);
+			inject_count_.fetch_add(1, std::memory_order_release);
+		}
+		WakeUp();
+	}
+
+	template<class F, class... Args>
+	auto Send(const TaskID& key, F&& f, Args&&... args) 
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
+	{
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(key, MakePackagedTask(res, std::forward<F>(f), std::forward<Args>(args)...));
+		return res;
+	}
+
+	template<class F, class... Args>
+	auto Send(F&& f, Args&&... args) 
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
+	{
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(MakePackagedTask(res, std::forward<F>(f), std::forward<Args>(args)...));
+		return res;
+	}
+
+	//只能取消还没到期的延迟任务
+	void Cancel(const TaskID& t)
+	{
+		std::lock_guard<std::mutex> lock(timer_mutex_);
+		auto it = timers_.find(t.id);
+		if (it != timers_.end()) {
+			timer_wheel_.Remove(it->second);
+			timers_.erase(it);
+		}
+	}
+
+protected:
+	//有线程休眠时唤醒一个
+	inline void WakeUp()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleepers_.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(park_mutex_);
+			if (signals_ < sleepers_.load(std::memory_order_relaxed)) {
+				signals_++;
+				park_cv_.notify_one();
+			}
+		}
+	}
+
+	inline bool HasWork()
+	{
+		if (inject_count_.load(std::memory_order_acquire)) {
+			return true;
+		}
+		for (auto &worker : workers_) {
+			if (!worker->que.IsEmpty()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//从注入队列批量取一部分到本地队列，返回第一个
+	inline TaskNode* PopInject(Worker& self)
+	{
+		if (!inject_count_.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		std::lock_guard<std::mutex> lock(inject_mutex_);
+		if (inject_.empty()) {
+			return nullptr;
+		}
+		size_t count = std::min<size_t>(inject_.size() / workers_.size() + 1, 32);
+		TaskNode* node = inject_.front();
+		inject_.pop_front();
+		for (size_t i = 1; i < count && !inject_.empty(); i++)
+		{
+			if (!self.que.Push(inject_.front())) {
+				break;
+			}
+			inject_.pop_front();
+		}
+		inject_count_.store(inject_.size(), std::memory_order_release);
+		return node;
+	}
+
+	inline TaskNode* Take(size_t index)
+	{
+		Worker& self = *workers_[index];
+		TaskNode* node = self.que.Pop();
+		if (node) {
+			return node;
+		}
+		node = PopInject(self);
+		if (node) {
+			return node;
+		}
+		size_t count = workers_.size();
+		for (size_t i = 1; i < count; i++)
+		{
+			node = workers_[(index + i) % count]->que.Pop();
+			if (node) {
+				return node;
+			}
+		}
+		return nullptr;
+	}
+
+	void OnRun(size_t index)
+	{
+		Current& cur = ThisWorker();
+		cur.pool = this;
+		cur.index = index;
+		while (!stop_flag_)
+		{
+			TaskNode* node = Take(index);
+			if (node) {
+				if (!workers_[index]->que.IsEmpty()) {
+					WakeUp(); //本地还有任务，叫醒别的线程来窃取
+				}
+				node->task();
+				FreeNode(node);
+				continue;
+			}
+			sleepers_.fetch_add(1, std::memory_order_seq_cst);
+			if (HasWork()) {
+				sleepers_.fetch_sub(1, std::memory_order_relaxed);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(park_mutex_);
+			park_cv_.wait(lock, [this] { return signals_ > 0 || stop_flag_; });
+			if (signals_ > 0) {
+				signals_--;
+			}
+			sleepers_.fetch_sub(1, std::memory_order_relaxed);
+		}
+		cur.pool = nullptr;
+	}
+
+	void OnTimerRun()
+	{
+		std::unique_lock<std::mutex> lock(timer_mutex_);
+		while (!stop_flag_)
+		{
+			timer_wheel_.Advance();
+			TimerWheel::Callback cb;
+			while (timer_wheel_.PopExpired(cb))
+			{
+				lock.unlock();
+				cb();
+				cb = nullptr;
+				lock.lock();
+			}
+			if (stop_flag_) {
+				break;
+			}
+			int64_t timeout = timer_wheel_.NextTimeOut();
+			if (timeout < 0) {
+				timer_cv_.wait(lock);
+			} else if (timeout > 0) {
+				timer_cv_.wait_for(lock, std::chrono::milliseconds(timeout));
+			}
+		}
+	}
+
+private:
+	std::atomic<bool> stop_flag_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::mutex inject_mutex_;
+	std::deque<TaskNode*> inject_; //外部线程投递的任务
+	std::atomic<size_t> inject_count_;
+	std::mutex park_mutex_;
+	std::condition_variable park_cv_;
+	std::atomic<size_t> sleepers_; //休眠（准备休眠）的工作线程数
+	size_t signals_; //待消费的唤醒信号，park_mutex_保护
+	std::thread timer_thread_;
+	std::mutex timer_mutex_;
+	std::condition_variable timer_cv_;
+	TimerWheel timer_wheel_; //延迟任务
+	std::unordered_map<size_t,TimerWheel::TimerID> timers_; //延迟任务ID到定时器
+};
+
+/*!
+ *	@brief ThreadGroupPool 定义.
+ *
+ *	封装ThreadGroupPool，按序号固定到单线程池，同一序号的任务串行有序执行
+ *	不需要有序执行的任务直接用ThreadPool，由工作窃取负载均衡
+ */
+class ThreadGroupPool
+{
+public:
+	static ThreadGroupPool& Inst() {
+		static ThreadGroupPool _inst(std::thread::hardware_concurrency()+1);
+		return _inst;
+	}
+
+	ThreadGroupPool() : stop_flag_(true)
+	{
+		
+	}
+	ThreadGroupPool(size_t threads) : stop_flag_(true)
+	{
+		Start(threads);
+	}
+
+	~ThreadGroupPool()
+	{
+		Stop();
+	}
+
+	inline bool IsStopFlag() {
+		return stop_flag_;
+	}
+
+	void Start(size_t threads)
+	{
+		bool expected = true;
+		if (!stop_flag_.compare_exchange_strong(expected, false)) {
+			return;
+		}
+
+		for (size_t i = 0; i < threads; ++i) {
+			workers_.emplace_back(std::make_shared<ThreadPool>(1));
+		}
+	}
+
+	void Stop()
+	{
+		bool expected = false;
+		if (!stop_flag_.compare_exchange_strong(expected, true)) {
+			return;
+		}
+		for (auto &worker : workers_) {
+			worker->Stop();
+		}
+		workers_.clear();
+	}
+
+	ThreadPool& operator[](size_t n) {
+		n %= workers_.size();
+		return *workers_[n];
+	}
+	const ThreadPool& operator[](size_t n) const {
+		n %= workers_.size();
+		return *workers_[n];
+	}
+private:
+	std::atomic<bool> stop_flag_;
+	std::vector<std::shared_ptr<ThreadPool>> workers_;
+};
+
+/*!
+ *	@brief HostCache 定义.
+ *
+ *	封装HostCache，进程内共享的主机名解析缓存，按TTL缓存肯定和否定结果，并合并同名的并发解析
+ */
+class HostCache
+{
+public:
+	//解析结果，error为0表示成功，否则为EAI_XXX错误码；地址端口为0
+	struct Result
+	{
+		int error = 0;
+		std::vector<sockaddr_storage> addrs;
+	};
+	typedef std::function<void(const Result&)> Waiter;
+
+	static HostCache& Inst() {
+		static HostCache _inst;
+		return _inst;
+	}
+
+	/*!
+	 *	@brief 设置缓存时间（秒）.
+	 *
+	 *	default_ttl用于没有TTL的结果（getaddrinfo），肯定结果不超过max_ttl，否定结果不超过negative_ttl
+	 */
+	inline void SetTTL(uint32_t default_ttl, uint32_t max_ttl, uint32_t negative_ttl)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		default_ttl_ = default_ttl;
+		max_ttl_ = max_ttl;
+		negative_ttl_ = negative_ttl;
+	}
+	inline uint32_t GetDefaultTTL() { return default_ttl_; }
+	inline void SetMaxCount(size_t count) { max_count_ = count; }
+
+	//是否是IP地址字符串，IP地址不需要解析也不缓存
+	static inline bool IsNumericHost(const char* name)
+	{
+		unsigned char buf[sizeof(struct in6_addr)];
+		return XSocket::Socket::IpStr2IpAddr(name, AF_INET, buf) == 1 || XSocket::Socket::IpStr2IpAddr(name, AF_INET6, buf) == 1;
+	}
+
+	//缓存只保存地址，不指定套接字类型或者带AI_CANONNAME、AI_ADDRCONFIG等标志时getaddrinfo的结果不同，不能走缓存
+	static inline bool IsCacheableHints(const struct addrinfo& hints)
+	{
+		return hints.ai_socktype != 0 && !(hints.ai_flags & ~AI_PASSIVE);
+	}
+
+	//是否是可以否定缓存的错误（名字不存在），其他错误是临时的
+	static inline bool IsNegativeError(int err)
+	{
+#ifdef EAI_NODATA
+		if (err == EAI_NODATA) {
+			return true;
+		}
+#endif
+		return err == EAI_NONAME;
+	}
+
+	//从addrinfo链表提取地址
+	static inline void ToResult(const struct addrinfo* ai, Result& res)
+	{
+		res.error = 0;
+		res.addrs.clear();
+		for (; ai; ai = ai->ai_next)
+		{
+			if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) {
+				continue;
+			}
+			sockaddr_storage addr = {};
+			memcpy(&addr, ai->ai_addr, std::min<size_t>(ai->ai_addrlen, sizeof(addr)));
+			XSocket::Socket::SetAddrPort((struct sockaddr*)&addr, 0);
+			//getaddrinfo按socktype返回重复地址，去重
+			bool exist = false;
+			for (auto& it : res.addrs)
+			{
+				if (IsSameAddr(it, addr)) {
+					exist = true;
+					break;
+				}
+			}
+			if (!exist) {
+				res.addrs.push_back(addr);
+			}
+		}
+	}
+
+	static inline bool IsSameAddr(const sockaddr_storage& a, const sockaddr_storage& b)
+	{
+		if (a.ss_family != b.ss_family) {
+			return false;
+		}
+		if (a.ss_family == AF_INET) {
+			return ((const sockaddr_in&)a).sin_addr.s_addr == ((const sockaddr_in&)b).sin_addr.s_addr;
+		} else if (a.ss_family == AF_INET6) {
+			return memcmp(&((const sockaddr_in6&)a).sin6_addr, &((const sockaddr_in6&)b).sin6_addr, sizeof(struct in6_addr)) == 0;
+		}
+		return false;
+	}
+
+	/*!
+	 *	@brief 查找缓存.
+	 *
+	 *	family为AF_UNSPEC时，先找AF_UNSPEC的结果（保持getaddrinfo的顺序），
+	 *	再合并IPv6和IPv4的结果，任意一个有地址即命中，两个都是否定结果才返回否定结果
+	 *	@return 返回false表示没有缓存，需要解析
+	 */
+	inline bool Lookup(const std::string& name, int family, Result& res)
 	{
-		Start(threads);
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		const Entry* entry = Find(name, family, now);
+		if (entry) {
+			res.error = entry->error;
+			res.addrs = entry->addrs;
+			return true;
+		}
+		if (family != AF_UNSPEC) {
+			return false;
+		}
+		const Entry* v6 = Find(name, AF_INET6, now);
+		const Entry* v4 = Find(name, AF_INET, now);
+		bool v6_ok = v6 && !v6->error, v4_ok = v4 && !v4->error;
+		if (!v6_ok && !v4_ok) {
+			if (v6 && v4) {
+				res.error = v6->error;
+				res.addrs.clear();
+				return true;
+			}
+			return false;
+		}
+		res.error = 0;
+		res.addrs.clear();
+		if (v6_ok) {
+			res.addrs.insert(res.addrs.end(), v6->addrs.begin(), v6->addrs.end());
+		}
+		if (v4_ok) {
+			res.addrs.insert(res.addrs.end(), v4->addrs.begin(), v4->addrs.end());
+		}
+		return true;
 	}
 
-	~ThreadPool()
+	/*!
+	 *	@brief 写入缓存.
+	 *
+	 *	res.error非0时为否定缓存，ttl为0的结果不缓存
+	 */
+	inline void Insert(const std::string& name, int family, const Result& res, uint32_t ttl)
 	{
-		Stop();
+		std::lock_guard<std::mutex> lock(mutex_);
+		DoInsert(MakeKey(name, family), res, ttl);
 	}
 
-	inline bool IsStopFlag() {
-		return stop_flag_;
+	/*!
+	 *	@brief 加入等待.
+	 *
+	 *	同名同地址族的解析只发起一次，返回true表示调用者是第一个，需要发起解析并在完成后调用Complete；
+	 *	等待回调在调用Complete的线程执行
+	 */
+	inline bool Wait(const std::string& name, int family, Waiter&& waiter)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto& waiters = waiters_[MakeKey(name, family)];
+		waiters.emplace_back(std::move(waiter));
+		return waiters.size() == 1;
 	}
 
-	void Start(size_t threads)
+	/*!
+	 *	@brief 异步解析.
+	 *
+	 *	加入等待，第一个等待者在ThreadPool执行getaddrinfo，完成后写入缓存并唤醒所有等待者；
+	 *	等待回调在ThreadPool线程执行
+	 */
+	inline void Resolve(const std::string& name, int family, Waiter&& waiter)
 	{
-		bool expected = true;
-		if (!stop_flag_.compare_exchange_strong(expected, false)) {
+		if (!Wait(name, family, std::move(waiter))) {
+			//同名解析已经在进行中
 			return;
 		}
-		for (size_t i = 0; i < threads; ++i) {
-			workers_.emplace_back(
-				[this] {
-					std::chrono::milliseconds timeout(3000);
-					for (;;)
-					{
-						std::function<void()> task;
-						{
-							std::unique_lock<std::mutex> lock(mutex_);
-							if(!cv_.wait_for(lock, timeout, [this] { return stop_flag_ || !TaskQue::IsEmpty(); })) {
-								continue;
-							}
-							if (stop_flag_)
-								break;
-							
-							ssize_t delay = 0;
-							TaskQue::Pop(task,&delay);
-							if(delay > 0) {
-								timeout = std::chrono::milliseconds(delay);
-							} else {
-								timeout = std::chrono::milliseconds(3000);
-							}
-							// if(!tasks_que_.empty()) {
-							// 	task = std::move(tasks_que_.front());
-							// 	tasks_que_.pop();
-							// } else {
-							// 	auto it = tasks_.begin();
-							// 	std::chrono::steady_clock::time_point tp_now = std::chrono::steady_clock::now();
-							// 	if(it->first.time > tp_now) {
-							// 		timeout = std::chrono::duration_cast<std::chrono::milliseconds>(it->first.time - tp_now);
-							// 		continue;
-							// 	} else {
-							// 		timeout = std::chrono::milliseconds(3000);
-							// 	}
-							// 	task = std::move(it->second);
-							// 	tasks_.erase(it);
-							// }
-						}
-						task();
-					}
-				});
-		}
-		//return true;
+		ThreadPool::Inst().Post([this,name,family]() {
+			struct addrinfo hints = {};
+			hints.ai_family = family;
+			hints.ai_socktype = SOCK_STREAM;
+			struct addrinfo* ai = nullptr;
+			Result res;
+			uint32_t ttl = GetDefaultTTL();
+			int err = XSocket::Socket::GetAddrInfo(name.c_str(), nullptr, &hints, &ai);
+			if (!err) {
+				ToResult(ai, res);
+				freeaddrinfo(ai);
+			} else {
+				res.error = err;
+				if (!IsNegativeError(err)) {
+					ttl = 0; //临时错误不缓存
+				}
+			}
+			Complete(name, family, res, ttl);
+		});
 	}
 
-	void Stop()
+	//解析完成，写入缓存并唤醒所有等待者
+	inline void Complete(const std::string& name, int family, const Result& res, uint32_t ttl)
 	{
-		bool expected = false;
-		if (!stop_flag_.compare_exchange_strong(expected, true)) {
-			return;
+		std::vector<Waiter> waiters;
+		{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::string key = MakeKey(name, family);
+		DoInsert(key, res, ttl);
+		auto it = waiters_.find(key);
+		if (it != waiters_.end()) {
+			waiters.swap(it->second);
+			waiters_.erase(it);
 		}
-		cv_.notify_all();
-		for (auto &worker : workers_) {
-			worker.join();
 		}
-		workers_.clear();
+		for (auto& waiter : waiters)
+		{
+			waiter(res);
+		}
 	}
 
-	void Post(const TaskID& key, std::function<void()> && task)
+	inline void Clear()
 	{
 		std::lock_guard<std::mutex> lock(mutex_);
-		TaskQue::Push(key, std::move(task));
-		cv_.notify_one();
-	}
-
-	void Post(std::function<void()> && task)
-	{		
-		// TaskID key;
-		// Post(key, std::move(task));
-		std::lock_guard<std::mutex> lock(mutex_);
-		TaskQue::Push(std::move(task));
-		cv_.notify_one();
+		entries_.clear();
 	}
 
-	template<class F, class... Args>
-	auto Send(const TaskID& key, F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+	//缓存键，域名不区分大小写，忽略结尾的根域'.'
+	static inline std::string MakeKey(const std::string& name, int family)
 	{
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-			
-		std::future<return_type> res = task->get_future();
-		{
-			Post(key, [task](){ (*task)(); });
+		std::string key(name);
+		if (!key.empty() && key.back() == '.') {
+			key.pop_back();
 		}
-		return res;
+		std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+		key += '#';
+		key += std::to_string(family);
+		return key;
 	}
 
-	template<class F, class... Args>
-	auto Send(F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+protected:
+	struct Entry
 	{
-		// TaskID key;
-		// return Send(key, std::forward<F>(f), std::forward<Args>(args)...);
-		using return_type = typename std::result_of<F(Args...)>::type;
+		int error = 0;
+		std::vector<sockaddr_storage> addrs;
+		std::chrono::steady_clock::time_point expire;
+	};
 
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-			
-		std::future<return_type> res = task->get_future();
-		{
-			Post([task](){ (*task)(); });
+	//调用者需持有mutex_
+	inline const Entry* Find(const std::string& name, int family, const std::chrono::steady_clock::time_point& now)
+	{
+		auto it = entries_.find(MakeKey(name, family));
+		if (it == entries_.end()) {
+			return nullptr;
 		}
-		return res;
+		if (it->second.expire <= now) {
+			entries_.erase(it);
+			return nullptr;
+		}
+		return &it->second;
 	}
 
-	void Cancel(const TaskID& t)
+	//调用者需持有mutex_
+	inline void DoInsert(const std::string& key, const Result& res, uint32_t ttl)
 	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		TaskQue::Remove(t);
+		ttl = std::min(ttl, res.error ? negative_ttl_ : max_ttl_);
+		if (!ttl) {
+			return;
+		}
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (entries_.size() >= max_count_) {
+			//先清理过期的，还是满就整体淘汰
+			for (auto it = entries_.begin(); it != entries_.end(); )
+			{
+				if (it->second.expire <= now) {
+					it = entries_.erase(it);
+				} else {
+					++it;
+				}
+			}
+			if (entries_.size() >= max_count_) {
+				entries_.clear();
+			}
+		}
+		Entry& entry = entries_[key];
+		entry.error = res.error;
+		entry.addrs = res.addrs;
+		entry.expire = now + std::chrono::seconds(ttl);
 	}
 
-private:
-	std::atomic<bool> stop_flag_;
-	std::vector<std::thread> workers_;
-	// std::map<TaskID,std::function<void()>> tasks_;
-	// std::queue<std::function<void()>> tasks_que_;
+protected:
 	std::mutex mutex_;
-	std::condition_variable cv_;
+	std::unordered_map<std::string, Entry> entries_;
+	std::unordered_map<std::string, std::vector<Waiter>> waiters_;
+	uint32_t default_ttl_ = 30;
+	uint32_t max_ttl_ = 3600;
+	uint32_t negative_ttl_ = 60;
+	size_t max_count_ = 4096;
 };
 
-class ThreadGroupPool
+/*!
+ *	@brief AddrInfoList 定义.
+ *
+ *	封装AddrInfoList，自己持有内存的addrinfo链表，可以从getaddrinfo结果或者解析缓存结果构造
+ */
+class AddrInfoList
 {
 public:
-	static ThreadGroupPool& Inst() {
-		static ThreadGroupPool _inst(std::thread::hardware_concurrency()+1);
-		return _inst;
-	}
-
-	ThreadGroupPool() : stop_flag_(true)
-	{
-		
-	}
-	ThreadGroupPool(size_t threads) : stop_flag_(true)
+	AddrInfoList() {}
+	AddrInfoList(const struct addrinfo* ai) { Assign(ai); }
+	AddrInfoList(const AddrInfoList& o) { Assign(o.get()); }
+	AddrInfoList(AddrInfoList&& o) = default; //vector移动不改变元素地址，链表指针仍然有效
+	AddrInfoList& operator=(const AddrInfoList& o) { if (this != &o) { Assign(o.get()); } return *this; }
+	AddrInfoList& operator=(AddrInfoList&& o) = default;
+
+	inline struct addrinfo* get() const { return ais_.empty() ? nullptr : const_cast<struct addrinfo*>(&ais_[0]); }
+	inline bool empty() const { return ais_.empty(); }
+	inline void clear() { ais_.clear(); addrs_.clear(); canonname_.clear(); }
+
+	//复制addrinfo链表，ai可以是本对象的链表，AI_CANONNAME的规范名保留在第一项
+	inline void Assign(const struct addrinfo* ai)
 	{
-		Start(threads);
+		std::vector<struct addrinfo> ais;
+		std::vector<sockaddr_storage> addrs;
+		std::vector<char> canonname;
+		if (ai && ai->ai_canonname) {
+			canonname.assign(ai->ai_canonname, ai->ai_canonname + strlen(ai->ai_canonname) + 1);
+		}
+		canonname_.swap(canonname);
+		for (; ai; ai = ai->ai_next)
+		{
+			struct addrinfo item = *ai;
+			item.ai_canonname = nullptr;
+			item.ai_next = nullptr;
+			ais.push_back(item);
+			sockaddr_storage addr = {};
+			memcpy(&addr, ai->ai_addr, std::min<size_t>(ai->ai_addrlen, sizeof(addr)));
+			addrs.push_back(addr);
+		}
+		Link(ais, addrs);
 	}
 
-	~ThreadGroupPool()
+	//从解析结果构造，按hints过滤地址族，并设置端口
+	inline void Assign(const HostCache::Result& res, const struct addrinfo& hints, u_short port)
 	{
-		Stop();
-	}
-
-	inline bool IsStopFlag() {
-		return stop_flag_;
+		std::vector<struct addrinfo> ais;
+		std::vector<sockaddr_storage> addrs;
+		canonname_.clear();
+		for (auto& addr : res.addrs)
+		{
+			if (hints.ai_family != AF_UNSPEC && hints.ai_family != addr.ss_family) {
+				continue;
+			}
+			struct addrinfo item = {};
+			item.ai_family = addr.ss_family;
+			item.ai_socktype = hints.ai_socktype ? hints.ai_socktype : SOCK_STREAM;
+			item.ai_protocol = hints.ai_protocol;
+			item.ai_addrlen = addr.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+			ais.push_back(item);
+			addrs.push_back(addr);
+			XSocket::Socket::SetAddrPort((struct sockaddr*)&addrs.back(), port);
+		}
+		Link(ais, addrs);
 	}
 
-	void Start(size_t threads)
+	//按RFC 8305交替排列地址族，保持各地址族内部顺序，首个地址族不变
+	inline void Interleave()
 	{
-		bool expected = true;
-		if (!stop_flag_.compare_exchange_strong(expected, false)) {
+		std::vector<struct addrinfo> ais;
+		std::vector<sockaddr_storage> addrs;
+		size_t count = ais_.size();
+		if (count < 3) {
 			return;
 		}
-
-		for (size_t i = 0; i < threads; ++i) {
-			workers_.emplace_back(std::make_shared<ThreadPool>(1));
+		int family = ais_[0].ai_family;
+		for (size_t i = 0, j = 0; ais.size() < count; )
+		{
+			for (; i < count && ais_[i].ai_family != family; i++);
+			if (i < count) {
+				ais.push_back(ais_[i]);
+				addrs.push_back(addrs_[i]);
+				i++;
+			}
+			for (; j < count && ais_[j].ai_family == family; j++);
+			if (j < count) {
+				ais.push_back(ais_[j]);
+				addrs.push_back(addrs_[j]);
+				j++;
+			}
 		}
+		Link(ais, addrs);
 	}
 
-	void Stop()
+protected:
+	inline void Link(std::vector<struct addrinfo>& ais, std::vector<sockaddr_storage>& addrs)
 	{
-		bool expected = false;
-		if (!stop_flag_.compare_exchange_strong(expected, true)) {
-			return;
-		}
-		for (auto &worker : workers_) {
-			worker->Stop();
+		for (size_t i = 0; i < ais.size(); i++)
+		{
+			ais[i].ai_addr = (struct sockaddr*)&addrs[i];
+			ais[i].ai_next = (i + 1) < ais.size() ? &ais[i + 1] : nullptr;
+			ais[i].ai_canonname = (i == 0 && !canonname_.empty()) ? &canonname_[0] : nullptr;
 		}
-		workers_.clear();
+		ais_.swap(ais);
+		addrs_.swap(addrs);
 	}
 
-	ThreadPool& operator[](size_t n) {
-		n %= workers_.size();
-		return *workers_[n];
-	}
-	const ThreadPool& operator[](size_t n) const {
-		n %= workers_.size();
-		return *workers_[n];
-	}
-private:
-	std::atomic<bool> stop_flag_;
-	std::vector<std::shared_ptr<ThreadPool>> workers_;
+protected:
+	std::vector<struct addrinfo> ais_;
+	std::vector<sockaddr_storage> addrs_;
+	std::vector<char> canonname_; //vector移动不改变数据地址，ai_canonname仍然有效
 };
 
 /*!
@@ -1164,100 +3204,161 @@ class TaskServiceT : public TBase, public TaskQue
 {
 	typedef TBase Base;
 public:
-	inline void Post(const TaskID& key, std::function<void()> && task)
-	{
- 		std::lock_guard<std::mutex> lock(mutex_);
-// 		auto it = tasks_.emplace(key,std::move(task));
-// 		ASSERT(it.second);
-// #ifdef _DEBUG
-// 		printf("task delay queue:");
-// 		for(auto& pr : tasks_) {
-// 			ssize_t delay = 0;
-// 			IsActive(pr.first,&delay);
-// 			printf("%d ", (int)delay);
-// 		}
-// 		printf("\n");
-// #endif//
-		TaskQue::Push(key, std::move(task));
+	inline void Post(const TaskID& key, InplaceTask&& task)
+	{
+		//延迟任务挂在服务时间轮上
 		ssize_t delay = 0;
 		if (IsActive(key,&delay)) {
+			delay = 0;
+		}
+		{
+		std::lock_guard<std::mutex> lock(mutex_);
+		size_t id = key.id;
+		//C++11没有移动捕获，只能移动的任务通过bind带进回调
+		timers_[id] = Base::AddTimer(delay, std::bind([this,id](InplaceTask& task) {
+			{
+			std::lock_guard<std::mutex> lock(mutex_);
+			timers_.erase(id);
+			}
+			task();
+		}, std::move(task)));
+		}
+		if (!delay) {
 			Base::PostNotify();	
 		} else {
 			Base::PostTimer(delay);
 		}
 	}
 
-	inline void Post(std::function<void()> && task)
+	inline void Post(InplaceTask&& task)
 	{
 		// TaskID key;
 		// Post(key, std::move(task));
-		std::lock_guard<std::mutex> lock(mutex_);
-		// tasks_que_.emplace(std::move(task));
-		TaskQue::Push(std::move(task));
+		//无锁入队，服务线程阻塞等待时才真正唤醒
+		task_que_.Push(std::move(task));
 		Base::PostNotify();	
 	}
 
 	template<class F, class... Args>
 	auto Send(const TaskID& key, F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-			
-		std::future<return_type> res = task->get_future();
-		{
-			Post(key, [task](){ (*task)(); });
-		}
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(key, MakePackagedTask(res, std::forward<F>(f), std::forward<Args>(args)...));
 		return res;
 	}
 
 	template<class F, class... Args>
 	inline auto Send(F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
-		// TaskID key;
-		// return Send(key, std::forward<F>(f), std::forward<Args>(args)...);
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-			
-		std::future<return_type> res = task->get_future();
-		{
-			Post([task](){ (*task)(); });
-		}
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(MakePackagedTask(res, std::forward<F>(f), std::forward<Args>(args)...));
 		return res;
 	}
 
 	void Cancel(const TaskID& t)
 	{
+		size_t timer = 0;
+		{
 		std::unique_lock<std::mutex> lock(mutex_);
-		TaskQue::Remove(t);
+		auto it = timers_.find(t.id);
+		if (it == timers_.end()) {
+			return;
+		}
+		timer = it->second;
+		timers_.erase(it);
+		}
+		//RemoveTimer会等待正在执行的回调，回调先锁mutex_，所以要在锁外移除
+		Base::RemoveTimer(timer);
 	}
 
+	/*!
+	 *	@brief 异步解析主机名.
+	 *
+	 *	IP地址直接解析，命中HostCache直接投递回调，否则同名解析合并成一次，交给ThreadPool执行getaddrinfo并写入HostCache；
+	 *	回调在服务线程执行，result只在回调期间有效，失败时为nullptr
+	 */
 	inline void PostGetAddrInfo(const std::string& hostname, const std::string& service, const struct addrinfo& hints, std::function<void(struct addrinfo*)>&& cb)
 	{
-		//auto result = std::async(//std::launch::async|std::launch::deferred,
-		return ThreadPool::Inst().Post(
-			[this,hostname,service,hints,cb = std::move(cb)]() mutable {
-			struct addrinfo* res = nullptr;
-			XSocket::Socket::GetAddrInfo(hostname.c_str(),service.c_str(),&hints,&res);
-			Post([res,cb = std::move(cb)]() mutable {
-				cb(res);
+		char* end = nullptr;
+		u_short port = (u_short)strtoul(service.c_str(), &end, 10);
+		if (*end || !HostCache::IsCacheableHints(hints)) {
+			//服务名需要getaddrinfo解析端口，特殊hints要按原样解析，都不走缓存；C++11没有移动捕获，回调通过bind带进任务
+			ThreadPool::Inst().Post(std::bind(
+				[this,hostname,service,hints](std::function<void(struct addrinfo*)>& cb) {
+				struct addrinfo* res = nullptr;
+				XSocket::Socket::GetAddrInfo(hostname.c_str(),service.c_str(),&hints,&res);
+				AddrInfoList ai(res);
+				if (res) {
+					freeaddrinfo(res);
+				}
+				PostAddrInfo(std::move(ai), std::move(cb));
+			}, std::move(cb)));
+			return;
+		}
+		HostCache::Result res;
+		if (HostCache::IsNumericHost(hostname.c_str())) {
+			struct addrinfo numeric_hints = hints;
+			numeric_hints.ai_flags |= AI_NUMERICHOST;
+			struct addrinfo* ai = nullptr;
+			if (!XSocket::Socket::GetAddrInfo(hostname.c_str(), nullptr, &numeric_hints, &ai)) {
+				HostCache::ToResult(ai, res);
+				freeaddrinfo(ai);
+			} else {
+				res.error = EAI_NONAME;
+			}
+			PostAddrInfo(res, hints, port, std::move(cb));
+			return;
+		}
+		if (HostCache::Inst().Lookup(hostname, hints.ai_family, res)) {
+			PostAddrInfo(res, hints, port, std::move(cb));
+			return;
+		}
+		//Waiter是std::function，回调按值捕获
+		std::function<void(struct addrinfo*)> waiter_cb(std::move(cb));
+		HostCache::Inst().Resolve(hostname, hints.ai_family,
+			[this,hints,port,waiter_cb](const HostCache::Result& res) {
+				std::function<void(struct addrinfo*)> cb(waiter_cb);
+				PostAddrInfo(res, hints, port, std::move(cb));
 			});
-		});
 	}
 
 protected:
 	//
+	inline void PostAddrInfo(const HostCache::Result& res, const struct addrinfo& hints, u_short port, std::function<void(struct addrinfo*)>&& cb)
+	{
+		AddrInfoList ai;
+		if (!res.error) {
+			ai.Assign(res, hints, port);
+		}
+		PostAddrInfo(std::move(ai), std::move(cb));
+	}
+	inline void PostAddrInfo(AddrInfoList&& ai, std::function<void(struct addrinfo*)>&& cb)
+	{
+		Post(std::bind([](AddrInfoList& ai, std::function<void(struct addrinfo*)>& cb) {
+			cb(ai.get());
+		}, std::move(ai), std::move(cb)));
+	}
+
 	void DoTask()
 	{
+		//从头开始消费，每轮最多执行一批，剩下的留到下一轮，避免持续投递时IO饿死
+		static const size_t max_batch = 1024;
+		InplaceTask task;
+		for(size_t i = 0; i < max_batch; i++) {
+			if(!task_que_.Pop(task)) {
+				return;
+			}
+			task();
+			task = nullptr;
+		}
+		if(!task_que_.IsEmpty()) {
+			Base::PostNotify();
+		}
+
 		// //从头开始消费
-		std::unique_lock<std::mutex> lock(mutex_);
+		// std::unique_lock<std::mutex> lock(mutex_);
 		
 		// size_t i = 0, j = tasks_que_.size();
 		// for(; i < j; i++)
@@ -1291,22 +3392,6 @@ protected:
 		// 		break;
 		// 	}
 		// }
-		
-		std::function<void()> task;
-		size_t i = 0, j = TaskQue::Count();
-		for(; i < j; i++) {
-			ssize_t delay = 0;
-			if(TaskQue::Pop(task,&delay)) {
-				lock.unlock();
-				task();
-				lock.lock();
-			} else {
-				if(delay > 0) {
-					Base::PostTimer(delay);
-				}
-				break;
-			}
-		}
 	}
 	
 	// virtual void OnIdle()
@@ -1334,6 +3419,8 @@ private:
 // 	}
 // 	std::map<TaskID,std::function<void()>> tasks_;
 // 	std::queue<std::function<void()>> tasks_que_;
+	MPSCQueue<InplaceTask> task_que_; //实时任务
+	std::unordered_map<size_t,Service::TimerID> timers_; //延迟任务ID到定时器
 	std::mutex mutex_;
 };
 
@@ -1355,19 +3442,23 @@ public:
 	}
 	
 	inline void PostNotify() { 
-		//std::lock_guard<std::mutex> lock(mutex_);
 		Base::PostNotify();
-		cv_.notify_one(); 
+		if(Base::IsNeedWakeUp()) {
+			//持锁通知，服务线程要么还没检查通知标志，要么已经在wait_for里
+			std::lock_guard<std::mutex> lock(mutex_);
+			cv_.notify_one(); 
+		}
 	}
 	
 protected:
 	//
 	virtual void OnWait()
 	{
-		size_t timeout = Base::GetWaitingTimeOut();
+		std::unique_lock<std::mutex> lock(mutex_);
+		size_t timeout = Base::BeginWaiting();
 		if (timeout) {
-			std::unique_lock<std::mutex> lock(mutex_);
 			cv_.wait_for(lock, std::chrono::milliseconds(timeout));
+			Base::EndWaiting();
 		}
 	}
 
@@ -1557,6 +3648,7 @@ public:
 		Base::Start();
 		//thread_ = std::thread(std::bind(&This::OnRun, this));
 		thread_ptr_ = std::make_shared<std::thread>(std::bind(&This::OnRun,this));
+		ApplyCpuAffinity();
 		return true;
 	}
 
@@ -1573,10 +3665,41 @@ public:
 		Base::Stop();
 	}
 
+	//绑定服务线程到指定CPU，<0表示不绑定，运行中设置立即生效
+	inline void SetCpuAffinity(int cpu) 
+	{ 
+		cpu_affinity_ = cpu; 
+		if(thread_ptr_) {
+			ApplyCpuAffinity();
+		}
+	}
+	inline int GetCpuAffinity() { return cpu_affinity_; }
+
+protected:
+	inline void ApplyCpuAffinity()
+	{
+#ifndef WIN32
+		if(cpu_affinity_ >= 0 && thread_ptr_) {
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(cpu_affinity_, &cpuset);
+			int ret = pthread_setaffinity_np(thread_ptr_->native_handle(), sizeof(cpuset), &cpuset);
+			if(ret) {
+				PRINTF("pthread_setaffinity_np cpu=%d failed, errno(%d): %s", cpu_affinity_, ret, strerror(ret));
+			}
+		}
+#else
+		if(cpu_affinity_ >= 0 && thread_ptr_) {
+			SetThreadAffinityMask(thread_ptr_->native_handle(), (DWORD_PTR)1 << cpu_affinity_);
+		}
+#endif//
+	}
+
 protected:
 	//线程
 	//std::thread thread_;
 	std::shared_ptr<std::thread> thread_ptr_;
+	int cpu_affinity_ = -1;
 };
 
 typedef ThreadServiceT<Service> ThreadService;
@@ -1613,22 +3736,68 @@ protected:
 	bool connected_;
 	size_t connect_time_;
 	size_t connect_timeout_;
+	Service* connect_svr_ = nullptr; //连接超时定时器所在服务
+	Service::TimerID connect_timer_ = 0; //连接超时定时器
+	bool fastopen_ = false; //开启TCP Fast Open
+	int fastopen_state_ = 0; //FASTOPEN_STATE
 
 public:
+	enum FASTOPEN_STATE
+	{
+		FASTOPEN_NONE = 0, //没有使用TFO
+		FASTOPEN_DEFER, //connect延迟到第一次发送，SYN还没发出
+		FASTOPEN_SENT, //第一次发送的数据已交给内核随SYN发送，没有cookie时内核退回普通握手，握手后再发
+		FASTOPEN_FALLBACK, //内核不支持或者发送返回EINPROGRESS，退回普通握手，数据在握手完成后发送
+	};
+
 	ConnectSocketT():Base(), connected_(false), connect_time_(0), connect_timeout_(0) {}
 	//virtual ~ConnectSocketT() {}
 
 	int Close()
 	{
+		StopConnectTimer();
 		int rlt = Base::Close();
 		connected_ = false;
 		connect_time_ = 0;
+		fastopen_state_ = FASTOPEN_NONE;
 		return rlt;
 	}
 
+	/*!
+	 *	@brief 开启TCP Fast Open，需要在Connect之前调用.
+	 *
+	 *	LINUX下用TCP_FASTOPEN_CONNECT，connect不发SYN，马上报告连接成功，第一次发送的数据随SYN发出；
+	 *	没有cookie时内核只发带cookie请求的SYN，数据在握手完成后再发，下次连接就能带数据，IsSynData可以区分；
+	 *	只适合客户端先发数据的协议，连接后要尽快SendBuf；需要net.ipv4.tcp_fastopen开启客户端(1)
+	 */
+	inline void SetFastOpen(bool enable = true) { fastopen_ = enable; }
+	inline bool IsFastOpen() { return fastopen_; }
+	inline int GetFastOpenState() { return fastopen_state_; }
+	/*!
+	 *	@brief 第一次发送的数据是否真的随SYN发出并被服务端确认.
+	 *
+	 *	握手完成后才有意义，返回false表示没有cookie或者服务端没接受，数据是握手后再发的
+	 */
+	inline bool IsSynData()
+	{
+#ifdef TCPI_OPT_SYN_DATA
+		if(fastopen_state_ == FASTOPEN_SENT) {
+			struct tcp_info info = {0};
+			socklen_t info_len = sizeof(info);
+			if(getsockopt(*this, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0) {
+				return info.tcpi_options & TCPI_OPT_SYN_DATA;
+			}
+		}
+#endif//
+		return false;
+	}
+
 	void SetConnectTimeOut(size_t TimeOut)
 	{
 		connect_timeout_ = TimeOut;
+		if(IsConnecting()) {
+			StartConnectTimer();
+		}
 	}
 
 	size_t GetConnectTimeOut()
@@ -1662,13 +3831,56 @@ public:
 		return false;
 	}
 
-protected:
+protected:
+	//连接超时由服务时间轮触发，不再依赖FD_IDLE轮询
+	inline void StartConnectTimer()
+	{
+		StopConnectTimer();
+		if(!connect_svr_ || !connect_timeout_ || !IsConnecting()) {
+			return;
+		}
+		size_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		size_t elapsed = now - connect_time_;
+		size_t remain = elapsed < connect_timeout_ ? connect_timeout_ - elapsed : 0;
+		//不在回调里清connect_timer_，Close在其他线程调用StopConnectTimer时要靠它等回调执行完
+		connect_timer_ = connect_svr_->AddTimer(remain, [this]() {
+			if(Base::IsSelect(FD_CONNECT) && !IsConnected()) {
+				OnConnect(ETIMEDOUT);
+			}
+		});
+	}
+
+	inline void StopConnectTimer()
+	{
+		if(connect_timer_) {
+			if(connect_svr_) {
+				connect_svr_->RemoveTimer(connect_timer_);
+			}
+			connect_timer_ = 0;
+		}
+	}
+
+	virtual void OnAttachService(Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+		connect_svr_ = pSvr;
+		StartConnectTimer();
+	}
+
+	virtual void OnDetachService(Service* pSvr)
+	{
+		StopConnectTimer();
+		connect_svr_ = nullptr;
+		Base::OnDetachService(pSvr);
+	}
+
 	virtual void OnIdle()
 	{
 		Base::OnIdle();
 
 		//ASSERT(IsConnectSocket());
-		if(Base::IsSelect(FD_CONNECT) && connect_timeout_) {
+		//没有挂到服务上时，仍然在空闲时检查连接超时
+		if(!connect_svr_ && Base::IsSelect(FD_CONNECT) && connect_timeout_) {
 			if(IsConnectTimeOut()) {
 				OnConnect(ETIMEDOUT);
 			}
@@ -1681,10 +3893,43 @@ protected:
 
 		//ASSERT(nRole==SOCKET_ROLE_CONNECT);
 		connect_time_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		fastopen_state_ = FASTOPEN_NONE;
+		if(fastopen_) {
+			//在connect之前设置，内核不支持时退回普通握手
+			fastopen_state_ = FASTOPEN_FALLBACK;
+#ifdef TCP_FASTOPEN_CONNECT
+			if(SOCKET_ERROR != Base::SetSockOpt(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1)) {
+				fastopen_state_ = FASTOPEN_DEFER;
+			}
+#endif//
+		}
+		StartConnectTimer();
+	}
+
+	virtual void OnSend(int nErrorCode)
+	{
+#ifndef WIN32
+		if(nErrorCode == EINPROGRESS && fastopen_state_ == FASTOPEN_DEFER) {
+			//没有cookie，SYN只带cookie请求，数据没有发出，等握手完成可写时再发
+			fastopen_state_ = FASTOPEN_FALLBACK;
+			Base::Select(FD_WRITE);
+			return;
+		}
+#endif//
+		Base::OnSend(nErrorCode);
+	}
+
+	virtual void OnSend(const char* lpBuf, int nBufLen, int nFlags)
+	{
+		if(fastopen_state_ == FASTOPEN_DEFER) {
+			fastopen_state_ = FASTOPEN_SENT;
+		}
+		Base::OnSend(lpBuf, nBufLen, nFlags);
 	}
 
 	virtual void OnConnect(int nErrorCode)
 	{
+		StopConnectTimer();
 		Base::OnConnect(nErrorCode);
 
 		if(!nErrorCode) {
@@ -1699,36 +3944,218 @@ protected:
  *	@brief ListenSocketT 模板定义.
  *
  *	封装ListenSocket，适用于服务端监听Socket
+ *
+ *	一次FD_ACCEPT通知循环接受连接，直到EAGAIN或者用完本轮预算(SetAcceptBudget)，
+ *	预算用完时重新登记事件(ET下下一轮会再通知)，避免连接风暴时监听Socket独占服务线程；
+ *	LINUX下使用accept4直接得到非阻塞+CLOEXEC的Socket，省掉每个连接的fcntl；
+ *	TCP_NODELAY、SO_KEEPALIVE、收发缓存等选项LINUX下由监听Socket继承，设置在监听Socket上即可，
+ *	不需要每个连接再设置一次；
+ *	接受的连接按批交给OnAcceptBatch，默认逐个触发FD_ACCEPT，可重载后用SocketManagerT::AddSockets批量分配；
+ *	EMFILE/ENFILE/ENOBUFS/ENOMEM时暂停FD_ACCEPT，退避一段时间(SetAcceptBackoff)后再接受，避免空转
  */
 template<class TBase>
 class ListenSocketT : public TBase
 {
 	typedef TBase Base;
 public:
+	enum { 
+		ACCEPT_BUDGET = 64, //默认每次通知最多接受的连接数
+		ACCEPT_BATCH = 16, //每批交给OnAcceptBatch的连接数
+		ACCEPT_BACKOFF = 100, //默认资源不足时暂停接受的时间（毫秒）
+	};
+	struct AcceptItem
+	{
+		SOCKET Sock;
+		SOCKADDR_STORAGE Addr;
+		int AddrLen;
+	};
+	struct AcceptStat
+	{
+		uint64_t wakeups = 0; //FD_ACCEPT通知次数
+		uint64_t accepts = 0; //接受的连接数
+		uint64_t budget_hits = 0; //用完预算的次数，频繁出现说明预算偏小或者监听Socket太少
+		uint64_t errors = 0; //除EAGAIN/EINTR以外的错误次数，比如EMFILE
+		size_t max_batch = 0; //单次通知接受的最大连接数
+	};
+protected:
+	size_t accept_budget_ = ACCEPT_BUDGET;
+	size_t accept_backoff_ = ACCEPT_BACKOFF;
+	//服务线程更新，GetAcceptStat可能在其他线程读取
+	struct
+	{
+		std::atomic<uint64_t> wakeups{0};
+		std::atomic<uint64_t> accepts{0};
+		std::atomic<uint64_t> budget_hits{0};
+		std::atomic<uint64_t> errors{0};
+		std::atomic<size_t> max_batch{0};
+	} accept_stat_;
+	int fastopen_qlen_ = 0; //TCP Fast Open队列长度，0表示不开启
+	Service* accept_svr_ = nullptr; //退避定时器所在服务
+	Service::TimerID accept_timer_ = 0;
+public:
 
 	ListenSocketT():Base()
 	{
 
 	}
+	virtual ~ListenSocketT()
+	{
+		StopAcceptTimer();
+	}
+
+	int Close()
+	{
+		StopAcceptTimer();
+		return Base::Close();
+	}
+
+	//设置每次通知最多接受的连接数，0表示不限制
+	inline void SetAcceptBudget(size_t budget) { accept_budget_ = budget; }
+	inline size_t GetAcceptBudget() { return accept_budget_; }
+	//设置资源不足时暂停接受的时间（毫秒）
+	inline void SetAcceptBackoff(size_t millis) { accept_backoff_ = millis; }
+	inline size_t GetAcceptBackoff() { return accept_backoff_; }
+	//任意线程可调用，各字段分别读取，彼此之间不保证是同一时刻的值
+	inline AcceptStat GetAcceptStat() 
+	{
+		AcceptStat stat;
+		stat.wakeups = accept_stat_.wakeups.load(std::memory_order_relaxed);
+		stat.accepts = accept_stat_.accepts.load(std::memory_order_relaxed);
+		stat.budget_hits = accept_stat_.budget_hits.load(std::memory_order_relaxed);
+		stat.errors = accept_stat_.errors.load(std::memory_order_relaxed);
+		stat.max_batch = accept_stat_.max_batch.load(std::memory_order_relaxed);
+		return stat;
+	}
+
+	/*!
+	 *	@brief 开启TCP Fast Open，需要在Listen之前调用.
+	 *
+	 *	qlen是还没完成握手就带数据的连接最大个数，0关闭；需要net.ipv4.tcp_fastopen开启服务端(2)
+	 */
+	inline void SetFastOpen(int qlen) { fastopen_qlen_ = qlen; }
+	inline int GetFastOpen() { return fastopen_qlen_; }
+
+#ifndef WIN32
+	//接受的连接的SYN是否带了数据并且已被接受(TFO)
+	static bool IsSynData(SOCKET Sock)
+	{
+#ifdef TCPI_OPT_SYN_DATA
+		struct tcp_info info = {0};
+		socklen_t info_len = sizeof(info);
+		if(getsockopt(Sock, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0) {
+			return info.tcpi_options & TCPI_OPT_SYN_DATA;
+		}
+#endif//
+		return false;
+	}
+
+	/*!
+	 *	@brief 获取监听Socket当前的全连接队列长度和上限.
+	 *
+	 *	LINUX下监听Socket的TCP_INFO中tcpi_unacked是当前队列长度，tcpi_sacked是backlog
+	 */
+	inline bool GetAcceptQueue(uint32_t& len, uint32_t& max_len)
+	{
+		struct tcp_info info = {0};
+		socklen_t info_len = sizeof(info);
+		if(getsockopt(*this, IPPROTO_TCP, TCP_INFO, &info, &info_len) != 0) {
+			return false;
+		}
+		len = info.tcpi_unacked;
+		max_len = info.tcpi_sacked;
+		return true;
+	}
+
+	/*!
+	 *	@brief 获取全连接队列满导致的丢弃计数.
+	 *
+	 *	读取/proc/net/netstat的TcpExt ListenOverflows和ListenDrops，是整个网络命名空间的累计值，
+	 *	取两次的差值观察，持续增长说明accept跟不上或者backlog太小
+	 */
+	static bool GetListenOverflows(uint64_t& overflows, uint64_t& drops)
+	{
+		FILE* fp = fopen("/proc/net/netstat", "r");
+		if(!fp) {
+			return false;
+		}
+		bool found = false;
+		char names[4096], values[4096];
+		while(fgets(names, sizeof(names), fp) && fgets(values, sizeof(values), fp)) {
+			if(strncmp(names, "TcpExt:", 7) != 0) {
+				continue;
+			}
+			//名字行和数值行一一对应
+			char *name_save = nullptr, *value_save = nullptr;
+			char* name = strtok_r(names, " \n", &name_save);
+			char* value = strtok_r(values, " \n", &value_save);
+			for(; name && value; name = strtok_r(nullptr, " \n", &name_save), value = strtok_r(nullptr, " \n", &value_save)) {
+				if(strcmp(name, "ListenOverflows") == 0) {
+					overflows = strtoull(value, nullptr, 10);
+					found = true;
+				} else if(strcmp(name, "ListenDrops") == 0) {
+					drops = strtoull(value, nullptr, 10);
+				}
+			}
+			break;
+		}
+		fclose(fp);
+		return found;
+	}
+#endif//
 
 protected:
 	//
+	virtual void OnRole(int nRole)
+	{
+		Base::OnRole(nRole);
+
+#ifdef TCP_FASTOPEN
+		if(nRole == SOCKET_ROLE_LISTEN && fastopen_qlen_ > 0) {
+			//在listen之前设置，失败不影响监听
+			if(SOCKET_ERROR == Base::SetSockOpt(IPPROTO_TCP, TCP_FASTOPEN, fastopen_qlen_)) {
+				PRINTF("TCP_FASTOPEN Error=%d", XSocket::Socket::GetLastError());
+			}
+		}
+#endif//
+	}
+
 	virtual void OnAccept(int nErrorCode)
 	{
 		if(nErrorCode) {
 			return Base::OnAccept(nErrorCode);
 		}
 
-		//bool bConitnue = false;
-		//do {
-		//	bConitnue = false;
-			SOCKADDR_STORAGE stAddr = {0};
-			int nAddrLen = sizeof(stAddr);
-			SOCKET Sock = Base::Accept((SOCKADDR*)&stAddr, &nAddrLen);
-	 		if(XSocket::Socket::IsSocket(Sock)) {
-				Base::Trigger(FD_ACCEPT, Sock, (const SOCKADDR*)&stAddr, nAddrLen);
-				//bConitnue = true;
+		accept_stat_.wakeups.fetch_add(1, std::memory_order_relaxed);
+		AcceptItem items[ACCEPT_BATCH];
+		int count = 0;
+		size_t total = 0;
+		bool bContinue = true;
+		do {
+			AcceptItem& item = items[count];
+			memset(&item.Addr, 0, sizeof(item.Addr));
+			item.AddrLen = sizeof(item.Addr);
+#ifdef WIN32
+			//IOCP的Accept每次投递一个AcceptEx，一次通知只取一个连接
+			item.Sock = Base::Accept((SOCKADDR*)&item.Addr, &item.AddrLen);
+			bContinue = false;
+#else
+			item.Sock = Base::Accept4((SOCKADDR*)&item.Addr, &item.AddrLen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#endif//
+	 		if(XSocket::Socket::IsSocket(item.Sock)) {
+				++count;
+				++total;
+				if(count >= ACCEPT_BATCH) {
+					OnAcceptBatch(items, count);
+					count = 0;
+				}
+				if(accept_budget_ && total >= accept_budget_) {
+					//预算用完，剩下的连接留到下一轮，ET下需要重新登记才会再通知
+					accept_stat_.budget_hits.fetch_add(1, std::memory_order_relaxed);
+					Base::RearmSelect();
+					break;
+				}
 			} else {
+				bContinue = false;
 				nErrorCode = XSocket::Socket::GetLastError();
 				switch(nErrorCode)
 				{
@@ -1742,14 +4169,94 @@ protected:
 				case EWOULDBLOCK:
 					break;
 				case EINTR:
+					bContinue = true;
+					break;
+				case ECONNABORTED:
+					//连接在accept前被对端重置，继续接受下一个
+					bContinue = true;
+					break;
+				case EMFILE:
+				case ENFILE:
+				case ENOBUFS:
+				case ENOMEM:
+					//资源不足，不关闭监听Socket，退避一段时间再试，立即重新登记会在LT/ET下空转
+					accept_stat_.errors.fetch_add(1, std::memory_order_relaxed);
+					StartAcceptTimer();
 					break;
 #endif//
 				default:
+					accept_stat_.errors.fetch_add(1, std::memory_order_relaxed);
+					if(count > 0) {
+						OnAcceptBatch(items, count);
+						count = 0;
+					}
 					Base::Trigger(FD_CLOSE,nErrorCode);
 					break;
 				}
 			}
-		//} while (bConitnue);
+		} while (bContinue && Base::IsSocket());
+		if(count > 0) {
+			OnAcceptBatch(items, count);
+		}
+		accept_stat_.accepts.fetch_add(total, std::memory_order_relaxed);
+		//只有服务线程写，不需要CAS
+		if(total > accept_stat_.max_batch.load(std::memory_order_relaxed)) {
+			accept_stat_.max_batch.store(total, std::memory_order_relaxed);
+		}
+	}
+
+	/*!
+	 *	@brief 接受一批连接.
+	 *
+	 *	默认逐个触发FD_ACCEPT，LINUX下传入的Socket已经是非阻塞的；
+	 *	重载时接管items中所有Socket的所有权
+	 */
+	virtual void OnAcceptBatch(AcceptItem* items, int count)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			Base::Trigger(FD_ACCEPT, items[i].Sock, (const SOCKADDR*)&items[i].Addr, items[i].AddrLen);
+		}
+	}
+
+	//暂停FD_ACCEPT，到时间后重新选择，EPOLL下重新选择会马上触发一次接受
+	inline void StartAcceptTimer()
+	{
+		if(!accept_svr_ || !accept_backoff_) {
+			Base::RearmSelect();
+			return;
+		}
+		StopAcceptTimer();
+		Base::RemoveSelect(FD_ACCEPT);
+		//不在回调里清accept_timer_，Close在其他线程调用StopAcceptTimer时要靠它等回调执行完
+		accept_timer_ = accept_svr_->AddTimer(accept_backoff_, [this]() {
+			if(Base::IsSocket()) {
+				Base::Select(FD_ACCEPT);
+			}
+		});
+	}
+
+	inline void StopAcceptTimer()
+	{
+		if(accept_timer_) {
+			if(accept_svr_) {
+				accept_svr_->RemoveTimer(accept_timer_);
+			}
+			accept_timer_ = 0;
+		}
+	}
+
+	virtual void OnAttachService(Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+		accept_svr_ = pSvr;
+	}
+
+	virtual void OnDetachService(Service* pSvr)
+	{
+		StopAcceptTimer();
+		accept_svr_ = nullptr;
+		Base::OnDetachService(pSvr);
 	}
 };
 
@@ -1763,7 +4270,10 @@ class HostSocketExT : public TBase
 {
 	typedef TBase Base;
 protected:
+	AddrInfoList ai_list_; //自己持有地址链表，Open(struct addrinfo*)的参数只需在调用期间有效
 	struct addrinfo* ai_current_ = nullptr;
+	bool ai_interleave_ = false; //Open时按地址族交替排列地址
+	bool ai_async_ = false; //服务线程上Open没有命中HostCache时不阻塞，后台解析
 public:
 	HostSocketExT()
 	{
@@ -1773,25 +4283,84 @@ public:
 	{
 	}
 
+	/*!
+	 *	@brief 按主机名打开Socket.
+	 *
+	 *	IP地址和命中HostCache的主机名不会阻塞；没有命中时同步调用getaddrinfo并写入HostCache；
+	 *	SetAsyncResolve(true)后服务线程上不阻塞，在ThreadPool后台解析写入HostCache，本次返回INVALID_SOCKET，
+	 *	错误码为EWOULDBLOCK，稍后重试即可命中；需要解析完成通知时用Open(host, af, type, cb)、
+	 *	SocketSetT::AddConnect(sock_ptr, host, port)、PostGetAddrInfo或者DNSResolverT
+	 */
 	inline SOCKET Open(const char* lpszHostAddress, int nSockAf = AF_UNSPEC, int nSockType = SOCK_STREAM)
 	{
-		struct addrinfo hints = {0};
+		struct addrinfo hints = {};
 		hints.ai_family = nSockAf;
 		hints.ai_socktype = nSockType;
 		hints.ai_flags = AI_PASSIVE;
+		bool cacheable = lpszHostAddress && lpszHostAddress[0] && !HostCache::IsNumericHost(lpszHostAddress);
+		if (cacheable) {
+			HostCache::Result res;
+			if (HostCache::Inst().Lookup(lpszHostAddress, nSockAf, res)) {
+				return OpenResult(lpszHostAddress, nSockAf, nSockType, res);
+			}
+			if (ai_async_ && Service::service()) {
+				HostCache::Inst().Resolve(lpszHostAddress, nSockAf, [](const HostCache::Result&) {});
+				XSocket::Socket::SetLastError(EWOULDBLOCK);
+				PRINTF("%s %s in progress", "GetAddrInfo", lpszHostAddress);
+				return INVALID_SOCKET;
+			}
+		}
 		struct addrinfo* result = nullptr;
 		int ret = XSocket::Socket::GetAddrInfo(lpszHostAddress, nullptr, &hints, &result);
 		if(ret) {
+			if (cacheable && HostCache::IsNegativeError(ret)) {
+				HostCache::Result res;
+				res.error = ret;
+				HostCache::Inst().Insert(lpszHostAddress, nSockAf, res, HostCache::Inst().GetDefaultTTL());
+			}
 			int nErrorCode = GetLastError();
 			PRINTF("%s Error=%d:%s", "GetAddrInfo", nErrorCode, GetErrorMessage(nErrorCode));
 			return INVALID_SOCKET;
 		}
-		return Open(result);
+		if (cacheable) {
+			HostCache::Result res;
+			HostCache::ToResult(result, res);
+			HostCache::Inst().Insert(lpszHostAddress, nSockAf, res, HostCache::Inst().GetDefaultTTL());
+		}
+		SOCKET sock = Open(result);
+		freeaddrinfo(result);
+		return sock;
+	}
+
+	/*!
+	 *	@brief 按主机名异步打开Socket.
+	 *
+	 *	IP地址和命中HostCache时在调用线程直接Open并回调，否则在ThreadPool后台解析，完成后在ThreadPool线程Open并回调；
+	 *	回调参数是Open的结果，失败为INVALID_SOCKET，回调需要持有Socket（比如捕获shared_ptr）保证解析期间Socket有效
+	 */
+	inline void Open(const std::string& strHostAddress, int nSockAf, int nSockType, std::function<void(SOCKET)>&& cb)
+	{
+		HostCache::Result res;
+		if (strHostAddress.empty() || HostCache::IsNumericHost(strHostAddress.c_str())
+			|| HostCache::Inst().Lookup(strHostAddress, nSockAf, res)) {
+			cb(OpenResult(strHostAddress.c_str(), nSockAf, nSockType, res));
+			return;
+		}
+		//Waiter是std::function，回调按值捕获
+		std::function<void(SOCKET)> open_cb(std::move(cb));
+		std::string host(strHostAddress);
+		HostCache::Inst().Resolve(strHostAddress, nSockAf, [this,host,nSockAf,nSockType,open_cb](const HostCache::Result& res) {
+			open_cb(OpenResult(host.c_str(), nSockAf, nSockType, res));
+		});
 	}
 
 	inline SOCKET Open(struct addrinfo* result)
 	{
-		ai_current_ = result;
+		ai_list_.Assign(result);
+		if (ai_interleave_) {
+			ai_list_.Interleave();
+		}
+		ai_current_ = ai_list_.get();
 		if(ai_current_) {
 #ifdef _DEBUG
 			for(addrinfo* ai_next = ai_current_; ai_next; ai_next = ai_next->ai_next)
@@ -1802,51 +4371,361 @@ public:
 #endif
 			return Base::Open(ai_current_->ai_family, ai_current_->ai_socktype, ai_current_->ai_protocol);
 		}
-		return INVALID_SOCKET;
+		return INVALID_SOCKET;
+	}
+
+	inline SOCKET OpenNext()
+	{
+		if (ai_current_) {
+			for(ai_current_ = ai_current_->ai_next; ai_current_; ai_current_ = ai_current_->ai_next)
+			{
+				return Base::Open(ai_current_->ai_family, ai_current_->ai_socktype, ai_current_->ai_protocol);
+			}
+		}
+		return INVALID_SOCKET;
+	}
+
+	//服务线程上按主机名Open没有命中HostCache时不阻塞，默认关闭（同步解析）
+	inline void SetAsyncResolve(bool enable) { ai_async_ = enable; }
+	inline bool IsAsyncResolve() { return ai_async_; }
+
+	inline bool IsAddrLast() { return ai_current_ && ai_current_->ai_next ? false : true; }
+
+	inline int GetAddrType() { ai_current_?ai_current_->ai_family:Base::GetAddrType(); }
+
+protected:
+	//用解析结果打开，IP地址和空地址没有缓存结果，直接走同步Open（不会阻塞）
+	inline SOCKET OpenResult(const char* lpszHostAddress, int nSockAf, int nSockType, const HostCache::Result& res)
+	{
+		if (!lpszHostAddress[0] || HostCache::IsNumericHost(lpszHostAddress)) {
+			return Open(lpszHostAddress, nSockAf, nSockType);
+		}
+		if (res.error) {
+			PRINTF("%s Error=%d:%s", "GetAddrInfo", res.error, gai_strerror(res.error));
+			return INVALID_SOCKET;
+		}
+		struct addrinfo hints = {};
+		hints.ai_family = nSockAf;
+		hints.ai_socktype = nSockType;
+		AddrInfoList ai;
+		ai.Assign(res, hints, 0);
+		return Open(ai.get());
+	}
+};
+
+/*!
+ *	@brief ConnectSocketExT 模板定义.
+ *
+ *	封装ConnectSocketExT，自适应IPV4/IPV6套接字
+ *
+ *	SetHappyEyeballs开启RFC 8305并行连接：地址按IPv6/IPv4交替排列，自身套接字连接第一个地址，
+ *	之后每隔attempt_delay_或者上一个尝试失败时，用裸套接字连接下一个地址，
+ *	最先连接成功的套接字替换自身套接字后触发OnConnect，其余尝试全部关闭；
+ *	竞速期间自身套接字不选择FD_CONNECT，和裸套接字一样由定时器检查连接结果，
+ *	单个尝试失败不通知上层，OnConnect只调用一次：成功，或者全部失败/超时时带最后的错误
+ */
+template<class TBase = SocketEx>
+class ConnectSocketExT : public HostSocketExT<ConnectSocketT<TBase>>
+{
+	typedef HostSocketExT<ConnectSocketT<TBase>> Base;
+protected:
+	//并行连接尝试
+	struct Attempt
+	{
+		SOCKET sock;
+		struct addrinfo* ai;
+	};
+	size_t attempt_delay_ = 0; //相邻连接尝试间隔，0表示不并行连接
+	size_t attempt_poll_ = 10; //裸套接字连接状态检查间隔
+	size_t attempt_time_ = 0; //最近一次发起连接尝试的时间
+	int attempt_error_ = 0; //最近一次连接尝试失败的错误
+	u_short attempt_port_ = 0;
+	bool attempt_self_ = false; //自身套接字还在竞速连接中
+	struct addrinfo* ai_attempt_ = nullptr; //下一个待尝试的地址
+	std::vector<Attempt> attempts_; //与自身套接字并行的连接尝试
+	Service::TimerID attempt_timer_ = 0;
+public:
+	ConnectSocketExT()
+	{
+
+	}
+	virtual ~ConnectSocketExT() 
+	{
+		StopAttempts();
+	}
+
+	int Close()
+	{
+		StopAttempts();
+		return Base::Close();
+	}
+
+	/*!
+	 *	@brief 开启Happy Eyeballs并行连接.
+	 *
+	 *	需要在Open之前调用，delay为相邻连接尝试间隔，RFC 8305建议250ms，0关闭
+	 */
+	inline void SetHappyEyeballs(size_t delay = 250)
+	{
+		attempt_delay_ = delay;
+		Base::ai_interleave_ = delay != 0;
+	}
+
+	inline size_t GetHappyEyeballs() { return attempt_delay_; }
+
+	inline int Connect(int nHostPort = 0)
+	{
+		ASSERT(Base::IsSocket());
+		if (Base::ai_current_) {
+			StopAttempts();
+			XSocket::Socket::SetAddrPort(Base::ai_current_->ai_addr, nHostPort);
+			int ret = Base::Connect(Base::ai_current_->ai_addr, Base::ai_current_->ai_addrlen);
+			if (attempt_delay_ && Base::ai_current_->ai_next) {
+				attempt_port_ = nHostPort;
+				attempt_time_ = GetAttemptTime();
+				attempt_error_ = 0;
+				ai_attempt_ = Base::ai_current_->ai_next;
+				//自身套接字也由定时器检查结果，服务不再触发FD_CONNECT，单个地址失败不会通知上层
+				Base::RemoveSelect(FD_CONNECT);
+				attempt_self_ = true;
+				if (ret == SOCKET_ERROR && !IsAttemptInProgress(XSocket::Socket::GetLastError())) {
+					//自身套接字同步失败，下一个地址立即开始尝试
+					attempt_error_ = XSocket::Socket::GetLastError();
+					attempt_self_ = false;
+				}
+				StartAttemptTimer();
+			}
+			return ret;
+		}
+		return SOCKET_ERROR;
+	}
+
+protected:
+	static inline size_t GetAttemptTime()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static inline bool IsAttemptInProgress(int nErrorCode)
+	{
+#ifdef WIN32
+		return nErrorCode == WSAEWOULDBLOCK;
+#else
+		return nErrorCode == EINPROGRESS || nErrorCode == EWOULDBLOCK || nErrorCode == EINTR;
+#endif
+	}
+
+	//还有连接尝试在进行或者还有地址未尝试
+	inline bool IsRacing()
+	{
+		return attempt_self_ || !attempts_.empty() || ai_attempt_;
+	}
+
+	//自身套接字或者裸套接字还在连接中
+	inline bool IsAttemptPending()
+	{
+		return attempt_self_ || !attempts_.empty();
+	}
+
+	inline void StartAttemptTimer()
+	{
+		StopAttemptTimer();
+		if(!Base::connect_svr_ || !IsRacing()) {
+			return;
+		}
+		size_t delay = attempt_delay_;
+		if (ai_attempt_) {
+			size_t elapsed = GetAttemptTime() - attempt_time_;
+			delay = IsAttemptPending() ? (elapsed < attempt_delay_ ? attempt_delay_ - elapsed : 0) : 0;
+		}
+		if (IsAttemptPending()) {
+			delay = std::min(delay, attempt_poll_);
+		}
+		//回调里不清attempt_timer_，Close/析构/OnDetachService总能经StopAttemptTimer的RemoveTimer等回调执行完，this不会悬空
+		attempt_timer_ = Base::connect_svr_->AddTimer(delay, [this]() {
+			DoAttempts();
+		});
+	}
+
+	inline void StopAttemptTimer()
+	{
+		if(attempt_timer_) {
+			if(Base::connect_svr_) {
+				Base::connect_svr_->RemoveTimer(attempt_timer_);
+			}
+			attempt_timer_ = 0;
+		}
+	}
+
+	inline void StopAttempts()
+	{
+		StopAttemptTimer();
+		for (auto& attempt : attempts_)
+		{
+			XSocket::Socket::Close(attempt.sock);
+		}
+		attempts_.clear();
+		ai_attempt_ = nullptr;
+		attempt_self_ = false;
+	}
+
+	//用裸套接字连接下一个地址，同步失败返回false
+	inline bool StartAttempt()
+	{
+		struct addrinfo* ai = ai_attempt_;
+		ai_attempt_ = ai->ai_next;
+		attempt_time_ = GetAttemptTime();
+		SOCKET sock = XSocket::Socket::Create(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (!XSocket::Socket::IsSocket(sock)) {
+			attempt_error_ = XSocket::Socket::GetLastError();
+			return false;
+		}
+		XSocket::Socket::SetNonBlock(sock);
+		//沿用自身套接字上常用的选项
+		int opt = 0;
+		if (SOCKET_ERROR != Base::GetSockOpt(IPPROTO_TCP, TCP_NODELAY, (void*)&opt, sizeof(opt)) && opt) {
+			XSocket::Socket::SetSockOpt(sock, IPPROTO_TCP, TCP_NODELAY, (const void*)&opt, sizeof(opt));
+		}
+		opt = 0;
+		if (SOCKET_ERROR != Base::GetSockOpt(SOL_SOCKET, SO_KEEPALIVE, (void*)&opt, sizeof(opt)) && opt) {
+			XSocket::Socket::SetSockOpt(sock, SOL_SOCKET, SO_KEEPALIVE, (const void*)&opt, sizeof(opt));
+		}
+		XSocket::Socket::SetAddrPort(ai->ai_addr, attempt_port_);
+		if (SOCKET_ERROR == XSocket::Socket::Connect(sock, ai->ai_addr, ai->ai_addrlen)) {
+			int nErrorCode = XSocket::Socket::GetLastError();
+			if (!IsAttemptInProgress(nErrorCode)) {
+				attempt_error_ = nErrorCode;
+				XSocket::Socket::Close(sock);
+				return false;
+			}
+		}
+		attempts_.push_back({sock, ai});
+		return true;
+	}
+
+	//检查裸套接字是否完成连接，完成时nErrorCode为连接结果
+	inline bool PollAttempt(const Attempt& attempt, int& nErrorCode)
+	{
+#ifdef WIN32
+		fd_set writefds, exceptfds;
+		FD_ZERO(&writefds);
+		FD_ZERO(&exceptfds);
+		FD_SET(attempt.sock, &writefds);
+		FD_SET(attempt.sock, &exceptfds);
+		struct timeval tv = {0, 0};
+		if (select(0, NULL, &writefds, &exceptfds, &tv) <= 0) {
+			return false;
+		}
+#else
+		struct pollfd pfd = {};
+		pfd.fd = attempt.sock;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, 0) <= 0) {
+			return false;
+		}
+#endif
+		nErrorCode = 0;
+		XSocket::Socket::GetSockOpt(attempt.sock, SOL_SOCKET, SO_ERROR, (void*)&nErrorCode, sizeof(nErrorCode));
+#ifdef WIN32
+		if (!nErrorCode && FD_ISSET(attempt.sock, &exceptfds)) {
+			nErrorCode = ENETDOWN;
+		}
+#else
+		if (!nErrorCode && (pfd.revents & (POLLERR | POLLHUP))) {
+			nErrorCode = ECONNREFUSED;
+		}
+#endif
+		return true;
 	}
 
-	inline SOCKET OpenNext()
+	//检查裸套接字连接结果，到达间隔或者没有进行中的尝试时发起下一个尝试
+	inline void DoAttempts()
 	{
-		if (ai_current_) {
-			for(ai_current_ = ai_current_->ai_next; ai_current_; ai_current_ = ai_current_->ai_next)
-			{
-				return Base::Open(ai_current_->ai_family, ai_current_->ai_socktype, ai_current_->ai_protocol);
+		StopAttemptTimer();
+		if (attempt_self_) {
+			Attempt self = {(SOCKET)*this, Base::ai_current_};
+			int nErrorCode = 0;
+			if (PollAttempt(self, nErrorCode)) {
+				attempt_self_ = false;
+				if (!nErrorCode) {
+					StopAttempts();
+					OnConnect(0);
+					return;
+				}
+				attempt_error_ = nErrorCode;
 			}
 		}
-		return INVALID_SOCKET;
+		for (size_t i = 0; i < attempts_.size(); )
+		{
+			int nErrorCode = 0;
+			if (!PollAttempt(attempts_[i], nErrorCode)) {
+				i++;
+				continue;
+			}
+			Attempt attempt = attempts_[i];
+			attempts_.erase(attempts_.begin() + i);
+			if (!nErrorCode) {
+				WinAttempt(attempt);
+				return;
+			}
+			attempt_error_ = nErrorCode;
+			XSocket::Socket::Close(attempt.sock);
+		}
+		if (Base::IsConnectTimeOut()) {
+			//竞速期间自身套接字不选择FD_CONNECT，连接超时由这里处理
+			StopAttempts();
+			OnConnect(ETIMEDOUT);
+			return;
+		}
+		while (ai_attempt_ && (!IsAttemptPending() || GetAttemptTime() >= attempt_time_ + attempt_delay_))
+		{
+			StartAttempt();
+		}
+		if (!IsAttemptPending()) {
+			//所有地址都连接失败
+			OnConnect(attempt_error_ ? attempt_error_ : ECONNREFUSED);
+			return;
+		}
+		StartAttemptTimer();
 	}
 
-	inline bool IsAddrLast() { return ai_current_ && ai_current_->ai_next ? false : true; }
-
-	inline int GetAddrType() { ai_current_?ai_current_->ai_family:Base::GetAddrType(); }
-};
-
-/*!
- *	@brief ConnectSocketExT 模板定义.
- *
- *	封装ConnectSocketExT，自适应IPV4/IPV6套接字
- */
-template<class TBase = SocketEx>
-class ConnectSocketExT : public HostSocketExT<ConnectSocketT<TBase>>
-{
-	typedef HostSocketExT<ConnectSocketT<TBase>> Base;
-public:
-	ConnectSocketExT()
+	//裸套接字胜出，替换自身套接字
+	inline void WinAttempt(const Attempt& attempt)
 	{
+		StopAttempts();
+		//清除已选择的事件，OnConnect重新选择时把新套接字注册到服务
+		Base::RemoveSelect(FD_CONNECT|FD_READ|FD_OOB|FD_WRITE);
+		XSocket::Socket::Close(Base::Attach(attempt.sock));
+		Base::ai_current_ = attempt.ai;
+		OnConnect(0);
+	}
 
+	virtual void OnAttachService(Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+		StartAttemptTimer();
 	}
-	virtual ~ConnectSocketExT() 
+
+	virtual void OnDetachService(Service* pSvr)
 	{
+		StopAttemptTimer();
+		Base::OnDetachService(pSvr);
 	}
 
-	inline int Connect(int nHostPort = 0)
+	virtual void OnIdle()
 	{
-		ASSERT(Base::IsSocket());
-		if (Base::ai_current_) {
-			XSocket::Socket::SetAddrPort(Base::ai_current_->ai_addr, nHostPort);
-			return Base::Connect(Base::ai_current_->ai_addr, Base::ai_current_->ai_addrlen);
+		Base::OnIdle();
+
+		//没有挂到服务上时，在空闲时推进连接尝试
+		if(!Base::connect_svr_ && IsRacing() && !Base::IsConnected()) {
+			DoAttempts();
 		}
-		return SOCKET_ERROR;
+	}
+
+	virtual void OnConnect(int nErrorCode)
+	{
+		StopAttempts();
+		Base::OnConnect(nErrorCode);
 	}
 };
 
@@ -1885,7 +4764,10 @@ public:
 /*!
  *	@brief SocketSetT 模板定义.
  *
- *	封装SocketSet，实现最多管理uFD_SETSize数Socket
+ *	封装SocketSet，实现最多管理nMaxSocketCount数Socket
+ *
+ *	Socket按槽位存放，槽位标签(代数<<32|位置)用于O(1)查找，空闲槽位通过侵入式链表分配/回收，
+ *	每次回收槽位代数递增，旧标签的事件会因为代数不匹配而被丢弃
  */
 template<class TService = ThreadService, class TSocket = SocketEx>
 class SocketSetT : public TService
@@ -1895,41 +4777,56 @@ public:
 	typedef TService Service;
 	typedef TSocket Socket;
 protected:
-	u_short sock_count_ = 0;
+	struct SockSlot
+	{
+		uint32_t gen = 1; //槽位代数，0保留给非Socket的内部描述符
+		int next = -1; //下一个空闲槽位
+	};
+	size_t sock_count_ = 0;
 	std::vector<std::shared_ptr<Socket>> sock_ptrs_;
+	std::vector<SockSlot> sock_slots_;
+	int sock_free_ = -1; //空闲槽位链表头
 	//u_short sock_idle_next_ = 0;
 	std::mutex mutex_;
 public:
+	static inline uint64_t MakeSockTag(int pos, uint32_t gen) { return ((uint64_t)gen << 32) | (uint32_t)pos; }
+	static inline int SockTagPos(uint64_t tag) { return (int)(uint32_t)tag; }
+	static inline uint32_t SockTagGen(uint64_t tag) { return (uint32_t)(tag >> 32); }
+
 	SocketSetT(){}
-	SocketSetT(int nMaxSocketCount):sock_ptrs_(nMaxSocketCount)
+	SocketSetT(int nMaxSocketCount)
 	{
+		SetMaxSocketCount(nMaxSocketCount);
 	}
 
-	inline void SetMaxSocketCount(int nMaxSocketCount) { sock_ptrs_.resize(nMaxSocketCount); }
+	inline void SetMaxSocketCount(int nMaxSocketCount) 
+	{ 
+		std::unique_lock<std::mutex> lock(mutex_);
+		sock_ptrs_.resize(nMaxSocketCount); 
+		sock_slots_.resize(nMaxSocketCount);
+		//重建空闲链表，低位槽位优先分配
+		sock_free_ = -1;
+		for (int i = nMaxSocketCount - 1; i >= 0; i--)
+		{
+			if (!sock_ptrs_[i]) {
+				sock_slots_[i].next = sock_free_;
+				sock_free_ = i;
+			}
+		}
+	}
 	inline const size_t GetMaxSocketCount() { return sock_ptrs_.size(); }
 	inline size_t GetSocketCount() { return sock_count_; }
 
 	int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
 	{
 		std::unique_lock<std::mutex> lock(mutex_);
-		int i, j;
-		for (i = 0, j = sock_ptrs_.size(); i < j; i++)
-		{
-			if(sock_ptrs_[i]==NULL) {
-				if (sock_ptr) {
-					sock_count_++;
-					sock_ptr->AttachService(this);
-					sock_ptr->Select(evt);
-					sock_ptrs_[i] = sock_ptr;
-					return i;
-				} else {
-					//测试可不可以增加Socket，返回true表示可以增加
-					return i;
-				}
-				break;
-			}
+		if (!sock_ptr || sock_free_ < 0) {
+			//测试可不可以增加Socket，返回>=0表示可以增加
+			return sock_free_;
 		}
-		return -1;
+		sock_ptr->AttachService(this);
+		sock_ptr->Select(evt);
+		return AllocSlot(sock_ptr);
 	}
 	template<class Ty = Socket>
 	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
@@ -1939,6 +4836,25 @@ public:
 		}
 		return AddSocket(std::static_pointer_cast<Socket>(sock_ptr));
 	}
+	/*!
+	 *	@brief 按主机名连接.
+	 *
+	 *	解析不阻塞调用线程，命中HostCache时直接连接，否则后台解析完成后再Open并连接；
+	 *	返回值同AddSocket(NULL)，解析或者Open失败、解析完成时已满，Socket都不会加入
+	 */
+	template<class Ty = Socket>
+	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, const std::string& host, u_short port, int nSockAf = AF_UNSPEC)
+	{
+		int ret = AddSocket(NULL);
+		if (sock_ptr && ret >= 0) {
+			sock_ptr->Open(host, nSockAf, SOCK_STREAM, [this,sock_ptr,port](SOCKET sock) {
+				if (sock != INVALID_SOCKET) {
+					AddConnect(sock_ptr, port);
+				}
+			});
+		}
+		return ret;
+	}
 	inline int AddAccept(std::shared_ptr<Socket> sock_ptr)
 	{
 		return AddSocket(sock_ptr,FD_ACCEPT);
@@ -1947,56 +4863,64 @@ public:
 	int RemoveSocket(std::shared_ptr<Socket> sock_ptr)
 	{
 		ASSERT(sock_ptr);
-		//std::unique_lock<std::mutex> lock(mutex_);
-		int i, j;
-		for (i = 0, j = sock_ptrs_.size(); i < j; i++)
-		{
-			if(sock_ptrs_[i]==sock_ptr) {
-				return RemoveSocketByPos(i);
-			}
-		}
-		return -1;
+		return RemoveSocketByPos(SockTagPos(sock_ptr->SlotTag()), sock_ptr.get());
 	}
 	
-	/*int RemoveInvalidSocket(std::shared_ptr<Socket> & sock_ptr)
+protected:
+	//分配槽位，调用者需持有mutex_
+	inline int AllocSlot(const std::shared_ptr<Socket>& sock_ptr)
 	{
-		//std::unique_lock<std::mutex> lock(mutex_);
-		int i, j;
-		for (i = 0, j = sock_ptrs_.size(); i < j; i++)
-		{
-			if(sock_ptrs_[i]) {
-				std::unique_lock<std::mutex> lock(mutex_);
-				std::shared_ptr<Socket> t_sock_ptr = sock_ptrs_[i];
-				if (t_sock_ptr) {
-					if (!t_sock_ptr->IsSocket() && !t_sock_ptr->IsSelect(-1)) {
-						sock_ptrs_[i].reset();
-						sock_count_--;
-						sock_ptr = t_sock_ptr;
-						sock_ptr->DetachService(this);
-						return i;
-						break;
-					}
-				}
+		int i = sock_free_;
+		if (i < 0) {
+			return -1;
+		}
+		SockSlot& slot = sock_slots_[i];
+		sock_free_ = slot.next;
+		slot.next = -1;
+		sock_count_++;
+		sock_ptr->SetSlotTag(MakeSockTag(i, slot.gen));
+		std::atomic_store(&sock_ptrs_[i], sock_ptr);
+		return i;
+	}
+
+	//回收槽位，调用者需持有mutex_
+	inline std::shared_ptr<Socket> FreeSlot(int i)
+	{
+		std::shared_ptr<Socket> sock_ptr = sock_ptrs_[i];
+		if (sock_ptr) {
+			SockSlot& slot = sock_slots_[i];
+			std::atomic_store(&sock_ptrs_[i], std::shared_ptr<Socket>());
+			if (++slot.gen == 0) {
+				slot.gen = 1;
 			}
+			slot.next = sock_free_;
+			sock_free_ = i;
+			sock_count_--;
+			OnFreeSlot(i, sock_ptr);
 		}
-		return -1;
-	}*/
-protected:
-	//
-	inline int RemoveSocketByPos(int i)
+		return sock_ptr;
+	}
+
+	//槽位回收通知，调用者持有mutex_，派生类可在这里释放槽位关联的资源
+	virtual void OnFreeSlot(int /*i*/, const std::shared_ptr<Socket>& /*sock_ptr*/)
+	{
+
+	}
+
+	//expect不为空时，只有槽位中仍是expect才移除
+	inline int RemoveSocketByPos(int i, SocketEx* expect = nullptr)
 	{
-		if (i>=0 && i<sock_ptrs_.size()) {
+		if (i>=0 && (size_t)i<sock_ptrs_.size()) {
 			std::unique_lock<std::mutex> lock(mutex_);
-			std::shared_ptr<Socket> sock_ptr = sock_ptrs_[i];
+			if (expect && sock_ptrs_[i].get() != expect) {
+				return -1;
+			}
+			std::shared_ptr<Socket> sock_ptr = FreeSlot(i);
+			lock.unlock();
 			if (sock_ptr) {
-				sock_ptrs_[i].reset();
-				sock_count_--;
-				lock.unlock();
 				sock_ptr->DetachService(this);
-				return i;
-			} else {
-				return i;
 			}
+			return i;
 		}
 		return -1;
 	}
@@ -2007,8 +4931,12 @@ protected:
 		for (i = 0, j = sock_ptrs_.size(); i < j; i++)
 		{
 			if (sock_ptrs_[i]) {
-				std::shared_ptr<Socket> sock_ptr = sock_ptrs_[i];
-				sock_ptrs_[i].reset();
+				std::unique_lock<std::mutex> lock(mutex_);
+				std::shared_ptr<Socket> sock_ptr = FreeSlot(i);
+				lock.unlock();
+				if (!sock_ptr) {
+					continue;
+				}
 				if (sock_ptr->IsSocket()) {
 					if (bClose) {
 						sock_ptr->Trigger(FD_CLOSE, 0);
@@ -2017,17 +4945,25 @@ protected:
 				sock_ptr->DetachService(this);
 			}
 		}
-		sock_count_ = 0;
+	}
+
+	//按槽位标签查找，不加锁，O(1)
+	inline std::shared_ptr<Socket> FindSocket(uint64_t tag) {
+		int i = SockTagPos(tag);
+		if (i >= 0 && (size_t)i < sock_ptrs_.size()) {
+			std::shared_ptr<Socket> sock_ptr = std::atomic_load(&sock_ptrs_[i]);
+			if (sock_ptr && sock_ptr->SlotTag() == tag) {
+				return sock_ptr;
+			}
+		}
+		return nullptr;
 	}
 
 	inline std::shared_ptr<Socket> FindSocket(SocketEx* sock_ptr) {
 		if(sock_ptr) {
-			int i, j;
-			for (i = 0, j = sock_ptrs_.size(); i < j; i++)
-			{
-				if(sock_ptrs_[i].get()==sock_ptr) {
-					return sock_ptrs_[i];
-				}
+			std::shared_ptr<Socket> t_sock_ptr = FindSocket(sock_ptr->SlotTag());
+			if(t_sock_ptr.get()==sock_ptr) {
+				return t_sock_ptr;
 			}
 		}
 		return nullptr;
@@ -2054,22 +4990,20 @@ protected:
 		int i = 0, j = 0;
 		for (; i < uFD_SETSize && j <= 20; i++)
 		{
-			if (sock_ptrs_[i]) {
-				std::shared_ptr<Socket> sock_ptr = sock_ptrs_[i];
-				if (sock_ptr) {
-					if(sock_ptr->IsSelect(FD_IDLE)) {
-						j++;
-						sock_ptr->RemoveSelect(FD_IDLE);
-						sock_ptr->Trigger(FD_IDLE
-						//, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
-						, 0
-						);
-					}
-					if (!sock_ptr->IsSocket()) {
-						if(!sock_ptr->IsSelect(-1)) { 
-							//自动移除
-							RemoveSocketByPos(i);
-						}
+			std::shared_ptr<Socket> sock_ptr = std::atomic_load(&sock_ptrs_[i]);
+			if (sock_ptr) {
+				if(sock_ptr->IsSelect(FD_IDLE)) {
+					j++;
+					sock_ptr->RemoveSelect(FD_IDLE);
+					sock_ptr->Trigger(FD_IDLE
+					//, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+					, 0
+					);
+				}
+				if (!sock_ptr->IsSocket()) {
+					if(!sock_ptr->IsSelect(-1)) { 
+						//自动移除
+						RemoveSocketByPos(i, sock_ptr.get());
 					}
 				}
 			}
@@ -2077,6 +5011,30 @@ protected:
 	}
 };
 
+/*!
+ *	@brief SendBudget 定义.
+ *
+ *	发送内存预算，多个连接共享，统计这些连接未发送的数据总量，
+ *	超过预算时有未发送数据的连接进入写阻塞，可以跨线程使用；
+ *	连接通过shared_ptr持有，连接比SocketManagerT活得久也不会访问已释放的预算
+ */
+class SendBudget
+{
+protected:
+	std::atomic<size_t> used_;
+	std::atomic<size_t> limit_; //0表示不限制
+public:
+	SendBudget():used_(0),limit_(0) {}
+
+	inline void SetLimit(size_t limit) { limit_.store(limit, std::memory_order_relaxed); }
+	inline size_t GetLimit() const { return limit_.load(std::memory_order_relaxed); }
+	inline size_t GetUsed() const { return used_.load(std::memory_order_relaxed); }
+	inline bool IsOver() const { size_t limit = GetLimit(); return limit && GetUsed() >= limit; }
+
+	inline void Add(size_t len) { used_.fetch_add(len, std::memory_order_relaxed); }
+	inline void Sub(size_t len) { used_.fetch_sub(len, std::memory_order_relaxed); }
+};
+
 /*!
  *	@brief SocketManagerT 模板定义.
  *
@@ -2091,7 +5049,17 @@ public:
 protected:
 	std::vector<SocketSet*> sockset_ptrs_;
 	size_t sockset_add_next_ = 0;
+	std::shared_ptr<SendBudget> send_budget_ = std::make_shared<SendBudget>(); //所有连接共享的发送内存预算
+	int place_policy_ = 0; //PLACE_POLICY
+	uint32_t place_seed_ = 2463534242u; //二选一的随机数种子
 public:
+	enum PLACE_POLICY
+	{
+		PLACE_ROUND_ROBIN = 0, //轮询
+		PLACE_LEAST_CONN, //连接数最少
+		PLACE_LEAST_LOAD, //最近循环利用率最低，相同时连接数最少
+		PLACE_TWO_CHOICES, //随机取两个，选最近循环利用率低的，SocketSet很多时比全量比较便宜
+	};
 	SocketManagerT(){}
 	SocketManagerT(int nMaxSocketCount, int nMaxSockSetCount/* = std::thread::hardware_concurrency() + 1*/)
 	{
@@ -2138,6 +5106,59 @@ public:
 		}
 		return 0; 
 	}
+	/*!
+	 *	@brief 设置新连接分配到SocketSet的策略.
+	 *
+	 *	AddSocket/AddConnect/AddAccept从策略选出的SocketSet开始尝试，满了依次尝试下一个；
+	 *	负载策略用SocketSet的GetLoad，长连接流量不均时避免一部分服务线程满载一部分空闲
+	 */
+	inline void SetPlacePolicy(int policy) { place_policy_ = policy; }
+	inline int GetPlacePolicy() { return place_policy_; }
+
+	/*!
+	 *	@brief 迁移Socket到另一个SocketSet.
+	 *
+	 *	from是Socket当前所在SocketSet的序号(AddSocket的返回值)，需要SocketSet支持MigrateSocket，
+	 *	cb在最终所在服务线程回调，参数是Socket最终所在SocketSet的序号：成功是to，目标满了退回是from，失败是-1
+	 */
+	template<class Ty = Socket>
+	inline bool MigrateSocket(std::shared_ptr<Ty> sock_ptr, size_t from, size_t to, std::function<void(int)> cb = nullptr)
+	{
+		if (from >= sockset_ptrs_.size() || to >= sockset_ptrs_.size() || from == to) {
+			return false;
+		}
+		sockset_ptrs_[from]->MigrateSocket(std::static_pointer_cast<Socket>(sock_ptr), sockset_ptrs_[to], 
+			[from, to, cb](int result, bool bounced) {
+				if (cb) {
+					cb(result < 0 ? -1 : (int)(bounced ? from : to));
+				}
+			});
+		return true;
+	}
+
+	//设置每个SocketSet的忙轮询模式，需要SocketSet支持SetBusyPoll
+	inline void SetBusyPoll(size_t spin_us, int sock_busy_poll_us = 0, bool prefer = false) { 
+		for (size_t i = 0; i < sockset_ptrs_.size(); i++)
+		{
+			sockset_ptrs_[i]->SetBusyPoll(spin_us, sock_busy_poll_us, prefer);
+		}
+	}
+
+	//设置每个SocketSet的读预算，需要SocketSet支持SetReadBudget
+	inline void SetReadBudget(size_t bytes, size_t reads = 0) { 
+		for (size_t i = 0; i < sockset_ptrs_.size(); i++)
+		{
+			sockset_ptrs_[i]->SetReadBudget(bytes, reads);
+		}
+	}
+
+	//设置每个SocketSet的自动合并发送，需要SocketSet支持SetAutoCork
+	inline void SetAutoCork(bool enable, bool tcp_cork = false) { 
+		for (size_t i = 0; i < sockset_ptrs_.size(); i++)
+		{
+			sockset_ptrs_[i]->SetAutoCork(enable, tcp_cork);
+		}
+	}
 
 	inline void SetMaxSocketCount(int nMaxSocketCount, int nMaxSockSetCount/* = std::thread::hardware_concurrency() + 1*/)
 	{
@@ -2162,6 +5183,10 @@ public:
 		return count; 
 	}
 
+	//设置所有连接的发送内存预算，0表示不限制，连接需要SetSendBudget(GetSendBudget())加入预算
+	inline void SetSendBudget(size_t limit) { send_budget_->SetLimit(limit); }
+	inline const std::shared_ptr<SendBudget>& GetSendBudget() { return send_budget_; }
+
 	inline SocketSet* GetSocketSet(size_t pos) {
 		if(pos < sockset_ptrs_.size())
 			return sockset_ptrs_[pos];
@@ -2170,8 +5195,7 @@ public:
 
 	inline int AddSocket(std::shared_ptr<Socket> sock_ptr, int evt = 0)
 	{
-		size_t next = sockset_add_next_, next_end = sockset_add_next_ + sockset_ptrs_.size();
-		sockset_add_next_ = (sockset_add_next_ + 1) % sockset_ptrs_.size();
+		size_t next = PlaceNext(), next_end = next + sockset_ptrs_.size();
 		for (; next < next_end; next++)
 		{
 			int i = next % sockset_ptrs_.size();
@@ -2183,11 +5207,72 @@ public:
 		}
 		return -1;
 	}
+	/*!
+	 *	@brief 批量加入Socket，适用于ListenSocketT::OnAcceptBatch.
+	 *
+	 *	LEAST_CONN/LEAST_LOAD一批只取一次各SocketSet的分数，之后按分数加上本批已分到的个数分配，
+	 *	不用每个连接都比较一遍；其他策略逐个按PlaceNext分配；
+	 *	poses不为空时返回每个Socket所在的SocketSet，加入失败为-1，返回加入成功的个数
+	 */
+	template<class Ty = Socket>
+	inline size_t AddSockets(const std::shared_ptr<Ty>* sock_ptrs, size_t count, int evt = 0, int* poses = nullptr)
+	{
+		size_t set_count = sockset_ptrs_.size();
+		std::vector<uint64_t> scores;
+		if (place_policy_ == PLACE_LEAST_CONN || place_policy_ == PLACE_LEAST_LOAD) {
+			scores.resize(set_count);
+			for (size_t i = 0; i < set_count; i++)
+			{
+				scores[i] = PlaceScore(i);
+			}
+		}
+		const uint64_t full_score = ~(uint64_t)0;
+		size_t added = 0;
+		for (size_t k = 0; k < count; k++)
+		{
+			size_t next;
+			if (scores.empty()) {
+				next = PlaceNext();
+			} else {
+				//从轮询位置开始比较，分数相同时仍然轮流分配
+				next = sockset_add_next_;
+				sockset_add_next_ = (sockset_add_next_ + 1) % set_count;
+				for (size_t j = 1; j < set_count; j++)
+				{
+					size_t i = (next + j) % set_count;
+					if (scores[i] < scores[next]) {
+						next = i;
+					}
+				}
+			}
+			int pos = -1;
+			for (size_t j = 0; j < set_count; j++)
+			{
+				size_t i = (next + j) % set_count;
+				if (sockset_ptrs_[i]->AddSocket(sock_ptrs[k], evt) >= 0) {
+					pos = i;
+					break;
+				}
+				if (!scores.empty()) {
+					scores[i] = full_score; //已满，本批不再优先
+				}
+			}
+			if (pos >= 0) {
+				++added;
+				if (!scores.empty() && scores[pos] != full_score) {
+					++scores[pos];
+				}
+			}
+			if (poses) {
+				poses[k] = pos;
+			}
+		}
+		return added;
+	}
 	template<class Ty = Socket>
 	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, u_short port)
 	{
-		size_t next = sockset_add_next_, next_end = sockset_add_next_ + sockset_ptrs_.size();
-		sockset_add_next_ = (sockset_add_next_ + 1) % sockset_ptrs_.size();
+		size_t next = PlaceNext(), next_end = next + sockset_ptrs_.size();
 		for (; next < next_end; next++)
 		{
 			int i = next % sockset_ptrs_.size();
@@ -2199,10 +5284,23 @@ public:
 		}
 		return -1;
 	}
+	//按主机名连接，见SocketSetT::AddConnect
+	template<class Ty = Socket>
+	inline int AddConnect(std::shared_ptr<Ty> sock_ptr, const std::string& host, u_short port, int nSockAf = AF_UNSPEC)
+	{
+		int ret = AddSocket(NULL);
+		if (sock_ptr && ret >= 0) {
+			sock_ptr->Open(host, nSockAf, SOCK_STREAM, [this,sock_ptr,port](SOCKET sock) {
+				if (sock != INVALID_SOCKET) {
+					AddConnect(sock_ptr, port);
+				}
+			});
+		}
+		return ret;
+	}
 	inline int AddAccept(std::shared_ptr<Socket> sock_ptr)
 	{
-		size_t next = sockset_add_next_, next_end = sockset_add_next_ + sockset_ptrs_.size();
-		sockset_add_next_ = (sockset_add_next_ + 1) % sockset_ptrs_.size();
+		size_t next = PlaceNext(), next_end = next + sockset_ptrs_.size();
 		for (; next < next_end; next++)
 		{
 			int i = next % sockset_ptrs_.size();
@@ -2215,6 +5313,61 @@ public:
 		return -1;
 	}
 
+	/*!
+	 *	SO_REUSEPORT监听分片模式
+	 *
+	 *	每个SocketSet各自打开一个绑定同一地址的Ty类型监听Socket（需支持Open(address)/Bind(port)，如ListenSocketExT），
+	 *	内核按连接哈希把新连接分给各监听Socket，各SocketSet在自己的线程里Accept，
+	 *	监听Socket的OnAccept里用service()->AddSocket把新连接留在本SocketSet，不再经过单一的Accept线程。
+	 *	bIncomingCpu为true时第i个SocketSet线程绑定到CPU i并设置监听Socket的SO_INCOMING_CPU，
+	 *	使连接由处理其网卡收包队列的CPU所在的SocketSet接收。
+	 *	每个SocketSet都监听成功才返回SocketSet数，否则关闭已经打开的监听Socket并返回-1，args作为Ty的构造参数
+	 */
+	template<class Ty, class... Args>
+	inline int AddReusePortAccept(const char* address, u_short port, int backlog, bool bIncomingCpu, Args&&... args)
+	{
+		std::vector<std::shared_ptr<Ty>> sock_ptrs;
+		int cpu_count = std::thread::hardware_concurrency();
+		for (size_t i = 0; i < sockset_ptrs_.size(); i++)
+		{
+			std::shared_ptr<Ty> sock_ptr = std::make_shared<Ty>(std::forward<Args>(args)...);
+			if(!XSocket::Socket::IsSocket(sock_ptr->Open(address))) {
+				break;
+			}
+			sock_ptr->SetSockOpt(SOL_SOCKET, SO_REUSEADDR, 1);
+			if(sock_ptr->SetSockOpt(SOL_SOCKET, SO_REUSEPORT, 1) == SOCKET_ERROR) {
+				PRINTF("SO_REUSEPORT is not supported, errno(%d)", XSocket::Socket::GetLastError());
+				sock_ptr->Close();
+				break;
+			}
+			if(bIncomingCpu && cpu_count > 0) {
+				int cpu = i % cpu_count;
+				sockset_ptrs_[i]->SetCpuAffinity(cpu);
+				sock_ptr->SetSockOpt(SOL_SOCKET, SO_INCOMING_CPU, cpu);
+			}
+			if(sock_ptr->Bind(port) == SOCKET_ERROR || sock_ptr->Listen(backlog) == SOCKET_ERROR) {
+				PRINTF("ReusePort Listen %s:%d failed, errno(%d)", address, port, XSocket::Socket::GetLastError());
+				sock_ptr->Close();
+				break;
+			}
+			if(sockset_ptrs_[i]->AddAccept(sock_ptr) < 0) {
+				sock_ptr->Close();
+				break;
+			}
+			sock_ptrs.push_back(sock_ptr);
+		}
+		if (sock_ptrs.size() < sockset_ptrs_.size()) {
+			//部分SocketSet没有监听上，连接会不均匀，全部回滚
+			for (size_t i = 0; i < sock_ptrs.size(); i++)
+			{
+				sockset_ptrs_[i]->RemoveSocket(sock_ptrs[i]);
+				sock_ptrs[i]->Close();
+			}
+			return -1;
+		}
+		return (int)sock_ptrs.size();
+	}
+
 	inline int RemoveSocket(std::shared_ptr<Socket> sock_ptr)
 	{
 		for (size_t i=0,j=sockset_ptrs_.size();i<j;i++)
@@ -2251,6 +5404,54 @@ public:
 	}*/
 
 protected:
+	//负载分数，越小越优先，利用率按5%分档，同档时比较连接数，避免微小抖动把连接都分到一个SocketSet
+	inline uint64_t PlaceScore(size_t i)
+	{
+		uint64_t count = sockset_ptrs_[i]->GetSocketCount();
+		if (place_policy_ == PLACE_LEAST_CONN) {
+			return count;
+		}
+		return ((uint64_t)(sockset_ptrs_[i]->GetLoad() / 50) << 32) | (count & 0xFFFFFFFF);
+	}
+
+	//按分配策略选出第一个尝试的SocketSet
+	inline size_t PlaceNext()
+	{
+		size_t count = sockset_ptrs_.size();
+		size_t next = sockset_add_next_;
+		sockset_add_next_ = (sockset_add_next_ + 1) % count;
+		switch (place_policy_)
+		{
+		case PLACE_LEAST_CONN:
+		case PLACE_LEAST_LOAD: {
+			//从轮询位置开始比较，分数相同时仍然轮流分配
+			uint64_t best_score = PlaceScore(next);
+			for (size_t k = 1; k < count; k++)
+			{
+				size_t i = (sockset_add_next_ + k - 1) % count;
+				uint64_t score = PlaceScore(i);
+				if (score < best_score) {
+					best_score = score;
+					next = i;
+				}
+			}
+		} break;
+		case PLACE_TWO_CHOICES: {
+			if (count > 1) {
+				//xorshift32
+				place_seed_ ^= place_seed_ << 13;
+				place_seed_ ^= place_seed_ >> 17;
+				place_seed_ ^= place_seed_ << 5;
+				size_t i = place_seed_ % count;
+				size_t j = (i + 1 + (place_seed_ >> 16) % (count - 1)) % count;
+				next = PlaceScore(i) <= PlaceScore(j) ? i : j;
+			}
+		} break;
+		default:
+			break;
+		}
+		return next;
+	}
 };
 
 /*!
@@ -2304,6 +5505,12 @@ protected:
 		maxfds = fd + 1;
 		FD_SET(fd, &exceptfds);
 		if (Base::IsListenSocket()) {
+			if (!Base::IsSelect(FD_ACCEPT)) {
+				//暂停接受(比如资源不足退避)时监听Socket一直可读，不select，避免空转
+				if(tv.tv_usec)
+					std::this_thread::sleep_for(std::chrono::microseconds(tv.tv_usec));
+				return;
+			}
 			fd_set readfds;
 			FD_ZERO(&readfds);
 			FD_SET(fd, &readfds);
@@ -2421,7 +5628,7 @@ public:
 /*!
  *	@brief SelectSocketSet 模板定义.
  *
- *	封装SelectSocketSet，实现对select模型封装，最多管理uFD_SETSize数Socket
+ *	封装SelectSocketSet，实现对select模型封装，最多管理FD_SETSIZE数Socket
  */
 template<class TService = SelectService, class TSocket = SocketEx>
 class SelectSocketSetT : public SocketSetT<TService,TSocket>
@@ -2451,7 +5658,7 @@ protected:
 		struct timeval tv = {0, Base::GetWaitingTimeOut()*1000};
 		std::unique_lock<std::mutex> lock(Base::mutex_);
 		{
-			for (size_t i=0; i<uFD_SETSize; ++i)
+			for (size_t i=0; i<Base::sock_ptrs_.size(); ++i)
 			{
 				if (Base::sock_ptrs_[i] && Base::sock_ptrs_[i]->IsSocket()) {
 					nfds++;
@@ -2477,7 +5684,7 @@ protected:
 		else if(tv.tv_usec)
 			std::this_thread::sleep_for(std::chrono::microseconds(tv.tv_usec));
 		if (nfds > 0) {
-			for (size_t i = 0; i < uFD_SETSize; ++i)
+			for (size_t i = 0; i < Base::sock_ptrs_.size(); ++i)
 			{
 				if (Base::sock_ptrs_[i]) {
 					lock.lock();
@@ -2587,6 +5794,7 @@ public:
 	typedef typename SocketSet::Socket Socket;
 	typedef SocketManagerT<SocketSet> SockManager;
 	typedef SelectOneSocketT<TService,TBase> Base;
+	typedef typename Base::AcceptItem AcceptItem;
 protected:
 	std::string address_;
 	u_short port_;
@@ -2660,7 +5868,9 @@ protected:
 				}
 				std::shared_ptr<Socket> sock_ptr = std::make_shared<Socket>();
 				sock_ptr->Attach(Sock,SOCKET_ROLE_WORK);
-				sock_ptr->SetNonBlock();//设为非阻塞模式
+#ifdef WIN32
+				sock_ptr->SetNonBlock();//设为非阻塞模式，LINUX下accept4已经设置
+#endif//
 				int pos = SockManager::AddSocket(sock_ptr, FD_READ|FD_OOB);
 				if(pos >= 0) {
 					//
@@ -2669,6 +5879,30 @@ protected:
 					sock_ptr->Trigger(FD_CLOSE, 0);
 				}
 	}
+
+	//整批交给SockManager分配，加入失败的关闭
+	virtual void OnAcceptBatch(AcceptItem* items, int count)
+	{
+		std::shared_ptr<Socket> sock_ptrs[Base::ACCEPT_BATCH];
+		int poses[Base::ACCEPT_BATCH];
+		for(int i = 0; i < count; i++)
+		{
+			sock_ptrs[i] = std::make_shared<Socket>();
+			sock_ptrs[i]->Attach(items[i].Sock,SOCKET_ROLE_WORK);
+#ifdef WIN32
+			sock_ptrs[i]->SetNonBlock();//设为非阻塞模式，LINUX下accept4已经设置
+#endif//
+		}
+		if(SockManager::AddSockets(sock_ptrs, count, FD_READ|FD_OOB, poses) < (size_t)count) {
+			PRINTF("The connection was refused by the computer running select server because the maximum number of sessions has been exceeded.");
+			for(int i = 0; i < count; i++)
+			{
+				if(poses[i] < 0) {
+					sock_ptrs[i]->Trigger(FD_CLOSE, 0);
+				}
+			}
+		}
+	}
 };
 
 /*!
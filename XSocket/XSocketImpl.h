@@ -22,6 +22,11 @@
 #define _H_XSOCKETIMPL_H_
 
 #include "XSocketEx.h"
+#include "XBuffer.h"
+
+#ifndef XSOCKET_SEND_IOV_MAX
+#define XSOCKET_SEND_IOV_MAX 64 //一次聚集发送最多的缓存个数，iovec数组在OnSend栈上
+#endif
 
 #include <string>
 #include <queue>
@@ -65,6 +70,311 @@ enum
 	SOCKET_PACKET_OP_MASK			= 0XF0000000,
 };
 
+/*!
+ *	@brief RecvRing 定义.
+ *
+ *	接收环形缓存，容量为2的幂。默认是堆上的线性缓存，只在写到末尾时才搬移一次；
+ *	SetMirrorSize开启后，容量达到阈值时Linux下同一段内存连续映射两次(镜像)，
+ *	回绕的数据也是连续的，ParseBuf看到的总是连续视图，不需要搬移数据。
+ *	镜像每个连接要占一个memfd和两段映射，受vm.max_map_count限制，只适合少量大流量连接。
+ *	容量不够时Expand翻倍；清空时调用Shrink，连续多次清空时用量都不超过容量的1/4才收缩回初始容量，
+ *	避免大包交替时反复映射。
+ *	惰性模式(SetLazy)下平时不占内存，接收时借用本线程的临时缓存(BorrowScratch)直接解析，
+ *	只有剩余半包时才Append到私有的线性缓存，清空后立即释放，适合大量空闲连接
+ */
+class RecvRing
+{
+protected:
+	char* buf_ = nullptr;
+	size_t cap_ = 0;
+	size_t head_ = 0;
+	size_t size_ = 0;
+	size_t reserve_ = 0; //初始容量
+	size_t max_ = 0; //最大容量，0表示不限制
+	size_t peak_ = 0; //本次清空前的最大用量
+	int idle_ = 0; //连续低用量清空次数
+	size_t mirror_size_ = 0; //使用镜像映射的最小容量，0表示不使用
+	bool mirror_ = false;
+	bool lazy_ = false; //惰性模式
+	//线程临时接收缓存，同一线程上的惰性连接轮流借用
+	struct Scratch
+	{
+		char* buf = nullptr;
+		bool busy = false;
+		~Scratch() { free(buf); }
+	};
+	static inline Scratch& LocalScratch() { static thread_local Scratch scratch; return scratch; }
+public:
+	enum { SHRINK_IDLE_COUNT = 16, SCRATCH_SIZE = 64 * 1024 };
+
+	RecvRing() {}
+	RecvRing(const RecvRing&) = delete;
+	RecvRing& operator=(const RecvRing&) = delete;
+	~RecvRing() { Free(); }
+
+	inline bool empty() const { return !size_; }
+	inline size_t size() const { return size_; }
+	inline size_t capacity() const { return cap_; }
+	inline bool IsMirror() const { return mirror_; }
+	inline bool IsLazy() const { return lazy_; }
+
+	//所有接收缓存占用的内存总数
+	static inline std::atomic<size_t>& TotalCapacity() { static std::atomic<size_t> total(0); return total; }
+
+	//设置初始容量，缓存为空时立即按新容量分配，惰性模式下只记录
+	inline void Reserve(size_t size)
+	{
+		reserve_ = RoundUp(size);
+		if (!size_ && cap_ != reserve_ && !lazy_) {
+			Free();
+			Alloc(reserve_);
+		}
+	}
+
+	inline void SetMaxSize(size_t size) { max_ = size; }
+	inline size_t GetMaxSize() const { return max_; }
+
+	//容量达到size时使用镜像映射，0表示不使用，下次分配时生效
+	inline void SetMirrorSize(size_t size) { mirror_size_ = size; }
+	inline size_t GetMirrorSize() const { return mirror_size_; }
+
+	//设置惰性模式，缓存为空时立即释放内存
+	inline void SetLazy(bool lazy)
+	{
+		lazy_ = lazy;
+		if (lazy_ && !size_) {
+			Free();
+		}
+	}
+
+	//丢弃数据，保留内存，惰性模式下释放内存
+	inline void Clear()
+	{
+		head_ = 0; size_ = 0; peak_ = 0; idle_ = 0;
+		if (lazy_) {
+			Free();
+		}
+	}
+
+	//借用本线程的临时缓存，已被借用(回调里重入)时返回nullptr
+	static inline char* BorrowScratch(size_t& len)
+	{
+		Scratch& scratch = LocalScratch();
+		if (scratch.busy) {
+			return nullptr;
+		}
+		if (!scratch.buf) {
+			scratch.buf = (char*)malloc(SCRATCH_SIZE);
+			if (!scratch.buf) {
+				return nullptr;
+			}
+		}
+		scratch.busy = true;
+		len = SCRATCH_SIZE;
+		return scratch.buf;
+	}
+	static inline void ReturnScratch() { LocalScratch().busy = false; }
+	static inline bool IsScratch(const char* buf)
+	{
+		Scratch& scratch = LocalScratch();
+		return scratch.busy && buf >= scratch.buf && buf < scratch.buf + SCRATCH_SIZE;
+	}
+
+	//保留剩余数据到私有缓存，缓存必须为空，超过最大容量返回false
+	inline bool Append(const char* buf, size_t len)
+	{
+		ASSERT(!size_);
+		size_t cap = RoundUp(len);
+		if (max_ && cap > max_) {
+			return false;
+		}
+		if (cap_ < cap) {
+			Free();
+			if (!Alloc(cap)) {
+				return false;
+			}
+		}
+		memcpy(buf_, buf, len);
+		head_ = 0;
+		Commit(len);
+		return true;
+	}
+
+	inline const char* ReadPtr() const { return buf_ + head_; }
+	inline size_t ReadSize() const { return size_; }
+
+	inline bool IsFull() const { return size_ == cap_; }
+
+	//准备写入的连续空间，返回写入位置，len返回可写长度
+	inline char* PrepareWrite(size_t& len)
+	{
+		if (mirror_) {
+			len = cap_ - size_;
+			return buf_ + ((head_ + size_) & (cap_ - 1));
+		}
+		size_t tail = cap_ - head_ - size_;
+		if (head_ && tail < (cap_ - size_) / 2) {
+			//线性缓存尾部空间不足空闲空间的一半时才把未解析数据搬到开头，不是每次解析后都搬移
+			memmove(buf_, buf_ + head_, size_);
+			head_ = 0;
+			tail = cap_ - size_;
+		}
+		len = tail;
+		return buf_ + head_ + size_;
+	}
+
+	inline void Commit(size_t len)
+	{
+		ASSERT(size_ + len <= cap_);
+		size_ += len;
+		if (peak_ < size_) {
+			peak_ = size_;
+		}
+	}
+
+	inline void Consume(size_t len)
+	{
+		ASSERT(len <= size_);
+		size_ -= len;
+		if (!size_) {
+			head_ = 0;
+		} else if (mirror_) {
+			head_ = (head_ + len) & (cap_ - 1);
+		} else {
+			head_ += len;
+		}
+	}
+
+	//容量翻倍，保留未解析数据，超过最大容量返回false
+	inline bool Expand()
+	{
+		size_t cap = cap_ ? cap_ * 2 : RoundUp(reserve_);
+		if (max_ && cap > max_) {
+			return false;
+		}
+		char* buf = buf_;
+		size_t old_cap = cap_;
+		bool mirror = mirror_;
+		buf_ = nullptr;
+		cap_ = 0;
+		if (!Alloc(cap)) {
+			buf_ = buf;
+			cap_ = old_cap;
+			mirror_ = mirror;
+			return false;
+		}
+		if (size_) {
+			memcpy(buf_, buf + head_, size_);
+		}
+		head_ = 0;
+		Free(buf, old_cap, mirror);
+		return true;
+	}
+
+	//缓存清空时调用，按收缩策略收缩回初始容量，惰性模式下直接释放
+	inline void Shrink()
+	{
+		if (size_) {
+			return;
+		}
+		if (lazy_) {
+			Free();
+			return;
+		}
+		size_t reserve = RoundUp(reserve_);
+		if (cap_ <= reserve || peak_ > cap_ / 4) {
+			idle_ = 0;
+		} else if (++idle_ >= SHRINK_IDLE_COUNT) {
+			idle_ = 0;
+			Free();
+			Alloc(reserve);
+		}
+		peak_ = 0;
+	}
+
+protected:
+	static inline size_t PageSize()
+	{
+#ifdef WIN32
+		return 4096;
+#else
+		static size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+		return page_size;
+#endif//
+	}
+
+	static inline size_t RoundUp(size_t size)
+	{
+		size_t cap = PageSize();
+		while (cap < size) {
+			cap <<= 1;
+		}
+		return cap;
+	}
+
+	inline bool Alloc(size_t cap)
+	{
+		ASSERT(!buf_);
+		head_ = 0;
+#ifndef WIN32
+		//镜像映射：同一个memfd连续映射两次，惰性模式分配频繁，只用线性缓存
+		bool mirror = !lazy_ && mirror_size_ && cap >= mirror_size_;
+		int fd = mirror ? memfd_create("xsocket_ring", MFD_CLOEXEC) : -1;
+		if (fd >= 0) {
+			if (ftruncate(fd, cap) == 0) {
+				char* p = (char*)mmap(nullptr, cap * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (p != MAP_FAILED) {
+					if (mmap(p, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED
+						&& mmap(p + cap, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+						::close(fd);
+						buf_ = p;
+						cap_ = cap;
+						mirror_ = true;
+						TotalCapacity() += cap;
+						return true;
+					}
+					munmap(p, cap * 2);
+				}
+			}
+			::close(fd);
+		}
+#endif//
+		buf_ = (char*)malloc(cap);
+		if (!buf_) {
+			cap_ = 0;
+			return false;
+		}
+		cap_ = cap;
+		mirror_ = false;
+		TotalCapacity() += cap;
+		return true;
+	}
+
+	static inline void Free(char* buf, size_t cap, bool mirror)
+	{
+		if (!buf) {
+			return;
+		}
+		TotalCapacity() -= cap;
+#ifndef WIN32
+		if (mirror) {
+			munmap(buf, cap * 2);
+			return;
+		}
+#endif//
+		free(buf);
+	}
+
+	inline void Free()
+	{
+		Free(buf_, cap_, mirror_);
+		buf_ = nullptr;
+		cap_ = 0;
+		head_ = 0;
+		mirror_ = false;
+	}
+};
+
 /*!
  *	@brief TcpSocket 定义.
  *
@@ -78,18 +388,27 @@ protected:
 	int m_nRecvLen;
 	char* m_pRecvBuf;
 	int m_nRecvBufLen;
+	RecvRing* m_pRecvRing;
+	IOBuf m_RecvIOBuf; //IOBuf接收模式下未解析的数据，后面是可写入空间
+	size_t m_nRecvIOBufSize;
 	int m_nSendLen;
 	const char* m_pSendBuf;
 	int m_nSendBufLen;
+	bool m_bSendPending; //还有数据等待可写
+	bool m_bFlushPending; //已登记合并发送
 public:
 	TcpSocket()
 		:Base()
 		,m_nRecvLen(0)
 		,m_pRecvBuf(nullptr)
 		,m_nRecvBufLen(0)
+		,m_pRecvRing(nullptr)
+		,m_nRecvIOBufSize(0)
 		,m_nSendLen(0)
 		,m_pSendBuf(nullptr)
 		,m_nSendBufLen(0)
+		,m_bSendPending(false)
+		,m_bFlushPending(false)
 	{
 		
 	}
@@ -105,12 +424,49 @@ public:
 		m_nRecvLen = 0;
 		m_pRecvBuf = nullptr;
 		m_nRecvBufLen = 0;
+		if (m_pRecvRing) {
+			m_pRecvRing->Clear();
+			m_pRecvRing = nullptr;
+		}
+		m_RecvIOBuf.clear();
+		m_nRecvIOBufSize = 0;
 		m_nSendLen = 0;
 		m_pSendBuf = nullptr;
 		m_nSendBufLen = 0;
+		m_bSendPending = false;
+		m_bFlushPending = false;
 		return ret;
 	}
 
+	/*!
+	 *	@brief 写直通发送.
+	 *
+	 *	没有等待可写时直接在调用线程发送，发送不完(内核缓冲满)才选择FD_WRITE等待可写，
+	 *	发送完成后OnSend取消FD_WRITE；服务开启自动合并发送时只登记，本轮事件分发结束后再一次发送
+	 */
+	inline void SendDirect()
+	{
+		if(Base::IsSelect(FD_WRITE)) {
+			//已经在等待可写，数据会在可写时发出
+			return;
+		}
+		if(Base::IsSelect(FD_CONNECT)) {
+			Base::Select(FD_WRITE);
+			return;
+		}
+		if(m_bFlushPending) {
+			return;
+		}
+		if(Base::PostFlush()) {
+			m_bFlushPending = true;
+			return;
+		}
+		Base::Trigger(FD_WRITE, 0);
+		if(Base::IsSocket() && m_bSendPending) {
+			Base::SelectWait(FD_WRITE);
+		}
+	}
+
 protected:
 	//
 	//解析数据包
@@ -126,6 +482,30 @@ protected:
 	{
 		return false;
 	}
+	//准备接收环形缓存，返回nullptr则走PrepareRecvBuf线性缓存接收
+	virtual RecvRing* PrepareRecvRing()
+	{
+		return nullptr;
+	}
+	//准备IOBuf接收，返回内存块大小，返回0则不使用IOBuf接收
+	virtual size_t PrepareRecvIOBuf()
+	{
+		return 0;
+	}
+
+	/*!
+	 *	@brief 保留接收数据.
+	 *
+	 *	在OnRecvBuf里调用，IOBuf接收模式下返回共享接收内存块的切片，不拷贝，
+	 *	可以保留到以后或者放到其他连接的发送队列；其他接收模式下拷贝一份
+	 */
+	inline IOBuf RecvIOBuf(const char* lpBuf, int nBufLen)
+	{
+		if (m_RecvIOBuf.contains(lpBuf, nBufLen)) {
+			return m_RecvIOBuf.slice(lpBuf, nBufLen);
+		}
+		return IOBuf::copy(lpBuf, nBufLen);
+	}
 
 	//接收完整一个包
 	virtual void OnRecvBuf(const char* lpBuf, int nBufLen, int nFlags) 
@@ -145,6 +525,18 @@ protected:
 
 	}
 
+	//准备聚集发送缓存，返回填充的iovec个数，返回0则走PrepareSendBuf单缓存发送
+	virtual int PrepareSendIov(struct iovec* /*lpIov*/, int /*nIovCnt*/)
+	{
+		return 0;
+	}
+
+	//聚集发送了nBufLen字节，可能只发送了部分缓存
+	virtual void OnSendIov(int /*nBufLen*/)
+	{
+
+	}
+
 protected:
 	//
 	virtual void OnReceive(int nErrorCode)
@@ -153,22 +545,65 @@ protected:
 			Base::OnReceive(nErrorCode);
 			return;
 		}
+		//读预算，用完后登记还可读，让同一服务线程上的其他连接先处理
+		size_t nReadBytes = 0, nReads = 0;
 		bool bConitnue = false;
 		do {
 			bConitnue = false;
 			char* lpBuf = nullptr;
 			int nBufLen = 0;
-			if (!m_pRecvBuf) {
-				if(!PrepareRecvBuf(lpBuf,nBufLen)) {
-					//说明没有可接收缓存
+			bool bScratch = false;
+			if (!m_pRecvBuf && !m_pRecvRing && !m_nRecvIOBufSize) {
+				m_nRecvIOBufSize = PrepareRecvIOBuf();
+				m_pRecvRing = m_nRecvIOBufSize ? nullptr : PrepareRecvRing();
+				if (!m_pRecvRing && !m_nRecvIOBufSize) {
+					if(!PrepareRecvBuf(lpBuf,nBufLen)) {
+						//说明没有可接收缓存
+						return;
+					}
+					m_nRecvLen = 0;
+					m_pRecvBuf = lpBuf;
+					m_nRecvBufLen = nBufLen;
+				}
+			}
+			if (m_nRecvIOBufSize) {
+				//剩余空间太小时才换内存块，共享时只拷贝未解析的部分
+				size_t nSize = m_RecvIOBuf.size();
+				size_t nMinLen = std::max<size_t>(nSize, m_nRecvIOBufSize / 8);
+				if (m_RecvIOBuf.tailroom() < nMinLen 
+					&& !m_RecvIOBuf.reserve(nSize < m_nRecvIOBufSize ? std::max<size_t>(nMinLen, m_nRecvIOBufSize - nSize) : nMinLen)) {
+#ifdef WIN32
+					Base::Trigger(FD_CLOSE, WSAENOBUFS);
+#else
+					Base::Trigger(FD_CLOSE, ENOBUFS);
+#endif
 					return;
 				}
-				m_nRecvLen = 0;
-				m_pRecvBuf = lpBuf;
-				m_nRecvBufLen = nBufLen;
+				lpBuf = m_RecvIOBuf.tail();
+				nBufLen = (int)std::min<size_t>(m_RecvIOBuf.tailroom(), INT_MAX);
+			} else if (m_pRecvRing) {
+				size_t nRingLen = 0;
+				if (m_pRecvRing->IsLazy() && m_pRecvRing->empty()) {
+					//惰性模式没有未解析数据时借用线程临时缓存接收
+					lpBuf = RecvRing::BorrowScratch(nRingLen);
+					bScratch = lpBuf != nullptr;
+				}
+				if (!bScratch) {
+					if (m_pRecvRing->IsFull() && !m_pRecvRing->Expand()) {
+#ifdef WIN32
+						Base::Trigger(FD_CLOSE, WSAEMSGSIZE);
+#else
+						Base::Trigger(FD_CLOSE, EMSGSIZE);
+#endif
+						return;
+					}
+					lpBuf = m_pRecvRing->PrepareWrite(nRingLen);
+				}
+				nBufLen = (int)std::min<size_t>(nRingLen, INT_MAX);
+			} else {
+				lpBuf = m_pRecvBuf+m_nRecvLen;
+				nBufLen = (int)(m_nRecvBufLen-m_nRecvLen);
 			}
-			lpBuf = m_pRecvBuf+m_nRecvLen;
-			nBufLen = (int)(m_nRecvBufLen-m_nRecvLen);
 			ASSERT(nBufLen>0);
 			nBufLen = Base::Receive(lpBuf,nBufLen);
 			if (nBufLen<0) {
@@ -177,7 +612,16 @@ protected:
 				Base::Trigger(FD_CLOSE, XSocket::Socket::GetLastError());
 			} else {
 				OnReceive(lpBuf, nBufLen, 0);
-				bConitnue = Base::IsSocket();
+				//回调里可能暂停读(背压)，剩余数据等恢复读时再接收
+				bConitnue = Base::IsSocket() && Base::IsSelect(FD_READ);
+				nReadBytes += nBufLen;
+				nReads++;
+				if (bConitnue && Base::ReadBudgetExceeded(nReadBytes, nReads)) {
+					bConitnue = false;
+				}
+			}
+			if (bScratch) {
+				RecvRing::ReturnScratch();
 			}
 		} while (bConitnue);
 	}
@@ -185,27 +629,59 @@ protected:
 	virtual void OnReceive(const char* lpBuf, int nBufLen, int nFlags) 
 	{
 		Base::OnReceive(lpBuf, nBufLen, nFlags);
+		if (m_nRecvIOBufSize) {
+			m_RecvIOBuf.append(nBufLen);
+			//解析期间持有内存块，回调里关闭连接也不会释放正在解析的数据
+			IOBuf iobuf(m_RecvIOBuf);
+			int nParseBufLen = (int)std::min<size_t>(iobuf.size(), INT_MAX);
+			int nParseLen = ParseRecvBuf(iobuf.data(), nParseBufLen);
+			if (nParseLen < 0 || !Base::IsSocket()) {
+				//异常不处理了，后续会关闭连接
+				return;
+			}
+			m_RecvIOBuf.trim_front(nParseLen);
+			return;
+		}
+		if (m_pRecvRing) {
+			//环形缓存，数据总是连续的，解析多少消费多少，不需要搬移
+			RecvRing* pRecvRing = m_pRecvRing;
+			if (RecvRing::IsScratch(lpBuf)) {
+				//借用的临时缓存直接解析，只有剩余半包时才拷贝到私有缓存
+				int nParseLen = ParseRecvBuf(lpBuf, nBufLen);
+				if (nParseLen < 0 || !Base::IsSocket()) {
+					return;
+				}
+				if (nParseLen < nBufLen && !pRecvRing->Append(lpBuf + nParseLen, nBufLen - nParseLen)) {
+#ifdef WIN32
+					Base::Trigger(FD_CLOSE, WSAEMSGSIZE);
+#else
+					Base::Trigger(FD_CLOSE, EMSGSIZE);
+#endif
+				}
+				return;
+			}
+			pRecvRing->Commit(nBufLen);
+			int nParseBufLen = (int)std::min<size_t>(pRecvRing->ReadSize(), INT_MAX);
+			int nParseLen = ParseRecvBuf(pRecvRing->ReadPtr(), nParseBufLen);
+			if (nParseLen < 0 || !Base::IsSocket()) {
+				//异常不处理了，后续会关闭连接
+				return;
+			}
+			pRecvRing->Consume(nParseLen);
+			if (pRecvRing->empty()) {
+				pRecvRing->Shrink();
+			}
+			return;
+		}
 		m_nRecvLen += nBufLen;
 		const char* lpParseBuf = m_pRecvBuf;
 		int nParseBufLen = m_nRecvLen; //还剩多少数据长度需要解析
-		int nParseFlags = 0;
-		do {
-			int nPacketBufLen = nParseBufLen;
-			nParseFlags = ParseBuf(lpParseBuf, nPacketBufLen);
-			if(!nParseFlags) {
-				Base::Trigger(FD_CLOSE, XSocket::Socket::GetLastError());
-				break;
-			} else if(!(nParseFlags & SOCKET_PACKET_FLAG_COMPLETE)) {
-				break;
-			} else {
-				OnRecvBuf(lpParseBuf, nPacketBufLen, nParseFlags);
-			}
-			lpParseBuf += nPacketBufLen;
-			nParseBufLen -= nPacketBufLen;
-		} while (nParseBufLen > 0);
-		if(!nParseFlags) {
+		int nParseLen = ParseRecvBuf(lpParseBuf, nParseBufLen);
+		if(nParseLen < 0) {
 			//异常不处理了，后续会关闭连接
 		} else {
+			lpParseBuf += nParseLen;
+			nParseBufLen -= nParseLen;
 			if(nParseBufLen <= 0) {
 				m_nRecvLen = 0;
 				//m_pRecvBuf;
@@ -233,6 +709,29 @@ protected:
 		}
 	}
 
+	//解析连续的接收数据，回调完整包，返回解析的长度，解析失败返回-1
+	int ParseRecvBuf(const char* lpParseBuf, int nParseBufLen)
+	{
+		int nParseLen = 0;
+		int nParseFlags = 0;
+		do {
+			int nPacketBufLen = nParseBufLen;
+			nParseFlags = ParseBuf(lpParseBuf, nPacketBufLen);
+			if(!nParseFlags) {
+				Base::Trigger(FD_CLOSE, XSocket::Socket::GetLastError());
+				return -1;
+			} else if(!(nParseFlags & SOCKET_PACKET_FLAG_COMPLETE)) {
+				break;
+			} else {
+				OnRecvBuf(lpParseBuf, nPacketBufLen, nParseFlags);
+			}
+			lpParseBuf += nPacketBufLen;
+			nParseBufLen -= nPacketBufLen;
+			nParseLen += nPacketBufLen;
+		} while (nParseBufLen > 0);
+		return nParseLen;
+	}
+
 	virtual void OnSend(int nErrorCode)
 	{
 		if (nErrorCode) {
@@ -241,13 +740,34 @@ protected:
 		}
 
 		bool bConitnue = false;
+		bool bFlush = m_bFlushPending;
+		m_bFlushPending = false;
+		m_bSendPending = true;
 		do {
 			bConitnue = false;
 			const char* lpBuf = nullptr;
 			int nBufLen = 0;
 			if (!m_pSendBuf) {
+				//优先聚集发送，一次writev/sendmsg发送多个缓存
+				struct iovec Iov[XSOCKET_SEND_IOV_MAX];
+				int nIovCnt = PrepareSendIov(Iov, XSOCKET_SEND_IOV_MAX);
+				if (nIovCnt > 0) {
+					nBufLen = Base::SendV(Iov, nIovCnt);
+					if (nBufLen<0) {
+						Base::OnSend(XSocket::Socket::GetLastError());
+					} else if(nBufLen == 0) {
+						Base::Trigger(FD_CLOSE, XSocket::Socket::GetLastError());
+					} else {
+						//走虚函数让派生类的OnSend也能看到聚集发送，lpBuf只是第一个缓存
+						OnSend((const char*)Iov[0].iov_base, nBufLen, 0);
+						OnSendIov(nBufLen);
+						bConitnue = Base::IsSocket(); //继续发送
+					}
+					continue;
+				}
 				if(!PrepareSendBuf(lpBuf,nBufLen)) {
 					//说明没有可发送数据
+					m_bSendPending = false;
 					Base::RemoveSelect(FD_WRITE);
 					return;
 				}
@@ -268,11 +788,19 @@ protected:
 				bConitnue = Base::IsSocket(); //继续发送
 			}
 		} while (bConitnue);
+		if (bFlush && Base::IsSocket() && m_bSendPending && !Base::IsSelect(FD_WRITE)) {
+			//合并发送没有发完，等待可写
+			Base::SelectWait(FD_WRITE);
+		}
 	}
 
 	virtual void OnSend(const char* lpBuf, int nBufLen, int nFlags)
 	{
 		Base::OnSend(lpBuf, nBufLen, nFlags);
+		if (!m_pSendBuf) {
+			//聚集发送，由OnSendIov消费
+			return;
+		}
 		m_nSendLen += nBufLen;
 		if (m_nSendLen >= m_nSendBufLen) {
 			OnSendBuf(m_pSendBuf, m_nSendLen);
@@ -329,6 +857,22 @@ public:
 		return ret;
 	}
 
+	//写直通发送，同TcpSocket::SendDirect
+	inline void SendDirect()
+	{
+		if(Base::IsSelect(FD_WRITE)) {
+			return;
+		}
+		if(Base::IsSelect(FD_CONNECT)) {
+			Base::Select(FD_WRITE);
+			return;
+		}
+		Base::Trigger(FD_WRITE, 0);
+		if(Base::IsSocket() && m_pSendBuf) {
+			Base::SelectWait(FD_WRITE);
+		}
+	}
+
 protected:
 	//
 	//解析数据包
@@ -367,6 +911,7 @@ protected:
 			return;
 		}
 
+		size_t nReadBytes = 0, nReads = 0;
 		bool bConitnue = false;
 		do {
 			bConitnue = false;
@@ -383,6 +928,11 @@ protected:
 			} else {
 				Base::Trigger(FD_READ, lpBuf, nBufLen,(const SOCKADDR*)&stAddr, nAddrLen, 0);
 				bConitnue = Base::IsSocket();
+				nReadBytes += nBufLen;
+				nReads++;
+				if (bConitnue && Base::ReadBudgetExceeded(nReadBytes, nReads)) {
+					bConitnue = false;
+				}
 			}
 		} while(bConitnue);
 	}
@@ -422,6 +972,7 @@ protected:
 			if (!m_pSendBuf) {
 				if(!PrepareSendBuf(lpBuf,nBufLen,lpAddr)) {
 					//说明没有可发送数据
+					Base::RemoveSelect(FD_WRITE);
 					return;
 				}
 				m_nSendLen = 0;
@@ -484,18 +1035,18 @@ public:
 			//+ lpAddr fix capacity is sizeof SOCKADDR_STORAGE
 			//+ lpBuf
 		}UDPBUF,*PUDPBUF;
-		std::shared_ptr<UdpBuffer> bufptr_;
+		UdpBufferPool::Ptr bufptr_;
 		inline PUDPBUF ptr() { return (PUDPBUF)bufptr_->data(); }
 		inline char *begin() { return (char*)ptr() + sizeof(UDPBUF) + sizeof(SOCKADDR_STORAGE); } 
 		inline char *tail() { return begin() + ptr()->nBufLen; };
 	public:
 		Buffer(){}
-		Buffer(std::shared_ptr<UdpBuffer> bufptr):bufptr_(bufptr) {}
+		Buffer(const UdpBufferPool::Ptr& bufptr):bufptr_(bufptr) {}
 		Buffer(const char* lpBuf, int nBufLen, const SOCKADDR* lpAddr, int nAddrLen, int nFlags = 0) { 
 			reinit(lpBuf,nBufLen,lpAddr,nAddrLen,nFlags);
 		}
 		Buffer(const Buffer& rhs):Buffer(rhs.bufptr_) {}
-		Buffer(Buffer&& rhs):Buffer(rhs.bufptr_) {}
+		Buffer(Buffer&& rhs):bufptr_(std::move(rhs.bufptr_)) {}
 		~Buffer() { reset(); }
 		Buffer& operator=(const Buffer& rhs) {
 			if(this == &rhs) {
@@ -508,11 +1059,13 @@ public:
 			if(this == &rhs) {
 				return *this;
 			}
-			bufptr_ = rhs.bufptr_;
+			bufptr_ = std::move(rhs.bufptr_);
 			return *this;
 		}
 
 		inline bool valid() const { return bufptr_?true:false; }
+		//没有其他引用，可以原地复用
+		inline bool unique() const { return bufptr_.use_count() == 1; }
 		inline bool reinit(const char* lpBuf, int nBufLen, const SOCKADDR* lpAddr, int nAddrLen, int nFlags = 0) {
 			bufptr_ = UdpBufferPool::Inst().New();
 #ifdef _DEBUG
@@ -520,9 +1073,11 @@ public:
 			char* str = data();
 			size_t l = left();
 #endif
+			clear(); //池里复用的缓存还留着上次的长度
 			flag(nFlags);
 			addr(lpAddr,nAddrLen);
 			write(lpBuf,nBufLen);
+			return true;
 		}
 		inline void reset() { bufptr_.reset(); }
 
@@ -556,9 +1111,33 @@ public:
 			}
 		}
 	};
+	enum 
+	{ 
+		UDP_BATCH_MAX = 64, //批量收发每批最多的数据报个数
+		UDP_GSO_SEGMENTS = 64, //一次GSO发送/GRO接收最多的分段数，同内核UDP_MAX_SEGMENTS
+		UDP_GSO_BYTES = 65507, //一次GSO发送最大的数据长度
+		UDP_SEND_BUFS = 256, //开启GSO时每次sendmmsg最多的数据报个数
+	};
+	struct BatchStat
+	{
+		uint64_t recv_calls = 0; //批量接收的系统调用次数
+		uint64_t recv_packets = 0; //批量接收的数据报个数，除以recv_calls是平均每批个数
+		uint64_t send_calls = 0; //批量发送的系统调用次数
+		uint64_t send_packets = 0; //批量发送的数据报个数，除以send_calls是平均每批个数
+		uint64_t gso_msgs = 0; //带UDP_SEGMENT合并发送的消息个数
+		uint64_t gro_msgs = 0; //收到的GRO合并数据报个数
+	};
 protected:
 	Buffer recvbuf_;
 	Buffer sendbuf_;
+	int recv_batch_ = 0; //每次recvmmsg最多接收的数据报个数，0或1表示逐个接收
+	int send_batch_ = 0; //每次sendmmsg最多发送的数据报个数，0或1表示逐个发送
+	std::vector<Buffer> sendbatch_; //已经取出还没发出的数据报
+	BatchStat batch_stat_;
+	bool recv_batching_ = false; //正在回调OnRecvBatch
+	bool gso_ = false; //发送时合并相同目的地址的等长数据报，带UDP_SEGMENT一次发出
+	bool gro_ = false; //接收内核GRO合并的数据报，按分段拆开回调
+	std::vector<char> grobuf_; //GRO接收缓存
 public:
 	UdpSocketEx():Base()
 	{
@@ -581,11 +1160,86 @@ public:
 		int ret = Base::Close();
 		recvbuf_.reset();
 		sendbuf_.reset();
+		sendbatch_.clear();
+		gro_ = false;
+		grobuf_.clear();
+		grobuf_.shrink_to_fit();
 		return ret;
 	}
 
+	/*!
+	 *	@brief 设置批量收发的每批数据报个数.
+	 *
+	 *	LINUX下大于1时用recvmmsg/sendmmsg，一次系统调用收发多个数据报，最多UDP_BATCH_MAX；
+	 *	接收的数据报通过OnRecvBatch回调，默认逐个回调OnRecvBuf；每次可写最多发送一批
+	 */
+	inline void SetRecvBatch(int count) { recv_batch_ = std::min<int>(count, UDP_BATCH_MAX); }
+	inline int GetRecvBatch() { return recv_batch_; }
+	inline void SetSendBatch(int count) { send_batch_ = std::min<int>(count, UDP_BATCH_MAX); }
+	inline int GetSendBatch() { return send_batch_; }
+	inline const BatchStat& GetBatchStat() { return batch_stat_; }
+	//正在回调OnRecvBatch，这期间的发送可以等这批处理完再一起发送
+	inline bool IsRecvBatching() { return recv_batching_; }
+
+	/*!
+	 *	@brief 开启UDP GSO发送.
+	 *
+	 *	LINUX下发送队列里连续的、目的地址相同、长度相同(最后一个可以更短)的数据报，
+	 *	合成一个带UDP_SEGMENT控制消息的发送，由内核/网卡切分，最多UDP_GSO_SEGMENTS个；
+	 *	内核不支持返回false，网卡不支持(EIO)时自动关闭GSO逐个重发，EINVAL时只是这一次逐个重发
+	 */
+	inline bool SetGSO(bool enable)
+	{
+#if !defined(WIN32) && defined(UDP_SEGMENT)
+		if (enable) {
+			int nSegSize = 0;
+			if (Base::SetSockOpt(SOL_UDP, UDP_SEGMENT, &nSegSize, sizeof(nSegSize)) != 0) {
+				return false;
+			}
+		}
+		gso_ = enable;
+		return true;
+#else
+		return !enable;
+#endif//
+	}
+	inline bool IsGSO() { return gso_; }
+
+	/*!
+	 *	@brief 开启UDP GRO接收.
+	 *
+	 *	LINUX下内核把同一个流的多个数据报合并成一个交上来，一次recvmsg收一串，
+	 *	按UDP_GRO控制消息的分段长度拆成多个Buffer后通过OnRecvBatch回调；优先于SetRecvBatch
+	 */
+	inline bool SetGRO(bool enable)
+	{
+#if !defined(WIN32) && defined(UDP_GRO)
+		int nOptVal = enable ? 1 : 0;
+		if (Base::SetSockOpt(SOL_UDP, UDP_GRO, &nOptVal, sizeof(nOptVal)) != 0) {
+			return false;
+		}
+		gro_ = enable;
+		if (gro_) {
+			grobuf_.resize(65536);
+		}
+		return true;
+#else
+		return !enable;
+#endif//
+	}
+	inline bool IsGRO() { return gro_; }
+
 protected:
 	//
+	//批量接收一组数据包，默认逐个回调OnRecvBuf，需要保留的Buffer复制一份即可
+	virtual void OnRecvBatch(Buffer* bufs, int count)
+	{
+		for (int i = 0; i < count && Base::IsSocket(); i++)
+		{
+			OnRecvBuf(bufs[i]);
+		}
+	}
+
 	//接收完整一个包
 	virtual void OnRecvBuf(Buffer& buf)
 	{
@@ -619,6 +1273,17 @@ protected:
 			return;
 		}
 
+#ifndef WIN32
+		if (gro_) {
+			OnReceiveGRO();
+			return;
+		}
+		if (recv_batch_ > 1) {
+			OnReceiveBatch();
+			return;
+		}
+#endif//
+		size_t nReadBytes = 0, nReads = 0;
 		bool bConitnue = false;
 		do {
 			bConitnue = false;
@@ -641,9 +1306,310 @@ protected:
 				OnRecvBuf(recvbuf_);
 				recvbuf_.reset();
 				bConitnue = Base::IsSocket();
+				nReadBytes += nBufLen;
+				nReads++;
+				if (bConitnue && Base::ReadBudgetExceeded(nReadBytes, nReads)) {
+					bConitnue = false;
+				}
+			}
+		} while(bConitnue);
+	}
+
+#ifndef WIN32
+	//准备一个批量接收的槽位，缓存没有了才从池里取，消息头指向缓存
+	inline void PrepareRecvSlot(Buffer& buf, struct mmsghdr& msg, struct iovec& iov)
+	{
+		if (!buf.valid()) {
+			buf.reinit(nullptr,0,nullptr,0);
+		} else {
+			buf.clear();
+			buf.flag(0);
+		}
+		iov.iov_base = buf.data();
+		iov.iov_len = buf.left();
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_hdr.msg_name = buf.addr();
+		msg.msg_hdr.msg_namelen = sizeof(SOCKADDR_STORAGE);
+		msg.msg_hdr.msg_iov = &iov;
+		msg.msg_hdr.msg_iovlen = 1;
+	}
+
+	//recvmmsg批量接收，一批没收满说明已经收完
+	inline void OnReceiveBatch()
+	{
+		size_t nReadBytes = 0, nReads = 0;
+		Buffer bufs[UDP_BATCH_MAX];
+		struct mmsghdr msgs[UDP_BATCH_MAX];
+		struct iovec iovs[UDP_BATCH_MAX];
+		int nBatch = recv_batch_;
+		for (int i = 0; i < nBatch; i++)
+		{
+			PrepareRecvSlot(bufs[i], msgs[i], iovs[i]);
+		}
+		bool bConitnue = false;
+		do {
+			bConitnue = false;
+			int nCount = Base::ReceiveMMsg(msgs, nBatch);
+			if (nCount < 0) {
+				Base::OnReceive(XSocket::Socket::GetLastError());
+			} else if (nCount > 0) {
+				batch_stat_.recv_calls++;
+				batch_stat_.recv_packets += nCount;
+				for (int i = 0; i < nCount; i++)
+				{
+					bufs[i].addrlen(msgs[i].msg_hdr.msg_namelen);
+					bufs[i].resize(msgs[i].msg_len);
+					nReadBytes += msgs[i].msg_len;
+				}
+				recv_batching_ = true;
+				OnRecvBatch(bufs, nCount);
+				recv_batching_ = false;
+				if (Base::IsSocket() && !Base::IsSelect(FD_WRITE)) {
+					//这批回调里的发送一起发出
+					Base::Trigger(FD_WRITE, 0);
+				}
+				nReads += nCount;
+				bConitnue = Base::IsSocket() && nCount == nBatch;
+				if (bConitnue && Base::ReadBudgetExceeded(nReadBytes, nReads)) {
+					bConitnue = false;
+				}
+				if (bConitnue) {
+					//只重新准备收到数据的槽位，回调里保留了引用的换新缓存，其他的原地复用
+					for (int i = 0; i < nCount; i++)
+					{
+						if (bufs[i].valid() && !bufs[i].unique()) {
+							bufs[i].reset();
+						}
+						PrepareRecvSlot(bufs[i], msgs[i], iovs[i]);
+					}
+				}
+			}
+		} while(bConitnue);
+	}
+
+	//GRO接收，一次recvmsg收一串合并的数据报，按分段长度拆开
+	inline void OnReceiveGRO()
+	{
+		size_t nReadBytes = 0, nReads = 0;
+		Buffer bufs[UDP_GSO_SEGMENTS];
+		union {
+			char buf[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr align;
+		} ctrl;
+		SOCKADDR_STORAGE stAddr;
+		bool bConitnue = false;
+		do {
+			bConitnue = false;
+			struct iovec iov = { grobuf_.data(), grobuf_.size() };
+			struct msghdr msg = { 0 };
+			msg.msg_name = &stAddr;
+			msg.msg_namelen = sizeof(stAddr);
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = ctrl.buf;
+			msg.msg_controllen = sizeof(ctrl.buf);
+			int nBufLen = Base::ReceiveMsg(&msg);
+			if (nBufLen < 0) {
+				Base::OnReceive(XSocket::Socket::GetLastError());
+			} else if (nBufLen == 0) {
+				Base::Trigger(FD_CLOSE, XSocket::Socket::GetLastError());
+			} else {
+				int nSegSize = nBufLen;
+				for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+				{
+					if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+						nSegSize = std::max<int>(*(int*)CMSG_DATA(cmsg), 1);
+						break;
+					}
+				}
+				int nCount = 0;
+				for (int nPos = 0; nPos < nBufLen && nCount < UDP_GSO_SEGMENTS; nPos += nSegSize)
+				{
+					int nLen = std::min<int>(nSegSize, nBufLen - nPos);
+					Buffer& buf = bufs[nCount];
+					buf.reinit(nullptr, 0, (const SOCKADDR*)&stAddr, msg.msg_namelen);
+					if (buf.left() < (size_t)nLen) {
+						//超过UdpBuffer容量的分段丢弃
+						if(Base::IsDebug()) {
+							PRINTF("(%p %p %u)::OnReceiveGRO drop segment:%d", Service::service(), this, (SOCKET)*this, nLen);
+						}
+						buf.reset();
+						continue;
+					}
+					buf.write(grobuf_.data() + nPos, nLen);
+					nCount++;
+				}
+				batch_stat_.recv_calls++;
+				batch_stat_.recv_packets += nCount;
+				if (nSegSize < nBufLen) {
+					batch_stat_.gro_msgs++;
+				}
+				if (nCount > 0) {
+					recv_batching_ = true;
+					OnRecvBatch(bufs, nCount);
+					recv_batching_ = false;
+					for (int i = 0; i < nCount; i++)
+					{
+						bufs[i].reset();
+					}
+					if (Base::IsSocket() && !Base::IsSelect(FD_WRITE)) {
+						//这批回调里的发送一起发出
+						Base::Trigger(FD_WRITE, 0);
+					}
+				}
+				nReadBytes += nBufLen;
+				nReads += nCount;
+				bConitnue = Base::IsSocket();
+				if (bConitnue && Base::ReadBudgetExceeded(nReadBytes, nReads)) {
+					bConitnue = false;
+				}
+			}
+		} while(bConitnue);
+	}
+
+	//从sendbatch_[nPos]开始，目的地址相同、长度相同(最后一个可以更短)的连续数据报个数，可以合成一个GSO发送
+	inline int GetSegmentCount(int nPos, int nEnd)
+	{
+		Buffer& first = sendbatch_[nPos];
+		size_t nSegSize = first.size(), nTotal = nSegSize;
+		int i = nPos + 1;
+		for (; i < nEnd && i - nPos < UDP_GSO_SEGMENTS; i++)
+		{
+			Buffer& buf = sendbatch_[i];
+			if (buf.size() > nSegSize || nTotal + buf.size() > UDP_GSO_BYTES
+				|| buf.addrlen() != first.addrlen() || memcmp(buf.addr(), first.addr(), first.addrlen()) != 0) {
+				break;
+			}
+			nTotal += buf.size();
+			if (buf.size() < nSegSize) {
+				//短的只能是最后一个
+				i++;
+				break;
+			}
+		}
+		return i - nPos;
+	}
+
+	//sendmmsg批量发送，开启GSO时连续的等长数据报合成一个消息，没发完的留到下次可写
+	inline void OnSendBatch()
+	{
+		if (sendbuf_.valid()) {
+			sendbatch_.push_back(std::move(sendbuf_));
+			sendbuf_.reset();
+		}
+		const int nMaxMsgs = std::max<int>(send_batch_, 1);
+		Buffer sent[UDP_SEND_BUFS];
+		struct mmsghdr msgs[UDP_BATCH_MAX];
+		struct iovec iovs[UDP_SEND_BUFS];
+		int segs[UDP_BATCH_MAX]; //每个消息包含的数据报个数
+		union {
+			char buf[CMSG_SPACE(sizeof(uint16_t))];
+			struct cmsghdr align;
+		} ctrls[UDP_BATCH_MAX];
+		bool bGSO = gso_; //本次是否合并发送，EINVAL时本次不合并重发
+		bool bConitnue = false;
+		do {
+			bConitnue = false;
+			const int nMaxBufs = bGSO ? std::min<int>(nMaxMsgs * UDP_GSO_SEGMENTS, UDP_SEND_BUFS) : nMaxMsgs;
+			while (sendbatch_.size() < (size_t)nMaxBufs)
+			{
+				Buffer buf;
+				if (!PrepareSendBuf(buf)) {
+					break;
+				}
+				sendbatch_.push_back(std::move(buf));
+			}
+			if (sendbatch_.empty()) {
+				//说明没有可发送数据
+				if (Base::IsSelect(FD_WRITE)) {
+					Base::RemoveSelect(FD_WRITE);
+				}
+				return;
+			}
+			int nBufs = std::min<int>((int)sendbatch_.size(), nMaxBufs);
+			int nMsgs = 0, nGSOMsgs = 0;
+			for (int i = 0; i < nBufs && nMsgs < nMaxMsgs; nMsgs++)
+			{
+				int nSegs = bGSO ? GetSegmentCount(i, nBufs) : 1;
+				Buffer& first = sendbatch_[i];
+				memset(&msgs[nMsgs], 0, sizeof(msgs[nMsgs]));
+				msgs[nMsgs].msg_hdr.msg_name = first.addrlen() ? first.addr() : nullptr;
+				msgs[nMsgs].msg_hdr.msg_namelen = first.addrlen();
+				msgs[nMsgs].msg_hdr.msg_iov = &iovs[i];
+				msgs[nMsgs].msg_hdr.msg_iovlen = nSegs;
+				for (int j = 0; j < nSegs; j++)
+				{
+					Buffer& buf = sendbatch_[i + j];
+					iovs[i + j].iov_base = buf.data();
+					iovs[i + j].iov_len = buf.size();
+				}
+				if (nSegs > 1) {
+					msgs[nMsgs].msg_hdr.msg_control = ctrls[nMsgs].buf;
+					msgs[nMsgs].msg_hdr.msg_controllen = sizeof(ctrls[nMsgs].buf);
+					struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[nMsgs].msg_hdr);
+					cmsg->cmsg_level = SOL_UDP;
+					cmsg->cmsg_type = UDP_SEGMENT;
+					cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+					*(uint16_t*)CMSG_DATA(cmsg) = (uint16_t)first.size();
+					nGSOMsgs++;
+				}
+				segs[nMsgs] = nSegs;
+				i += nSegs;
+			}
+			int nCount = Base::SendMMsg(msgs, nMsgs);
+			if (nCount < 0) {
+				int nErrorCode = XSocket::Socket::GetLastError();
+				if (nErrorCode == EIO && nGSOMsgs > 0) {
+					//网卡不支持校验和卸载，不能GSO，关闭后逐个重发
+					if(Base::IsDebug()) {
+						PRINTF("(%p %p %u)::OnSendBatch GSO disabled:%d", Service::service(), this, (SOCKET)*this, nErrorCode);
+					}
+					gso_ = false;
+					bGSO = false;
+					bConitnue = true;
+					continue;
+				}
+				if (nErrorCode == EINVAL && nGSOMsgs > 0) {
+					//这一批的分段长度或地址等不适合GSO，只是这次逐个重发，不影响以后的合并发送
+					bGSO = false;
+					bConitnue = true;
+					continue;
+				}
+				Base::OnSend(nErrorCode);
+				if (Base::IsSocket() && !Base::IsSelect(FD_WRITE)) {
+					//内核发送缓存满了，等待可写
+					Base::SelectWait(FD_WRITE);
+				}
+			} else if (nCount > 0) {
+				int nSent = 0;
+				for (int i = 0; i < nCount; i++)
+				{
+					nSent += segs[i];
+					if (segs[i] > 1) {
+						batch_stat_.gso_msgs++;
+					}
+				}
+				batch_stat_.send_calls++;
+				batch_stat_.send_packets += nSent;
+				//先移出已发送的，回调里可能关闭连接清空sendbatch_
+				std::move(sendbatch_.begin(), sendbatch_.begin() + nSent, sent);
+				sendbatch_.erase(sendbatch_.begin(), sendbatch_.begin() + nSent);
+				for (int i = 0; i < nSent; i++)
+				{
+					if (Base::IsSocket()) {
+						OnSendBuf(sent[i]);
+					}
+					sent[i].reset();
+				}
+				bConitnue = Base::IsSocket() && nCount == nMsgs;
+				if (Base::IsSocket() && nCount < nMsgs && !Base::IsSelect(FD_WRITE)) {
+					//没发完说明内核发送缓存满了，等待可写
+					Base::SelectWait(FD_WRITE);
+				}
 			}
 		} while(bConitnue);
 	}
+#endif//
 
 	virtual void OnSend(int nErrorCode)
 	{
@@ -651,6 +1617,12 @@ protected:
 			Base::OnSend(nErrorCode);
 			return;
 		}
+#ifndef WIN32
+		if (send_batch_ > 1 || gso_ || !sendbatch_.empty()) {
+			OnSendBatch();
+			return;
+		}
+#endif//
 		bool bConitnue = false;
 		do {
 			bConitnue = false;
@@ -661,6 +1633,9 @@ protected:
 			if (!sendbuf_.valid()) {
 				if(!PrepareSendBuf(sendbuf_)) {
 					//说明没有可发送数据
+					if (Base::IsSelect(FD_WRITE)) {
+						Base::RemoveSelect(FD_WRITE);
+					}
 					return;
 				}
 			}
@@ -673,6 +1648,10 @@ protected:
 			nBufLen = Base::SendTo(lpBuf,nBufLen,(const SOCKADDR*)lpAddr,nAddrLen);
 			if (nBufLen<0) {
 				Base::OnSend(XSocket::Socket::GetLastError());
+				if (Base::IsSocket() && !Base::IsSelect(FD_WRITE)) {
+					//内核发送缓存满了，等待可写
+					Base::SelectWait(FD_WRITE);
+				}
 			} else if(nBufLen == 0) {
 				Base::Trigger(FD_CLOSE, XSocket::Socket::GetLastError());
 			} else {
@@ -757,6 +1736,9 @@ protected:
  *	@brief SocketT 定义.
  *
  *	封装BasicSocketT，增加服务对象，实现简单的流式发送/接收（写入/读取）网络架构
+ *
+ *	PostOwned投递的任务总在Socket当前所在的服务线程执行：执行时发现Socket已经迁移(MigrateSocket)
+ *	到其他服务就转发过去，迁移途中(离开原服务、还没加入新服务)的任务先挂起，加入新服务后按顺序投递
  */
 template<class TBase>
 class BasicSocketT : public TBase
@@ -765,21 +1747,85 @@ class BasicSocketT : public TBase
 public:
 	typedef typename Base::SocketSet SocketSet;
 protected:
+	//任务归属，投递出去的任务持有它，Socket析构后仍然有效
+	struct TaskOwner
+	{
+		std::mutex mutex;
+		SocketSet* svr = nullptr; //当前所在服务，nullptr表示还没加入或者迁移途中
+		std::vector<InplaceTask> parked; //没有所在服务期间的任务
+		std::unordered_map<size_t,SocketSet*> keys; //带key的任务投递到的服务，nullptr表示挂起中，见TaskSocketT
+		//挂起时记下投递方法，事件服务没有Post(InplaceTask&&)，OnAttachService里不能直接调用
+		void (*post)(const std::shared_ptr<TaskOwner>& owner, SocketSet* svr, InplaceTask&& task) = nullptr;
+	};
 	SocketSet* service_ptr_ = nullptr;
+	std::shared_ptr<TaskOwner> owner_ = std::make_shared<TaskOwner>();
 public:
 	//
 	inline SocketSet* this_service() { return service_ptr_; }
 
+	//投递和这个Socket相关的任务，需要SocketSet支持Post(InplaceTask&&)
+	inline void PostOwned(InplaceTask&& task)
+	{
+		PostOwned(owner_, std::move(task));
+	}
+
 protected:
-	//
+	//在owner当前所在服务执行，没有所在服务时挂起
+	static void PostOwned(const std::shared_ptr<TaskOwner>& owner, InplaceTask&& task)
+	{
+		std::lock_guard<std::mutex> lock(owner->mutex);
+		if (!owner->svr) {
+			owner->post = &PostTo;
+			owner->parked.emplace_back(std::move(task));
+			return;
+		}
+		//在锁内投递，和OnAttachService投递挂起的任务保持先后顺序
+		PostTo(owner, owner->svr, std::move(task));
+	}
+	//C++11没有移动捕获，任务通过bind带进回调
+	static void PostTo(const std::shared_ptr<TaskOwner>& owner, SocketSet* svr, InplaceTask&& task)
+	{
+		svr->Post(std::bind([owner,svr](InplaceTask& task) {
+			RunOwned(owner, svr, task);
+		}, std::move(task)));
+	}
+	//在svr服务线程执行，Socket已经不在svr上就转发；迁移的注销也在svr线程执行，检查之后不会再变
+	static void RunOwned(const std::shared_ptr<TaskOwner>& owner, SocketSet* svr, InplaceTask& task)
+	{
+		{
+		std::unique_lock<std::mutex> lock(owner->mutex);
+		if (owner->svr != svr) {
+			lock.unlock();
+			PostOwned(owner, std::move(task));
+			return;
+		}
+		}
+		task();
+	}
+
 	virtual void OnAttachService(Service* pSvr)
 	{
 		Base::OnAttachService(pSvr);
 		service_ptr_ = dynamic_cast<SocketSet*>(pSvr);
+		std::lock_guard<std::mutex> lock(owner_->mutex);
+		owner_->svr = service_ptr_;
+		if (owner_->svr) {
+			for (size_t i = 0; i < owner_->parked.size(); i++)
+			{
+				owner_->post(owner_, owner_->svr, std::move(owner_->parked[i]));
+			}
+			owner_->parked.clear();
+		}
 	}
-	virtual void OnDeatchService(Service* pSvr)
+	virtual void OnDetachService(Service* pSvr)
 	{
-		service_ptr_ = nullptr;
+		//还打开着说明是迁移，之后的任务挂起到加入新服务；已经关闭的仍然投递到原来的服务，
+		//service_ptr_也保留，关闭后再投递的任务照常执行
+		if (Base::IsSocket()) {
+			std::lock_guard<std::mutex> lock(owner_->mutex);
+			owner_->svr = nullptr;
+		}
+		Base::OnDetachService(pSvr);
 	}
 };
 
@@ -806,11 +1852,11 @@ public:
 	}
 
 	inline bool IsSocket() {  return Base::sock_ != 0; }
-	inline void Close() { 
+	inline int Close() { 
 		if(Base::sock_) { 
-			TSocket* sock = (TSocket*)Base::sock_; 
 			Detach();
 		} 
+		return 0;
 	}
 
 protected:
@@ -848,6 +1894,9 @@ protected:
  *	@brief TaskSocketT 定义.
  *
  *	封装TaskSocketT，增加任务调用支持，支持异步DNS
+ *
+ *	任务按BasicSocketT::PostOwned投递，Socket迁移后仍在它所在的服务线程执行；
+ *	带key的任务记住投递到的服务，迁移后Cancel仍然有效
  */
 template<class TBase>
 class TaskSocketT : public BasicSocketT<TBase>
@@ -855,41 +1904,91 @@ class TaskSocketT : public BasicSocketT<TBase>
 	typedef BasicSocketT<TBase> Base;
 public:
 	typedef typename Base::SocketSet TaskSocketSet;
+	typedef typename Base::TaskOwner TaskOwner;
 public:
 	
-	inline void Post(const TaskID& key, std::function<void()> && task)
+	inline void Post(const TaskID& key, InplaceTask&& task)
 	{
-		Base::this_service()->Post(key, std::move(task));
+		PostOwnedKey(Base::owner_, key, std::move(task));
 	}
 
-	inline void Post(std::function<void()> && task)
+	inline void Post(InplaceTask&& task)
 	{
-		Base::this_service()->Post(std::move(task));
+		Base::PostOwned(std::move(task));
 	}
 
 	template<class F, class... Args>
 	auto Send(const TaskID& key, F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
-		return Base::this_service()->Send(key, std::forward<F>(f), std::forward<Args>(args)...);
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(key, MakePackagedTask(res, std::forward<F>(f), std::forward<Args>(args)...));
+		return res;
 	}
 	
 	template<class F, class... Args>
 	inline auto Send(F&& f, Args&&... args) 
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
-		return Base::this_service()->Send(std::forward<F>(f), std::forward<Args>(args)...);
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		Post(MakePackagedTask(res, std::forward<F>(f), std::forward<Args>(args)...));
+		return res;
 	}
 
 	inline void Cancel(const TaskID& key)
 	{
-		Base::this_service()->Cancel(key);
+		TaskSocketSet* svr = nullptr;
+		{
+		std::lock_guard<std::mutex> lock(Base::owner_->mutex);
+		auto it = Base::owner_->keys.find(key.id);
+		if (it == Base::owner_->keys.end()) {
+			svr = Base::this_service(); //不是通过这个Socket投递的，按原来的方式取消
+		} else {
+			//挂起中的任务去掉key后不再投递
+			svr = it->second;
+			Base::owner_->keys.erase(it);
+		}
+		}
+		if (svr) {
+			svr->Cancel(key);
+		}
 	}
 
 	inline void PostGetAddrInfo(const std::string& hostname, const std::string& service, const struct addrinfo& hints, std::function<void(struct addrinfo*)>&& cb)
 	{
 		Base::this_service()->PostGetAddrInfo(hostname, service, hints, std::move(cb));
 	}
+
+protected:
+	//带key的任务挂在所在服务的时间轮上，到期时Socket已经迁移就转发到新服务立即执行
+	static void PostOwnedKey(const std::shared_ptr<TaskOwner>& owner, const TaskID& key, InplaceTask&& task)
+	{
+		size_t id = key.id;
+		std::lock_guard<std::mutex> lock(owner->mutex);
+		TaskSocketSet* svr = owner->svr;
+		owner->keys[id] = svr;
+		if (!svr) {
+			//加入新服务后按key重新投递，延迟按key的时间重新计算
+			owner->post = &Base::PostTo;
+			owner->parked.emplace_back(std::bind([owner,key](InplaceTask& task) {
+				{
+				std::lock_guard<std::mutex> lock(owner->mutex);
+				if (!owner->keys.count(key.id)) {
+					return; //挂起期间被Cancel
+				}
+				}
+				PostOwnedKey(owner, key, std::move(task));
+			}, std::move(task)));
+			return;
+		}
+		svr->Post(key, std::bind([owner,svr,id](InplaceTask& task) {
+			{
+			std::lock_guard<std::mutex> lock(owner->mutex);
+			owner->keys.erase(id);
+			}
+			Base::RunOwned(owner, svr, task);
+		}, std::move(task)));
+	}
 };
 
 /*!
@@ -904,27 +2003,18 @@ class TaskSocketServiceT : public TBase
 protected:
 	struct Event
 	{
-		Event(std::function<void()> &&_task, void* _ptr = nullptr, size_t _delay = 0)
+		Event(InplaceTask &&_task, void* _ptr = nullptr, size_t _delay = 0)
 		:task(std::move(_task)), ptr(_ptr), time(std::chrono::steady_clock::now() + std::chrono::milliseconds(_delay)) {
 			//PRINTF("Event");
 		}
-		Event(const Event& o):task(o.task),ptr(o.ptr),time(o.time) {
-			//PRINTF("levent");
-		}
+		Event(const Event& o) = delete;
 		Event(Event&& o):task(std::move(o.task)),ptr(o.ptr),time(o.time) {
 			//PRINTF("revent");
 		}
 		~Event() {
 		}
 
-		Event& operator = (const Event& rhs) {
-			if(this == &rhs) return *this;
-			//DealyEventBase::operator=(rhs);
-			ptr = rhs.ptr;
-			task = rhs.task;
-			time = rhs.time;
-        	return *this;
-    	}
+		Event& operator = (const Event& rhs) = delete;
 		Event& operator = (Event&& rhs) {
 			if(this == &rhs) return *this;
 			//DealyEventBase::operator=(std::move(rhs));
@@ -950,10 +2040,11 @@ protected:
 			return false;
 		}
 		void* ptr = nullptr;
-		std::function<void()> task;
+		InplaceTask task;
 		std::chrono::steady_clock::time_point time;
 	};
-	std::vector<Event> queue_;
+	std::vector<Event> queue_; //实时任务
+	std::unordered_multimap<void*,Service::TimerID> timers_; //延迟任务定时器，挂在服务时间轮上
 	std::mutex mutex_;
 	//
 	/*template<class... _Valty>	
@@ -968,21 +2059,37 @@ public:
 		queue_.reserve(1024);
 	}
 
-	inline void Post(void* ptr, std::function<void()> && task)
+	inline void Post(void* ptr, InplaceTask&& task)
 	{
 		PostDelay(0, ptr, std::move(task));
 	}
 
-	inline void PostDelay(size_t delay, void* ptr, std::function<void()> && task)
+	inline void PostDelay(size_t delay, void* ptr, InplaceTask&& task)
 	{
 		ASSERT(task);
-		Event evt(std::move(task), ptr, delay);
 		{
 		std::lock_guard<std::mutex> lock(mutex_);
-		//实时任务排在延迟任务前面，延迟任务按延迟时间排队，延迟短排在前面,消费任务从头开始消费
-		auto it = std::upper_bound(queue_.begin(), queue_.end(), evt);
-		queue_.emplace(it,std::move(evt));
-		//queue_.emplace(it.base(),std::forward<std::function<void()>>(task), ptr, delay, repeat);
+		if(delay) {
+			//延迟任务由时间轮调度，到期后清理ptr下已经执行的定时器
+			timers_.emplace(ptr, Base::AddTimer(delay, std::bind([this,ptr](InplaceTask& task) {
+				{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto range = timers_.equal_range(ptr);
+				for (auto it = range.first; it != range.second; )
+				{
+					if (!Base::IsTimerActive(it->second)) {
+						it = timers_.erase(it);
+					} else {
+						++it;
+					}
+				}
+				}
+				task();
+			}, std::move(task))));
+		} else {
+			//实时任务按投递顺序排队，消费任务从头开始消费
+			queue_.emplace_back(std::move(task), ptr, delay);
+		}
 		}
 		if(delay) {
 			Base::PostTimer(delay);
@@ -993,37 +2100,24 @@ public:
 
 	template<class F, class... Args>
 	inline auto PostF(void* ptr, F&& f, Args&&... args)
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
 		return PostDelayF(0, ptr, std::forward<F>(f), std::forward<Args>(args)...);
 	}
 
 	template<class F, class... Args>
 	auto PostDelayF(size_t delay, void* ptr, F&& f, Args&&... args)
-		-> std::future<typename std::result_of<F(Args...)>::type>
+		-> TaskFuture<typename std::result_of<F(Args...)>::type>
 	{
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-
-		PostDelay(delay, ptr, [task](){ (*task)(); });
-		return task->get_future();
+		TaskFuture<typename std::result_of<F(Args...)>::type> res;
+		PostDelay(delay, ptr, MakePackagedTask(res, std::forward<F>(f), std::forward<Args>(args)...));
+		return res;
 	}
 
 	template<class F, class... Args>
-	static inline std::function<void()> Package(std::future<typename std::result_of<F(Args...)>::type>& res, F&& f, Args&&... args)
+	static inline InplaceTask Package(TaskFuture<typename std::result_of<F(Args...)>::type>& res, F&& f, Args&&... args)
 	{
-		using return_type = typename std::result_of<F(Args...)>::type;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-				std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-			);
-
-		res = task->get_future();
-
-		return [task](){ (*task)(); };
+		return MakePackagedTask(res, std::forward<F>(f), std::forward<Args>(args)...);
 	}
 
 	inline void Remove(void* ptr) {
@@ -1035,6 +2129,19 @@ public:
 				queue_.erase(queue_.begin() + i);
 			}
 		}
+		std::vector<size_t> timers;
+		auto range = timers_.equal_range(ptr);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			timers.push_back(it->second);
+		}
+		timers_.erase(range.first, range.second);
+		lock.unlock();
+		//RemoveTimer会等待正在执行的回调，回调先锁mutex_，所以要在锁外移除
+		for (size_t i = 0; i < timers.size(); i++)
+		{
+			Base::RemoveTimer(timers[i]);
+		}
 	}
 
 protected:
@@ -189,6 +189,24 @@ enum {
 
 		//构建数据包
 		static void BuildBuf(std::string& out, const char* lpBody, int nBodyLen, int nFlags, uint32_t mask = 0)
+		{
+			int flags = BuildFlags(nFlags, mask);
+			size_t frame_len = calc_size(flags, nBodyLen);
+			size_t out_len = out.size();out.resize(out_len+frame_len);
+			char* frame_buf = (char*)&out[out_len];
+			build(frame_buf, flags, (char*)&mask, lpBody, nBodyLen);
+		}
+
+		//只构建不带掩码的数据包头，包体另外发送
+		static void BuildHeaderBuf(std::string& out, uint64_t nBodyLen, int nFlags)
+		{
+			int flags = BuildFlags(nFlags, 0);
+			size_t header_len = calc_size(flags, nBodyLen) - nBodyLen;
+			size_t out_len = out.size();out.resize(out_len+header_len);
+			build_header((char*)&out[out_len], flags, nullptr, nBodyLen);
+		}
+
+		static int BuildFlags(int nFlags, uint32_t mask)
 		{
 			int flags = 0;
 			if(nFlags == SOCKET_PACKET_OP_CONTINUE) {
@@ -228,10 +246,7 @@ enum {
 				//mask = htonl(mask);
 				flags |= WS_HAS_MASK;
 			}
-			size_t frame_len = calc_size(flags, nBodyLen);
-			size_t out_len = out.size();out.resize(out_len+frame_len);
-			char* frame_buf = (char*)&out[out_len];
-			build(frame_buf, flags, (char*)&mask, lpBody, nBodyLen);
+			return flags;
 		}
 
 		//解析数据包
@@ -378,6 +393,18 @@ enum {
 			Base::SendBufDirect();
 		}
 
+		//包体零拷贝发送，同一个IOBuf可以广播给多个连接；需要掩码时只能拷贝
+		void SendWSBuf(const IOBuf& body
+		, int nFlags = SOCKET_PACKET_OP_TEXT|SOCKET_PACKET_FLAG_FINAL, uint32_t mask = 0)
+		{
+			if (mask) {
+				SendWSBuf(body.data(), (int)body.size(), nFlags, mask);
+				return;
+			}
+			ws_buffer_.BuildHeaderBuf(Base::SendBuf(), body.size(), nFlags);
+			Base::SendBuf(body);
+		}
+
 	protected:
 		//
 		//解析数据包
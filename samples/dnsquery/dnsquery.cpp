@@ -248,6 +248,68 @@ protected:
 #endif//
 };
 
+/*!
+ *	resolver 非阻塞解析演示，DNSResolverT和其他Socket一样在服务线程收发DNS查询，不阻塞服务线程
+ */
+typedef DNSResolverT<SimpleUdpSocketT<SelectSocketT<ClientService,SocketEx>,SockAddrType>> ResolverSocket;
+class resolver : public SocketExImpl<resolver,SelectUdpClientT<ClientService,ResolverSocket>>
+{
+	typedef SocketExImpl<resolver,SelectUdpClientT<ClientService,ResolverSocket>> Base;
+protected:
+	std::string host_;
+public:
+	bool Start(const std::string& host)
+	{
+		host_ = host;
+		Base::Start();
+		return true;
+	}
+
+protected:
+	//
+	bool OnInit()
+	{
+		if(!Base::OnInit()) {
+			return false;
+		}
+		Open(AF_INETType,SOCK_DGRAM);
+		Select(FD_READ);
+		SetNonBlock();//设为非阻塞模式
+		return true;
+	}
+
+	void OnTerm()
+	{
+		if (IsSocket()) {
+			Close();
+		}
+		Base::OnTerm();
+	}
+
+	virtual void OnAttachService(XSocket::Service* pSvr)
+	{
+		Base::OnAttachService(pSvr);
+		//Resolve只能在服务线程调用，通过定时器切到服务线程
+		pSvr->AddTimer(0, [this]() {
+			struct addrinfo hints = {};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			std::string host = host_;
+			Resolve(host_, "80", hints, [host](struct addrinfo* result) {
+				if (!result) {
+					PRINTF("Resolve %s failed", host.c_str());
+					return;
+				}
+				for (struct addrinfo* ai = result; ai; ai = ai->ai_next)
+				{
+					char buf[64] = {0};
+					PRINTF("Resolve %s: %s", host.c_str(), SockAddr2IpStr(ai->ai_addr, ai->ai_addrlen, buf, 64));
+				}
+			});
+		});
+	}
+};
+
 class manager 
 #if USE_MANAGER
 : public SocketManagerT<ClientSocketSet>
@@ -262,6 +324,7 @@ class manager
 #endif//
 protected:
 	client *c;
+	resolver r_;
 public:
 
 #if USE_MANAGER
@@ -282,6 +345,7 @@ public:
 	bool Start()
 	{
 		bool ret = Base::Start();
+		r_.Start("www.baidu.com");
 	#if USE_MANAGER
 		for(int i=0;i<DEFAULT_CLIENT_COUNT;i++)
 		{
@@ -290,8 +354,7 @@ public:
 			sp_client->Open(AF_INET,SOCK_DGRAM);
 			AddSocket(sp_client);
 	#else
-			sp_client->Open(DEFAULT_IP);
-			AddConnect(sp_client,DEFAULT_PORT);
+			AddConnect(sp_client,DEFAULT_IP,DEFAULT_PORT);
 	#endif//
 		}
 	#else
@@ -306,6 +369,7 @@ public:
 
 	void Stop()
 	{
+		r_.Stop();
 		Base::Stop();
 	#if USE_MANAGER
 	#else
@@ -2,6 +2,8 @@
 #include "../../../XSocket/XSocketImpl.h"
 #if USE_EPOLL
 #include "../../../XSocket/XEPoll.h"
+#elif USE_IOURING
+#include "../../../XSocket/XIoUring.h"
 #elif USE_IOCP
 #include "../../../XSocket/XCompletionPort.h"
 #else
@@ -40,6 +42,8 @@ public:
 class EventService : public
 #if USE_EPOLL
 EventServiceT<Event,EPollService>
+#elif USE_IOURING
+EventServiceT<Event,IoUringService>
 #elif USE_IOCP
 EventServiceT<Event,CompletionPortService>
 #else
@@ -61,6 +65,8 @@ typedef SimpleUdpSocketT<ConnectSocketExT<SelectSocketT<ClientService,SocketEx>>
 #else
 #if USE_EPOLL
 typedef EPollSocketSetT<ClientService,client> ClientSocketSet;
+#elif USE_IOURING
+typedef IoUringSocketSetT<ClientService,client> ClientSocketSet;
 #elif USE_IOCP
 typedef CompletionPortSocketSetT<ClientService,client> ClientSocketSet;
 #else
@@ -70,6 +76,8 @@ typedef SelectSocketSetT<ClientService,client> ClientSocketSet;
 #if USE_MANAGER
 #if USE_EPOLL
 typedef ConnectSocketExT<EPollSocketT<ClientSocketSet,SocketEx>> ClientSocketBase;
+#elif USE_IOURING
+typedef ConnectSocketExT<IoUringSocketT<ClientSocketSet,SocketEx>> ClientSocketBase;
 #elif USE_IOCP
 typedef ConnectSocketExT<CompletionPortSocketT<ClientSocketSet,SocketEx>> ClientSocketBase;
 #else
@@ -266,8 +274,7 @@ public:
 			sp_client->Open(AF_INET,SOCK_DGRAM);
 			AddSocket(sp_client);
 	#else
-			sp_client->Open(DEFAULT_IP);
-			AddConnect(sp_client,DEFAULT_PORT);
+			AddConnect(sp_client,DEFAULT_IP,DEFAULT_PORT);
 	#endif//
 		}
 	#else
@@ -0,0 +1,120 @@
+#include "../../samples.h"
+#include "../../../XSocket/XSocketImpl.h"
+#if USE_EPOLL
+#include "../../../XSocket/XEPoll.h"
+#endif//
+#include "../../../XSocket/XCoroutine.h"
+using namespace XSocket;
+
+//协程版echo客户端，需要C++20，配合echo server使用
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L && USE_EPOLL
+
+class co_client;
+
+typedef TaskServiceT<EPollService> CoService;
+typedef EPollSocketSetT<CoService,co_client> CoSocketSet;
+
+//TcpSocket作为Base，验证协程读写不会被Base的接收/发送处理抢走
+class co_client : public SocketExImpl<co_client,CoSocketT<TcpSocket<EPollSocketT<CoSocketSet,SocketEx>>>>
+{
+	typedef SocketExImpl<co_client,CoSocketT<TcpSocket<EPollSocketT<CoSocketSet,SocketEx>>>> Base;
+public:
+	CoTask<int> Run(int count)
+	{
+		SockAddrType stAddr = {};
+#if USE_IPV6
+		stAddr.sin6_family = AF_INET6;
+		IpStr2IpAddr(DEFAULT_IP,AF_INET6,&stAddr.sin6_addr);
+		stAddr.sin6_port = H2N((u_short)DEFAULT_PORT);
+#else
+		stAddr.sin_family = AF_INET;
+		stAddr.sin_addr.s_addr = Ip2N(Url2Ip(DEFAULT_IP));
+		stAddr.sin_port = htons((u_short)DEFAULT_PORT);
+#endif//
+		int ret = co_await Connect((const SOCKADDR*)&stAddr, sizeof(stAddr));
+		if (ret) {
+			PRINTF("co_client connect failed: %d", ret);
+			co_return ret;
+		}
+		char sbuf[64] = {0}, rbuf[64] = {0};
+		for (int i = 0; i < count; i++)
+		{
+			int len = snprintf(sbuf, sizeof(sbuf), "hello.%d", i);
+			if (co_await WriteAll(sbuf, len) != len) {
+				PRINTF("co_client write failed: %d", GetLastError());
+				co_return SOCKET_ERROR;
+			}
+			if (co_await ReadAll(rbuf, len) != len || memcmp(sbuf, rbuf, len)) {
+				PRINTF("co_client echo mismatch: %d", GetLastError());
+				co_return SOCKET_ERROR;
+			}
+			PRINTF("co_client echo:%.*s", len, rbuf);
+			co_await SleepFor(100);
+		}
+		co_return 0;
+	}
+
+	static CoTask<void> Start(std::shared_ptr<co_client> sp, int count)
+	{
+		int ret = co_await sp->Run(count);
+		PRINTF("co_client %p done: %d", sp.get(), ret);
+	}
+};
+
+class manager : public SocketManagerT<CoSocketSet>
+{
+	typedef SocketManagerT<CoSocketSet> Base;
+public:
+	manager():Base(DEFAULT_MAX_SOCKET_COUNT,DEFAULT_MAX_SOCKSET_COUNT)
+	{
+		SetWaitTimeOut(DEFAULT_WAIT_TIMEOUT);
+	}
+
+	bool Start(int client_count, int count)
+	{
+		bool ret = Base::Start();
+		for (int i = 0; i < client_count; i++)
+		{
+			std::shared_ptr<co_client> sp_client = std::make_shared<co_client>();
+			sp_client->Open(AF_INETType, SOCK_STREAM);
+			sp_client->SetNonBlock();
+			int pos = AddSocket(sp_client); //返回所在SocketSet的序号
+			if (pos < 0) {
+				sp_client->Close();
+				continue;
+			}
+			//协程在SocketSet的服务线程上启动和恢复
+			sockset_ptrs_[pos]->Post([sp_client,count]() { CoSpawn(co_client::Start(sp_client, count)); });
+		}
+		return ret;
+	}
+};
+
+#ifdef WIN32
+int _tmain(int argc, _TCHAR* argv[])
+#else
+int main(int argc, char* argv[])
+#endif//
+{
+	Socket::Init();
+	int client_count = DEFAULT_CLIENT_COUNT;
+	if(argc > 1) {
+		client_count = atoi(argv[1]);
+	}
+	manager m;
+	m.Start(client_count, 10);
+	getchar();
+	m.Stop();
+	Socket::Term();
+	return 0;
+}
+
+#else
+
+int main()
+{
+	printf("co_client needs C++20 coroutines and epoll\n");
+	return 0;
+}
+
+#endif//__cpp_impl_coroutine
@@ -135,13 +135,11 @@ int write_streams() {
       return 0;
     }
 
-    sendbuf_.push(nwrite);
-
     //update_endpoint(&path.path.local);
-    update_remote_addr(&path.path.remote);
     reset_idle_timer();
 
-    send_packet();
+    //满长的包攒成一串，一次GSO发送
+    write_packet(&path.path.remote, nwrite);
   }
 }
 
@@ -176,6 +174,7 @@ public:
 		this->max_streams_bidi = 100;
 		this->max_streams_uni = 3;
 		this->max_dyn_length = 20_m;
+		this->max_gso_pktcnt = 10;
 
 		if (generate_secret(this->static_secret.data(),
 									this->static_secret.size()) != 0) {
@@ -206,6 +205,8 @@ public:
 		stAddr.sin_port = htons((u_short)DEFAULT_PORT);
 	#endif//
 		Bind((const SOCKADDR*)&stAddr, sizeof(stAddr));
+		SetGSO(true);
+		SetGRO(true);
 		Select(FD_READ);
 		SetNonBlock();//设为非阻塞模式
 		return true;
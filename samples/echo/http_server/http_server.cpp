@@ -142,7 +142,7 @@ public:
 	{
 		this_service()->Post(std::function<void()>([spWorker = shared_from_this(),Buf](){ spWorker->SendBuf(Buf); }));
 		this_service()->Post(3000, std::bind((void (worker::*)(const SendBuffer&))&worker::SendBuf, this, Buf));
-		//std::future<int> fu;
+		//TaskFuture<int> fu;
 		//this_service()->Post(this_service()->Package(fu, (int (worker::*)(const std::string&, int ))&worker::SendBuf, this, Buf));
 	}
 	inline void PostBuf(const char* lpBuf, int nBufLen)
@@ -155,7 +155,7 @@ public:
 		// auto task = std::make_shared< std::packaged_task<int()> >(
 		// 		std::bind((int (worker::*)(const char*, int, int ))&worker::SendBuf, this, lpBuf, nBufLen)
 		// 	);
-		std::future<int> fu;
+		TaskFuture<int> fu;
 		this_service()->Post(this_service()->Package(fu, (int (worker::*)(const char*, int, int ))&worker::SendBuf, this, lpBuf, nBufLen));
 		*/
 	}
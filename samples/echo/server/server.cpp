@@ -5,6 +5,8 @@
 #include "../../../XSocket/XSocketImpl.h"
 #if USE_EPOLL
 #include "../../../XSocket/XEPoll.h"
+#elif USE_IOURING
+#include "../../../XSocket/XIoUring.h"
 #elif USE_IOCP
 #include "../../../XSocket/XCompletionPort.h"
 #endif//
@@ -113,6 +115,8 @@ public:
 class WorkEventService : public
 #if USE_EPOLL
 EventServiceT<WorkEvent,EPollService>
+#elif USE_IOURING
+EventServiceT<WorkEvent,IoUringService>
 #elif USE_IOCP
 EventServiceT<WorkEvent,CompletionPortService>
 #else
@@ -137,6 +141,8 @@ class WorkSocket;
 
 #if USE_EPOLL
 typedef EPollSocketSetT<WorkService,WorkSocket> WorkSocketSet;
+#elif USE_IOURING
+typedef IoUringSocketSetT<WorkService,WorkSocket> WorkSocketSet;
 #elif USE_IOCP
 typedef CompletionPortSocketSetT<WorkService,WorkSocket> WorkSocketSet;
 #else
@@ -146,6 +152,8 @@ typedef SelectSocketSetT<WorkService,WorkSocket> WorkSocketSet;
 class WorkSocket : public
 #if USE_EPOLL
 EPollSocketT<WorkSocketSet,SocketEx>
+#elif USE_IOURING
+IoUringSocketT<WorkSocketSet,SocketEx>
 #elif USE_IOCP
 CompletionPortSocketT<WorkSocketSet,SocketEx>
 #else
@@ -251,16 +259,24 @@ protected:
 		//
 		virtual void OnAccept(SOCKET Sock, const SOCKADDR* lpSockAddr, int nSockAddrLen) 
 		{
+#if USE_REUSEPORT
+				//SO_REUSEPORT模式下连接留在本监听Socket所在的SocketSet
+				WorkSocketSet* sockset = service();
+#else
+				server* sockset = srv_;
+#endif
 				//测试下还能不能再接收SOCKET
-				if(srv_->AddSocket(NULL) < 0) {
+				if(sockset->AddSocket(NULL) < 0) {
 					PRINTF("The connection was refused by the computer running select server because the maximum number of sessions has been exceeded.");
 					XSocket::Socket::Close(Sock);
 					return;
 				}
 				std::shared_ptr<worker> sock_ptr = std::make_shared<worker>();
 				sock_ptr->Attach(Sock,SOCKET_ROLE_WORK);
-				sock_ptr->SetNonBlock();//设为非阻塞模式
-				int pos = srv_->AddSocket(sock_ptr, FD_READ|FD_OOB);
+#ifdef WIN32
+				sock_ptr->SetNonBlock();//设为非阻塞模式，LINUX下accept4已经设置
+#endif//
+				int pos = sockset->AddSocket(sock_ptr, FD_READ|FD_OOB);
 				if(pos >= 0) {
 					//
 				} else {
@@ -268,6 +284,31 @@ protected:
 					sock_ptr->Trigger(FD_CLOSE, 0);
 				}
 		}
+#if !USE_REUSEPORT
+		//整批交给server分配
+		virtual void OnAcceptBatch(AcceptItem* items, int count)
+		{
+				std::shared_ptr<worker> sock_ptrs[ACCEPT_BATCH];
+				int poses[ACCEPT_BATCH];
+				for(int i = 0; i < count; i++)
+				{
+					sock_ptrs[i] = std::make_shared<worker>();
+					sock_ptrs[i]->Attach(items[i].Sock,SOCKET_ROLE_WORK);
+#ifdef WIN32
+					sock_ptrs[i]->SetNonBlock();//设为非阻塞模式，LINUX下accept4已经设置
+#endif//
+				}
+				if(srv_->AddSockets(sock_ptrs, count, FD_READ|FD_OOB, poses) < (size_t)count) {
+					PRINTF("The connection was refused by the computer running select server because the maximum number of sessions has been exceeded.");
+					for(int i = 0; i < count; i++)
+					{
+						if(poses[i] < 0) {
+							sock_ptrs[i]->Trigger(FD_CLOSE, 0);
+						}
+					}
+				}
+		}
+#endif
 	};
 #endif
 public:
@@ -288,6 +329,11 @@ public:
 			return false;
 		}
 
+#if USE_REUSEPORT
+		if(AddReusePortAccept<listener>(address, port, 1024, false, this) > 0) {
+			return true;
+		}
+#endif
 		std::shared_ptr<listener> sock_ptr = std::make_shared<listener>(this);
 		sock_ptr->Open(address);
 		sock_ptr->SetSockOpt(SOL_SOCKET, SO_REUSEADDR, 1);
@@ -14,10 +14,20 @@
 #define USE_IOCP 1
 #endif
 #else
+//io_uring模型，需要Linux 5.19以上内核，可以由编译选项-DUSE_IOURING=1打开
+#ifndef USE_IOURING
+#define USE_IOURING 0
+#endif//
+#if USE_IOURING
+#define USE_EPOLL 0
+#else
 #define USE_EPOLL 1
+#endif//
 #if USE_EPOLL
 #define USE_EPOLLET
 #endif//
+//每个SocketSet各自用SO_REUSEPORT监听同一地址，连接留在接收它的SocketSet
+#define USE_REUSEPORT 0
 #endif//
 
 //UDP构建可靠数据传输